@@ -6,6 +6,13 @@
 #include <Ticker.h>
 #include <PubSubClient.h>
 #include <Preferences.h>
+#include <SampleFilter.h>
+#include <SpscQueue.h>
+#include <SpeedOfSound.h>
+#include <CommandRouter.h>
+#include <LogRing.h>
+#include <Metrics.h>
+#include <PerfSpan.h>
 
 #define VERSION "V1.1" // N.B: document changes in README.md
 
@@ -15,24 +22,135 @@
 #endif
 
 #define MQTT_TOPIC_PREFIX "sealevel" // prefix for all MQTT topics
+#define MQTT_LOCATION_SIZE 64        // deviceLocation, the second level of every topic
+#define MQTT_TOPIC_SIZE (sizeof(MQTT_TOPIC_PREFIX) + MQTT_LOCATION_SIZE) // "<prefix>/<location>"
+#define MQTT_SUBTOPIC_SIZE (MQTT_TOPIC_SIZE + 24) // a topic under it, "/level/predicted" or "/lowpower/set"
+#define MQTT_BUFFER_SIZE 512 // PubSubClient's packet: header, topic and payload
 
 // tide data
-#define NOAA_BASE_URL "https://api.tidesandcurrents.noaa.gov/api/prod/datagetter?product=predictions&application=NOS.COOPS.TAC.WL&datum=MSL&time_zone=lst_ldt&units=english&interval=hilo&format=json"
+// predictions in the datum we publish (MLLW) and in GMT, like epochNow()
+#ifndef NOAA_BASE_URL
+#define NOAA_BASE_URL "https://api.tidesandcurrents.noaa.gov/api/prod/datagetter?product=predictions&application=NOS.COOPS.TAC.WL&datum=MLLW&time_zone=gmt&units=english&interval=hilo&format=json"
+#endif
 #define NOAA_DEFAULT_STATION "8722718" // Ocean Ridge, FL
 // sewall basically @2.45 NAVD88 while MLLW is 2.26 NAVD88
 #define SEAWALL_MLLW_OFFSET (2.26+2.45)       // NAVD88 to MLLW conversion https://www.vdatum.noaa.gov/vdatumweb/vdatumweb?a=053505920250519
-#define MQTT_UPDATE_INTERVAL 300000L    // 300s=5 min,  500s = 8.3 min, 900 = 15 min
-#define TIDE_UPDATE_INTERVAL 10000L      // every 10s
+#define CM_TO_FT 0.0328084
+#define MQTT_UPDATE_INTERVAL 300000L    // 300s=5 min,  500s = 8.3 min, 900 = 15 min, starting value, see SampleScheduler
+#define TIDE_UPDATE_INTERVAL 10000L      // every 10s, starting value, see SampleScheduler
+
+#define SAMPLE_QUEUE_SIZE 64 // pings in flight between the sensing and network tasks, power of two
+#define SENSING_CORE 1       // sensing task, also where the echo interrupt is allocated
+#define NETWORK_CORE 0       // network & console task, next to the WiFi stack
+
+#define BACKLOG_CAPACITY 576 // interval records held for the broker, 2 days of 5 minute intervals
+
+// one closed publish interval
+struct LevelRecord
+{
+  uint32_t id;        // sequence number in the reading log
+  uint32_t epoch;     // UTC seconds when the interval closed, 0 if SNTP had not synced
+  uint32_t uptime;    // seconds since boot when the interval closed
+  float level;        // ft MLLW
+  uint16_t samples;   // samples accepted by the filter
+  uint16_t rejected;  // samples rejected by the filter
+};
+
+// one ping, handed from the sensing task to the network task
+struct EchoSample
+{
+  uint32_t timeUs;    // micros() when the ping was triggered
+  uint32_t widthUs;   // echo pulse width, 0 when no echo came back
+  uint8_t sensor;     // index in echoPins
+  bool wave;          // a tick of a wave capture, see Waves.cpp
+  bool waveOnly;      // a wave tick between the regular pings, not for the level
+};
+
+// an interval of every sensor fused into one reading
+struct FusedLevel
+{
+  double distance;    // Q8 cm
+  double spread;      // of the samples, Q8 cm
+  int samples;        // taken into the level
+  int rejected;       // rejected by a filter or with their sensor
+};
+
+// one ultrasonic sensor of ECHO_SENSOR_PINS (pins.h)
+struct EchoPins
+{
+  uint8_t trig;
+  uint8_t echo;
+  uint8_t slot;       // sensors of a slot ping together
+  int16_t offsetMm;   // added to the distance it measures
+};
+constexpr EchoPins echoPins[] = {ECHO_SENSOR_PINS};
+constexpr int ECHO_SENSORS = sizeof(echoPins) / sizeof(echoPins[0]);
 
 // Ultrasonic sensor data
-extern float current_level; // running average of distance measurement in cm
-extern int sample_count;    // number of samples in current_level
-extern Ticker tideUpdateTicker;
+extern SampleFilter sensorFilters[ECHO_SENSORS]; // robust statistics of each sensor's distances in Q8 cm, network task only
+extern SpscQueue<EchoSample, SAMPLE_QUEUE_SIZE> sampleQueue;
 extern Ticker mqttPublishTicker;
 
+// in Log
+// LOG_E(TAG, format, ...) to LOG_D record a message in logRing, formatted later (Log.cpp);
+// TAG is the module's static const char TAG[], levels above LOG_LOCAL_LEVEL compile to nothing
+// and levels no reader shows (logKept) are not recorded
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_DEBUG
+#endif
+#ifndef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL LOG_LEVEL
+#endif
+#define LOG_AT(level, tag, format, ...)                   \
+  do                                                      \
+  {                                                       \
+    if constexpr (level <= LOG_LOCAL_LEVEL)               \
+    {                                                     \
+      if (false) logFormatCheck(format, ##__VA_ARGS__);   \
+      if (logKept(level))                                 \
+        logRing.write(level, tag, format, ##__VA_ARGS__); \
+    }                                                     \
+  } while (0)
+#define LOG_E(tag, format, ...) LOG_AT(LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define LOG_W(tag, format, ...) LOG_AT(LOG_WARN, tag, format, ##__VA_ARGS__)
+#define LOG_I(tag, format, ...) LOG_AT(LOG_INFO, tag, format, ##__VA_ARGS__)
+#define LOG_D(tag, format, ...) LOG_AT(LOG_DEBUG, tag, format, ##__VA_ARGS__)
+inline void __attribute__((format(printf, 1, 2))) logFormatCheck(const char *, ...) {} // printf checks at the call site
+extern LogRing logRing;
+extern LogLevel mqttLogLevel; // records up to this level are forwarded to <topic>/debug
+extern bool debugMode;
+// the console shows warnings and errors, everything in debug mode; MQTT up to its level
+inline bool logKept(LogLevel level) { return level <= LOG_WARN || debugMode || level <= mqttLogLevel; }
+void configureLog();
+void handleLog();
+void flushLog();
+bool setLogLevel(const char *name);
+void printLog();
+
+// in Health
+extern Histogram networkLoopUs;
+extern Histogram reconnectMs;
+extern Counter samplesMetric;
+extern Counter wifiDropsMetric;
+extern Counter mqttDropsMetric;
+extern uint32_t metricsIntervalMs; // 0: not published
+void configureMetrics();
+void handleMetrics();
+void publishMetrics();
+void setMetricsInterval(uint32_t seconds);
+void printMetrics();
+extern PerfSpan updateSpan;   // updateAverage(), one sample into the filter
+extern PerfSpan publishSpan;  // publishAverageLevel(), closing and publishing an interval
+extern PerfSpan mqttSpan;     // checkMQTTConnection(), a connect attempt included
+extern PerfSpan consoleSpan;  // dConsole::check(), telnet and serial input and output
+extern PerfSpan wavesSpan;    // the spectrum of a wave capture
+void printPerf();
+
 // in main
+extern volatile bool sensingEnabled;
 void pauseTideUpdate();
 void resumeTideUpdate();
+void restartPublishTicker();
 
 // in WIFIConfig
 extern char myHostName[];
@@ -43,6 +161,7 @@ extern char mqttUser[];
 extern char mqttPwd[];
 extern char NoaaStation[];
 extern bool otaInProgress;  // stop doing stuff if we are uploading software
+extern int secondsWithoutWIFI;
 extern Preferences prefs;   // used to save preferences to NVM
 
 void configureWIFI();
@@ -57,19 +176,165 @@ void configureOTA(char *);
 extern dConsole console;
 void setupConsole();
 void handleConsole();
+void printLocalTime();
+void startUDPConsole();                  // at WiFi connect, with the persisted port
+bool setUDPConsole(const char *port);    // a port number or "off"
+
+// in Commands
+bool consoleCommand(const char *name, const char *args); // false for an unknown command
+bool mqttCommand(const char *topic, const char *payload); // false if the topic is not a command
+void subscribeCommands();
+const cmd::Command *findCommand(const char *key, cmd::Source source); // console name or full MQTT topic
 
 // in main
-void measureDistanceAndUpdateAverage();
+void queueSample(uint8_t sensor, unsigned long triggerUs, unsigned long durationUs);
+void updateAverage(const EchoSample &sample);
 void publishAverageLevel();
+void closeInterval(uint32_t ageS, uint32_t lengthS, bool live);
+bool setFilterMode(const char *name);
+
+// in Backlog
+extern unsigned long backlogDrops;
+uint32_t epochNow();
+int backlogDepth();
+void resetBacklog();
+void queueLevelRecord(const LevelRecord &record);
+void drainBacklog();
+
+// in ReadingLog
+extern unsigned long logCorruptFrames;
+void configureReadingLog();
+void appendReading(LevelRecord &record);
+void setLogCursor(uint32_t id);
+bool readingLogReplaying();
+uint32_t readingLogPendingId();
+void handleReadingLog();
+void flushReadingLog();
+void printReadingLogStatus();
+
+// in TidePredictions
+extern unsigned long predictionFetches;
+void configureTidePredictions();
+void resetTidePredictions();
+void handleTidePredictions();
+bool predictedTide(uint32_t epoch, float &level);
+void printTidePredictionStatus();
+
+// in AirTemperature
+extern float airTemperature;
+extern float configuredAirTemp;
+extern bool airTempFromProbe;
+extern volatile uint32_t soundSpeedFactor; // Q32 cm/us, see SpeedOfSound.h
+void configureAirTemperature();
+void setAirTemperature(float tempC);
+void handleAirTemperature();
+
+// in SampleScheduler
+extern volatile uint32_t pingIntervalMs;
+extern uint32_t publishIntervalMs;
+extern float levelRate;
+void configureScheduler();
+void updateSchedule(const LevelRecord &record, float spreadCm);
+bool setRateCommand(const char *args);
+void publishRateStatus();
+void printSchedule();
+
+// in LowPower
+extern bool lowPowerMode;
+extern bool lowPowerUplink; // this boot is a low power uplink
+bool lowPowerWake();
+void configureLowPower();
+void handleLowPower();
+bool setLowPowerCommand(const char *args);
+void publishLowPowerStatus();
+void printLowPowerStatus();
+
+// in EchoSensor
+typedef void (*EchoCallback)(uint8_t sensor, unsigned long triggerUs, unsigned long durationUs); // pulse width in us, 0 on timeout
+extern unsigned long echoTimeouts;
+void configureEchoSensor(EchoCallback onComplete);
+int echoSlots();
+bool startEcho(int slot);
+bool handleEchoSensor();
+
+// in Burst
+void startBursts(EchoCallback onSample); // one sample per sensor and burst to onSample
+void configureBurst();
+void pingBurst(int size); // burstPings(), or 1 for a single ping
+int burstPings(); // per sensor and tick, 1 with bursts off
+bool setBurstCommand(const char *args);
+void publishBurstStatus();
+void printBurst();
+
+// in SensorArray
+void configureSensors();
+bool addSensorSample(uint8_t sensor, int32_t distance); // Q8 cm as measured, 0 for no usable echo
+int intervalSamples();
+int intervalRejected();
+bool fuseSensors(FusedLevel &level); // false when no sensor has a reading
+void resetSensors();
+void setSensorFilterMode(FilterMode mode);
+FilterMode sensorFilterMode();
+bool setSensorCommand(const char *args);
+void publishSensorStatus();
+void printSensors();
+int healthiestSensor();
+bool sensorTrusted(uint8_t sensor); // its samples count in the level
+
+// in LevelTracker
+void configureLevelTracker();
+void trackLevel(const EchoSample &sample, int32_t distance); // an accepted sample, Q8 cm
+bool trackedLevel(float &levelFt, float &rateFtHr);
+bool setTrackerCommand(const char *args);
+void printTracker();
+
+// in Alerts
+void configureAlerts();
+void checkAlerts(uint32_t sampleUs); // after every accepted sample, trigger time
+bool setAlertCommand(const char *args);
+void publishAlertStatus();
+void printAlerts();
+
+// in Waves
+void configureWaves();
+uint32_t waveTickMs(); // sensing task: the capture tick, 0 without a capture
+void waveTicked();
+void addWaveSample(const EchoSample &sample, int32_t distance); // Q8 cm, 0 for none
+void handleWaves();
+bool setWavesCommand(const char *args);
+void publishWaveStats();
+void printWaves();
 
 // in MQTTConfig
+enum ConnState { CONN_WIFI_DOWN, CONN_MQTT_BACKOFF, CONN_MQTT_CONNECTING, CONN_ONLINE };
+extern ConnState connState;
+extern unsigned long reconnectLatency;
+extern unsigned long mqttConnects;
+extern int secondsWithoutMQTT;
+const char *connStateName();
+unsigned long timeInConnState();
 extern bool debugMode;
+extern char mqtt_topic[];
 void configureMQTT();
 extern PubSubClient mqtt_client; // Make mqtt_client accessible globally
 bool checkMQTTConnection();
 void mqttDisconnect();
 void mqttCallback(char *topic, byte *payload, unsigned int length);
-void publishLevel(float level);
+void publishLevel(float level, float stddev, int rejected); // ft MLLW, ft
+bool publishBacklog(const char *payload);
+void publishBacklogStatus(int depth, unsigned long drops);
+void publishPrediction(float predicted, float residual);
+void publishTrackedLevel(float level, float rate); // ft MLLW, ft/hr
+void publishFilterMode();
+void publishDebug(const char *message);
+void publishSchedule(const char *json);
+void publishLowPower(const char *json);
+void publishMetricsSnapshot(const char *json);
+size_t metricsSnapshotRoom(); // the longest payload that fits the packet with the topic
+void publishSensors(const char *json);
+void publishBurst(const char *json);
+void publishWaves(const char *json);
+void publishAlert(int rule, const char *json); // to <topic>/alert/<rule>
 
 
 
@@ -11,4 +11,15 @@
 
 #define TRIG_PIN 4          // GPIO4 - Trigger pin for ultrasonic sensor
 #define ECHO_PIN 5          // GPIO5 - Echo pin for ultrasonic sensor
+
+// Ultrasonic sensors, one {trigger pin, echo pin, ping slot, mount offset mm} each.
+// Every tick the slots ping one after the other; the sensors of a slot fire together
+// and their echoes are timed in parallel, so sensors that can hear each other
+// (neighbours) go in different slots. The mount offset is added to what a sensor
+// measures, so that all of them measure from the same height. A build flag replaces
+// the table, e.g. -D'ECHO_SENSOR_PINS={4,5,0,0},{16,17,1,0},{18,19,0,-25}'
+#ifndef ECHO_SENSOR_PINS
+#define ECHO_SENSOR_PINS {TRIG_PIN, ECHO_PIN, 0, 0}
+#endif
+//#define TEMP_PROBE_PIN 15   // GPIO15 - optional DS18B20 air temperature probe (1-Wire)
 #endif
\ No newline at end of file
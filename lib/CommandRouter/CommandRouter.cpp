@@ -0,0 +1,53 @@
+/**************************************************************************************
+
+  Command argument parsing -- see CommandRouter.h
+
+  ***************************************************************************************/
+#include "CommandRouter.h"
+
+#include <stdlib.h>
+#include <strings.h>
+
+namespace cmd
+{
+  static bool parseOnOff(const char *s, bool &on)
+  {
+    if (!strcasecmp(s, "on") || !strcasecmp(s, "true") || !strcmp(s, "1")) on = true;
+    else if (!strcasecmp(s, "off") || !strcasecmp(s, "false") || !strcmp(s, "0")) on = false;
+    else return false;
+    return true;
+  }
+
+  bool parseArgs(const Command &c, const char *text, Args &args, char *buffer, size_t size)
+  {
+    // trimmed copy, the caller's text is left alone
+    while (*text == ' ' || *text == '\t') text++;
+    size_t n = strlen(text);
+    while (n && (text[n - 1] == ' ' || text[n - 1] == '\t' || text[n - 1] == '\r' || text[n - 1] == '\n')) n--;
+    if (n >= size) return false;
+    memcpy(buffer, text, n);
+    buffer[n] = 0;
+
+    args = {n > 0, buffer, 0, 0, false};
+    if (c.arg == ARG_NONE) return true;
+    if (!args.present) return c.optional;
+
+    char *end;
+    switch (c.arg)
+    {
+    case ARG_WORD:
+      buffer[strcspn(buffer, " \t")] = 0;
+      return true;
+    case ARG_INT:
+      args.i = strtol(buffer, &end, 10);
+      return !*end;
+    case ARG_FLOAT:
+      args.f = strtof(buffer, &end);
+      return !*end;
+    case ARG_ONOFF:
+      return parseOnOff(buffer, args.on);
+    default:
+      return true;
+    }
+  }
+}
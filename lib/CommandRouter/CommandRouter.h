@@ -0,0 +1,139 @@
+/**************************************************************************************
+
+  Table-driven command router, shared by the console and MQTT
+
+  Every command is declared once in a constexpr table: its console name, the
+  MQTT subtopic it listens on, the type of its argument, a line of help and the
+  handler. At compile time the names and the subtopics are hashed (FNV-1a)
+  into two open-addressed indexes, so finding a command costs one hash of the
+  incoming word and, barring a collision, one strcmp to confirm it, however
+  many commands there are.
+
+  The argument is parsed once, by type, before the handler runs; a missing or
+  malformed argument never reaches the handler. The help is generated from the
+  same table.
+
+  ***************************************************************************************/
+#ifndef _COMMAND_ROUTER_H
+#define _COMMAND_ROUTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace cmd
+{
+  enum ArgType : uint8_t
+  {
+    ARG_NONE,  // anything after the command is ignored
+    ARG_WORD,  // first word
+    ARG_TEXT,  // the rest of the line, trimmed
+    ARG_INT,
+    ARG_FLOAT,
+    ARG_ONOFF, // on/off, true/false, 1/0, any case
+  };
+
+  enum Source : uint8_t
+  {
+    FROM_CONSOLE,
+    FROM_MQTT,
+  };
+
+  // the parsed argument, the field matching the command's ArgType is set
+  struct Args
+  {
+    bool present;     // an argument was given (optional arguments)
+    const char *text; // ARG_WORD and ARG_TEXT, "" when absent
+    long i;
+    float f;
+    bool on;
+  };
+
+  // false when the argument parsed but is not one the command takes
+  typedef bool (*Handler)(const Args &args, Source source);
+
+  struct Command
+  {
+    const char *name;  // console command, nullptr for MQTT only
+    const char *topic; // MQTT subtopic under <prefix>/<location>, nullptr for console only
+    ArgType arg;
+    bool optional;     // the argument may be left out
+    const char *usage; // argument synopsis for the help
+    const char *help;
+    Handler handler;
+  };
+
+  constexpr uint32_t hash(const char *s)
+  {
+    uint32_t h = 2166136261u;
+    while (*s) h = (h ^ (uint8_t)*s++) * 16777619u;
+    return h;
+  }
+
+  // parse text according to the command's argument type, false if it does not fit;
+  // args.text points into buffer
+  bool parseArgs(const Command &c, const char *text, Args &args, char *buffer, size_t size);
+
+  template <size_t N>
+  class Router
+  {
+  public:
+    static constexpr size_t SLOTS = N * 2 < 8 ? 8 : (N * 2 <= 16 ? 16 : (N * 2 <= 32 ? 32 : (N * 2 <= 64 ? 64 : 128)));
+    static_assert(N < SLOTS / 2 + 1 && N < 255, "command table too large for the index");
+
+    constexpr Router(const Command (&table)[N]) : table(table), names{}, topics{}
+    {
+      for (size_t i = 0; i < N; i++)
+      {
+        if (table[i].name) insert(names, hash(table[i].name), i);
+        if (table[i].topic) insert(topics, hash(table[i].topic), i);
+      }
+    }
+
+    // no two commands share a name or a subtopic, checked with static_assert
+    constexpr bool unique() const
+    {
+      for (size_t i = 0; i < N; i++)
+        for (size_t j = i + 1; j < N; j++)
+          if (same(table[i].name, table[j].name) || same(table[i].topic, table[j].topic)) return false;
+      return true;
+    }
+
+    const Command *byName(const char *name) const { return find(names, name, &Command::name); }
+    const Command *byTopic(const char *topic) const { return find(topics, topic, &Command::topic); }
+
+    size_t size() const { return N; }
+    const Command &operator[](size_t i) const { return table[i]; }
+
+  private:
+    const Command (&table)[N];
+    uint8_t names[SLOTS];  // index + 1 of the command in table, 0 for an empty slot
+    uint8_t topics[SLOTS];
+
+    static constexpr void insert(uint8_t (&index)[SLOTS], uint32_t h, size_t i)
+    {
+      size_t slot = h & (SLOTS - 1);
+      while (index[slot]) slot = (slot + 1) & (SLOTS - 1);
+      index[slot] = (uint8_t)(i + 1);
+    }
+
+    static constexpr bool same(const char *a, const char *b)
+    {
+      if (!a || !b) return false;
+      while (*a && *a == *b) a++, b++;
+      return *a == *b;
+    }
+
+    const Command *find(const uint8_t (&index)[SLOTS], const char *key, const char *Command::*field) const
+    {
+      for (size_t slot = hash(key) & (SLOTS - 1); index[slot]; slot = (slot + 1) & (SLOTS - 1))
+      {
+        const Command &c = table[index[slot] - 1];
+        if (!strcmp(c.*field, key)) return &c;
+      }
+      return nullptr;
+    }
+  };
+}
+
+#endif
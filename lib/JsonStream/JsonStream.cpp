@@ -0,0 +1,199 @@
+/**************************************************************************************
+
+  Fixed-memory streaming JSON parser -- see JsonStream.h
+
+  ***************************************************************************************/
+#include "JsonStream.h"
+#include <string.h>
+
+static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+static bool isLiteral(char c)
+{
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '-' || c == '+' || c == '.' || c == 'E';
+}
+
+void JsonStream::reset()
+{
+  state = VALUE;
+  inKey = false;
+  unicodeLeft = 0;
+  depth = 0;
+  arrays = 0;
+  key[0] = text[0] = 0;
+  keyLen = textLen = 0;
+}
+
+bool JsonStream::fail()
+{
+  state = FAILED;
+  return false;
+}
+
+void JsonStream::append(char c)
+{
+  if (inKey)
+  {
+    if (keyLen < JSON_MAX_KEY) key[keyLen++] = c;
+    key[keyLen] = 0;
+  }
+  else
+  {
+    if (textLen < JSON_MAX_VALUE) text[textLen++] = c;
+    text[textLen] = 0;
+  }
+}
+
+void JsonStream::open(bool array)
+{
+  depth++;
+  if (array)
+  {
+    arrays |= 1u << depth;
+    listener.startArray(depth, key);
+    key[0] = 0; // array elements have no key
+    keyLen = 0;
+    state = FIRST_VALUE;
+  }
+  else
+  {
+    arrays &= ~(1u << depth);
+    listener.startObject(depth, key);
+    state = FIRST_KEY;
+  }
+}
+
+bool JsonStream::close(bool array)
+{
+  if (!depth || ((arrays >> depth) & 1) != array) return fail();
+  if (array)
+    listener.endArray(depth);
+  else
+    listener.endObject(depth);
+  depth--;
+  key[0] = 0;
+  keyLen = 0;
+  endValue();
+  return true;
+}
+
+void JsonStream::endValue()
+{
+  state = depth ? NEXT : DONE;
+}
+
+bool JsonStream::feed(char c)
+{
+  switch (state)
+  {
+  case FIRST_VALUE:
+    if (c == ']') return close(true);
+    // fall through
+  case VALUE:
+    if (isSpace(c)) return true;
+    if (c == '{' || c == '[')
+    {
+      if (depth == JSON_MAX_DEPTH) return fail();
+      open(c == '[');
+      return true;
+    }
+    textLen = 0;
+    text[0] = 0;
+    if (c == '"')
+    {
+      inKey = false;
+      state = STRING;
+      return true;
+    }
+    if (!isLiteral(c)) return fail();
+    append(c);
+    state = LITERAL;
+    return true;
+
+  case LITERAL:
+    if (isLiteral(c))
+    {
+      append(c);
+      return true;
+    }
+    listener.value(depth, key, text, false);
+    endValue();
+    return feed(c); // the character that ended the literal belongs to what follows
+
+  case STRING:
+    if (c == '\\')
+      state = ESCAPE;
+    else if (c == '"')
+    {
+      if (inKey)
+      {
+        inKey = false;
+        state = COLON;
+      }
+      else
+      {
+        listener.value(depth, key, text, true);
+        endValue();
+      }
+    }
+    else
+      append(c);
+    return true;
+
+  case ESCAPE:
+    state = STRING;
+    switch (c)
+    {
+    case 'n': append('\n'); break;
+    case 't': append('\t'); break;
+    case 'r': append('\r'); break;
+    case 'b': append('\b'); break;
+    case 'f': append('\f'); break;
+    case 'u':
+      append('?');
+      unicodeLeft = 4;
+      state = UNICODE;
+      break;
+    default: append(c); // \" \\ \/
+    }
+    return true;
+
+  case UNICODE:
+    if (--unicodeLeft == 0) state = STRING;
+    return true;
+
+  case FIRST_KEY:
+    if (c == '}') return close(false);
+    // fall through
+  case KEY:
+    if (isSpace(c)) return true;
+    if (c != '"') return fail();
+    inKey = true;
+    keyLen = 0;
+    key[0] = 0;
+    state = STRING;
+    return true;
+
+  case COLON:
+    if (isSpace(c)) return true;
+    if (c != ':') return fail();
+    state = VALUE;
+    return true;
+
+  case NEXT:
+    if (isSpace(c)) return true;
+    if (c == ',')
+    {
+      state = (arrays >> depth) & 1 ? VALUE : KEY;
+      return true;
+    }
+    if (c == '}' || c == ']') return close(c == ']');
+    return fail();
+
+  case DONE:
+    return isSpace(c) ? true : fail();
+
+  case FAILED:
+  default:
+    return false;
+  }
+}
@@ -0,0 +1,67 @@
+/**************************************************************************************
+
+  Fixed-memory streaming JSON parser
+
+  Characters are fed one at a time as they come off the network; the parser
+  never holds more than the current key and the current scalar value, so a
+  document of any length parses in sizeof(JsonStream) bytes. Every scalar is
+  reported to a JsonListener together with its key (empty inside arrays) and
+  the nesting depth it sits at, plus the start and end of objects and arrays.
+
+  Keys longer than JSON_MAX_KEY and values longer than JSON_MAX_VALUE are
+  truncated, \uXXXX escapes become '?', and nesting deeper than JSON_MAX_DEPTH
+  is a syntax error.
+
+  ***************************************************************************************/
+#ifndef _JSON_STREAM_H
+#define _JSON_STREAM_H
+
+#include <stdint.h>
+
+#define JSON_MAX_DEPTH 16
+#define JSON_MAX_KEY 24
+#define JSON_MAX_VALUE 48
+
+class JsonListener
+{
+public:
+  virtual ~JsonListener() {}
+  // quoted: the value was a JSON string, otherwise a number, true, false or null
+  virtual void value(int depth, const char *key, const char *value, bool quoted) = 0;
+  virtual void startObject(int depth, const char *key) { (void)depth, (void)key; }
+  virtual void endObject(int depth) { (void)depth; }
+  virtual void startArray(int depth, const char *key) { (void)depth, (void)key; }
+  virtual void endArray(int depth) { (void)depth; }
+};
+
+class JsonStream
+{
+public:
+  explicit JsonStream(JsonListener &listener) : listener(listener) { reset(); }
+
+  void reset();
+  bool feed(char c);                   // false once the document is invalid
+  bool done() const { return state == DONE; }   // a complete top level value was read
+  bool failed() const { return state == FAILED; }
+
+private:
+  enum State { VALUE, FIRST_VALUE, STRING, ESCAPE, UNICODE, LITERAL, FIRST_KEY, KEY, COLON, NEXT, DONE, FAILED };
+
+  JsonListener &listener;
+  State state;
+  bool inKey;          // the string being read is a key
+  int unicodeLeft;     // hex digits left in a \u escape
+  int depth;
+  uint32_t arrays;     // bit n set: level n is an array
+  char key[JSON_MAX_KEY + 1];
+  char text[JSON_MAX_VALUE + 1];
+  int keyLen, textLen;
+
+  void append(char c);
+  void open(bool array);
+  bool close(bool array);
+  void endValue();
+  bool fail();
+};
+
+#endif
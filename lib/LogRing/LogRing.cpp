@@ -0,0 +1,201 @@
+/**************************************************************************************
+
+  Binary log ring with deferred formatting -- see LogRing.h
+
+  ***************************************************************************************/
+#include "LogRing.h"
+#include <Arduino.h>
+#include <stdio.h>
+#include <strings.h>
+
+static const char *levelNames[] = {"none", "error", "warn", "info", "debug"};
+
+LogRing::LogRing() : headPos(0), tailPos(0), headSeq(0), tailSeq(0) {}
+
+char LogRing::levelLetter(LogLevel level) { return "-EWID"[level <= LOG_DEBUG ? level : 0]; }
+
+const char *LogRing::levelName(LogLevel level) { return levelNames[level <= LOG_DEBUG ? level : 0]; }
+
+bool LogRing::parseLevel(const char *name, LogLevel &level)
+{
+  for (int i = LOG_NONE; i <= LOG_DEBUG; i++)
+    if (!strcasecmp(name, levelNames[i]))
+    {
+      level = (LogLevel)i;
+      return true;
+    }
+  return false;
+}
+
+void LogRing::put(uint8_t *record, size_t &n, uint8_t &argc, char type, const void *value, size_t size)
+{
+  if ((argc & ARGS_FULL) || n + 1 + size > LOG_MAX_RECORD)
+  {
+    argc |= ARGS_FULL;
+    return;
+  }
+  record[n++] = type;
+  memcpy(record + n, value, size);
+  n += size;
+  argc++;
+}
+
+// strings are stored as a length byte and the bytes, no terminator
+void LogRing::encode(uint8_t *r, size_t &n, uint8_t &argc, const char *s)
+{
+  if (!s) s = "(null)";
+  size_t len = strnlen(s, LOG_MAX_STRING);
+  uint8_t stored[1 + LOG_MAX_STRING];
+  stored[0] = len;
+  memcpy(stored + 1, s, len);
+  put(r, n, argc, 's', stored, 1 + len);
+}
+
+void LogRing::dropOldest()
+{
+  uint8_t *p = ring + (tailPos & (LOG_RING_SIZE - 1));
+  uint16_t size;
+  memcpy(&size, p, 2);
+  if (p[2] != PAD) tailSeq++;
+  tailPos += size;
+}
+
+void LogRing::push(LogLevel level, const char *tag, const char *format, uint8_t *record, size_t size, uint8_t argc)
+{
+  // sizes are multiples of 4, so is a filler and its size field always fits
+  size = (size + 3) & ~(size_t)3;
+  uint32_t ms = millis();
+  uint16_t size16 = size;
+  memcpy(record, &size16, 2);
+  record[2] = level;
+  record[3] = argc & ~ARGS_FULL;
+  memcpy(record + 4, &ms, 4);
+  memcpy(record + 8, &tag, sizeof(tag));
+  memcpy(record + 8 + sizeof(tag), &format, sizeof(format));
+
+  // a record never straddles the end of the ring: pad to the start instead
+  size_t at = headPos & (LOG_RING_SIZE - 1);
+  size_t pad = LOG_RING_SIZE - at < size ? LOG_RING_SIZE - at : 0;
+  while (LOG_RING_SIZE - (headPos - tailPos) < pad + size) dropOldest();
+  if (pad)
+  {
+    uint16_t pad16 = pad;
+    memcpy(ring + at, &pad16, 2);
+    ring[at + 2] = PAD;
+    headPos += pad;
+  }
+  memcpy(ring + (headPos & (LOG_RING_SIZE - 1)), record, size);
+  headPos += size;
+  headSeq++;
+}
+
+// one conversion of the format with the stored value, the length modifier of the
+// original is replaced by the one of the stored type
+static size_t convert(char *out, size_t size, const char *spec, size_t specLen, char conv, const uint8_t *arg, bool have)
+{
+  char f[24];
+  if (specLen > sizeof(f) - 4) specLen = sizeof(f) - 4;
+  memcpy(f, spec, specLen);
+  char type = have ? arg[0] : 0;
+  int64_t i = 0;
+  double d = 0;
+  if (type == 'i' || type == 'u') memcpy(&i, arg + 1, 8);
+  if (type == 'f') memcpy(&d, arg + 1, 8);
+
+  int n;
+  switch (conv)
+  {
+  case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+    if (type == 'f') i = (int64_t)d;
+    else if (type != 'i' && type != 'u') return snprintf(out, size, "?");
+    f[specLen] = 'l', f[specLen + 1] = 'l', f[specLen + 2] = conv, f[specLen + 3] = 0;
+    if (conv == 'c') f[specLen] = 'c', f[specLen + 1] = 0;
+    n = conv == 'c' ? snprintf(out, size, f, (int)i) : snprintf(out, size, f, (long long)i);
+    break;
+  case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+    if (type == 'i') d = (double)i;
+    else if (type == 'u') d = (double)(uint64_t)i;
+    else if (type != 'f') return snprintf(out, size, "?");
+    f[specLen] = conv, f[specLen + 1] = 0;
+    n = snprintf(out, size, f, d);
+    break;
+  case 's':
+  {
+    if (type != 's') return snprintf(out, size, "?");
+    char str[LOG_MAX_STRING + 1];
+    memcpy(str, arg + 2, arg[1]);
+    str[arg[1]] = 0;
+    f[specLen] = 's', f[specLen + 1] = 0;
+    n = snprintf(out, size, f, str);
+    break;
+  }
+  case 'p':
+    if (type != 'u') return snprintf(out, size, "?");
+    n = snprintf(out, size, "%p", (void *)(uintptr_t)i);
+    break;
+  default:
+    return 0;
+  }
+  return n < 0 ? 0 : n;
+}
+
+bool LogRing::read(Cursor &cursor, Entry &entry, char *text, size_t size)
+{
+  entry.lost = 0;
+  if ((int32_t)(cursor.pos - tailPos) < 0)
+  {
+    // overwritten while we were away
+    entry.lost = tailSeq - cursor.seq;
+    cursor = tail();
+  }
+  for (;;)
+  {
+    if (cursor.pos == headPos) return false;
+    const uint8_t *p = ring + (cursor.pos & (LOG_RING_SIZE - 1));
+    uint16_t recSize;
+    memcpy(&recSize, p, 2);
+    cursor.pos += recSize;
+    if (p[2] == PAD) continue;
+    cursor.seq++;
+
+    entry.level = (LogLevel)p[2];
+    uint8_t argc = p[3];
+    memcpy(&entry.ms, p + 4, 4);
+    const char *format;
+    memcpy(&entry.tag, p + 8, sizeof(entry.tag));
+    memcpy(&format, p + 8 + sizeof(entry.tag), sizeof(format));
+
+    // walk the format, each conversion takes the next stored argument
+    const uint8_t *arg = p + HEADER;
+    size_t n = 0;
+    for (const char *f = format; *f && n + 1 < size; f++)
+    {
+      if (*f != '%')
+      {
+        text[n++] = *f;
+        continue;
+      }
+      if (f[1] == '%')
+      {
+        text[n++] = '%';
+        f++;
+        continue;
+      }
+      // flags, width and precision are kept, length modifiers dropped
+      const char *spec = f++;
+      while (*f && strchr("-+ #0123456789.", *f)) f++;
+      size_t specLen = f - spec;
+      while (*f && strchr("hlLqjzt", *f)) f++;
+      if (!*f) break;
+      n += convert(text + n, size - n, spec, specLen, *f, arg, argc > 0);
+      if (n >= size) n = size - 1;
+      if (argc)
+      {
+        arg += 1 + (arg[0] == 's' ? 1 + arg[1] : 8);
+        argc--;
+      }
+    }
+    text[n] = 0;
+    return true;
+  }
+}
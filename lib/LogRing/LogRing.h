@@ -0,0 +1,130 @@
+/**************************************************************************************
+
+  Binary log ring with deferred formatting
+
+  A log call does not format anything: it stores the format string pointer,
+  the tag pointer and the raw arguments (integers as 64 bit, floats as double,
+  strings copied, at most LOG_MAX_STRING bytes each) as one record in a fixed
+  byte ring. The text is produced only when a reader asks for it, with the
+  conversions of the original format applied to the stored values. The format
+  and the tag must therefore be string literals.
+
+  Each reader keeps its own cursor, so the console and a network sink consume
+  the same records at their own pace. When the ring is full the oldest records
+  are overwritten; a reader that falls behind them skips ahead and is told how
+  many records it lost.
+
+  Nothing is allocated. The ring is not locked: every call must come from the
+  same task.
+
+  ***************************************************************************************/
+#ifndef _LOG_RING_H
+#define _LOG_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LOG_RING_SIZE 4096   // bytes of records, power of two
+#define LOG_MAX_RECORD 160   // largest record, arguments beyond it are dropped
+#define LOG_MAX_STRING 48    // longest string argument kept
+
+enum LogLevel : uint8_t
+{
+  LOG_NONE,
+  LOG_ERROR,
+  LOG_WARN,
+  LOG_INFO,
+  LOG_DEBUG,
+};
+
+class LogRing
+{
+public:
+  LogRing();
+
+  // record a message, see LOG_D and friends in RedGlobals.h
+  template <typename... T>
+  void write(LogLevel level, const char *tag, const char *format, T... args)
+  {
+    uint8_t record[LOG_MAX_RECORD];
+    size_t n = HEADER;
+    uint8_t argc = 0;
+    int expand[] = {0, (encode(record, n, argc, args), 0)...};
+    (void)expand;
+    push(level, tag, format, record, n, argc);
+  }
+
+  // where a reader is: the byte position and the number of records before it
+  struct Cursor
+  {
+    uint32_t pos;
+    uint32_t seq;
+  };
+
+  // a formatted record, from read()
+  struct Entry
+  {
+    uint32_t ms;      // millis() when it was written
+    LogLevel level;
+    const char *tag;
+    unsigned long lost; // records overwritten before this reader got to them
+  };
+
+  // the record at cursor, formatted into text; advances the cursor, false when
+  // the reader is up to date
+  bool read(Cursor &cursor, Entry &entry, char *text, size_t size);
+
+  Cursor head() const { return {headPos, headSeq}; } // a reader that only wants new records
+  Cursor tail() const { return {tailPos, tailSeq}; } // a reader that wants everything held
+  uint32_t pending(const Cursor &cursor) const { return headSeq - cursor.seq; } // records not read yet
+  uint32_t overwritten() const { return tailSeq; }   // records lost to the ring wrapping
+
+  static char levelLetter(LogLevel level);
+  static const char *levelName(LogLevel level);
+  static bool parseLevel(const char *name, LogLevel &level); // case insensitive
+
+private:
+  // record layout: size (2) level (1) argc (1) ms (4) tag (ptr) format (ptr) args...
+  static const size_t HEADER = 8 + 2 * sizeof(const char *);
+  static const uint8_t PAD = 0xFF; // level of the filler that skips to the start of the ring
+
+  uint8_t ring[LOG_RING_SIZE];
+  uint32_t headPos, tailPos; // free running byte positions, records never straddle the wrap
+  uint32_t headSeq, tailSeq; // records written, records dropped
+
+  void push(LogLevel level, const char *tag, const char *format, uint8_t *record, size_t size, uint8_t argc);
+  void dropOldest();
+
+  // argc counts the stored arguments, ARGS_FULL is set once one did not fit and
+  // keeps the later ones out too
+  static const uint8_t ARGS_FULL = 0x80;
+  static void put(uint8_t *record, size_t &n, uint8_t &argc, char type, const void *value, size_t size);
+
+  template <typename V>
+  static void putInt(uint8_t *r, size_t &n, uint8_t &argc, char type, V v)
+  {
+    int64_t wide = (int64_t)v;
+    put(r, n, argc, type, &wide, sizeof(wide));
+  }
+
+  static void encode(uint8_t *r, size_t &n, uint8_t &argc, long long v) { putInt(r, n, argc, 'i', v); }
+  static void encode(uint8_t *r, size_t &n, uint8_t &argc, unsigned long long v) { putInt(r, n, argc, 'u', v); }
+  static void encode(uint8_t *r, size_t &n, uint8_t &argc, long v) { putInt(r, n, argc, 'i', v); }
+  static void encode(uint8_t *r, size_t &n, uint8_t &argc, unsigned long v) { putInt(r, n, argc, 'u', v); }
+  static void encode(uint8_t *r, size_t &n, uint8_t &argc, int v) { putInt(r, n, argc, 'i', v); }
+  static void encode(uint8_t *r, size_t &n, uint8_t &argc, unsigned int v) { putInt(r, n, argc, 'u', v); }
+  static void encode(uint8_t *r, size_t &n, uint8_t &argc, short v) { putInt(r, n, argc, 'i', v); }
+  static void encode(uint8_t *r, size_t &n, uint8_t &argc, unsigned short v) { putInt(r, n, argc, 'u', v); }
+  static void encode(uint8_t *r, size_t &n, uint8_t &argc, char v) { putInt(r, n, argc, 'i', v); }
+  static void encode(uint8_t *r, size_t &n, uint8_t &argc, signed char v) { putInt(r, n, argc, 'i', v); }
+  static void encode(uint8_t *r, size_t &n, uint8_t &argc, unsigned char v) { putInt(r, n, argc, 'u', v); }
+  static void encode(uint8_t *r, size_t &n, uint8_t &argc, bool v) { putInt(r, n, argc, 'u', v); }
+  static void encode(uint8_t *r, size_t &n, uint8_t &argc, double v) { put(r, n, argc, 'f', &v, sizeof(v)); }
+  static void encode(uint8_t *r, size_t &n, uint8_t &argc, float v) { encode(r, n, argc, (double)v); }
+  static void encode(uint8_t *r, size_t &n, uint8_t &argc, const void *p) { putInt(r, n, argc, 'u', (uintptr_t)p); }
+  static void encode(uint8_t *r, size_t &n, uint8_t &argc, const char *s);
+  static void encode(uint8_t *r, size_t &n, uint8_t &argc, char *s) { encode(r, n, argc, (const char *)s); }
+};
+
+#endif
@@ -0,0 +1,116 @@
+/**************************************************************************************
+
+  Metrics registry -- see Metrics.h
+
+  ***************************************************************************************/
+#include "Metrics.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+Metric *Metric::registry = nullptr;
+
+// metrics are globals: this runs during static initialisation, before any task
+Metric::Metric(const char *name) : name(name), link(nullptr)
+{
+  Metric **tail = &registry;
+  while (*tail) tail = &(*tail)->link;
+  *tail = this; // in declaration order within a file
+}
+
+bool Metric::append(char *buffer, size_t size, size_t &length, const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(buffer + length, size - length, format, args);
+  va_end(args);
+  if (n < 0 || (size_t)n >= size - length)
+  {
+    buffer[length] = 0; // the part that did not fit is not kept
+    return false;
+  }
+  length += n;
+  return true;
+}
+
+size_t Metric::writeSnapshot(char *buffer, size_t size, uint32_t uptimeSeconds)
+{
+  size_t length = 0;
+  append(buffer, size, length, "{\"up\":%lu", (unsigned long)uptimeSeconds);
+  for (Metric *m = registry; m; m = m->link)
+  {
+    size_t mark = length;
+    // room for the closing brace stays free
+    if (!append(buffer, size - 1, length, ",") || !m->writeJson(buffer, size - 1, length))
+    {
+      length = mark;
+      break;
+    }
+  }
+  append(buffer, size, length, "}");
+  return length;
+}
+
+void Metric::printAll(Print &out)
+{
+  for (Metric *m = registry; m; m = m->link) m->printTo(out);
+}
+
+void Metric::resetAll()
+{
+  for (Metric *m = registry; m; m = m->link) m->reset();
+}
+
+bool Counter::writeJson(char *buffer, size_t size, size_t &length) const
+{
+  return append(buffer, size, length, "\"%s\":%lu", name, (unsigned long)value());
+}
+
+void Counter::printTo(Print &out) const { out.printf("  %-16s %lu\r\n", name, (unsigned long)value()); }
+
+bool Gauge::writeJson(char *buffer, size_t size, size_t &length) const
+{
+  return append(buffer, size, length, "\"%s\":%ld", name, (long)value());
+}
+
+void Gauge::printTo(Print &out) const { out.printf("  %-16s %ld\r\n", name, (long)value()); }
+
+Histogram::Histogram(const char *name, std::initializer_list<uint32_t> list) : Metric(name), buckets(0)
+{
+  for (uint32_t bound : list)
+    if (buckets < METRIC_MAX_BUCKETS) bounds[buckets++] = bound;
+  reset();
+}
+
+void Histogram::reset()
+{
+  for (auto &c : counts) c.store(0, std::memory_order_relaxed);
+  total.store(0, std::memory_order_relaxed);
+  largest.store(0, std::memory_order_relaxed);
+}
+
+void Histogram::record(uint32_t value)
+{
+  int i = 0;
+  while (i < buckets && value > bounds[i]) i++;
+  counts[i].fetch_add(1, std::memory_order_relaxed);
+  total.fetch_add(1, std::memory_order_relaxed);
+  uint32_t seen = largest.load(std::memory_order_relaxed);
+  while (value > seen && !largest.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+}
+
+// "name":{"n":count,"max":largest,"b":[per bucket, the last one above every bound]}
+bool Histogram::writeJson(char *buffer, size_t size, size_t &length) const
+{
+  if (!append(buffer, size, length, "\"%s\":{\"n\":%lu,\"max\":%lu,\"b\":[", name, (unsigned long)count(), (unsigned long)max()))
+    return false;
+  for (int i = 0; i <= buckets; i++)
+    if (!append(buffer, size, length, i ? ",%lu" : "%lu", (unsigned long)counts[i].load(std::memory_order_relaxed))) return false;
+  return append(buffer, size, length, "]}");
+}
+
+void Histogram::printTo(Print &out) const
+{
+  out.printf("  %-16s n=%lu max=%lu ", name, (unsigned long)count(), (unsigned long)max());
+  for (int i = 0; i < buckets; i++) out.printf(" <=%lu:%lu", (unsigned long)bounds[i], (unsigned long)counts[i].load(std::memory_order_relaxed));
+  out.printf(" >%lu:%lu\r\n", (unsigned long)bounds[buckets - 1], (unsigned long)counts[buckets].load(std::memory_order_relaxed));
+}
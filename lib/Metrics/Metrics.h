@@ -0,0 +1,115 @@
+/**************************************************************************************
+
+  Metrics registry: counters, gauges and fixed-bucket histograms
+
+  Each metric is a global object with a short name; its constructor links it
+  into one registry, so declaring it is all it takes to have it in the snapshot.
+  Updates are relaxed atomic operations on 32 bit words, safe from any task and
+  cheap enough for the hot paths; nothing is allocated or locked.
+
+  Counters only go up, gauges are a level. Either can instead be read from an
+  existing variable through a function when the snapshot is taken, so values
+  the firmware already keeps are not counted twice. A histogram counts values
+  into at most METRIC_MAX_BUCKETS buckets by inclusive upper bound, plus one
+  for everything above, and keeps the largest value seen.
+
+  writeJson() produces the compact snapshot, one key per metric; printTo() the
+  same for a person.
+
+  ***************************************************************************************/
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <Print.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <initializer_list>
+
+#define METRIC_MAX_BUCKETS 8
+
+class Metric
+{
+public:
+  const char *const name;
+
+  static Metric *first() { return registry; }
+  Metric *next() const { return link; }
+
+  // "name":value, false if it did not fit in size
+  virtual bool writeJson(char *buffer, size_t size, size_t &length) const = 0;
+  virtual void printTo(Print &out) const = 0;
+  virtual void reset() = 0;
+
+  // the whole registry as one JSON object, cut short rather than overflowing
+  static size_t writeSnapshot(char *buffer, size_t size, uint32_t uptimeSeconds);
+  static void printAll(Print &out);
+  static void resetAll(); // back to zero, as after a boot
+
+protected:
+  explicit Metric(const char *name);
+  static bool append(char *buffer, size_t size, size_t &length, const char *format, ...)
+      __attribute__((format(printf, 4, 5)));
+
+private:
+  static Metric *registry;
+  Metric *link;
+};
+
+class Counter : public Metric
+{
+public:
+  explicit Counter(const char *name, uint32_t (*source)() = nullptr) : Metric(name), source(source) {}
+
+  void inc(uint32_t by = 1) { n.fetch_add(by, std::memory_order_relaxed); }
+  uint32_t value() const { return source ? source() : n.load(std::memory_order_relaxed); }
+
+  bool writeJson(char *buffer, size_t size, size_t &length) const override;
+  void printTo(Print &out) const override;
+  void reset() override { n.store(0, std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint32_t> n{0};
+  uint32_t (*const source)();
+};
+
+class Gauge : public Metric
+{
+public:
+  explicit Gauge(const char *name, int32_t (*source)() = nullptr) : Metric(name), source(source) {}
+
+  void set(int32_t value) { v.store(value, std::memory_order_relaxed); }
+  int32_t value() const { return source ? source() : v.load(std::memory_order_relaxed); }
+
+  bool writeJson(char *buffer, size_t size, size_t &length) const override;
+  void printTo(Print &out) const override;
+  void reset() override { v.store(0, std::memory_order_relaxed); }
+
+private:
+  std::atomic<int32_t> v{0};
+  int32_t (*const source)();
+};
+
+class Histogram : public Metric
+{
+public:
+  // bounds ascending, 1 to METRIC_MAX_BUCKETS of them
+  Histogram(const char *name, std::initializer_list<uint32_t> bounds);
+
+  void record(uint32_t value);
+  uint32_t count() const { return total.load(std::memory_order_relaxed); }
+  uint32_t max() const { return largest.load(std::memory_order_relaxed); }
+
+  bool writeJson(char *buffer, size_t size, size_t &length) const override;
+  void printTo(Print &out) const override;
+  void reset() override;
+
+private:
+  uint32_t bounds[METRIC_MAX_BUCKETS];
+  uint8_t buckets; // bounds used, the counts have one more
+  std::atomic<uint32_t> counts[METRIC_MAX_BUCKETS + 1];
+  std::atomic<uint32_t> total{0};
+  std::atomic<uint32_t> largest{0};
+};
+
+#endif
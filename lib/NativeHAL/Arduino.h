@@ -0,0 +1,93 @@
+/**************************************************************************************
+
+  Native (host) hardware abstraction layer -- Arduino core subset
+
+  Provides digitalWrite/pulseIn/millis/delay & friends on top of a virtual clock
+  so the firmware sources compile and run unchanged on a Linux box. Time only
+  moves when the firmware blocks (delay, delayMicroseconds, pulseIn) or when the
+  simulation driver advances it, which lets a simulated day run in milliseconds.
+
+  See NativeHAL.h for the simulation controls.
+
+  ***************************************************************************************/
+#ifndef _NATIVE_ARDUINO_H
+#define _NATIVE_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/time.h>
+#include <functional>
+
+#include "WString.h"
+#include "Print.h"
+#include "IPAddress.h"
+#include "HardwareSerial.h"
+#include "FreeRTOS.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define LOW 0x0
+#define HIGH 0x1
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define IRAM_ATTR
+#define RTC_DATA_ATTR
+
+// GPIO
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout = 1000000L);
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode);
+void attachInterruptArg(uint8_t pin, void (*isr)(void *), void *arg, int mode);
+void detachInterrupt(uint8_t pin);
+uint8_t digitalPinToInterrupt(uint8_t pin);
+
+// time (virtual clock)
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+// wall clock, driven by the virtual clock once configTime() has been called
+void configTime(long gmtOffset_sec, int daylightOffset_sec, const char *server1, const char *server2 = nullptr, const char *server3 = nullptr);
+bool getLocalTime(struct tm *info, uint32_t ms = 5000);
+// time(): seconds since boot until configTime(), then epoch seconds like newlib after SNTP.
+// Function-like macro so the firmware can keep calling time(NULL); every standard header
+// the stand-ins need is included above.
+time_t hal_time(time_t *t);
+#define time(t) hal_time(t)
+
+// random
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+// chip
+class EspClass
+{
+public:
+  void restart();
+  uint32_t getFreeHeap();
+  uint32_t getMinFreeHeap();
+  uint32_t getMaxAllocHeap();
+  uint32_t getCycleCount();
+};
+extern EspClass ESP;
+inline uint32_t getCpuFrequencyMhz() { return 240; }
+
+#endif
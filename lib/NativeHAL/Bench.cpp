@@ -0,0 +1,335 @@
+/**************************************************************************************
+
+  Native (host) micro-benchmarks -- see Bench.h
+
+  ***************************************************************************************/
+#include <Arduino.h>
+#include <RedGlobals.h>
+#include "Bench.h"
+#include "NativeHAL.h"
+#include <LevelKalman.h>
+#include <WaveSpectrum.h>
+
+#include <new>
+
+void configureTopics(); // MQTTConfig.cpp
+
+// every heap allocation of the program goes through here on the host, the
+// benchmarks count them
+unsigned long bench::allocations = 0;
+
+void *operator new(size_t size)
+{
+  bench::allocations++;
+  if (void *p = malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+namespace
+{
+  // every console word the gauge knows, and one it does not
+  const char *const consoleWords[] = {"?", "status", "on", "off", "debug", "filter", "temp", "rate", "lowpower",
+                                      "noaa", "location", "mqtt", "reset", "reboot", "quit", "exit", "frob"};
+  const int CONSOLE_WORDS = sizeof(consoleWords) / sizeof(consoleWords[0]);
+
+  const char *const subtopics[] = {"level/command", "debug/set", "filter/set", "rate/set", "lowpower/set", "level/nope"};
+  const int SUBTOPICS = sizeof(subtopics) / sizeof(subtopics[0]);
+
+  // the console dispatch before the command table: every comparison ran for every line
+  int consoleChain(const char *c)
+  {
+    int hit = 0;
+    if (strcmp(c, "on") == 0) hit = 1;
+    if (strcmp(c, "off") == 0) hit = 2;
+    if (strcmp(c, "status") == 0) hit = 3;
+    if (strcmp(c, "test") == 0) hit = 4;
+    if (strcmp(c, "noaa") == 0) hit = 5;
+    if (strcmp(c, "temp") == 0) hit = 6;
+    if (strcmp(c, "rate") == 0) hit = 7;
+    if (strcmp(c, "lowpower") == 0) hit = 8;
+    if (strcmp(c, "filter") == 0) hit = 9;
+    if (strcmp(c, "?") == 0) hit = 10;
+    if (strcmp(c, "debug") == 0) hit = 11;
+    if (strcmp(c, "location") == 0) hit = 12;
+    if (strcmp(c, "mqtt") == 0) hit = 13;
+    if (strcmp(c, "reset") == 0) hit = 14;
+    if (strcmp(c, "reboot") == 0) hit = 15;
+    if ((strcmp(c, "exit") == 0) || (strcmp(c, "quit") == 0)) hit = 16;
+    return hit;
+  }
+
+  // the MQTT dispatch before the command table: full topic compares, level, filter,
+  // rate and low power first, debug last
+  char chainTopics[5][96];
+  int mqttChain(const char *topic)
+  {
+    static const int order[] = {0, 2, 3, 4, 1};
+    for (int i : order)
+      if (strcmp(topic, chainTopics[i]) == 0) return i + 1;
+    return 0;
+  }
+
+  void dispatchBenchmarks(const char *filter)
+  {
+    snprintf(mqtt_topic, 64, "%s/%s", MQTT_TOPIC_PREFIX, "Ocean Ridge");
+    char topics[SUBTOPICS][96];
+    for (int i = 0; i < SUBTOPICS; i++) snprintf(topics[i], sizeof(topics[i]), "%s/%s", mqtt_topic, subtopics[i]);
+    for (int i = 0; i < 5; i++) strcpy(chainTopics[i], topics[i]);
+
+    int i = 0;
+    bench::run(filter, "dispatch/console/chain", [&]() {
+      bench::keep(consoleChain(consoleWords[i]));
+      i = i + 1 < CONSOLE_WORDS ? i + 1 : 0;
+    });
+    bench::run(filter, "dispatch/console/table", [&]() {
+      bench::keep(findCommand(consoleWords[i], cmd::FROM_CONSOLE));
+      i = i + 1 < CONSOLE_WORDS ? i + 1 : 0;
+    });
+    i = 0; // the console loops leave it past the topics
+    bench::run(filter, "dispatch/mqtt/chain", [&]() {
+      bench::keep(mqttChain(topics[i]));
+      i = i + 1 < SUBTOPICS ? i + 1 : 0;
+    });
+    bench::run(filter, "dispatch/mqtt/table", [&]() {
+      bench::keep(findCommand(topics[i], cmd::FROM_MQTT));
+      i = i + 1 < SUBTOPICS ? i + 1 : 0;
+    });
+  }
+
+  // echo widths around 21 cm with some spread, as the sensor sees the water
+  uint32_t echoWidth(unsigned i) { return 1220 + (i * 37) % 23; }
+
+  // the per-sample path on the network task, and the estimate that closes an interval
+  // of 30 samples (5 minutes at 10 s) in each filter mode
+  void sensingBenchmarks(const char *filter)
+  {
+    int i = 0;
+    bench::run(filter, "sense/echoToCm", [&]() { bench::keep(echoToCm(echoWidth(i++), soundSpeedFactor)); });
+    bench::run(filter, "sense/echoToQ8", [&]() { bench::keep(echoToQ8(echoWidth(i++), soundSpeedFactor)); });
+
+    SampleFilter &levelFilter = sensorFilters[0];
+    configureSensors();
+    bench::run(filter, "sense/updateAverage", [&]() {
+      EchoSample sample = {0, echoWidth(i++), 0};
+      updateAverage(sample);
+      if (intervalSamples() == 30) resetSensors();
+    });
+
+    FilterMode mode = levelFilter.getMode();
+    for (int m = 0; m < FILTER_MODES; m++)
+    {
+      char name[48];
+      snprintf(name, sizeof(name), "sense/estimate/%s", SampleFilter::modeName((FilterMode)m));
+      levelFilter.setMode((FilterMode)m);
+      levelFilter.reset();
+      for (int k = 0; k < 30; k++) levelFilter.add(echoToQ8(echoWidth(k), soundSpeedFactor));
+      bench::run(filter, name, [&]() { bench::keep(levelFilter.estimate()); });
+    }
+    levelFilter.setMode(mode);
+
+    // the level tracker's share of a sample
+    LevelKalman kalman;
+    bench::run(filter, "sense/kalman", [&]() { bench::keep(kalman.update(echoWidth(i++) / 58.0, 30)); });
+
+    // closing the interval of every sensor into one level
+    FusedLevel fused;
+    bench::run(filter, "sense/fuse", [&]() { bench::keep(fuseSensors(fused)); });
+    resetSensors();
+  }
+
+  // topic and payload building; the client is not connected, so publish() returns
+  // before the stand-in broker and only the firmware's formatting is timed
+  void formatBenchmarks(const char *filter)
+  {
+    snprintf(deviceLocation, 64, "%s", "Ocean Ridge");
+    bench::run(filter, "format/configureTopics", [&]() { configureTopics(); });
+    float level = 3.14f;
+    bench::run(filter, "format/publishLevel", [&]() {
+      publishLevel(level, 0.004f, 2);
+      level += 0.01f;
+    });
+  }
+
+  // a message from the broker: payload copy, topic match, argument parsing and the
+  // handler; level/command ON with sensing on changes nothing
+  void callbackBenchmarks(const char *filter)
+  {
+    configureTopics();
+    char command[96], unknown[96];
+    snprintf(command, sizeof(command), "%s/level/command", mqtt_topic);
+    snprintf(unknown, sizeof(unknown), "%s/level/nope", mqtt_topic);
+    bool sensing = sensingEnabled;
+    sensingEnabled = true;
+    bench::run(filter, "mqtt/callback/command", [&]() { mqttCallback(command, (byte *)"ON", 2); });
+    bench::run(filter, "mqtt/callback/unknown", [&]() { mqttCallback(unknown, (byte *)"ON", 2); });
+    sensingEnabled = sensing;
+  }
+
+  // console output to a telnet session, the status line is a typical printf; serial
+  // is on like in the firmware, swallowed unless --verbose
+  void consoleBenchmarks(const char *filter)
+  {
+    console.enableSerial(&Serial, true);
+    console.enableTelnet(23);
+    auto session = hal::telnetConnect();
+    console.check(); // accepts the session
+
+    char line[128];
+    size_t bytes = snprintf(line, sizeof(line), "Connection %s for %lu s, last reconnect took %lu ms, %lu connects\r\n", "online", 42UL, 1234UL, 3UL);
+    bench::Result r = bench::run(filter, "console/telnet/printf", [&]() {
+      console.printf("Connection %s for %lu s, last reconnect took %lu ms, %lu connects\r\n", "online", 42UL, 1234UL, 3UL);
+    }, bytes);
+    if (r.ops)
+    {
+      // what costs on the device: one TCP send per socket write
+      console.flush();
+      unsigned long writes = session->writes;
+      for (int i = 0; i < 100; i++) console.write((const uint8_t *)line, bytes);
+      console.flush();
+      bench::report("console/telnet/printf", (session->writes - writes) / 100.0, "writes/line");
+    }
+
+    // a peer that stopped reading: writes must neither block nor grow the queue. The
+    // stub's WiFiClient::write() waits like the ESP32 core's, so a blocking send shows
+    // up as virtual time
+    session->window = 0;
+    r = bench::run(filter, "console/telnet/stalled", [&]() { console.write((const uint8_t *)line, bytes); }, bytes);
+    if (r.ops)
+    {
+      bench::report("console/telnet/stalled", console.queuedOutput(), "bytes-queued");
+      unsigned long start = millis();
+      for (int i = 0; i < 100; i++) console.write((const uint8_t *)line, bytes);
+      bench::report("console/telnet/stalled", (millis() - start) / 100.0, "ms-blocked/line");
+    }
+    session->window = 5744;
+
+    // three sessions, the second one stalled: the others get every line in one write,
+    // and nothing waits for the stalled one
+    auto second = hal::telnetConnect();
+    console.check();
+    auto third = hal::telnetConnect();
+    console.check();
+    second->window = 0;
+    r = bench::run(filter, "console/telnet/3-sessions-1-stalled", [&]() { console.write((const uint8_t *)line, bytes); }, bytes);
+    if (r.ops)
+    {
+      unsigned long writes = third->writes, start = millis();
+      third->tx.clear();
+      for (int i = 0; i < 100; i++) console.write((const uint8_t *)line, bytes);
+      bench::report("console/telnet/3-sessions-1-stalled", (millis() - start) / 100.0, "ms-blocked/line");
+      bench::report("console/telnet/3-sessions-1-stalled", (third->writes - writes) / 100.0, "writes/line");
+      bench::report("console/telnet/3-sessions-1-stalled", 100.0 * third->tx.size() / (100 * bytes), "%-delivered");
+    }
+    console.closeTelnetConnection();
+
+    // the same line as UDP broadcast, packed into datagrams
+    console.enableUDP(IPAddress(192, 168, 68, 80), 4210);
+    r = bench::run(filter, "console/udp/printf", [&]() { console.write((const uint8_t *)line, bytes); }, bytes);
+    if (r.ops)
+    {
+      unsigned long datagrams = hal::stats().udpPackets;
+      for (int i = 0; i < 100; i++) console.write((const uint8_t *)line, bytes);
+      bench::report("console/udp/printf", (hal::stats().udpPackets - datagrams) / 100.0, "datagrams/line");
+    }
+    console.disableUDP();
+  }
+
+  // what a debug line costs the caller: formatting it on the spot, or leaving the
+  // arguments in the log ring for the network task
+  void logBenchmarks(const char *filter)
+  {
+    char line[160];
+    float cm = 21.61f;
+    int samples = 10, rejected = 0;
+    bench::run(filter, "log/caller/snprintf", [&]() {
+      bench::keep(snprintf(line, sizeof(line), "Measured distance: %.2f cm%s, Samples: %d, Rejected: %d", cm, "", samples, rejected));
+    });
+    bench::run(filter, "log/caller/ring", [&]() {
+      logRing.write(LOG_DEBUG, "level", "Measured distance: %.2f cm%s, Samples: %d, Rejected: %d", cm, "", samples, rejected);
+    });
+    LogRing::Cursor cursor = logRing.head();
+    logRing.write(LOG_DEBUG, "level", "Measured distance: %.2f cm%s, Samples: %d, Rejected: %d", cm, "", samples, rejected);
+    LogRing::Entry entry;
+    bench::run(filter, "log/reader/format", [&]() {
+      LogRing::Cursor c = cursor;
+      bench::keep(logRing.read(c, entry, line, sizeof(line)));
+    });
+  }
+
+  // what a metric costs on the hot path, and a snapshot on the network task
+  void metricsBenchmarks(const char *filter)
+  {
+    uint32_t v = 0;
+    bench::run(filter, "metrics/counter/inc", [&]() { samplesMetric.inc(); });
+    bench::run(filter, "metrics/histogram/record", [&]() { networkLoopUs.record(v += 7919); });
+    char json[440];
+    bench::run(filter, "metrics/snapshot", [&]() { bench::keep(Metric::writeSnapshot(json, sizeof(json), 86400)); });
+    Metric::resetAll();
+  }
+
+  // a wave capture of 2 Hz samples: 5 s swell on a rising tide, a gap and a spike
+  void waveSeries(float *x, int n)
+  {
+    for (int i = 0; i < n; i++) x[i] = 64 - 0.002f * i + 12 * sinf(2 * (float)M_PI * i / 10 + 0.4f) + 3 * sinf(i * 1.7f);
+    x[n / 3] = NAN;
+    x[n / 2] = 9;
+  }
+
+  // the FFT and the whole analysis at each capture size; test/test_wave_spectrum
+  // checks the FFT against a direct DFT
+  void wavesBenchmarks(const char *filter)
+  {
+    static RealFFT<WAVE_FFT_SIZE> fft;
+    static WaveSpectrum spectrum;
+    float x[WAVE_FFT_SIZE], input[WAVE_FFT_SIZE];
+    for (int n : {64, 256, WAVE_FFT_SIZE})
+    {
+      char name[48];
+      for (int i = 0; i < n; i++) input[i] = 12 * sinf(2 * (float)M_PI * i / 10) + (i * 7919 % 61) / 10.0f;
+      snprintf(name, sizeof(name), "waves/fft/%d", n);
+      bench::run(filter, name, [&]() {
+        std::copy(input, input + n, x);
+        fft.transform(x, n);
+        bench::keep(x[1]);
+      });
+
+      snprintf(name, sizeof(name), "waves/analyse/%d", n);
+      WaveStats stats;
+      bench::run(filter, name, [&]() {
+        waveSeries(x, n);
+        bench::keep(spectrum.analyse(x, n, 2, stats));
+      });
+    }
+  }
+
+#if PERF_SPANS
+  // entering and leaving a timing span; on the host the cycle counter is the
+  // virtual clock, so this is the bookkeeping without the two ccount reads
+  void perfBenchmarks(const char *filter)
+  {
+    static PerfSpan span("bench"); // stays in the registry
+    bench::run(filter, "perf/scope", [&]() { PERF_SCOPE(span); });
+  }
+#endif
+}
+
+int bench::runAll(const char *filter)
+{
+  sensingBenchmarks(filter);
+  formatBenchmarks(filter);
+  callbackBenchmarks(filter);
+  dispatchBenchmarks(filter);
+  consoleBenchmarks(filter);
+  logBenchmarks(filter);
+  metricsBenchmarks(filter);
+  wavesBenchmarks(filter);
+#if PERF_SPANS
+  perfBenchmarks(filter);
+#endif
+  return 0;
+}
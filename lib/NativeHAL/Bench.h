@@ -0,0 +1,77 @@
+/**************************************************************************************
+
+  Native (host) micro-benchmarks
+
+  `program --bench [NAME]` runs the benchmarks in Bench.cpp whose name starts
+  with NAME instead of the simulation. Each one is timed on the wall clock over
+  enough iterations to fill BENCH_MIN_MS and reported in ns/op, with the heap
+  allocations (operator new) per call; host numbers compare two
+  implementations, they are not ESP32 timings.
+
+  Every line is "name value unit [value unit...]" with one-word names and
+  units, so two runs diff line by line; tools/benchdiff.py lines them up and
+  flags the changes:
+
+      pio run -e native_bench && .pio/build/native_bench/program --bench > after.txt
+      tools/benchdiff.py before.txt after.txt
+
+  ***************************************************************************************/
+#ifndef _NATIVE_BENCH_H
+#define _NATIVE_BENCH_H
+
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BENCH_MIN_MS 200 // wall clock per benchmark
+
+namespace bench
+{
+  // keeps the optimizer from dropping a result it thinks nobody reads
+  template <typename T>
+  inline void keep(const T &value) { asm volatile("" : : "r"(&value) : "memory"); }
+
+  extern unsigned long allocations; // operator new calls so far, see Bench.cpp
+
+  struct Result
+  {
+    double nsPerOp;
+    double allocsPerOp;
+    uint64_t ops; // calls in the timed batch
+  };
+
+  // time calls of fn(), doubling the iterations until a batch takes BENCH_MIN_MS
+  template <typename F>
+  Result time(F fn)
+  {
+    for (uint64_t n = 64;; n *= 2)
+    {
+      unsigned long allocated = allocations;
+      auto start = std::chrono::steady_clock::now();
+      for (uint64_t i = 0; i < n; i++) fn();
+      std::chrono::duration<double, std::nano> ns = std::chrono::steady_clock::now() - start;
+      if (ns.count() >= BENCH_MIN_MS * 1e6) return {ns.count() / n, (double)(allocations - allocated) / n, n};
+    }
+  }
+
+  // run and print one benchmark unless filtered out, with the throughput when each
+  // call moves bytesPerOp bytes; ops is 0 when filtered out
+  template <typename F>
+  Result run(const char *filter, const char *name, F fn, size_t bytesPerOp = 0)
+  {
+    if (filter && strncmp(name, filter, strlen(filter))) return {0, 0, 0};
+    Result r = time(fn);
+    printf("%-40s %10.1f ns/op %8.2f allocs/op", name, r.nsPerOp, r.allocsPerOp);
+    if (bytesPerOp) printf(" %8.1f MB/s", bytesPerOp * 1e3 / r.nsPerOp);
+    printf("\n");
+    return r;
+  }
+
+  // a figure other than time, measured after the benchmark of the same name
+  inline void report(const char *name, double value, const char *unit) { printf("%-40s %10.2f %s\n", name, value, unit); }
+
+  int runAll(const char *filter); // nullptr for all of them
+}
+
+#endif
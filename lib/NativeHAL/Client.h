@@ -0,0 +1,11 @@
+/**************************************************************************************
+
+  Native (host) stand-in for the Arduino Client interface.
+
+  ***************************************************************************************/
+#ifndef _NATIVE_CLIENT_H
+#define _NATIVE_CLIENT_H
+
+#include "WiFiClient.h"
+
+#endif
@@ -0,0 +1,71 @@
+/**************************************************************************************
+
+  Native (host) stand-in for the ESP32 FS / File API, backed by a host directory.
+
+  ***************************************************************************************/
+#ifndef _NATIVE_FS_H
+#define _NATIVE_FS_H
+
+#include <memory>
+#include <stdio.h>
+#include "Arduino.h"
+
+namespace fs
+{
+  enum SeekMode
+  {
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2
+  };
+
+  class File : public Stream
+  {
+  public:
+    File() {}
+    explicit File(FILE *f) : fp(f, fclose) {}
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t size) override { return fp ? fwrite(buf, 1, size, fp.get()) : 0; }
+    using Print::write;
+    size_t read(uint8_t *buf, size_t size) { return fp ? fread(buf, 1, size, fp.get()) : 0; }
+    int read() override
+    {
+      uint8_t c;
+      return read(&c, 1) == 1 ? c : -1;
+    }
+    int available() override { return fp ? (int)(size() - position()) : 0; }
+    int peek() override
+    {
+      int c = read();
+      if (c >= 0) seek(position() - 1);
+      return c;
+    }
+    void flush() override
+    {
+      if (fp) fflush(fp.get());
+    }
+    bool seek(uint32_t pos, SeekMode mode = SeekSet) { return fp && fseek(fp.get(), pos, mode) == 0; }
+    size_t position() const { return fp ? ftell(fp.get()) : 0; }
+    size_t size() const;
+    void close() { fp.reset(); }
+    operator bool() const { return (bool)fp; }
+
+  private:
+    std::shared_ptr<FILE> fp;
+  };
+
+  class FS
+  {
+  public:
+    File open(const char *path, const char *mode = "r", bool create = false);
+    bool exists(const char *path);
+    bool remove(const char *path);
+    bool mkdir(const char *path);
+  };
+}
+
+using fs::File;
+using fs::FS;
+
+#endif
@@ -0,0 +1,48 @@
+/**************************************************************************************
+
+  Native (host) hardware abstraction layer -- FreeRTOS task subset
+
+  The ESP32 Arduino core pulls FreeRTOS in through Arduino.h; this is the part
+  of it the firmware uses. Tasks are cooperative coroutines on the host thread:
+  the simulation driver resumes a task once the virtual clock reaches its wake
+  time, and the task runs until it blocks (vTaskDelay, vTaskDelayUntil,
+  ulTaskNotifyTake or delay()). Blocking in one task lets the others run, like
+  the two cores of an ESP32 would; the core a task is pinned to is only
+  reported back. A task waiting in ulTaskNotifyTake() is due again the moment
+  xTaskNotifyGive() reaches it, otherwise at its timeout; in between the
+  driver moves the clock straight to the next event.
+
+  One tick is one millisecond (CONFIG_FREERTOS_HZ=1000 on the ESP32 core).
+
+  ***************************************************************************************/
+#ifndef _NATIVE_FREERTOS_H
+#define _NATIVE_FREERTOS_H
+
+#include <stdint.h>
+
+typedef void *TaskHandle_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL 0
+#define pdPASS 1
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms) / portTICK_PERIOD_MS)
+#define configMAX_PRIORITIES 25
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stackDepth, void *param,
+                                   UBaseType_t priority, TaskHandle_t *created, BaseType_t core);
+void vTaskDelete(TaskHandle_t task);      // NULL: the calling task, or loop() when called from it
+void vTaskDelay(TickType_t ticks);        // a zero delay still waits a tick in the simulation
+void vTaskDelayUntil(TickType_t *previousWake, TickType_t period);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);                      // from a task or the timer task
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait); // the count before taking
+TickType_t xTaskGetTickCount();
+BaseType_t xPortGetCoreID();
+
+#endif
@@ -0,0 +1,43 @@
+/**************************************************************************************
+
+  Native (host) stand-in for the ESP32 HTTPClient.
+
+  GET() hands the URL to the handler installed with hal::setHttpHandler() (see
+  NativeHAL.h), waits the simulated request latency and exposes the response
+  body through getStreamPtr(), byte by byte like a socket would.
+
+  ***************************************************************************************/
+#ifndef _NATIVE_HTTPCLIENT_H
+#define _NATIVE_HTTPCLIENT_H
+
+#include "Arduino.h"
+#include "WiFiClient.h"
+
+#define HTTP_CODE_OK 200
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+#define HTTPC_ERROR_NOT_CONNECTED (-4)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+
+class HTTPClient
+{
+public:
+  bool begin(WiFiClient &client, const String &url);
+  void end();
+  void useHTTP10(bool on = true) { (void)on; }
+  void setTimeout(uint16_t ms) { (void)ms; }
+  void setReuse(bool reuse) { (void)reuse; }
+
+  int GET();
+  int getSize() { return size; }
+  bool connected() { return stream.connected(); }
+  WiFiClient *getStreamPtr() { return &stream; }
+  WiFiClient &getStream() { return stream; }
+  static String errorToString(int error);
+
+private:
+  String url;
+  WiFiClient stream;
+  int size = -1;
+};
+
+#endif
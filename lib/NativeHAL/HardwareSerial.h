@@ -0,0 +1,39 @@
+/**************************************************************************************
+
+  Native (host) stand-in for HardwareSerial.
+
+  Output goes to stdout; input is fed by the simulation driver (hal::serialInput)
+  so console commands can be scripted against the virtual clock.
+
+  ***************************************************************************************/
+#ifndef _NATIVE_HARDWARESERIAL_H
+#define _NATIVE_HARDWARESERIAL_H
+
+#include <deque>
+#include "Print.h"
+
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long baud) { (void)baud; }
+  void end() {}
+
+  int available() override { return (int)rx.size(); }
+  int read() override;
+  int peek() override { return rx.empty() ? -1 : rx.front(); }
+
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+  void flush() override;
+
+  void inject(const char *text); // queue text as if typed on the serial port
+  bool echo = true;              // when false, output is swallowed (quiet simulations)
+
+private:
+  std::deque<uint8_t> rx;
+};
+
+extern HardwareSerial Serial;
+
+#endif
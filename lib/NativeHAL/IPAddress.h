@@ -0,0 +1,34 @@
+/**************************************************************************************
+
+  Native (host) stand-in for the Arduino IPAddress class.
+
+  ***************************************************************************************/
+#ifndef _NATIVE_IPADDRESS_H
+#define _NATIVE_IPADDRESS_H
+
+#include <stdint.h>
+#include "Print.h"
+
+class IPAddress : public Printable
+{
+public:
+  IPAddress() : bytes{0, 0, 0, 0} {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : bytes{a, b, c, d} {}
+
+  uint8_t operator[](int index) const { return bytes[index]; }
+  uint8_t &operator[](int index) { return bytes[index]; }
+
+  String toString() const
+  {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+    return String(buf);
+  }
+
+  size_t printTo(Print &p) const override { return p.print(toString()); }
+
+private:
+  uint8_t bytes[4];
+};
+
+#endif
@@ -0,0 +1,23 @@
+/**************************************************************************************
+
+  Native (host) stand-in for the ESP32 LittleFS library. The "partition" is a
+  host directory (hal::setFlashDir), a fresh temporary one unless the
+  simulation names one, so logs can survive simulated reboots across runs.
+
+  ***************************************************************************************/
+#ifndef _NATIVE_LITTLEFS_H
+#define _NATIVE_LITTLEFS_H
+
+#include "FS.h"
+
+class LittleFSFS : public fs::FS
+{
+public:
+  bool begin(bool formatOnFail = false, const char *basePath = "/littlefs", uint8_t maxOpenFiles = 10, const char *partitionLabel = "spiffs");
+  void end() {}
+  size_t totalBytes() { return 1441792; }
+};
+
+extern LittleFSFS LittleFS;
+
+#endif
@@ -0,0 +1,1092 @@
+/**************************************************************************************
+
+  Native (host) hardware abstraction layer -- implementation
+
+  Everything runs on one host thread against a virtual microsecond clock:
+    - the clock only moves in advanceTo(), called from delay()/delayMicroseconds()/
+      pulseIn() or by the simulation driver when loop() returns without blocking
+    - Ticker callbacks run like they do in the ESP32 esp_timer task: one at a time,
+      and while one is running the others wait (nested advances only move time)
+    - FreeRTOS tasks are ucontext coroutines the driver resumes in runTasks();
+      a task blocking in delay() or vTaskDelay() hands the clock back to the driver
+    - the broker, WiFi link and NVS are plain in-process state
+
+  ***************************************************************************************/
+#include <Arduino.h>
+#include <Ticker.h>
+#include <Preferences.h>
+#include <WiFi.h>
+#include <PubSubClient.h>
+#include <HTTPClient.h>
+#include <WiFiManager.h>
+#include <ArduinoOTA.h>
+#include <LittleFS.h>
+#include <esp_sleep.h>
+#include <lwip/sockets.h>
+#include "NativeHAL.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <exception>
+#include <random>
+#include <list>
+#include <set>
+#include <vector>
+
+using hal::SIM_EPOCH;
+
+HardwareSerial Serial;
+EspClass ESP;
+WiFiClass WiFi;
+ArduinoOTAClass ArduinoOTA;
+LittleFSFS LittleFS;
+
+namespace
+{
+  uint64_t clockUs = 0;
+  uint64_t bootUs = 0; // clockUs when setup() last started: millis() and micros() count from here
+  bool inTimerTask = false;
+
+  const size_t TASK_STACK_BYTES = 256 * 1024; // host code needs far more than the ESP32 stack depth
+
+  struct Task
+  {
+    std::string name;
+    TaskFunction_t code;
+    void *param;
+    int core;
+    ucontext_t ctx;
+    std::vector<char> stack;
+    uint64_t wakeUs = 0;
+    bool done = false;
+    uint32_t notified = 0;       // xTaskNotifyGive() count
+    bool waitingNotify = false;  // in ulTaskNotifyTake()
+  };
+  std::list<Task> tasks;
+  Task *currentTask = nullptr; // task being run by runTasks(), null in the driver
+  ucontext_t driverCtx;
+  bool loopAlive = true;
+  std::exception_ptr taskException; // Restart or DeepSleep thrown in a task, rethrown by runTasks()
+  hal::Stats counters;
+
+  // deep sleep
+  uint64_t sleepTimerUs = 0;
+  bool wokeFromSleep = false;
+  uint64_t wakeAt = 0;      // clockUs of the last timer wake
+  bool wakePing = false;    // no ping since that wake yet
+
+  std::vector<Ticker *> &tickers()
+  {
+    static std::vector<Ticker *> list;
+    return list;
+  }
+  std::multimap<uint64_t, std::function<void()>> scripted;
+
+  uint8_t pinLevel[64];
+  void (*pinIsr[64])(void);
+  void (*pinIsrArg[64])(void *); // attachInterruptArg(), called with pinArg
+  void *pinArg[64];
+  int pinIsrMode[64];
+
+  struct Edge
+  {
+    uint8_t pin;
+    uint8_t level;
+  };
+  std::multimap<uint64_t, Edge> edges;
+
+  hal::EchoModel echoModel;
+  struct SensorPins
+  {
+    uint8_t trig, echo;
+    uint64_t pingUs;         // last trigger, UINT64_MAX before the first
+    unsigned long widthUs;   // echo of that ping, 0 for none
+  };
+  std::vector<SensorPins> echoSensors;
+  uint32_t isrLatencyUs = 0;
+
+  bool timeConfigured = false;
+  std::mt19937 rng(1);
+
+  // network
+  bool wifiIsUp = true;
+  uint64_t associatedUs = 0; // WiFi.begin() completes at this time, UINT64_MAX with the radio off
+  bool brokerIsUp = true;
+  uint32_t connectTimeoutMs = 1000;
+  bool mqttTrace = false;
+  std::function<void(const char *, const std::string &)> publishHook;
+  hal::HttpHandler httpHandler;
+  std::set<std::string> subscriptions;
+  std::deque<std::pair<std::string, std::string>> inbox;
+  std::map<std::string, hal::TopicStats> published;
+  std::deque<std::shared_ptr<hal::NetSocket>> pendingTelnet;
+  std::map<int, std::weak_ptr<hal::NetSocket>> socketsByFd;
+  int nextFd = 54; // lwIP numbers its sockets from LWIP_SOCKET_OFFSET
+  int udpForwardSocket = -1;
+  sockaddr_in udpForwardAddress;
+
+  // the access point is up and we are associated with it
+  bool linkUp() { return wifiIsUp && clockUs >= associatedUs; }
+
+  // nvs
+  std::map<std::string, std::string> nvs;
+  std::string nvsFile;
+
+  // flash
+  std::string flashRoot;
+
+  void saveNvs()
+  {
+    if (nvsFile.empty()) return;
+    FILE *f = fopen(nvsFile.c_str(), "wb");
+    if (!f) return;
+    for (auto &kv : nvs)
+    {
+      uint32_t klen = kv.first.size(), vlen = kv.second.size();
+      fwrite(&klen, sizeof(klen), 1, f);
+      fwrite(kv.first.data(), 1, klen, f);
+      fwrite(&vlen, sizeof(vlen), 1, f);
+      fwrite(kv.second.data(), 1, vlen, f);
+    }
+    fclose(f);
+  }
+
+  void loadNvs()
+  {
+    nvs.clear();
+    FILE *f = fopen(nvsFile.c_str(), "rb");
+    if (!f) return;
+    uint32_t klen, vlen;
+    while (fread(&klen, sizeof(klen), 1, f) == 1)
+    {
+      std::string k(klen, '\0'), v;
+      if (fread(&k[0], 1, klen, f) != klen || fread(&vlen, sizeof(vlen), 1, f) != 1) break;
+      v.resize(vlen);
+      if (vlen && fread(&v[0], 1, vlen, f) != vlen) break;
+      nvs[k] = v;
+    }
+    fclose(f);
+  }
+}
+
+/*
+ * ********************************************************************************
+
+  virtual clock
+
+ * ********************************************************************************
+*/
+namespace hal
+{
+  uint64_t nowMicros() { return clockUs; }
+
+  uint64_t nextEventMicros()
+  {
+    uint64_t next = UINT64_MAX;
+    for (Ticker *t : tickers())
+      if (t->active()) next = std::min(next, t->due);
+    if (!scripted.empty()) next = std::min(next, scripted.begin()->first);
+    if (!edges.empty()) next = std::min(next, edges.begin()->first);
+    for (Task &t : tasks)
+      if (!t.done) next = std::min(next, t.wakeUs);
+    return next;
+  }
+
+  void at(uint64_t us, std::function<void()> fn) { scripted.emplace(us, fn); }
+
+  void advanceTo(uint64_t target)
+  {
+    for (;;)
+    {
+      // GPIO edges interrupt anything, including a ticker callback that is blocking
+      if (!edges.empty() && edges.begin()->first <= target)
+      {
+        auto it = edges.begin();
+        clockUs = std::max(clockUs, it->first);
+        Edge e = it->second;
+        edges.erase(it);
+        pinLevel[e.pin] = e.level;
+        int mode = pinIsrMode[e.pin];
+        if ((pinIsr[e.pin] || pinIsrArg[e.pin]) && (mode == CHANGE || (mode == RISING) == (e.level == HIGH)))
+        {
+          counters.isrCalls++;
+          if (pinIsr[e.pin]) pinIsr[e.pin]();
+          else pinIsrArg[e.pin](pinArg[e.pin]);
+        }
+        continue;
+      }
+
+      // a ticker callback that blocks only moves time: other timers wait for it to return
+      if (inTimerTask) break;
+
+      Ticker *next = nullptr;
+      for (Ticker *t : tickers())
+        if (t->active() && t->due <= target && (!next || t->due < next->due)) next = t;
+
+      bool runScript = !scripted.empty() && scripted.begin()->first <= target && (!next || scripted.begin()->first < next->due);
+
+      if (runScript)
+      {
+        auto it = scripted.begin();
+        clockUs = std::max(clockUs, it->first);
+        auto fn = it->second;
+        scripted.erase(it);
+        fn();
+      }
+      else if (next)
+      {
+        clockUs = std::max(clockUs, next->due);
+        uint64_t start = clockUs;
+        inTimerTask = true;
+        next->fire();
+        inTimerTask = false;
+        uint64_t held = clockUs - start;
+        counters.tickerCalls++;
+        counters.tickerTotalUs += held;
+        counters.tickerMaxUs = std::max(counters.tickerMaxUs, held);
+      }
+      else
+        break;
+    }
+    clockUs = std::max(clockUs, target);
+  }
+
+  void setEchoModel(EchoModel model) { echoModel = model; }
+  void attachEchoSensor(uint8_t trigPin, uint8_t echoPin) { echoSensors.push_back({trigPin, echoPin, UINT64_MAX, 0}); }
+  void setIsrLatency(uint32_t maxUs) { isrLatencyUs = maxUs; }
+
+  Stats &stats() { return counters; }
+
+  std::string formatTime(uint64_t us)
+  {
+    char buf[32];
+    uint64_t ms = us / 1000;
+    snprintf(buf, sizeof(buf), "%02lu:%02lu:%02lu.%03lu", (unsigned long)(ms / 3600000), (unsigned long)(ms / 60000 % 60),
+             (unsigned long)(ms / 1000 % 60), (unsigned long)(ms % 1000));
+    return buf;
+  }
+
+  // -------- network
+  void setWiFiUp(bool up) { wifiIsUp = up; }
+  bool wifiUp() { return wifiIsUp; }
+  void setBrokerUp(bool up) { brokerIsUp = up; }
+  bool brokerUp() { return brokerIsUp; }
+  void setConnectTimeout(uint32_t ms) { connectTimeoutMs = ms; }
+  void mqttInject(const char *topic, const char *payload) { inbox.emplace_back(topic, payload); }
+  void setMqttTrace(bool on) { mqttTrace = on; }
+  void onPublish(std::function<void(const char *, const std::string &)> fn) { publishHook = fn; }
+  void setHttpHandler(HttpHandler handler) { httpHandler = handler; }
+  const std::map<std::string, TopicStats> &mqttPublished() { return published; }
+
+  void setUdpForward(uint16_t port)
+  {
+    if (udpForwardSocket < 0) udpForwardSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&udpForwardAddress, 0, sizeof(udpForwardAddress));
+    udpForwardAddress.sin_family = AF_INET;
+    udpForwardAddress.sin_port = htons(port);
+    udpForwardAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  }
+
+  std::shared_ptr<NetSocket> telnetConnect()
+  {
+    auto s = std::make_shared<NetSocket>();
+    s->fd = nextFd++;
+    socketsByFd[s->fd] = s;
+    pendingTelnet.push_back(s);
+    return s;
+  }
+
+  // -------- serial & nvs
+  void serialInput(const char *line) { Serial.inject(line); }
+  void setSerialEcho(bool on) { Serial.echo = on; }
+  void setNvsFile(const char *path)
+  {
+    nvsFile = path;
+    loadNvs();
+  }
+
+  void setFlashDir(const char *path)
+  {
+    flashRoot = path;
+    ::mkdir(path, 0755);
+  }
+
+  const std::string &flashDir()
+  {
+    if (flashRoot.empty())
+    {
+      char tmpl[] = "/tmp/simflash-XXXXXX";
+      if (mkdtemp(tmpl)) flashRoot = tmpl;
+    }
+    return flashRoot;
+  }
+}
+
+/*
+ * ********************************************************************************
+
+  Arduino core
+
+ * ********************************************************************************
+*/
+void pinMode(uint8_t pin, uint8_t mode) { (void)pin; (void)mode; }
+
+// a falling trigger on a sensor schedules the echo pulse the model asks for; a
+// neighbour that pinged less than ECHO_CROSSTALK_US ago is still ringing, its
+// echo reaches this sensor first
+static void ping(size_t sensor)
+{
+  SensorPins &s = echoSensors[sensor];
+  counters.pings++;
+  if (wakePing)
+  {
+    uint64_t latency = clockUs - wakeAt;
+    wakePing = false;
+    counters.wakeToSampleCount++;
+    counters.wakeToSampleTotalUs += latency;
+    counters.wakeToSampleMaxUs = std::max(counters.wakeToSampleMaxUs, latency);
+  }
+  unsigned long width = echoModel ? echoModel(sensor, clockUs) : 0;
+  s.pingUs = clockUs;
+  s.widthUs = width;
+  for (size_t n : {sensor - 1, sensor + 1})
+  {
+    if (n >= echoSensors.size() || echoSensors[n].pingUs == UINT64_MAX) continue;
+    uint64_t since = clockUs - echoSensors[n].pingUs;
+    if (since >= hal::ECHO_CROSSTALK_US || !echoSensors[n].widthUs) continue;
+    counters.crosstalk++;
+    if (echoSensors[n].widthUs > since && (!width || echoSensors[n].widthUs - since < width)) width = echoSensors[n].widthUs - since;
+  }
+  if (width == 0)
+  {
+    counters.missedEchoes++;
+    return;
+  }
+  uint64_t rise = clockUs + hal::ECHO_DELAY_US + (isrLatencyUs ? random(isrLatencyUs + 1) : 0);
+  uint64_t fall = clockUs + hal::ECHO_DELAY_US + width + (isrLatencyUs ? random(isrLatencyUs + 1) : 0);
+  edges.emplace(rise, Edge{s.echo, HIGH});
+  edges.emplace(fall, Edge{s.echo, LOW});
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  pin &= 63;
+  bool falling = pinLevel[pin] == HIGH && val == LOW;
+  pinLevel[pin] = val;
+  if (falling)
+    for (size_t i = 0; i < echoSensors.size(); i++)
+      if (echoSensors[i].trig == pin) ping(i);
+}
+
+int digitalRead(uint8_t pin) { return pinLevel[pin & 63]; }
+
+// measured against the scheduled edges, exactly like the busy-wait in the ESP32 core
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout)
+{
+  uint64_t start = clockUs, rise = 0, fall = 0;
+  for (auto &e : edges)
+  {
+    if (e.second.pin != pin) continue;
+    if (!rise && e.second.level == state) rise = e.first;
+    else if (rise && e.second.level != state)
+    {
+      fall = e.first;
+      break;
+    }
+  }
+  if (!fall || fall - start > timeout)
+  {
+    delayMicroseconds(timeout);
+    return 0;
+  }
+  hal::advanceTo(fall);
+  return fall - rise;
+}
+
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode)
+{
+  pinIsr[pin & 63] = isr;
+  pinIsrArg[pin & 63] = nullptr;
+  pinIsrMode[pin & 63] = mode;
+}
+void attachInterruptArg(uint8_t pin, void (*isr)(void *), void *arg, int mode)
+{
+  pinIsr[pin & 63] = nullptr;
+  pinIsrArg[pin & 63] = isr;
+  pinArg[pin & 63] = arg;
+  pinIsrMode[pin & 63] = mode;
+}
+void detachInterrupt(uint8_t pin) { pinIsr[pin & 63] = nullptr, pinIsrArg[pin & 63] = nullptr; }
+uint8_t digitalPinToInterrupt(uint8_t pin) { return pin; }
+
+unsigned long millis() { return (clockUs - bootUs) / 1000; }
+unsigned long micros() { return clockUs - bootUs; }
+void delay(uint32_t ms)
+{
+  // on the ESP32 delay() is vTaskDelay(): other tasks keep running
+  if (currentTask && !inTimerTask)
+    vTaskDelay(ms);
+  else
+    hal::advanceTo(clockUs + ms * 1000ULL);
+}
+void delayMicroseconds(uint32_t us) { hal::advanceTo(clockUs + us); }
+void yield() {}
+
+void configTime(long gmtOffset_sec, int daylightOffset_sec, const char *server1, const char *server2, const char *server3)
+{
+  (void)gmtOffset_sec, (void)daylightOffset_sec, (void)server1, (void)server2, (void)server3;
+  timeConfigured = true;
+}
+
+bool getLocalTime(struct tm *info, uint32_t ms)
+{
+  if (!timeConfigured)
+  {
+    delay(ms); // the ESP32 core polls until the timeout expires
+    return false;
+  }
+  time_t now = SIM_EPOCH + clockUs / 1000000;
+  gmtime_r(&now, info);
+  return true;
+}
+
+time_t hal_time(time_t *t)
+{
+  time_t now = (timeConfigured ? SIM_EPOCH : 0) + clockUs / 1000000;
+  if (t) *t = now;
+  return now;
+}
+
+long random(long howbig) { return howbig > 0 ? (long)(rng() % (unsigned long)howbig) : 0; }
+long random(long howsmall, long howbig) { return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall); }
+void randomSeed(unsigned long seed) { rng.seed(seed); }
+
+void EspClass::restart()
+{
+  Serial.flush();
+  throw hal::Restart();
+}
+uint32_t EspClass::getFreeHeap() { return 200000; }
+uint32_t EspClass::getMinFreeHeap() { return 180000; }
+uint32_t EspClass::getMaxAllocHeap() { return 110580; }
+uint32_t EspClass::getCycleCount() { return (uint32_t)((clockUs - bootUs) * 240); } // 240 MHz core
+
+/*
+ * ********************************************************************************
+
+  Deep sleep
+
+ * ********************************************************************************
+*/
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us)
+{
+  sleepTimerUs = time_in_us;
+  return ESP_OK;
+}
+
+void esp_deep_sleep_start()
+{
+  Serial.flush();
+  throw hal::DeepSleep{sleepTimerUs};
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause() { return wokeFromSleep ? ESP_SLEEP_WAKEUP_TIMER : ESP_SLEEP_WAKEUP_UNDEFINED; }
+
+namespace hal
+{
+  bool wakeFromDeepSleep(const DeepSleep &sleep, uint64_t endUs)
+  {
+    // RAM, timers, interrupts and the radio are gone; RTC memory, NVS, flash and the RTC clock are not
+    tasks.clear();
+    currentTask = nullptr;
+    loopAlive = true;
+    for (Ticker *t : tickers()) t->detach();
+    edges.clear();
+    for (int i = 0; i < 64; i++) pinIsr[i] = nullptr, pinIsrArg[i] = nullptr;
+    associatedUs = UINT64_MAX;
+    counters.deepSleeps++;
+    counters.sleepUs += std::min(sleep.us, endUs > clockUs ? endUs - clockUs : 0);
+
+    // scripted events keep happening while the chip sleeps
+    uint64_t wake = clockUs + sleep.us;
+    advanceTo(std::min(wake, endUs));
+    if (wake >= endUs) return false;
+    wakeAt = clockUs;
+    wakePing = true;
+    wokeFromSleep = true;
+    advanceTo(std::min(wake + DEEP_SLEEP_BOOT_US, endUs));
+    bootUs = clockUs;
+    return clockUs < endUs;
+  }
+}
+
+/*
+ * ********************************************************************************
+
+  FreeRTOS tasks
+
+ * ********************************************************************************
+*/
+namespace
+{
+  void taskEntry()
+  {
+    Task *t = currentTask;
+    try
+    {
+      t->code(t->param);
+    }
+    catch (...)
+    {
+      taskException = std::current_exception(); // rethrown by runTasks() on the driver's stack
+    }
+    t->done = true;
+    swapcontext(&t->ctx, &driverCtx);
+  }
+
+  // hand the clock back to the driver until wakeUs
+  void sleepTask(uint64_t wakeUs)
+  {
+    Task *t = currentTask;
+    t->wakeUs = std::max(wakeUs, clockUs + 1000); // never resume in the same instant
+    swapcontext(&t->ctx, &driverCtx);
+  }
+}
+
+namespace hal
+{
+  void runTasks()
+  {
+    for (Task &t : tasks)
+    {
+      if (t.done || t.wakeUs > clockUs) continue;
+      currentTask = &t;
+      swapcontext(&driverCtx, &t.ctx);
+      currentTask = nullptr;
+      if (taskException)
+      {
+        std::exception_ptr e = taskException;
+        taskException = nullptr;
+        std::rethrow_exception(e);
+      }
+    }
+  }
+
+  bool loopRunning() { return loopAlive; }
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stackDepth, void *param,
+                                   UBaseType_t priority, TaskHandle_t *created, BaseType_t core)
+{
+  (void)stackDepth, (void)priority;
+  tasks.emplace_back();
+  Task &t = tasks.back();
+  t.name = name;
+  t.code = code;
+  t.param = param;
+  t.core = core;
+  t.wakeUs = clockUs;
+  t.stack.resize(TASK_STACK_BYTES);
+  getcontext(&t.ctx);
+  t.ctx.uc_stack.ss_sp = t.stack.data();
+  t.ctx.uc_stack.ss_size = t.stack.size();
+  t.ctx.uc_link = nullptr;
+  makecontext(&t.ctx, taskEntry, 0);
+  if (created) *created = &t;
+  return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+  if (!task && !currentTask)
+  {
+    loopAlive = false; // loop() deleting the Arduino loop task
+    return;
+  }
+  Task *t = task ? (Task *)task : currentTask;
+  t->done = true;
+  if (t == currentTask) swapcontext(&t->ctx, &driverCtx);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+  if (currentTask && !inTimerTask)
+    sleepTask(clockUs + ticks * 1000ULL);
+  else
+    hal::advanceTo(clockUs + ticks * 1000ULL);
+}
+
+void vTaskDelayUntil(TickType_t *previousWake, TickType_t period)
+{
+  *previousWake += period;
+  uint64_t wake = bootUs + *previousWake * 1000ULL;
+  if (wake <= clockUs) return; // running late: no wait, like FreeRTOS
+  if (currentTask && !inTimerTask)
+    sleepTask(wake);
+  else
+    hal::advanceTo(wake);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+  Task *t = (Task *)task;
+  t->notified++;
+  if (t->waitingNotify) t->wakeUs = std::min(t->wakeUs, clockUs); // runTasks() resumes it next
+  return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait)
+{
+  Task *t = currentTask;
+  if (!t || inTimerTask) return 0; // only the tasks started by setup() are notified
+  if (!t->notified && ticksToWait)
+  {
+    t->waitingNotify = true;
+    sleepTask(clockUs + ticksToWait * 1000ULL);
+    t->waitingNotify = false;
+  }
+  uint32_t count = t->notified;
+  t->notified = clearCountOnExit || !count ? 0 : count - 1;
+  return count;
+}
+
+TickType_t xTaskGetTickCount() { return (TickType_t)((clockUs - bootUs) / 1000); }
+BaseType_t xPortGetCoreID() { return currentTask ? currentTask->core : 1; }
+
+/*
+ * ********************************************************************************
+
+  Print & Serial
+
+ * ********************************************************************************
+*/
+size_t Print::printf(const char *format, ...)
+{
+  char loc_buf[64];
+  char *temp = loc_buf;
+  va_list arg;
+  va_start(arg, format);
+  int len = vsnprintf(temp, sizeof(loc_buf), format, arg);
+  va_end(arg);
+  if (len < 0) return 0;
+  if (len >= (int)sizeof(loc_buf))
+  {
+    temp = (char *)malloc(len + 1);
+    if (!temp) return 0;
+    va_start(arg, format);
+    vsnprintf(temp, len + 1, format, arg);
+    va_end(arg);
+  }
+  len = write((uint8_t *)temp, len);
+  if (temp != loc_buf) free(temp);
+  return len;
+}
+
+size_t Print::print(struct tm *timeinfo, const char *format)
+{
+  char buf[64];
+  size_t n = strftime(buf, sizeof(buf), format ? format : "%c", timeinfo);
+  return write(buf, n);
+}
+
+int HardwareSerial::read()
+{
+  if (rx.empty()) return -1;
+  int c = rx.front();
+  rx.pop_front();
+  return c;
+}
+
+size_t HardwareSerial::write(uint8_t c) { return write(&c, 1); }
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+  if (echo) fwrite(buffer, 1, size, stdout);
+  return size;
+}
+void HardwareSerial::flush() { fflush(stdout); }
+
+void HardwareSerial::inject(const char *text)
+{
+  while (*text) rx.push_back((uint8_t)*text++);
+}
+
+/*
+ * ********************************************************************************
+
+  Ticker
+
+ * ********************************************************************************
+*/
+Ticker::Ticker() { tickers().push_back(this); }
+Ticker::~Ticker()
+{
+  auto &list = tickers();
+  list.erase(std::remove(list.begin(), list.end(), this), list.end());
+}
+
+void Ticker::arm(uint64_t periodUs, bool repeating, callback_function_t callback)
+{
+  period = periodUs;
+  repeat = repeating;
+  cb = callback;
+  due = clockUs + periodUs;
+  armed = true;
+}
+
+void Ticker::detach() { armed = false; }
+
+void Ticker::fire()
+{
+  callback_function_t fn = cb; // the callback may re-arm or detach this ticker
+  if (repeat)
+    due += period;
+  else
+    armed = false;
+  if (fn) fn();
+}
+
+/*
+ * ********************************************************************************
+
+  Preferences
+
+ * ********************************************************************************
+*/
+bool Preferences::begin(const char *name, bool ro, const char *partition_label)
+{
+  (void)partition_label;
+  ns = String(name) + "/";
+  readOnly = ro;
+  return true;
+}
+void Preferences::end() {}
+
+bool Preferences::clear()
+{
+  for (auto it = nvs.begin(); it != nvs.end();)
+    it = it->first.compare(0, ns.length(), ns.c_str()) == 0 ? nvs.erase(it) : std::next(it);
+  saveNvs();
+  return true;
+}
+
+bool Preferences::remove(const char *key)
+{
+  bool found = nvs.erase(std::string(ns.c_str()) + key) > 0;
+  saveNvs();
+  return found;
+}
+
+bool Preferences::isKey(const char *key) { return nvs.count(std::string(ns.c_str()) + key) > 0; }
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t len)
+{
+  if (readOnly) return 0;
+  nvs[std::string(ns.c_str()) + key] = std::string((const char *)value, len);
+  saveNvs();
+  return len;
+}
+
+String Preferences::getString(const char *key, const String &defaultValue)
+{
+  auto it = nvs.find(std::string(ns.c_str()) + key);
+  return it == nvs.end() ? defaultValue : String(it->second.c_str());
+}
+
+size_t Preferences::getBytesLength(const char *key)
+{
+  auto it = nvs.find(std::string(ns.c_str()) + key);
+  return it == nvs.end() ? 0 : it->second.size();
+}
+
+size_t Preferences::getBytes(const char *key, void *buf, size_t maxLen)
+{
+  auto it = nvs.find(std::string(ns.c_str()) + key);
+  if (it == nvs.end() || it->second.size() > maxLen) return 0;
+  memcpy(buf, it->second.data(), it->second.size());
+  return it->second.size();
+}
+
+/*
+ * ********************************************************************************
+
+  LittleFS on a host directory
+
+ * ********************************************************************************
+*/
+bool LittleFSFS::begin(bool formatOnFail, const char *basePath, uint8_t maxOpenFiles, const char *partitionLabel)
+{
+  (void)formatOnFail, (void)basePath, (void)maxOpenFiles, (void)partitionLabel;
+  return !hal::flashDir().empty();
+}
+
+size_t fs::File::size() const
+{
+  struct stat st;
+  return fp && fstat(fileno(fp.get()), &st) == 0 ? st.st_size : 0;
+}
+
+fs::File fs::FS::open(const char *path, const char *mode, bool create)
+{
+  (void)create;
+  std::string m = std::string(mode) + "b";
+  FILE *f = fopen((hal::flashDir() + path).c_str(), m.c_str());
+  return f ? File(f) : File();
+}
+
+bool fs::FS::exists(const char *path) { return access((hal::flashDir() + path).c_str(), F_OK) == 0; }
+bool fs::FS::remove(const char *path) { return ::remove((hal::flashDir() + path).c_str()) == 0; }
+bool fs::FS::mkdir(const char *path) { return ::mkdir((hal::flashDir() + path).c_str(), 0755) == 0; }
+
+/*
+ * ********************************************************************************
+
+  WiFi, sockets & UDP
+
+ * ********************************************************************************
+*/
+wl_status_t WiFiClass::status() { return linkUp() ? WL_CONNECTED : WL_DISCONNECTED; }
+
+wl_status_t WiFiClass::begin()
+{
+  if (associatedUs == UINT64_MAX) associatedUs = clockUs + hal::WIFI_ASSOC_MS * 1000ULL;
+  return status();
+}
+
+int WiFiClient::connect(const char *host, uint16_t port)
+{
+  (void)host, (void)port;
+  return 0;
+}
+uint8_t WiFiClient::connected() { return sock && sock->open && linkUp(); }
+void WiFiClient::stop()
+{
+  if (sock) sock->open = false;
+  sock.reset();
+}
+int WiFiClient::available() { return connected() ? (int)sock->rx.size() : 0; }
+int WiFiClient::read()
+{
+  if (!available()) return -1;
+  int c = sock->rx.front();
+  sock->rx.pop_front();
+  return c;
+}
+int WiFiClient::peek() { return available() ? sock->rx.front() : -1; }
+// what the window takes of one send, without waiting
+static size_t sendNow(hal::NetSocket &sock, const uint8_t *buffer, size_t size)
+{
+  if (size > sock.window) size = sock.window; // a stalled peer: the driver shrinks the window
+  if (!size) return 0;
+  sock.writes++;
+  sock.tx.append((const char *)buffer, size);
+  if (sock.tx.size() > 131072) sock.tx.erase(0, sock.tx.size() - 65536); // keep the last 64k, trimmed in bulk
+  return size;
+}
+
+// the ESP32 core's loop: send, and while the rest does not fit, select() for room
+size_t WiFiClient::write(const uint8_t *buffer, size_t size)
+{
+  size_t sent = 0;
+  for (int retry = WIFI_CLIENT_MAX_WRITE_RETRY; sent < size && retry && connected();)
+  {
+    size_t n = sendNow(*sock, buffer + sent, size - sent);
+    sent += n;
+    if (n)
+      retry = WIFI_CLIENT_MAX_WRITE_RETRY;
+    else
+    {
+      delay(WIFI_CLIENT_SELECT_TIMEOUT_MS); // the select() timing out
+      retry--;
+    }
+  }
+  return sent;
+}
+int WiFiClient::fd() const { return sock ? sock->fd : -1; }
+
+ssize_t lwip_send(int s, const void *data, size_t size, int flags)
+{
+  auto it = socketsByFd.find(s);
+  std::shared_ptr<hal::NetSocket> sock = it == socketsByFd.end() ? nullptr : it->second.lock();
+  if (!sock || !sock->open || !linkUp())
+  {
+    errno = ENOTCONN;
+    return -1;
+  }
+  if (!(flags & MSG_DONTWAIT)) return WiFiClient(sock).write((const uint8_t *)data, size);
+  size_t n = sendNow(*sock, (const uint8_t *)data, size);
+  if (!n && size)
+  {
+    errno = EWOULDBLOCK;
+    return -1;
+  }
+  return n;
+}
+int WiFiClient::availableForWrite() { return connected() ? (int)sock->window : 0; }
+
+bool HTTPClient::begin(WiFiClient &client, const String &u)
+{
+  (void)client;
+  url = u;
+  return true;
+}
+
+int HTTPClient::GET()
+{
+  counters.httpRequests++;
+  size = -1;
+  if (!linkUp()) return HTTPC_ERROR_NOT_CONNECTED;
+  delay(hal::HTTP_LATENCY_MS);
+  std::string body;
+  int code = httpHandler ? httpHandler(url.c_str(), body) : HTTPC_ERROR_CONNECTION_REFUSED;
+  if (code <= 0) return code;
+  auto sock = std::make_shared<hal::NetSocket>();
+  sock->rx.assign(body.begin(), body.end());
+  stream = WiFiClient(sock);
+  size = body.size();
+  return code;
+}
+
+void HTTPClient::end() { stream.stop(); }
+
+String HTTPClient::errorToString(int error)
+{
+  switch (error)
+  {
+  case HTTPC_ERROR_CONNECTION_REFUSED: return "connection refused";
+  case HTTPC_ERROR_NOT_CONNECTED: return "not connected";
+  case HTTPC_ERROR_READ_TIMEOUT: return "read Timeout";
+  default: return "";
+  }
+}
+
+WiFiClient WiFiServer::available()
+{
+  if (!listening || pendingTelnet.empty()) return WiFiClient();
+  auto s = pendingTelnet.front();
+  pendingTelnet.pop_front();
+  return WiFiClient(s);
+}
+
+int WiFiUDP::beginPacket(const char *h, uint16_t p)
+{
+  host = h;
+  port = p;
+  data.clear();
+  return 1;
+}
+size_t WiFiUDP::write(const uint8_t *buffer, size_t size)
+{
+  data.append((const char *)buffer, size);
+  return size;
+}
+int WiFiUDP::endPacket()
+{
+  if (!linkUp()) return 0;
+  counters.udpPackets++;
+  counters.udpBytes += data.size();
+  if (udpForwardSocket >= 0)
+    sendto(udpForwardSocket, data.data(), data.size(), 0, (const sockaddr *)&udpForwardAddress, sizeof(udpForwardAddress));
+  return 1;
+}
+
+/*
+ * ********************************************************************************
+
+  PubSubClient against the in-process broker
+
+ * ********************************************************************************
+*/
+PubSubClient &PubSubClient::setServer(const char *domain, uint16_t port)
+{
+  (void)domain, (void)port;
+  return *this;
+}
+
+PubSubClient &PubSubClient::setCallback(MQTT_CALLBACK_SIGNATURE)
+{
+  this->callback = callback;
+  return *this;
+}
+
+bool PubSubClient::connect(const char *id)
+{
+  (void)id;
+  if (!linkUp() || !brokerIsUp)
+  {
+    delay(connectTimeoutMs); // the TCP connect blocks until it times out
+    counters.mqttConnectFailures++;
+    lastState = MQTT_CONNECT_FAILED;
+    return false;
+  }
+  isConnected = true;
+  lastState = MQTT_CONNECTED;
+  subscriptions.clear();
+  counters.mqttConnects++;
+  return true;
+}
+
+void PubSubClient::disconnect()
+{
+  isConnected = false;
+  lastState = MQTT_DISCONNECTED;
+}
+
+bool PubSubClient::connected()
+{
+  if (isConnected && (!linkUp() || !brokerIsUp))
+  {
+    isConnected = false;
+    lastState = MQTT_CONNECTION_LOST;
+  }
+  return isConnected;
+}
+
+int PubSubClient::state() { return lastState; }
+
+bool PubSubClient::loop()
+{
+  if (!connected()) return false;
+  while (!inbox.empty())
+  {
+    auto msg = inbox.front();
+    inbox.pop_front();
+    if (!subscriptions.count(msg.first) || !callback) continue;
+    std::vector<char> topic(msg.first.begin(), msg.first.end());
+    topic.push_back('\0');
+    callback(topic.data(), (uint8_t *)msg.second.data(), msg.second.size());
+  }
+  return true;
+}
+
+bool PubSubClient::publish(const char *topic, const uint8_t *payload, unsigned int plength, bool retained)
+{
+  if (!connected()) return false;
+  if (plength + strlen(topic) + 7 > bufferSize) return false; // the real client refuses oversized packets
+  hal::TopicStats &t = published[topic];
+  t.count++;
+  t.last.assign((const char *)payload, plength);
+  t.retained = retained;
+  if (publishHook) publishHook(topic, t.last);
+  if (mqttTrace)
+    ::printf("[sim %s] PUB %s %s%s\n", hal::formatTime(clockUs).c_str(), topic, t.last.c_str(), retained ? " (retained)" : "");
+  return true;
+}
+
+bool PubSubClient::subscribe(const char *topic)
+{
+  if (!connected()) return false;
+  subscriptions.insert(topic);
+  return true;
+}
+
+bool PubSubClient::unsubscribe(const char *topic)
+{
+  subscriptions.erase(topic);
+  return connected();
+}
@@ -0,0 +1,133 @@
+/**************************************************************************************
+
+  Native (host) hardware abstraction layer -- simulation controls
+
+  The firmware only ever sees the Arduino API (Arduino.h, Ticker.h, Preferences.h,
+  WiFi.h, PubSubClient.h...). This header is for the simulation driver: it owns
+  the virtual clock, the ultrasonic sensor model, the network/broker state and
+  the counters reported at the end of a run.
+
+  ***************************************************************************************/
+#ifndef _NATIVE_HAL_H
+#define _NATIVE_HAL_H
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace hal
+{
+  const long SIM_EPOCH = 1748736000L; // 2025-06-01 00:00:00 UTC, wall clock once configTime() is called
+
+  // -------- virtual clock
+  uint64_t nowMicros();
+  void advanceTo(uint64_t us);  // move the clock, firing due GPIO edges, tickers and scripted events
+  uint64_t nextEventMicros();   // earliest pending event, UINT64_MAX when idle
+  void at(uint64_t us, std::function<void()> fn); // scripted event in driver context
+
+  // -------- FreeRTOS tasks (see FreeRTOS.h)
+  void runTasks();    // resume every task whose wake time has come, each until it blocks
+  bool loopRunning(); // false once loop() has deleted the Arduino loop task
+
+  // -------- deep sleep (see esp_sleep.h)
+  const uint32_t DEEP_SLEEP_BOOT_US = 250000; // timer wake to setup(): ROM, bootloader and image load
+  struct DeepSleep
+  {
+    uint64_t us; // requested sleep time
+  };
+  // forget what a deep sleep loses and move the clock to the next setup(), false if endUs comes first
+  bool wakeFromDeepSleep(const DeepSleep &sleep, uint64_t endUs);
+
+  // -------- ultrasonic sensor
+  // returns the echo pulse width in microseconds for a ping of a sensor (in the order
+  // they were attached) issued at nowUs, 0 for no echo
+  typedef std::function<unsigned long(int sensor, uint64_t nowUs)> EchoModel;
+  void setEchoModel(EchoModel model);
+  const unsigned long ECHO_DELAY_US = 460;       // trigger to echo rising edge on an HC-SR04
+  const unsigned long ECHO_CROSSTALK_US = 30000; // a ping still rings for a neighbour this long
+
+  // edge simulator: a HIGH->LOW on trigPin schedules the echo's rising and falling
+  // edges on echoPin, which fire attached interrupts (also inside ticker callbacks).
+  // Sensors attached one after the other are neighbours: pinging one while the other
+  // rings hands it the other's echo, counted as crosstalk
+  void attachEchoSensor(uint8_t trigPin, uint8_t echoPin);
+  void setIsrLatency(uint32_t maxUs); // each edge is seen 0..maxUs late by its ISR
+
+  // -------- network
+  void setWiFiUp(bool up);
+  bool wifiUp();
+  void setBrokerUp(bool up);
+  bool brokerUp();
+  void setConnectTimeout(uint32_t ms); // how long connect() blocks when the broker is unreachable
+  const uint32_t WIFI_ASSOC_MS = 1500;  // WiFi.begin() to associated, after a boot or a deep sleep
+  void mqttInject(const char *topic, const char *payload);
+  void setMqttTrace(bool on); // print every publish with its virtual timestamp
+  void onPublish(std::function<void(const char *topic, const std::string &payload)> fn);
+
+  // HTTP GET stand-in: returns the status code and fills body, HTTPClient streams it back
+  typedef std::function<int(const std::string &url, std::string &body)> HttpHandler;
+  void setHttpHandler(HttpHandler handler); // without one every request is refused
+  const uint32_t HTTP_LATENCY_MS = 400;     // request to first byte
+
+  struct TopicStats
+  {
+    unsigned long count = 0;
+    std::string last;
+    bool retained = false;
+  };
+  const std::map<std::string, TopicStats> &mqttPublished();
+
+  struct NetSocket
+  {
+    bool open = true;
+    std::deque<uint8_t> rx;   // bytes waiting to be read by the firmware
+    std::string tx;           // bytes the firmware wrote (kept for inspection)
+    unsigned long writes = 0; // number of sends that reached the socket
+    size_t window = 5744;     // free space in the TCP send buffer, 0 for a peer that stopped reading
+    int fd = -1;              // WiFiClient::fd(), for lwip_send()
+  };
+  std::shared_ptr<NetSocket> telnetConnect(); // queue an incoming telnet session
+  void setUdpForward(uint16_t port);           // also send every UDP datagram to 127.0.0.1:port
+
+  // -------- serial & NVS
+  void serialInput(const char *line);
+  void setSerialEcho(bool on);
+  void setNvsFile(const char *path);
+  void setFlashDir(const char *path); // directory standing in for the LittleFS partition
+  const std::string &flashDir();
+
+  // -------- counters
+  struct Stats
+  {
+    unsigned long pings = 0;
+    unsigned long missedEchoes = 0;
+    unsigned long crosstalk = 0;     // pings while a neighbour was ringing
+    unsigned long isrCalls = 0;
+    unsigned long tickerCalls = 0;
+    uint64_t tickerTotalUs = 0;
+    uint64_t tickerMaxUs = 0;
+    unsigned long mqttConnects = 0;
+    unsigned long mqttConnectFailures = 0;
+    unsigned long httpRequests = 0;
+    unsigned long udpPackets = 0;
+    size_t udpBytes = 0;
+    unsigned long deepSleeps = 0;
+    uint64_t sleepUs = 0;
+    unsigned long wakeToSampleCount = 0; // wakes followed by a ping
+    uint64_t wakeToSampleTotalUs = 0;    // timer wake to trigger, boot included
+    uint64_t wakeToSampleMaxUs = 0;
+  };
+  Stats &stats();
+
+  // thrown by ESP.restart(): the simulation ends at a reboot
+  struct Restart
+  {
+  };
+
+  std::string formatTime(uint64_t us); // hh:mm:ss.mmm of virtual time
+}
+
+#endif
@@ -0,0 +1,57 @@
+/**************************************************************************************
+
+  Native (host) stand-in for the ESP32 Preferences (NVS) library.
+
+  Values live in an in-memory map keyed by namespace/key. When the simulation is
+  started with an NVS file (hal::setNvsFile) the map is loaded from and saved to
+  that file, so state survives simulated reboots and separate runs.
+
+  ***************************************************************************************/
+#ifndef _NATIVE_PREFERENCES_H
+#define _NATIVE_PREFERENCES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include "WString.h"
+
+class Preferences
+{
+public:
+  bool begin(const char *name, bool readOnly = false, const char *partition_label = NULL);
+  void end();
+
+  bool clear();
+  bool remove(const char *key);
+  bool isKey(const char *key);
+
+  size_t putBool(const char *key, bool value) { return putBytes(key, &value, sizeof(value)); }
+  size_t putInt(const char *key, int32_t value) { return putBytes(key, &value, sizeof(value)); }
+  size_t putUInt(const char *key, uint32_t value) { return putBytes(key, &value, sizeof(value)); }
+  size_t putFloat(const char *key, float value) { return putBytes(key, &value, sizeof(value)); }
+  size_t putString(const char *key, const char *value) { return putBytes(key, value, strlen(value) + 1); }
+  size_t putString(const char *key, const String &value) { return putString(key, value.c_str()); }
+  size_t putBytes(const char *key, const void *value, size_t len);
+
+  bool getBool(const char *key, bool defaultValue = false) { return get(key, defaultValue); }
+  int32_t getInt(const char *key, int32_t defaultValue = 0) { return get(key, defaultValue); }
+  uint32_t getUInt(const char *key, uint32_t defaultValue = 0) { return get(key, defaultValue); }
+  float getFloat(const char *key, float defaultValue = NAN) { return get(key, defaultValue); }
+  String getString(const char *key, const String &defaultValue = String());
+  size_t getBytesLength(const char *key);
+  size_t getBytes(const char *key, void *buf, size_t maxLen);
+
+private:
+  String ns;
+  bool readOnly = false;
+
+  template <typename T>
+  T get(const char *key, T defaultValue)
+  {
+    T value;
+    return getBytesLength(key) == sizeof(T) && getBytes(key, &value, sizeof(T)) == sizeof(T) ? value : defaultValue;
+  }
+};
+
+#endif
@@ -0,0 +1,58 @@
+/**************************************************************************************
+
+  Native (host) stand-in for PubSubClient.
+
+  Talks to an in-process broker owned by the simulation driver: connect() succeeds
+  while the simulated WiFi and broker are up, publish() is recorded per topic and
+  messages scripted with hal::mqttInject() are delivered from loop() to the
+  callback, exactly like the real client does.
+
+  ***************************************************************************************/
+#ifndef _NATIVE_PUBSUBCLIENT_H
+#define _NATIVE_PUBSUBCLIENT_H
+
+#include "Arduino.h"
+#include "Client.h"
+
+#define MQTT_MAX_PACKET_SIZE 256
+
+#define MQTT_CONNECTION_TIMEOUT -4
+#define MQTT_CONNECTION_LOST -3
+#define MQTT_CONNECT_FAILED -2
+#define MQTT_DISCONNECTED -1
+#define MQTT_CONNECTED 0
+
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char *, uint8_t *, unsigned int)> callback
+
+class PubSubClient
+{
+public:
+  PubSubClient(Client &client) { (void)client; }
+
+  PubSubClient &setServer(const char *domain, uint16_t port);
+  PubSubClient &setCallback(MQTT_CALLBACK_SIGNATURE);
+  bool setBufferSize(uint16_t size) { bufferSize = size; return true; }
+  uint16_t getBufferSize() { return bufferSize; }
+  PubSubClient &setSocketTimeout(uint16_t timeout) { (void)timeout; return *this; }
+
+  bool connect(const char *id);
+  bool connect(const char *id, const char *user, const char *pass) { (void)user; (void)pass; return connect(id); }
+  void disconnect();
+  bool connected();
+  int state();
+  bool loop();
+
+  bool publish(const char *topic, const char *payload) { return publish(topic, payload, false); }
+  bool publish(const char *topic, const char *payload, bool retained) { return publish(topic, (const uint8_t *)payload, strlen(payload), retained); }
+  bool publish(const char *topic, const uint8_t *payload, unsigned int plength, bool retained = false);
+  bool subscribe(const char *topic);
+  bool unsubscribe(const char *topic);
+
+private:
+  MQTT_CALLBACK_SIGNATURE;
+  uint16_t bufferSize = MQTT_MAX_PACKET_SIZE;
+  bool isConnected = false;
+  int lastState = MQTT_DISCONNECTED;
+};
+
+#endif
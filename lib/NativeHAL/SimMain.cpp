@@ -0,0 +1,423 @@
+/**************************************************************************************
+
+  Native (host) simulation driver
+
+  Plays the role of the Arduino core's main(): calls setup() once, then loop()
+  until the simulated duration has elapsed. Between loop() calls the virtual
+  clock jumps to the next pending event so idle time costs nothing.
+
+  A deep sleep (esp_deep_sleep_start) ends the run of setup()/loop() and, once
+  the sleep and the ROM boot have passed on the virtual clock, starts over with
+  setup(). Only RTC_DATA_ATTR state is meant to survive it: firmware statics
+  that setup() does not re-initialise would keep their value here while the
+  chip loses them, so every configure*() starts from a clean slate.
+
+  The water surface follows a semi-diurnal tide, with waves if asked for
+  (three swells around the peak period, a quarter, half and a quarter of the
+  variance), gaussian noise, missed
+  echoes and short "bird" reflections. WiFi/broker outages, console commands
+  and MQTT messages can be scripted on the virtual timeline.
+
+  usage: program [options]
+    --hours H              simulated duration (default 24)
+    --seed N               random seed for the sensor model (default 1)
+    --noise CM             1-sigma range noise in cm (default 0.5)
+    --air-temp C           air temperature the echoes travel through (default 20)
+    --miss-rate P          probability of a missed echo (default 0)
+    --spike-rate P         probability of a short spurious echo (default 0)
+    --waves HS:TP          waves of significant height HS ft and peak period TP s (default none)
+    --foul S:N             sensor N of ECHO_SENSOR_PINS sees an obstruction 8 cm away from
+                           S seconds on
+    --wifi-outage S:D      WiFi down at S seconds for D seconds (repeatable)
+    --broker-outage S:D    MQTT broker down at S seconds for D seconds (repeatable)
+    --connect-timeout MS   time a connect to an unreachable broker blocks (default 1000)
+    --isr-latency US       max interrupt latency applied to each echo edge (default 2)
+    --console S:LINE       type LINE on the serial console at S seconds (repeatable)
+    --telnet S:N[=LINE]    telnet session N connects at S seconds if it is not open, then
+                           types LINE (repeatable)
+    --telnet-stall S:N     session N stops reading at S seconds
+    --telnet-close S:N     session N hangs up at S seconds
+    --udp-forward PORT     send every UDP datagram to 127.0.0.1:PORT too (tools/udplisten.py)
+    --mqtt S:TOPIC=PAYLOAD deliver an MQTT message at S seconds (repeatable)
+    --noaa FILE            answer NOAA prediction requests with a saved response
+                           (default: hilo predictions generated from the tide model)
+    --noaa-outage S:D      NOAA requests fail with HTTP 503 at S seconds for D seconds
+    --nvs FILE             persist Preferences to FILE
+    --flash DIR            keep the LittleFS partition in DIR (default: fresh temp dir)
+    --record FILE          write every echo as "ms,sensor,width_us," lines, the trigger time
+                           in ms since the start (test/test_level_tracker replays them)
+    --trace                print every MQTT publish
+    --verbose              show the serial console output
+    --bench [NAME]         run the micro-benchmarks (those starting with NAME) instead, see Bench.h
+
+  ***************************************************************************************/
+#include <Arduino.h>
+#include <RedGlobals.h>
+#include "NativeHAL.h"
+#include "Bench.h"
+
+#include <chrono>
+#include <map>
+#include <random>
+
+void setup();
+void loop();
+
+namespace
+{
+  const double TIDE_MEAN_FT = 2.6;         // MLLW
+  const double TIDE_AMPLITUDE_FT = 1.4;
+  const double TIDE_PERIOD_S = 12.42 * 3600; // M2 constituent
+
+  double hours = 24;
+  double noiseCm = 0.5;
+  double airTempC = 20;
+  double missRate = 0;
+  double spikeRate = 0;
+  double waveHsFt = 0, wavePeriodS = 0;
+  std::mt19937 sensorRng(1);
+
+  // accuracy: each published level against the true level averaged over the pings of
+  // its interval (since the previous level, at most one publish interval back)
+  std::deque<std::pair<uint64_t, double>> truePings;
+  uint64_t publishIntervalUs = MQTT_UPDATE_INTERVAL * 1000ULL; // follows the retained rate topic
+  unsigned long levelPublishes = 0;
+  double errorSum = 0, errorMax = 0;
+
+  // the wave components: frequency around the peak, share of the variance, phase
+  struct Swell { double ratio, share, phase; };
+  const Swell swells[] = {{0.85, 0.25, 0.3}, {1.0, 0.5, 2.1}, {1.15, 0.25, 4.4}};
+
+  // true water level at a given time, in ft MLLW
+  double trueLevelFt(uint64_t us)
+  {
+    double t = us / 1e6, level = TIDE_MEAN_FT + TIDE_AMPLITUDE_FT * cos(2 * M_PI * t / TIDE_PERIOD_S);
+    if (waveHsFt > 0)
+      for (const Swell &s : swells)
+        level += waveHsFt / 4 * sqrt(2 * s.share) * sin(2 * M_PI * s.ratio * t / wavePeriodS + s.phase);
+    return level;
+  }
+
+  // the tide's rate of change, ft/hr
+  double trueRateFtHr(uint64_t us)
+  {
+    return -TIDE_AMPLITUDE_FT * 2 * M_PI / TIDE_PERIOD_S * 3600 * sin(2 * M_PI * (us / 1e6) / TIDE_PERIOD_S);
+  }
+
+  // lag: each published level, smoothed level and rate against the truth at the
+  // moment it is published
+  struct Track
+  {
+    unsigned long n = 0;
+    double sum = 0, max = 0;
+    void add(double error) { n++, sum += fabs(error), max = std::max(max, fabs(error)); }
+  };
+  Track levelNow, smoothedNow, rateNow;
+
+  // published wave statistics against the model
+  unsigned long wavePublishes = 0;
+  double waveHsSum = 0, wavePeriodSum = 0;
+
+  // sensors of echoPins fouled from a time on: a web or barnacles in front of the
+  // transducer answer instead of the water
+  std::map<int, uint64_t> fouledAt;
+  const double FOULED_CM = 8;
+
+  unsigned long echoWidth(int sensor, uint64_t us)
+  {
+    truePings.emplace_back(us, trueLevelFt(us));
+    std::uniform_real_distribution<double> u(0, 1);
+    std::normal_distribution<double> noise(0, noiseCm);
+    // a sensor mounted offsetMm lower sees that much less
+    double waterDistanceCm = (SEAWALL_MLLW_OFFSET - trueLevelFt(us)) / CM_TO_FT - echoPins[sensor].offsetMm / 10.0;
+    if (u(sensorRng) < missRate) return 0;
+    auto fouled = fouledAt.find(sensor);
+    if (fouled != fouledAt.end() && us >= fouled->second) waterDistanceCm = FOULED_CM;
+    double cm = u(sensorRng) < spikeRate ? 5 + 20 * u(sensorRng) : waterDistanceCm + noise(sensorRng);
+    return (unsigned long)(cm / sound::halfSpeed(airTempC) + 0.5);
+  }
+
+  // --record: every echo the model answers, as the firmware gets it
+  FILE *recording;
+
+  unsigned long recordedEcho(int sensor, uint64_t us)
+  {
+    unsigned long width = echoWidth(sensor, us);
+    fprintf(recording, "%llu,%d,%lu,\n", (unsigned long long)(us / 1000), sensor, width);
+    return width;
+  }
+
+  // NOAA stand-in
+  std::string noaaFile;
+  bool noaaUp = true;
+
+  void setNoaaUp(bool up) { noaaUp = up; }
+
+  // the model's highs and lows in the requested window, formatted like NOAA's hilo product
+  int noaaPredictions(const std::string &url, std::string &body)
+  {
+    if (!noaaUp) return 503;
+    if (!noaaFile.empty())
+    {
+      FILE *f = fopen(noaaFile.c_str(), "rb");
+      if (!f) return 404;
+      char buf[4096];
+      size_t n;
+      while ((n = fread(buf, 1, sizeof(buf), f)) > 0) body.append(buf, n);
+      fclose(f);
+      return 200;
+    }
+
+    int y, mo, d, h, mi;
+    long range;
+    size_t b = url.find("begin_date="), r = url.find("range=");
+    if (b == std::string::npos || r == std::string::npos ||
+        sscanf(url.c_str() + b, "begin_date=%4d%2d%2d%%20%d:%d", &y, &mo, &d, &h, &mi) != 5 ||
+        sscanf(url.c_str() + r, "range=%ld", &range) != 1)
+    {
+      body = "{\"error\": {\"message\": \"Wrong begin_date or range\"}}";
+      return 200; // NOAA reports request errors in the body
+    }
+    struct tm tm = {};
+    tm.tm_year = y - 1900, tm.tm_mon = mo - 1, tm.tm_mday = d, tm.tm_hour = h, tm.tm_min = mi;
+    double from = timegm(&tm) - hal::SIM_EPOCH, to = from + range * 3600.0;
+
+    body = "{ \"predictions\" : [";
+    bool first = true;
+    for (long k = (long)floor(from / (TIDE_PERIOD_S / 2)); k * TIDE_PERIOD_S / 2 <= to; k++)
+    {
+      double t = k * TIDE_PERIOD_S / 2;
+      time_t at = hal::SIM_EPOCH + (time_t)(t / 60 + 0.5) * 60; // NOAA gives minutes
+      if (t < from) continue;
+      char entry[96], when[24];
+      strftime(when, sizeof(when), "%Y-%m-%d %H:%M", gmtime(&at));
+      snprintf(entry, sizeof(entry), "%s\n{\"t\":\"%s\", \"v\":\"%.3f\", \"type\":\"%c\"}", first ? "" : ",", when,
+               trueLevelFt((uint64_t)(t * 1e6)), k % 2 ? 'L' : 'H');
+      body += entry;
+      first = false;
+    }
+    body += "\n]}\n";
+    return 200;
+  }
+
+  void checkLevel(const char *topic, const std::string &payload)
+  {
+    size_t n = strlen(topic);
+    size_t at = payload.find("\"publish_ms\":");
+    if (n >= 5 && !strcmp(topic + n - 5, "/rate") && at != std::string::npos)
+      publishIntervalUs = atol(payload.c_str() + at + 13) * 1000ULL;
+    if (n >= 6 && !strcmp(topic + n - 6, "/waves"))
+    {
+      size_t hs = payload.find("\"hs_ft\":"), tp = payload.find("\"tp_s\":");
+      if (hs == std::string::npos || tp == std::string::npos) return;
+      wavePublishes++;
+      waveHsSum += atof(payload.c_str() + hs + 8);
+      wavePeriodSum += atof(payload.c_str() + tp + 7);
+    }
+    if (n >= 9 && !strcmp(topic + n - 9, "/smoothed")) smoothedNow.add(atof(payload.c_str()) - trueLevelFt(hal::nowMicros()));
+    if (n >= 5 && !strcmp(topic + n - 5, "/rate") && payload[0] != '{') rateNow.add(atof(payload.c_str()) - trueRateFtHr(hal::nowMicros()));
+    if (n < 6 || strcmp(topic + n - 6, "/level")) return;
+    levelNow.add(atof(payload.c_str()) - trueLevelFt(hal::nowMicros()));
+    uint64_t now = hal::nowMicros(), from = now > publishIntervalUs ? now - publishIntervalUs : 0;
+    double sum = 0;
+    int count = 0;
+    for (auto &p : truePings)
+      if (p.first >= from) sum += p.second, count++;
+    truePings.clear();
+    if (!count) return;
+    double error = fabs(atof(payload.c_str()) - sum / count);
+    levelPublishes++;
+    errorSum += error;
+    errorMax = std::max(errorMax, error);
+  }
+
+  // scripted telnet sessions by number, transcripts are shown with --verbose
+  std::map<int, std::shared_ptr<hal::NetSocket>> telnetSessions;
+  bool verbose = false;
+
+  std::shared_ptr<hal::NetSocket> &telnetSession(int n)
+  {
+    auto &s = telnetSessions[n];
+    if (!s || !s->open) s = hal::telnetConnect();
+    return s;
+  }
+
+  bool parseAt(const char *arg, double &seconds, const char *&rest)
+  {
+    char *end;
+    seconds = strtod(arg, &end);
+    if (*end != ':') return false;
+    rest = end + 1;
+    return true;
+  }
+
+  void scheduleOutage(const char *arg, void (*set)(bool))
+  {
+    double start, duration;
+    const char *rest;
+    if (!parseAt(arg, start, rest)) return;
+    duration = atof(rest);
+    hal::at((uint64_t)(start * 1e6), [set]() { set(false); });
+    hal::at((uint64_t)((start + duration) * 1e6), [set]() { set(true); });
+  }
+
+  void report(double wallSeconds)
+  {
+    hal::Stats &s = hal::stats();
+    ::printf("[sim] %.2f h simulated in %.3f s\n", hal::nowMicros() / 3.6e9, wallSeconds);
+    ::printf("[sim] pings %lu, missed echoes %lu, echo interrupts %lu, crosstalk %lu\n", s.pings, s.missedEchoes, s.isrCalls, s.crosstalk);
+    if (levelPublishes)
+      ::printf("[sim] level error vs model: mean %.4f ft, max %.4f ft\n", errorSum / levelPublishes, errorMax);
+    if (levelNow.n && smoothedNow.n)
+      ::printf("[sim] level now: interval mean %.4f ft (max %.4f), smoothed %.4f ft (max %.4f), rate %.3f ft/hr (max %.3f)\n",
+               levelNow.sum / levelNow.n, levelNow.max, smoothedNow.sum / smoothedNow.n, smoothedNow.max,
+               rateNow.n ? rateNow.sum / rateNow.n : 0.0, rateNow.max);
+    if (wavePublishes)
+      ::printf("[sim] waves %lu: mean Hs %.3f ft (model %.3f), Tp %.2f s (model %.2f)\n", wavePublishes,
+               waveHsSum / wavePublishes, waveHsFt, wavePeriodSum / wavePublishes, wavePeriodS);
+    ::printf("[sim] ticker callbacks %lu, max %.3f ms, mean %.3f ms\n", s.tickerCalls, s.tickerMaxUs / 1000.0,
+             s.tickerCalls ? s.tickerTotalUs / 1000.0 / s.tickerCalls : 0.0);
+    ::printf("[sim] mqtt connects %lu, failed %lu, http requests %lu\n", s.mqttConnects, s.mqttConnectFailures, s.httpRequests);
+    if (s.udpPackets) ::printf("[sim] udp datagrams %lu, %zu bytes\n", s.udpPackets, s.udpBytes);
+    if (s.deepSleeps)
+      ::printf("[sim] deep sleeps %lu, asleep %.2f%%, wake to sample mean %.1f ms, max %.1f ms\n", s.deepSleeps,
+               100.0 * s.sleepUs / hal::nowMicros(), s.wakeToSampleCount ? s.wakeToSampleTotalUs / 1000.0 / s.wakeToSampleCount : 0.0,
+               s.wakeToSampleMaxUs / 1000.0);
+    for (auto &kv : hal::mqttPublished())
+      ::printf("[sim]   %-40s %6lu  last=%s\n", kv.first.c_str(), kv.second.count, kv.second.last.c_str());
+    for (auto &kv : telnetSessions)
+    {
+      hal::NetSocket &t = *kv.second;
+      ::printf("[sim] telnet %d: %s, %zu bytes received in %lu writes\n", kv.first, t.open ? "open" : "closed", t.tx.size(), t.writes);
+      if (verbose) ::printf("%s\n", t.tx.c_str());
+    }
+  }
+}
+
+#ifndef PIO_UNIT_TESTING // the tests in test/ bring their own
+int main(int argc, char **argv)
+{
+  hal::setSerialEcho(false);
+  hal::setIsrLatency(2);
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char *opt = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : "";
+    double at;
+    const char *rest;
+
+    if (!strcmp(opt, "--bench")) return bench::runAll(i + 1 < argc ? argv[i + 1] : nullptr);
+    else if (!strcmp(opt, "--trace")) hal::setMqttTrace(true);
+    else if (!strcmp(opt, "--verbose")) hal::setSerialEcho(true), verbose = true;
+    else if (!strcmp(opt, "--hours")) hours = atof(argv[++i]);
+    else if (!strcmp(opt, "--seed")) sensorRng.seed(atol(argv[++i]));
+    else if (!strcmp(opt, "--noise")) noiseCm = atof(argv[++i]);
+    else if (!strcmp(opt, "--air-temp")) airTempC = atof(argv[++i]);
+    else if (!strcmp(opt, "--miss-rate")) missRate = atof(argv[++i]);
+    else if (!strcmp(opt, "--spike-rate")) spikeRate = atof(argv[++i]);
+    else if (!strcmp(opt, "--waves") && parseAt(val, waveHsFt, rest)) wavePeriodS = atof(rest), i++;
+    else if (!strcmp(opt, "--wifi-outage")) scheduleOutage(argv[++i], hal::setWiFiUp);
+    else if (!strcmp(opt, "--broker-outage")) scheduleOutage(argv[++i], hal::setBrokerUp);
+    else if (!strcmp(opt, "--connect-timeout")) hal::setConnectTimeout(atol(argv[++i]));
+    else if (!strcmp(opt, "--isr-latency")) hal::setIsrLatency(atol(argv[++i]));
+    else if (!strcmp(opt, "--noaa")) noaaFile = argv[++i];
+    else if (!strcmp(opt, "--noaa-outage")) scheduleOutage(argv[++i], setNoaaUp);
+    else if (!strcmp(opt, "--nvs")) hal::setNvsFile(argv[++i]);
+    else if (!strcmp(opt, "--flash")) hal::setFlashDir(argv[++i]);
+    else if (!strcmp(opt, "--record") && (recording = fopen(val, "w"))) i++;
+    else if (!strcmp(opt, "--console") && parseAt(val, at, rest))
+    {
+      std::string line = std::string(rest) + "\n";
+      hal::at((uint64_t)(at * 1e6), [line]() { hal::serialInput(line.c_str()); });
+      i++;
+    }
+    else if (!strcmp(opt, "--foul") && parseAt(val, at, rest))
+    {
+      fouledAt[atoi(rest)] = (uint64_t)(at * 1e6);
+      i++;
+    }
+    else if (!strcmp(opt, "--udp-forward")) hal::setUdpForward(atoi(argv[++i]));
+    else if (!strcmp(opt, "--telnet") && parseAt(val, at, rest))
+    {
+      int n = atoi(rest);
+      const char *eq = strchr(rest, '=');
+      std::string line = eq ? std::string(eq + 1) + "\r\n" : "";
+      hal::at((uint64_t)(at * 1e6), [n, line]() {
+        auto &s = telnetSession(n);
+        s->rx.insert(s->rx.end(), line.begin(), line.end());
+      });
+      i++;
+    }
+    else if (!strcmp(opt, "--telnet-stall") && parseAt(val, at, rest))
+    {
+      int n = atoi(rest);
+      hal::at((uint64_t)(at * 1e6), [n]() { telnetSession(n)->window = 0; });
+      i++;
+    }
+    else if (!strcmp(opt, "--telnet-close") && parseAt(val, at, rest))
+    {
+      int n = atoi(rest);
+      hal::at((uint64_t)(at * 1e6), [n]() { telnetSession(n)->open = false; });
+      i++;
+    }
+    else if (!strcmp(opt, "--mqtt") && parseAt(val, at, rest) && strchr(rest, '='))
+    {
+      std::string topic(rest, strchr(rest, '=')), payload(strchr(rest, '=') + 1);
+      hal::at((uint64_t)(at * 1e6), [topic, payload]() { hal::mqttInject(topic.c_str(), payload.c_str()); });
+      i++;
+    }
+    else
+    {
+      fprintf(stderr, "unknown option %s (see lib/NativeHAL/SimMain.cpp)\n", opt);
+      return 1;
+    }
+  }
+
+  hal::setEchoModel(recording ? recordedEcho : echoWidth);
+  for (const EchoPins &p : echoPins) hal::attachEchoSensor(p.trig, p.echo);
+  hal::onPublish(checkLevel);
+  hal::setHttpHandler(noaaPredictions);
+  uint64_t end = (uint64_t)(hours * 3.6e9);
+  auto wallStart = std::chrono::steady_clock::now();
+  int rc = 0;
+
+  for (bool awake = true; awake;)
+  {
+    try
+    {
+      setup();
+      while (hal::nowMicros() < end)
+      {
+        uint64_t before = hal::nowMicros();
+        if (hal::loopRunning()) loop();
+        hal::runTasks();
+        // nothing blocked: skip ahead to the next thing that can happen, a loop() that
+        // polls without blocking in steps of at most 50 ms
+        if (hal::nowMicros() == before)
+        {
+          uint64_t next = hal::nextEventMicros();
+          if (hal::loopRunning()) next = std::min(next, before + 50000);
+          hal::advanceTo(std::min(next, end));
+        }
+      }
+      awake = false;
+    }
+    catch (hal::DeepSleep &sleep)
+    {
+      awake = hal::wakeFromDeepSleep(sleep, end);
+    }
+    catch (hal::Restart &)
+    {
+      ::printf("[sim %s] ESP.restart()\n", hal::formatTime(hal::nowMicros()).c_str());
+      rc = 2;
+      awake = false;
+    }
+  }
+
+  std::chrono::duration<double> wall = std::chrono::steady_clock::now() - wallStart;
+  report(wall.count());
+  if (recording) fclose(recording);
+  return rc;
+}
+#endif
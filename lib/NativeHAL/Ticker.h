@@ -0,0 +1,45 @@
+/**************************************************************************************
+
+  Native (host) stand-in for the ESP32 Ticker library.
+
+  Tickers are timers on the virtual clock. Like the ESP32 esp_timer task, callbacks
+  run one at a time: a callback that blocks (pulseIn, delay) holds up every other
+  ticker until it returns. The driver records how long each callback held the
+  timer task so worst-case callback duration can be measured on the host.
+
+  ***************************************************************************************/
+#ifndef _NATIVE_TICKER_H
+#define _NATIVE_TICKER_H
+
+#include <stdint.h>
+#include <functional>
+
+class Ticker
+{
+public:
+  typedef std::function<void(void)> callback_function_t;
+
+  Ticker();
+  ~Ticker();
+
+  void attach(float seconds, callback_function_t callback) { attach_ms((uint32_t)(seconds * 1000), callback); }
+  void attach_ms(uint32_t milliseconds, callback_function_t callback) { arm(milliseconds * 1000ULL, true, callback); }
+  void once(float seconds, callback_function_t callback) { once_ms((uint32_t)(seconds * 1000), callback); }
+  void once_ms(uint32_t milliseconds, callback_function_t callback) { arm(milliseconds * 1000ULL, false, callback); }
+  void detach();
+  bool active() const { return armed; }
+
+  // used by the virtual clock
+  uint64_t due = 0;
+  void fire();
+
+private:
+  uint64_t period = 0;
+  bool repeat = false;
+  bool armed = false;
+  callback_function_t cb;
+
+  void arm(uint64_t periodUs, bool repeat, callback_function_t callback);
+};
+
+#endif
@@ -0,0 +1,79 @@
+/**************************************************************************************
+
+  Native (host) stand-in for the Arduino String class.
+
+  Only the subset of the API used by the firmware is provided. Backed by std::string,
+  which is fine on a Linux host.
+
+  ***************************************************************************************/
+#ifndef _NATIVE_WSTRING_H
+#define _NATIVE_WSTRING_H
+
+#include <string>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <strings.h>
+
+class String
+{
+public:
+  String() {}
+  String(const char *s) : str(s ? s : "") {}
+  String(const std::string &s) : str(s) {}
+  String(char c) : str(1, c) {}
+  String(int v) : str(std::to_string(v)) {}
+  String(unsigned int v) : str(std::to_string(v)) {}
+  String(long v) : str(std::to_string(v)) {}
+  String(unsigned long v) : str(std::to_string(v)) {}
+  String(float v, unsigned int decimals = 2) { fromDouble(v, decimals); }
+  String(double v, unsigned int decimals = 2) { fromDouble(v, decimals); }
+
+  const char *c_str() const { return str.c_str(); }
+  unsigned int length() const { return str.length(); }
+  bool isEmpty() const { return str.empty(); }
+
+  long toInt() const { return atol(str.c_str()); }
+  float toFloat() const { return (float)atof(str.c_str()); }
+
+  void toUpperCase()
+  {
+    for (auto &c : str) c = toupper(c);
+  }
+  void toLowerCase()
+  {
+    for (auto &c : str) c = tolower(c);
+  }
+
+  bool equals(const String &s) const { return str == s.str; }
+  bool equalsIgnoreCase(const String &s) const { return strcasecmp(str.c_str(), s.c_str()) == 0; }
+  bool startsWith(const String &s) const { return str.compare(0, s.str.size(), s.str) == 0; }
+  int indexOf(char c) const { auto p = str.find(c); return p == std::string::npos ? -1 : (int)p; }
+  String substring(unsigned int from) const { return from < str.size() ? String(str.substr(from)) : String(); }
+  String substring(unsigned int from, unsigned int to) const { return from < str.size() ? String(str.substr(from, to - from)) : String(); }
+
+  char operator[](unsigned int i) const { return i < str.size() ? str[i] : 0; }
+  bool operator==(const String &s) const { return str == s.str; }
+  bool operator==(const char *s) const { return str == (s ? s : ""); }
+  bool operator!=(const String &s) const { return str != s.str; }
+
+  String &operator+=(const String &s) { str += s.str; return *this; }
+  String &operator+=(const char *s) { if (s) str += s; return *this; }
+  String &operator+=(char c) { str += c; return *this; }
+
+  friend String operator+(const String &a, const String &b) { return String(a.str + b.str); }
+  friend String operator+(const char *a, const String &b) { return String(std::string(a) + b.str); }
+  friend String operator+(const String &a, const char *b) { return String(a.str + b); }
+
+private:
+  std::string str;
+
+  void fromDouble(double v, unsigned int decimals)
+  {
+    char buf[48];
+    snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+    str = buf;
+  }
+};
+
+#endif
@@ -0,0 +1,46 @@
+/**************************************************************************************
+
+  Native (host) stand-in for the ESP32 WiFi library. Link state follows the
+  simulation driver's outage schedule.
+
+  ***************************************************************************************/
+#ifndef _NATIVE_WIFI_H
+#define _NATIVE_WIFI_H
+
+#include "Arduino.h"
+#include "WiFiClient.h"
+#include "WiFiServer.h"
+#include "WiFiUdp.h"
+
+typedef enum
+{
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum
+{
+  WIFI_OFF = 0,
+  WIFI_STA = 1
+} wifi_mode_t;
+
+class WiFiClass
+{
+public:
+  wl_status_t status();
+  bool mode(wifi_mode_t m) { (void)m; return true; }
+  wl_status_t begin(); // stored credentials, associated hal::WIFI_ASSOC_MS later if the radio was off
+  bool reconnect() { return true; }
+  bool disconnect(bool wifioff = false) { (void)wifioff; return true; }
+  bool setHostname(const char *name) { (void)name; return true; }
+  IPAddress localIP() { return IPAddress(192, 168, 68, 80); }
+  int8_t RSSI() { return -60; }
+};
+
+extern WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,66 @@
+/**************************************************************************************
+
+  Native (host) stand-in for WiFiClient.
+
+  The default client is never connected. The simulation driver can hand out
+  connected clients whose traffic is counted (see NativeHAL.h).
+
+  write() behaves like the ESP32 core's: what does not fit in the send window
+  waits for room, a select() of up to WIFI_CLIENT_SELECT_TIMEOUT_MS at a time,
+  and only after WIFI_CLIENT_MAX_WRITE_RETRY of them without progress does it
+  return short. Against a stalled peer one write() blocks the caller for 10 s
+  of virtual time. lwip_send() with MSG_DONTWAIT (lwip/sockets.h) does not wait.
+
+  ***************************************************************************************/
+#ifndef _NATIVE_WIFICLIENT_H
+#define _NATIVE_WIFICLIENT_H
+
+#include <memory>
+#include "Arduino.h"
+
+#define WIFI_CLIENT_MAX_WRITE_RETRY 10
+#define WIFI_CLIENT_SELECT_TIMEOUT_MS 1000
+
+class Client : public Stream
+{
+public:
+  virtual int connect(const char *host, uint16_t port) = 0;
+  virtual uint8_t connected() = 0;
+  virtual void stop() = 0;
+  virtual operator bool() = 0;
+};
+
+namespace hal
+{
+  struct NetSocket; // simulated socket state shared between copies of a client
+}
+
+class WiFiClient : public Client
+{
+public:
+  WiFiClient() {}
+  explicit WiFiClient(std::shared_ptr<hal::NetSocket> s) : sock(s) {}
+
+  int connect(const char *host, uint16_t port) override;
+  uint8_t connected() override;
+  void stop() override;
+  operator bool() override { return connected(); } // as on the ESP32: false once the peer is gone
+
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+  int availableForWrite() override;
+  void flush() override {}
+
+  int fd() const;
+  void setNoDelay(bool) {}
+  void setTimeout(uint32_t seconds) { (void)seconds; }
+
+private:
+  std::shared_ptr<hal::NetSocket> sock;
+};
+
+#endif
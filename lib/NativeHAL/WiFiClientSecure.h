@@ -0,0 +1,19 @@
+/**************************************************************************************
+
+  Native (host) stand-in for WiFiClientSecure: TLS is not simulated, the
+  client behaves like a plain WiFiClient.
+
+  ***************************************************************************************/
+#ifndef _NATIVE_WIFICLIENTSECURE_H
+#define _NATIVE_WIFICLIENTSECURE_H
+
+#include "WiFiClient.h"
+
+class WiFiClientSecure : public WiFiClient
+{
+public:
+  void setInsecure() {}
+  void setCACert(const char *rootCA) { (void)rootCA; }
+};
+
+#endif
@@ -0,0 +1,48 @@
+/**************************************************************************************
+
+  Native (host) stand-in for WiFiManager: the portal is never shown and
+  autoConnect() succeeds as soon as the simulated WiFi is up and associated.
+
+  ***************************************************************************************/
+#ifndef _NATIVE_WIFIMANAGER_H
+#define _NATIVE_WIFIMANAGER_H
+
+#include "WiFi.h"
+
+class WiFiManagerParameter
+{
+public:
+  WiFiManagerParameter(const char *id, const char *label, const char *defaultValue, int length)
+      : id(id), value(defaultValue), length(length) { (void)label; }
+  const char *getValue() const { return value; }
+  const char *getID() const { return id; }
+  int getValueLength() const { return length; }
+
+private:
+  const char *id;
+  const char *value;
+  int length;
+};
+
+class WiFiManager
+{
+public:
+  void setSaveConfigCallback(std::function<void()> func) { (void)func; }
+  bool addParameter(WiFiManagerParameter *p) { (void)p; return true; }
+  void setMinimumSignalQuality(int quality = 8) { (void)quality; }
+  void setConnectTimeout(unsigned long seconds) { connectTimeout = seconds; }
+  void setConfigPortalTimeout(unsigned long seconds) { (void)seconds; }
+  bool autoConnect(const char *apName, const char *apPassword = NULL)
+  {
+    (void)apName, (void)apPassword;
+    WiFi.begin();
+    for (unsigned long start = millis(); WiFi.status() != WL_CONNECTED && millis() - start < connectTimeout * 1000;) delay(100);
+    return WiFi.status() == WL_CONNECTED;
+  }
+  void resetSettings() {}
+
+private:
+  unsigned long connectTimeout = 30;
+};
+
+#endif
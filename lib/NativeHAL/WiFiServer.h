@@ -0,0 +1,27 @@
+/**************************************************************************************
+
+  Native (host) stand-in for WiFiServer. Accepts the clients queued by the
+  simulation driver (hal::telnetConnect).
+
+  ***************************************************************************************/
+#ifndef _NATIVE_WIFISERVER_H
+#define _NATIVE_WIFISERVER_H
+
+#include "WiFiClient.h"
+
+class WiFiServer
+{
+public:
+  WiFiServer(uint16_t port) : port(port) {}
+  void begin() { listening = true; }
+  void stop() { listening = false; }
+  WiFiClient available();
+  WiFiClient accept() { return available(); }
+  void setNoDelay(bool) {}
+
+private:
+  uint16_t port;
+  bool listening = false;
+};
+
+#endif
@@ -0,0 +1,31 @@
+/**************************************************************************************
+
+  Native (host) stand-in for WiFiUDP. Packets are counted, and forwarded to a
+  port on the host loopback if the driver asked for it (hal::setUdpForward).
+
+  ***************************************************************************************/
+#ifndef _NATIVE_WIFIUDP_H
+#define _NATIVE_WIFIUDP_H
+
+#include "Arduino.h"
+#include <string>
+
+class WiFiUDP : public Print
+{
+public:
+  uint8_t begin(uint16_t port) { (void)port; return 1; }
+  void stop() {}
+  int beginPacket(const char *host, uint16_t port);
+  int beginPacket(IPAddress ip, uint16_t port) { return beginPacket(ip.toString().c_str(), port); }
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+  int endPacket();
+
+private:
+  String host;
+  uint16_t port = 0;
+  std::string data;
+};
+
+#endif
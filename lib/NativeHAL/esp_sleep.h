@@ -0,0 +1,32 @@
+/**************************************************************************************
+
+  Native (host) stand-in for the ESP-IDF deep sleep API.
+
+  esp_deep_sleep_start() throws hal::DeepSleep; the simulation driver catches it,
+  forgets everything a deep sleep loses (tasks, timers, interrupts, the WiFi
+  association), moves the clock past the sleep and the ROM boot, and calls
+  setup() again. RTC_DATA_ATTR variables are plain globals on the host, so they
+  keep their value like RTC slow memory does.
+
+  ***************************************************************************************/
+#ifndef _NATIVE_ESP_SLEEP_H
+#define _NATIVE_ESP_SLEEP_H
+
+#include <stdint.h>
+
+typedef int esp_err_t;
+#ifndef ESP_OK
+#define ESP_OK 0
+#endif
+
+typedef enum
+{
+  ESP_SLEEP_WAKEUP_UNDEFINED = 0, // reset or power on, not a wake from sleep
+  ESP_SLEEP_WAKEUP_TIMER = 4,
+} esp_sleep_wakeup_cause_t;
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us);
+void esp_deep_sleep_start(); // does not return
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause();
+
+#endif
@@ -0,0 +1,21 @@
+/**************************************************************************************
+
+  Native (host) stand-in for the lwIP socket API, the call the firmware makes.
+
+  lwip_send() goes to the simulated socket behind WiFiClient::fd(): with
+  MSG_DONTWAIT it takes what fits in the send window and returns -1 with
+  errno EWOULDBLOCK when nothing does, like lwIP. Without it the send waits
+  for room the way WiFiClient::write() does.
+
+  ***************************************************************************************/
+#ifndef _NATIVE_LWIP_SOCKETS_H
+#define _NATIVE_LWIP_SOCKETS_H
+
+#include <errno.h>
+#include <stddef.h>
+#include <sys/socket.h> // MSG_DONTWAIT
+#include <sys/types.h>
+
+ssize_t lwip_send(int s, const void *data, size_t size, int flags);
+
+#endif
@@ -0,0 +1,58 @@
+/**************************************************************************************
+
+  NOAA hilo predictions -- see NoaaHilo.h
+
+  ***************************************************************************************/
+#include "NoaaHilo.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// days since 1970-01-01 of a civil date (Howard Hinnant's algorithm)
+static long daysFromCivil(int y, int m, int d)
+{
+  y -= m <= 2;
+  long era = (y >= 0 ? y : y - 399) / 400;
+  long yoe = y - era * 400;
+  long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+uint32_t parseNoaaTime(const char *s)
+{
+  int y, mo, d, h, mi;
+  if (sscanf(s, "%d-%d-%d %d:%d", &y, &mo, &d, &h, &mi) != 5) return 0;
+  return daysFromCivil(y, mo, d) * 86400 + h * 3600 + mi * 60;
+}
+
+void NoaaListener::value(int depth, const char *key, const char *value, bool quoted)
+{
+  (void)quoted;
+  if (depth == 3)
+  {
+    if (!strcmp(key, "t")) current.epoch = parseNoaaTime(value);
+    else if (!strcmp(key, "v")) current.level = atof(value);
+    else if (!strcmp(key, "type")) current.type = value[0];
+  }
+  else if (depth == 2 && !strcmp(key, "message"))
+  {
+    snprintf(message, sizeof(message), "%s", value);
+    error = true;
+  }
+}
+
+void NoaaListener::startObject(int depth, const char *key)
+{
+  (void)key;
+  if (depth == 3) current = {0, NAN, 0};
+}
+
+void NoaaListener::endObject(int depth)
+{
+  if (depth != 3 || !current.epoch || isnan(current.level)) return;
+  if (count && current.epoch <= found[count - 1].epoch) return;
+  if (count == NOAA_HILO_CAPACITY) memmove(found, found + 1, sizeof(TidePrediction) * --count);
+  found[count++] = current;
+}
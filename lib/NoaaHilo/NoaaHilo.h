@@ -0,0 +1,53 @@
+/**************************************************************************************
+
+  NOAA hilo predictions, read as the response streams in
+
+  A NoaaListener fed through a JsonStream picks the extremes out of the
+  CO-OPS response for product=predictions&interval=hilo:
+
+    {"predictions" : [{"t":"2025-06-01 03:12", "v":"3.921", "type":"H"}, ...]}
+
+  Each complete object with a time and a level is kept, in time order; one
+  that is not later than the last kept is ignored, and past NOAA_HILO_CAPACITY
+  the oldest make room. Errors come back as {"error": {"message": "..."}}:
+  error is set and the message kept. A response cut short keeps the extremes
+  that arrived whole, the JsonStream tells that it did not finish.
+
+  Times are read as GMT, the request asks for time_zone=gmt.
+
+  ***************************************************************************************/
+#ifndef _NOAA_HILO_H
+#define _NOAA_HILO_H
+
+#include <JsonStream.h>
+#include <stdint.h>
+
+#define NOAA_HILO_CAPACITY 40 // extremes, ~4 a day
+
+struct TidePrediction
+{
+  uint32_t epoch; // UTC seconds
+  float level;    // ft, in the datum of the request
+  char type;      // 'H' or 'L'
+};
+
+// "2025-06-01 03:12" in GMT to UTC seconds, 0 if it is not a time
+uint32_t parseNoaaTime(const char *s);
+
+class NoaaListener : public JsonListener
+{
+public:
+  TidePrediction found[NOAA_HILO_CAPACITY];
+  int count = 0;
+  bool error = false;
+  char message[JSON_MAX_VALUE + 1] = ""; // of the error
+
+  void value(int depth, const char *key, const char *value, bool quoted) override;
+  void startObject(int depth, const char *key) override;
+  void endObject(int depth) override;
+
+private:
+  TidePrediction current;
+};
+
+#endif
@@ -0,0 +1,63 @@
+/**************************************************************************************
+
+  Scoped timing spans -- see PerfSpan.h
+
+  ***************************************************************************************/
+#include "PerfSpan.h"
+
+PerfSpan *PerfSpan::registry = nullptr;
+
+// spans are globals: this runs during static initialisation, before any task
+PerfSpan::PerfSpan(const char *name) : name(name), link(nullptr)
+{
+  reset();
+  PerfSpan **tail = &registry;
+  while (*tail) tail = &(*tail)->link;
+  *tail = this;
+}
+
+void PerfSpan::reset()
+{
+  for (uint32_t &c : counts) c = 0;
+  n = largest = 0;
+  total = 0;
+}
+
+void PerfSpan::resetAll()
+{
+  for (PerfSpan *s = registry; s; s = s->link) s->reset();
+}
+
+uint32_t PerfSpan::bucketTop(int i)
+{
+  if (i < PERF_SUB_BUCKETS) return i;
+  int e = i / PERF_SUB_BUCKETS + PERF_SUB_BITS - 1;
+  uint64_t low = (uint64_t)(PERF_SUB_BUCKETS + i % PERF_SUB_BUCKETS) << (e - PERF_SUB_BITS);
+  return low + (1ULL << (e - PERF_SUB_BITS)) - 1;
+}
+
+uint32_t PerfSpan::percentile(float p) const
+{
+  if (!n) return 0;
+  uint32_t rank = (uint32_t)(p * n + 0.999f); // the sample at or above fraction p
+  if (rank < 1) rank = 1;
+  uint32_t seen = 0;
+  for (int i = 0; i < PERF_BUCKETS; i++)
+  {
+    seen += counts[i];
+    if (seen >= rank)
+    {
+      uint32_t top = bucketTop(i);
+      return top < largest ? top : largest;
+    }
+  }
+  return largest;
+}
+
+void PerfSpan::printAll(Print &out, uint32_t cyclesPerUs)
+{
+  out.printf("  %-10s %10s %10s %10s %10s %10s  (us)\r\n", "span", "count", "mean", "p50", "p99", "max");
+  for (PerfSpan *s = registry; s; s = s->link)
+    out.printf("  %-10s %10lu %10.1f %10.1f %10.1f %10.1f\r\n", s->name, (unsigned long)s->count(), (float)s->mean() / cyclesPerUs,
+               (float)s->percentile(0.5f) / cyclesPerUs, (float)s->percentile(0.99f) / cyclesPerUs, (float)s->max() / cyclesPerUs);
+}
@@ -0,0 +1,97 @@
+/**************************************************************************************
+
+  Scoped timing spans on the CPU cycle counter
+
+  A PerfSpan is a named global holding a histogram of how many cycles its
+  scopes took; PERF_SCOPE(span) times the rest of the enclosing block into it.
+  Entering and leaving a scope is two cycle counter reads, a count leading
+  zeros and three increments. Built with PERF_SPANS=0, PERF_SCOPE is nothing.
+
+  The histogram is log-linear: PERF_SUB_BUCKETS buckets per power of two, so a
+  percentile is the upper edge of its bucket and at most 1/PERF_SUB_BUCKETS
+  above the true value; the largest time is kept exactly. The cycle counter
+  wraps at 2^32, about 17 s at 240 MHz, longer scopes are not meaningful.
+
+  A span is recorded by one task; reset() from another can lose a count that
+  was in flight, nothing worse.
+
+  ***************************************************************************************/
+#ifndef _PERF_SPAN_H
+#define _PERF_SPAN_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+#ifndef PERF_SPANS
+#define PERF_SPANS 1
+#endif
+
+#define PERF_SUB_BUCKETS 4 // per power of two, power of two itself
+#define PERF_SUB_BITS 2    // log2(PERF_SUB_BUCKETS)
+#define PERF_BUCKETS ((32 - PERF_SUB_BITS + 1) * PERF_SUB_BUCKETS)
+
+class PerfSpan
+{
+public:
+  const char *const name;
+
+  explicit PerfSpan(const char *name);
+
+  void record(uint32_t cycles)
+  {
+    counts[bucket(cycles)]++;
+    n++;
+    total += cycles;
+    if (cycles > largest) largest = cycles;
+  }
+
+  uint32_t count() const { return n; }
+  uint32_t max() const { return largest; }
+  uint32_t mean() const { return n ? total / n : 0; }
+  uint32_t percentile(float p) const; // cycles, p in 0..1
+  void reset();
+
+  static PerfSpan *first() { return registry; }
+  PerfSpan *next() const { return link; }
+  static void resetAll();
+  static void printAll(Print &out, uint32_t cyclesPerUs); // a table in us
+
+  // values below PERF_SUB_BUCKETS have a bucket each, above that PERF_SUB_BUCKETS
+  // per power of two
+  static int bucket(uint32_t v)
+  {
+    if (v < PERF_SUB_BUCKETS) return v;
+    int e = 31 - __builtin_clz(v);
+    return (e - PERF_SUB_BITS + 1) * PERF_SUB_BUCKETS + ((v >> (e - PERF_SUB_BITS)) & (PERF_SUB_BUCKETS - 1));
+  }
+  static uint32_t bucketTop(int i); // largest value in bucket i
+
+private:
+  uint32_t counts[PERF_BUCKETS];
+  uint32_t n, largest;
+  uint64_t total;
+  PerfSpan *link;
+  static PerfSpan *registry;
+};
+
+// times its own lifetime into a span
+class PerfScope
+{
+public:
+  explicit PerfScope(PerfSpan &span) : span(span), start(ESP.getCycleCount()) {}
+  ~PerfScope() { span.record(ESP.getCycleCount() - start); }
+
+private:
+  PerfSpan &span;
+  const uint32_t start;
+};
+
+#define PERF_CONCAT2(a, b) a##b
+#define PERF_CONCAT(a, b) PERF_CONCAT2(a, b)
+#if PERF_SPANS
+#define PERF_SCOPE(span) PerfScope PERF_CONCAT(perfScope, __LINE__)(span)
+#else
+#define PERF_SCOPE(span) do {} while (0)
+#endif
+
+#endif
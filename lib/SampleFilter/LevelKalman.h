@@ -0,0 +1,128 @@
+/**************************************************************************************
+
+  Two-state Kalman filter: level and its rate of change from every sample
+
+  A boxcar mean over an interval is the level half an interval ago. This
+  tracks the distance d and its velocity v with a constant velocity model,
+  sample by sample, so the estimate is the level now and comes with a rate:
+
+    predict over dt     d += v dt, P = F P F' + Q, Q from a white noise
+                        acceleration of density q (cm^2/s^3)
+    update with z       innovation y = z - d, S = P00 + r^2, gain K = P[:,0] / S
+
+  q sets how fast the velocity may wander (the tide's acceleration is ~1e-6
+  cm/s^2), r is the 1-sigma noise of one sample in cm. A sample further than
+  KALMAN_GATE sigmas from the prediction is left out, as a spike; after
+  KALMAN_GATE_RESET of those in a row the level has moved (a sensor changed,
+  a long pause) and the filter restarts from the sample.
+
+  track() takes the sample's micros() instead of dt and keeps the clock: it
+  wraps, a sample a little older than the last (a burst hands over its
+  samples by sensor, not in time order) is taken without a predict step, and
+  a pause longer than TRACK_MAX_GAP_S restarts the filter, its velocity is
+  stale by then.
+
+  Five doubles of state, no allocation; units are the caller's (cm, s).
+
+  ***************************************************************************************/
+#ifndef _LEVEL_KALMAN_H
+#define _LEVEL_KALMAN_H
+
+#include <math.h>
+#include <stdint.h>
+
+#define KALMAN_GATE 5.0           // sigmas of the innovation that make a spike
+#define KALMAN_GATE_RESET 5       // spikes in a row that restart the filter
+#define KALMAN_VELOCITY_SIGMA 0.01 // cm/s, the velocity prior (36 cm/hr)
+#define TRACK_MAX_GAP_S 1800      // longer without samples and the velocity is stale
+
+class LevelKalman
+{
+public:
+  LevelKalman() : q(1e-9), r2(0.25), lastUs(0) { reset(); }
+
+  // q in cm^2/s^3, r in cm
+  void setNoise(double processQ, double sampleR)
+  {
+    q = processQ;
+    r2 = sampleR * sampleR;
+  }
+  double processNoise() const { return q; }
+  double sampleNoise() const { return sqrt(r2); }
+
+  void reset()
+  {
+    n = 0;
+    gated = 0;
+  }
+
+  // a sample z dt seconds after the previous one; false if it was gated out
+  bool update(double z, double dt)
+  {
+    if (!n)
+    {
+      start(z);
+      return true;
+    }
+    if (dt > 0)
+    {
+      d += v * dt;
+      p00 += dt * (2 * p01 + dt * p11) + q * dt * dt * dt / 3;
+      p01 += dt * p11 + q * dt * dt / 2;
+      p11 += q * dt;
+    }
+
+    double s = p00 + r2, y = z - d;
+    if (y * y > KALMAN_GATE * KALMAN_GATE * s)
+    {
+      if (++gated < KALMAN_GATE_RESET) return false;
+      start(z);
+      return true;
+    }
+    gated = 0;
+    n++;
+    double k0 = p00 / s, k1 = p01 / s;
+    d += k0 * y;
+    v += k1 * y;
+    p11 -= k1 * p01;
+    p00 *= 1 - k0;
+    p01 *= 1 - k0;
+    return true;
+  }
+
+  // a sample z taken at timeUs, micros() of the sample; false if it was gated out
+  bool track(double z, uint32_t timeUs)
+  {
+    uint32_t sinceUs = timeUs - lastUs;
+    double dt = sinceUs < 0x80000000UL ? sinceUs / 1e6 : 0; // older than the last: no step
+    if (n && dt > TRACK_MAX_GAP_S) reset();
+    if (dt > 0 || !n) lastUs = timeUs;
+    return update(z, dt);
+  }
+
+  int count() const { return n; }     // samples taken since the (re)start
+  double level() const { return d; }
+  double velocity() const { return v; }
+  double levelSigma() const { return sqrt(p00); }
+  double velocitySigma() const { return sqrt(p11); }
+
+private:
+  double q, r2;
+  double d, v;            // state
+  double p00, p01, p11;   // covariance
+  int n, gated;
+  uint32_t lastUs;        // of the newest sample, for track()
+
+  void start(double z)
+  {
+    d = z;
+    v = 0;
+    p00 = r2;
+    p01 = 0;
+    p11 = KALMAN_VELOCITY_SIGMA * KALMAN_VELOCITY_SIGMA;
+    n = 1;
+    gated = 0;
+  }
+};
+
+#endif
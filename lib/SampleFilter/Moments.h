@@ -0,0 +1,67 @@
+/**************************************************************************************
+
+  Exact running mean and variance of fixed-point samples
+
+  The textbook sum / sum of squares in floating point loses the variance to
+  cancellation once the mean is large against the spread, and a running float
+  average drifts as the count grows. Welford's update fixes the first in
+  floating point; with integer samples the same stability comes exactly:
+
+    - every sample is stored as its deviation from the first sample of the
+      interval, so the squares stay small however far the level is from zero
+    - the deviations and their squares are summed in 64 bit integers, which
+      never round: the sums after a million samples are the sums of those
+      million samples, in any order
+
+  mean() and variance() divide the exact sums once, when they are asked for.
+  With deviations below 2^17 (450 cm in Q8) the square sum holds 2^30 samples.
+
+  ***************************************************************************************/
+#ifndef _MOMENTS_H
+#define _MOMENTS_H
+
+#include <stdint.h>
+
+class Moments
+{
+public:
+  Moments() { reset(); }
+
+  void reset()
+  {
+    n = 0;
+    sum = 0;
+    sumSq = 0;
+  }
+
+  void add(int32_t x)
+  {
+    if (!n) ref = x;
+    int64_t d = (int64_t)x - ref;
+    n++;
+    sum += d;
+    sumSq += (uint64_t)(d * d);
+  }
+
+  uint32_t count() const { return n; }
+
+  // in sample units, 0 when empty
+  double mean() const { return n ? ref + (double)sum / n : 0; }
+
+  // sample variance (n - 1) in sample units squared, 0 with fewer than two
+  double variance() const
+  {
+    if (n < 2) return 0;
+    double m = (double)sum / n;
+    double v = ((double)sumSq - m * sum) / (n - 1);
+    return v > 0 ? v : 0;
+  }
+
+private:
+  uint32_t n;
+  int32_t ref;     // first sample, the deviations are taken from it
+  int64_t sum;     // of the deviations
+  uint64_t sumSq;  // of the squared deviations
+};
+
+#endif
@@ -0,0 +1,201 @@
+/**************************************************************************************
+
+  Fixed-capacity rolling median
+
+  Keeps the last `window` values (window <= N) in a ring and splits them across a
+  max-heap (lower half) and a min-heap (upper half) of ring slots. Each slot knows
+  where it sits in its heap, so evicting the oldest value is an in-place replace
+  followed by a sift: push() is O(log n), median() is O(1) and nothing is ever
+  allocated.
+
+  ***************************************************************************************/
+#ifndef _ROLLING_MEDIAN_H
+#define _ROLLING_MEDIAN_H
+
+#include <stdint.h>
+
+template <typename T, int N>
+class RollingMedian
+{
+public:
+  RollingMedian() { setWindow(N); }
+
+  // changes the window length (clamped to 1..N) and empties the filter
+  void setWindow(int w)
+  {
+    window = w < 1 ? 1 : (w > N ? N : w);
+    clear();
+  }
+  int getWindow() const { return window; }
+
+  void clear()
+  {
+    count = 0;
+    oldest = 0;
+    loSize = hiSize = 0;
+  }
+
+  int size() const { return count; }
+  bool full() const { return count == window; }
+
+  // raw access to the values in the window (ring order, not sorted)
+  const T *data() const { return values; }
+
+  void push(T x)
+  {
+    if (count == window)
+    {
+      // evict the oldest by overwriting its slot, then restore heap order
+      int s = oldest;
+      oldest = (oldest + 1) % window;
+      values[s] = x;
+      if (side[s] == LO)
+      {
+        siftUpLo(pos[s]);
+        siftDownLo(pos[s]);
+      }
+      else
+      {
+        siftUpHi(pos[s]);
+        siftDownHi(pos[s]);
+      }
+      if (hiSize && values[lo[0]] > values[hi[0]])
+      {
+        int a = lo[0], b = hi[0];
+        lo[0] = b, side[b] = LO, pos[b] = 0;
+        hi[0] = a, side[a] = HI, pos[a] = 0;
+        siftDownLo(0);
+        siftDownHi(0);
+      }
+      return;
+    }
+
+    int s = (oldest + count) % window;
+    values[s] = x;
+    count++;
+
+    // lower half keeps the extra element when the count is odd
+    if (loSize == hiSize)
+    {
+      pushHi(s);
+      moveTop(HI);
+    }
+    else
+    {
+      pushLo(s);
+      moveTop(LO);
+    }
+  }
+
+  T median() const
+  {
+    if (!count) return 0;
+    if (loSize > hiSize) return values[lo[0]];
+    return (values[lo[0]] + values[hi[0]]) / 2;
+  }
+
+private:
+  enum Side : uint8_t { LO, HI };
+
+  T values[N];
+  int lo[N], hi[N];     // heaps of slots
+  int pos[N];           // index of each slot inside its heap
+  Side side[N];         // heap each slot belongs to
+  int loSize, hiSize;
+  int count, oldest, window;
+
+  void place(int *heap, Side sd, int i, int s)
+  {
+    heap[i] = s;
+    side[s] = sd;
+    pos[s] = i;
+  }
+
+  void pushLo(int s)
+  {
+    place(lo, LO, loSize, s);
+    siftUpLo(loSize++);
+  }
+  void pushHi(int s)
+  {
+    place(hi, HI, hiSize, s);
+    siftUpHi(hiSize++);
+  }
+
+  // move the top of one heap to the other
+  void moveTop(Side from)
+  {
+    if (from == HI)
+    {
+      int s = hi[0];
+      place(hi, HI, 0, hi[--hiSize]);
+      siftDownHi(0);
+      pushLo(s);
+    }
+    else
+    {
+      int s = lo[0];
+      place(lo, LO, 0, lo[--loSize]);
+      siftDownLo(0);
+      pushHi(s);
+    }
+  }
+
+  // max-heap on the lower half
+  void siftUpLo(int i)
+  {
+    while (i > 0)
+    {
+      int p = (i - 1) / 2;
+      if (!(values[lo[i]] > values[lo[p]])) break;
+      int t = lo[i];
+      place(lo, LO, i, lo[p]);
+      place(lo, LO, p, t);
+      i = p;
+    }
+  }
+  void siftDownLo(int i)
+  {
+    for (;;)
+    {
+      int l = 2 * i + 1, r = l + 1, m = i;
+      if (l < loSize && values[lo[l]] > values[lo[m]]) m = l;
+      if (r < loSize && values[lo[r]] > values[lo[m]]) m = r;
+      if (m == i) break;
+      int t = lo[i];
+      place(lo, LO, i, lo[m]);
+      place(lo, LO, m, t);
+      i = m;
+    }
+  }
+
+  // min-heap on the upper half
+  void siftUpHi(int i)
+  {
+    while (i > 0)
+    {
+      int p = (i - 1) / 2;
+      if (!(values[hi[i]] < values[hi[p]])) break;
+      int t = hi[i];
+      place(hi, HI, i, hi[p]);
+      place(hi, HI, p, t);
+      i = p;
+    }
+  }
+  void siftDownHi(int i)
+  {
+    for (;;)
+    {
+      int l = 2 * i + 1, r = l + 1, m = i;
+      if (l < hiSize && values[hi[l]] < values[hi[m]]) m = l;
+      if (r < hiSize && values[hi[r]] < values[hi[m]]) m = r;
+      if (m == i) break;
+      int t = hi[i];
+      place(hi, HI, i, hi[m]);
+      place(hi, HI, m, t);
+      i = m;
+    }
+  }
+};
+
+#endif
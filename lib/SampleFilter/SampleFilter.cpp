@@ -0,0 +1,124 @@
+/**************************************************************************************
+
+  Streaming robust statistics -- see SampleFilter.h
+
+  ***************************************************************************************/
+#include "SampleFilter.h"
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#define HAMPEL_MIN_SAMPLES 5 // accept everything until the window has this many samples
+#define MAD_FLOOR (FILTER_SCALE / 4) // smallest MAD used (0.25 cm), keeps quantised readings from being rejected
+
+static const char *modeNames[FILTER_MODES] = {"mean", "median", "trimmed", "hampel"};
+
+SampleFilter::SampleFilter()
+{
+  mode = FILTER_HAMPEL;
+  trimFraction = 0.2f;
+  setHampel(11, 3.0f);
+  reset();
+}
+
+const char *SampleFilter::modeName(FilterMode m)
+{
+  return m < FILTER_MODES ? modeNames[m] : "?";
+}
+
+bool SampleFilter::parseMode(const char *name, FilterMode &m)
+{
+  for (int i = 0; i < FILTER_MODES; i++)
+  {
+    if (strcasecmp(name, modeNames[i]) == 0)
+    {
+      m = (FilterMode)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+void SampleFilter::setHampel(int w, float k)
+{
+  window.setWindow(std::max(3, std::min(w, HAMPEL_MAX_WINDOW)));
+  hampelK = k;
+}
+
+void SampleFilter::setTrimFraction(float f)
+{
+  trimFraction = std::max(0.0f, std::min(f, 0.45f));
+}
+
+void SampleFilter::reset()
+{
+  accepted = 0;
+  rejectedCount = 0;
+  moments.reset();
+  intervalMedian.clear();
+}
+
+// Hampel identifier against the raw history, O(w) for the MAD (w <= 31)
+bool SampleFilter::isOutlier(int32_t x)
+{
+  if (window.size() < HAMPEL_MIN_SAMPLES) return false;
+
+  int32_t med = window.median();
+  int n = window.size();
+  const int32_t *v = window.data();
+  for (int i = 0; i < n; i++) scratch[i] = abs(v[i] - med);
+  std::nth_element(scratch, scratch + n / 2, scratch + n);
+  int32_t mad = std::max(scratch[n / 2], (int32_t)MAD_FLOOR);
+
+  return abs(x - med) > hampelK * 1.4826f * mad;
+}
+
+bool SampleFilter::add(int32_t x)
+{
+  bool outlier = mode == FILTER_HAMPEL && isOutlier(x);
+  window.push(x);
+  if (outlier)
+  {
+    rejectedCount++;
+    return false;
+  }
+
+  samples[accepted % FILTER_CAPACITY] = x;
+  accepted++;
+  moments.add(x);
+  intervalMedian.push(x);
+  return true;
+}
+
+double SampleFilter::estimate()
+{
+  if (!accepted) return 0;
+
+  switch (mode)
+  {
+  case FILTER_MEDIAN:
+    return intervalMedian.median();
+
+  case FILTER_TRIMMED:
+  {
+    int n = std::min(accepted, FILTER_CAPACITY);
+    std::copy(samples, samples + n, scratch);
+    std::sort(scratch, scratch + n);
+    int cut = (int)(n * trimFraction);
+    int64_t s = 0;
+    for (int i = cut; i < n - cut; i++) s += scratch[i];
+    return (double)s / (n - 2 * cut);
+  }
+
+  case FILTER_MEAN:
+  case FILTER_HAMPEL:
+  default:
+    return moments.mean();
+  }
+}
+
+double SampleFilter::stddev() const
+{
+  return sqrt(moments.variance());
+}
@@ -0,0 +1,85 @@
+/**************************************************************************************
+
+  Streaming robust statistics for one publish interval of sensor samples
+
+  Every sample goes through add(), which may reject it (Hampel mode), and the
+  interval is summarised by estimate() using the selected mode:
+
+    mean     plain mean of all samples (the historical behaviour)
+    median   median of the interval
+    trimmed  mean after dropping the trimFraction lowest and highest samples
+    hampel   mean of the samples that pass a Hampel identifier: a sample is
+             rejected when it is more than k * 1.4826 * MAD away from the median
+             of the last `window` raw samples
+
+  Samples are fixed point, Q8 cm (1/256 cm, see echoToQ8() in SpeedOfSound.h):
+  the median, the trimmed sum and the mean and variance (Moments.h) are kept
+  in integers, so an interval of any length sums without rounding. Only the
+  estimate leaves as a double.
+
+  The median and trimmed modes keep the last FILTER_CAPACITY samples: an
+  interval longer than that is summarised by its last FILTER_CAPACITY. The
+  adaptive schedule (SampleScheduler.cpp) keeps intervals within it.
+
+  All storage is fixed at compile time; nothing is allocated.
+
+  ***************************************************************************************/
+#ifndef _SAMPLE_FILTER_H
+#define _SAMPLE_FILTER_H
+
+#include "Moments.h"
+#include "RollingMedian.h"
+
+#define FILTER_CAPACITY 64      // samples kept per interval for median / trimmed mean
+#define HAMPEL_MAX_WINDOW 31    // longest Hampel window
+#define FILTER_SCALE 256        // samples per cm, Q8
+
+enum FilterMode
+{
+  FILTER_MEAN,
+  FILTER_MEDIAN,
+  FILTER_TRIMMED,
+  FILTER_HAMPEL,
+  FILTER_MODES
+};
+
+class SampleFilter
+{
+public:
+  SampleFilter();
+
+  void setMode(FilterMode m) { mode = m; }
+  FilterMode getMode() const { return mode; }
+  static const char *modeName(FilterMode m);
+  static bool parseMode(const char *name, FilterMode &m); // case insensitive
+
+  void setHampel(int window, float k);  // window is clamped to 3..HAMPEL_MAX_WINDOW
+  void setTrimFraction(float f);        // 0 .. 0.45 from each end
+
+  bool add(int32_t x);     // Q8 cm; false if the sample was rejected as an outlier
+  double estimate();       // robust estimate of the interval in Q8 cm, 0 when empty
+  double stddev() const;   // spread of the accepted samples in Q8 cm, 0 with fewer than two
+  int count() const { return accepted; }
+  int rejected() const { return rejectedCount; }
+  void reset();            // start a new interval; the Hampel history is kept
+
+private:
+  FilterMode mode;
+  float trimFraction;
+  float hampelK;
+
+  // interval
+  int accepted;
+  int rejectedCount;
+  Moments moments;
+  int32_t samples[FILTER_CAPACITY]; // ring of the most recent accepted samples
+  RollingMedian<int32_t, FILTER_CAPACITY> intervalMedian;
+
+  // Hampel history, raw samples across intervals
+  RollingMedian<int32_t, HAMPEL_MAX_WINDOW> window;
+  int32_t scratch[FILTER_CAPACITY];
+
+  bool isOutlier(int32_t x);
+};
+
+#endif
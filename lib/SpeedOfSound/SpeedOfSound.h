@@ -0,0 +1,109 @@
+/**************************************************************************************
+
+  Temperature-compensated echo time to distance conversion
+
+  The speed of sound in dry air is 331.3 * sqrt(1 + T / 273.15) m/s, about 2%
+  apart between a winter and a summer afternoon. The half speed (round trip)
+  is tabulated at compile time every SOUND_TEMP_STEP degrees in Q32 cm/us, so
+  nothing on the device evaluates the square root:
+
+    - soundFactor(tempC) interpolates the table once per temperature change
+    - echoToCm(width, factor) is then a single 64 bit multiply per sample,
+      echoToQ8(width, factor) the same in Q8 cm for the integer filter path
+
+  The static_asserts at the bottom check the interpolated table against its
+  own constexpr square root at compile time; test/test_speed_of_sound checks
+  the factor and the conversions against the formula in double, past both
+  ends of the table and over every echo width.
+
+  ***************************************************************************************/
+#ifndef _SPEED_OF_SOUND_H
+#define _SPEED_OF_SOUND_H
+
+#include <stdint.h>
+
+#define SOUND_TEMP_MIN -40 // degC, lower end of the table
+#define SOUND_TEMP_MAX 60  // degC, upper end of the table
+#define SOUND_TEMP_STEP 2  // degC between two entries
+#define SOUND_TABLE_SIZE ((SOUND_TEMP_MAX - SOUND_TEMP_MIN) / SOUND_TEMP_STEP + 1)
+
+namespace sound
+{
+  constexpr double sqrtNewton(double x)
+  {
+    double r = x > 1 ? x : 1;
+    for (int i = 0; i < 40; i++) r = (r + x / r) / 2;
+    return r;
+  }
+
+  // exact half speed of sound in cm/us at tempC
+  constexpr double halfSpeed(double tempC)
+  {
+    return 331.3 * sqrtNewton(1 + tempC / 273.15) * 1e-4 / 2;
+  }
+
+  constexpr double Q32 = 4294967296.0;
+
+  struct Table
+  {
+    uint32_t q[SOUND_TABLE_SIZE]; // half speed in Q32 cm/us
+  };
+
+  constexpr Table makeTable()
+  {
+    Table t{};
+    for (int i = 0; i < SOUND_TABLE_SIZE; i++)
+      t.q[i] = (uint32_t)(halfSpeed(SOUND_TEMP_MIN + i * SOUND_TEMP_STEP) * Q32 + 0.5);
+    return t;
+  }
+
+  constexpr Table table = makeTable();
+
+  // Q32 half speed at tempC, clamped to the table range
+  constexpr uint32_t factor(float tempC)
+  {
+    float x = (tempC - SOUND_TEMP_MIN) / SOUND_TEMP_STEP;
+    if (!(x > 0)) return table.q[0];
+    if (x >= SOUND_TABLE_SIZE - 1) return table.q[SOUND_TABLE_SIZE - 1];
+    int i = (int)x;
+    return table.q[i] + (uint32_t)((table.q[i + 1] - table.q[i]) * (x - i) + 0.5f);
+  }
+
+  // largest relative error of factor() against halfSpeed(), probed every 0.1 degC
+  constexpr double maxTableError()
+  {
+    double worst = 0;
+    for (int t = SOUND_TEMP_MIN * 10; t <= SOUND_TEMP_MAX * 10; t++)
+    {
+      double exact = halfSpeed(t / 10.0);
+      double e = factor(t / 10.0f) / Q32 / exact - 1;
+      if (e < 0) e = -e;
+      if (e > worst) worst = e;
+    }
+    return worst;
+  }
+}
+
+// Q32 half speed of sound for an air temperature, update it when the temperature changes
+inline uint32_t soundFactor(float tempC) { return sound::factor(tempC); }
+
+// one way distance in cm of an echo width in us
+inline float echoToCm(uint32_t widthUs, uint32_t factor)
+{
+  return (float)(((uint64_t)widthUs * factor) >> 16) * (1.0f / 65536);
+}
+
+// one way distance in Q8 cm (1/256 cm), rounded; 450 cm is 115200
+inline int32_t echoToQ8(uint32_t widthUs, uint32_t factor)
+{
+  return (int32_t)(((uint64_t)widthUs * factor + (1u << 23)) >> 24);
+}
+
+// the historical 0.0343 cm/us is the speed of sound at 20 degC
+static_assert(sound::table.q[(20 - SOUND_TEMP_MIN) / SOUND_TEMP_STEP] / sound::Q32 > 0.01715 &&
+                  sound::table.q[(20 - SOUND_TEMP_MIN) / SOUND_TEMP_STEP] / sound::Q32 < 0.01717,
+              "speed of sound table is off at 20 degC");
+// 1e-5 of a 4 m range is 0.04 mm
+static_assert(sound::maxTableError() < 1e-5, "speed of sound table interpolation is off by more than 10 ppm");
+
+#endif
@@ -0,0 +1,64 @@
+/**************************************************************************************
+
+  Lock-free single producer / single consumer ring
+
+  One task pushes, one other task pops; neither ever blocks or takes a lock,
+  so the producer can live on one core and the consumer on the other. head is
+  only written by the producer and tail only by the consumer; the release
+  store of one index publishes the slot it covers to the acquire load on the
+  other side. The indices run freely and wrap at 2^32, N must be a power of two.
+
+  push() fails instead of overwriting when the ring is full: the producer keeps
+  its cadence and the loss is counted in dropped().
+
+  ***************************************************************************************/
+#ifndef _SPSC_QUEUE_H
+#define _SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+template <typename T, size_t N>
+class SpscQueue
+{
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+public:
+  // producer side
+  bool push(const T &item)
+  {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == N)
+    {
+      drops.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    buffer[h & (N - 1)] = item;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer side
+  bool pop(T &item)
+  {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) return false;
+    item = buffer[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // either side, a snapshot
+  size_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+  static constexpr size_t capacity() { return N; }
+  uint32_t dropped() const { return drops.load(std::memory_order_relaxed); }
+
+private:
+  T buffer[N];
+  std::atomic<uint32_t> head{0}; // next slot to fill
+  std::atomic<uint32_t> tail{0}; // next slot to drain
+  std::atomic<uint32_t> drops{0};
+};
+
+#endif
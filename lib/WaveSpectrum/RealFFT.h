@@ -0,0 +1,121 @@
+/**************************************************************************************
+
+  Fixed-size radix-2 FFT of real samples
+
+  A real series of n points is transformed as n/2 complex points (the even
+  samples as real parts, the odd ones as imaginary), followed by the split
+  that separates the two interleaved spectra. That halves the work and the
+  memory of a complex transform of the real data.
+
+  The twiddle factors exp(-2 pi i j / N) for every size up to N are computed
+  once, by the constructor; a smaller power of two n uses every (N/n)th of
+  them. transform() works in place, allocates nothing and takes
+  O(n log n) multiplies whatever the data, so it can run next to the sampling
+  in bounded time.
+
+  The result is packed in the n floats of the input:
+      x[0]          X[0]     (real)
+      x[1]          X[n/2]   (real, Nyquist)
+      x[2k], x[2k+1] Re X[k], Im X[k]   for 0 < k < n/2
+  with X[k] = sum x[t] exp(-2 pi i k t / n), unscaled.
+
+  ***************************************************************************************/
+#ifndef _REAL_FFT_H
+#define _REAL_FFT_H
+
+#include <math.h>
+
+template <int N>
+class RealFFT
+{
+  static_assert(N >= 4 && (N & (N - 1)) == 0, "the FFT size is a power of two");
+
+public:
+  RealFFT()
+  {
+    for (int j = 0; j < N / 2; j++)
+    {
+      cosTable[j] = cos(2 * M_PI * j / N);
+      sinTable[j] = sin(2 * M_PI * j / N);
+    }
+  }
+
+  static constexpr int maxSize = N;
+
+  static bool validSize(int n) { return n >= 4 && n <= N && (n & (n - 1)) == 0; }
+
+  // transform x[0..n-1] in place, see the packing above; false if n is not a
+  // power of two in 4..N
+  bool transform(float *x, int n) const
+  {
+    if (!validSize(n)) return false;
+    int m = n / 2;
+    complexTransform(x, m);
+
+    // split: X[k] = E[k] + W^k O[k] and X[m-k] = conj(E[k] - W^k O[k]), with E and
+    // O the spectra of the even and odd samples, from Z[k] and Z[m-k]
+    int step = N / n;
+    for (int k = 1; k <= m / 2; k++)
+    {
+      float a = x[2 * k], b = x[2 * k + 1];
+      float c = x[2 * (m - k)], d = x[2 * (m - k) + 1];
+      float er = (a + c) / 2, ei = (b - d) / 2;
+      float or_ = (b + d) / 2, oi = (c - a) / 2;
+      float wr = cosTable[k * step], wi = -sinTable[k * step];
+      float tr = wr * or_ - wi * oi, ti = wr * oi + wi * or_;
+      x[2 * k] = er + tr;
+      x[2 * k + 1] = ei + ti;
+      x[2 * (m - k)] = er - tr;
+      x[2 * (m - k) + 1] = ti - ei;
+    }
+    float z0r = x[0], z0i = x[1];
+    x[0] = z0r + z0i;
+    x[1] = z0r - z0i;
+    return true;
+  }
+
+  // |X[k]|^2 for 0 <= k <= n/2 of a packed result
+  static float power(const float *x, int n, int k)
+  {
+    if (k == 0) return x[0] * x[0];
+    if (k == n / 2) return x[1] * x[1];
+    return x[2 * k] * x[2 * k] + x[2 * k + 1] * x[2 * k + 1];
+  }
+
+private:
+  float cosTable[N / 2];
+  float sinTable[N / 2];
+
+  // in place over m complex points (re, im interleaved), m a power of two
+  void complexTransform(float *z, int m) const
+  {
+    for (int i = 1, j = 0; i < m; i++)
+    {
+      int bit = m >> 1;
+      for (; j & bit; bit >>= 1) j ^= bit;
+      j |= bit;
+      if (i < j)
+      {
+        float re = z[2 * i], im = z[2 * i + 1];
+        z[2 * i] = z[2 * j], z[2 * i + 1] = z[2 * j + 1];
+        z[2 * j] = re, z[2 * j + 1] = im;
+      }
+    }
+
+    for (int len = 2; len <= m; len <<= 1)
+    {
+      int half = len / 2, step = N / len;
+      for (int i = 0; i < m; i += len)
+        for (int j = 0; j < half; j++)
+        {
+          float wr = cosTable[j * step], wi = -sinTable[j * step];
+          float *p = z + 2 * (i + j), *q = z + 2 * (i + j + half);
+          float tr = wr * q[0] - wi * q[1], ti = wr * q[1] + wi * q[0];
+          q[0] = p[0] - tr, q[1] = p[1] - ti;
+          p[0] += tr, p[1] += ti;
+        }
+    }
+  }
+};
+
+#endif
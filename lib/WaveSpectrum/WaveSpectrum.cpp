@@ -0,0 +1,112 @@
+/**************************************************************************************
+
+  Wave statistics from range samples -- see WaveSpectrum.h
+
+  ***************************************************************************************/
+#include "WaveSpectrum.h"
+#include <algorithm>
+#include <math.h>
+
+#define MAD_FLOOR_CM 0.25f             // smallest MAD used, a flat sea is not all spikes
+#define SEA_WATER_RHO_G (1025 * 9.81f) // N/m^3
+
+// linear interpolation over the NAN runs, the ends repeat the nearest sample;
+// returns the samples filled, n if there were none to fill from
+int WaveSpectrum::fillGaps(float *x, int n)
+{
+  int filled = 0, last = -1;
+  for (int i = 0; i <= n; i++)
+  {
+    if (i < n && isnan(x[i])) continue;
+    int gap = i - last - 1;
+    if (gap > 0)
+    {
+      if (last < 0 && i == n) return n;
+      for (int j = last + 1; j < i; j++)
+        x[j] = last < 0 ? x[i] : i == n ? x[last] : x[last] + (x[i] - x[last]) * (j - last) / (i - last);
+      filled += gap;
+    }
+    last = i;
+  }
+  return filled;
+}
+
+float WaveSpectrum::median(const float *x, int n)
+{
+  std::copy(x, x + n, scratch);
+  std::nth_element(scratch, scratch + n / 2, scratch + n);
+  return scratch[n / 2];
+}
+
+bool WaveSpectrum::analyse(float *x, int n, float hz, WaveStats &stats)
+{
+  if (!fft.validSize(n) || !(hz > 0)) return false;
+
+  int missing = 0;
+  for (int i = 0; i < n; i++)
+    if (isnan(x[i])) missing++;
+  if (missing > n * (1 - WAVE_MIN_VALID)) return false;
+  stats.samples = n;
+  stats.filled = fillGaps(x, n);
+
+  // spikes: a bird or a piling, not the surface
+  float mid = median(x, n);
+  for (int i = 0; i < n; i++) scratch[i] = fabsf(x[i] - mid);
+  std::nth_element(scratch, scratch + n / 2, scratch + n);
+  float limit = WAVE_SPIKE_SIGMA * 1.4826f * std::max(scratch[n / 2], MAD_FLOOR_CM);
+  int spikes = 0;
+  for (int i = 0; i < n; i++)
+    if (fabsf(x[i] - mid) > limit) x[i] = NAN, spikes++;
+  if (spikes)
+  {
+    if (stats.filled + spikes > n * (1 - WAVE_MIN_VALID)) return false;
+    stats.filled += fillGaps(x, n);
+  }
+
+  // remove the line, then the Hann window; t is centred so the slope and the mean separate
+  double sx = 0, stx = 0, stt = 0, c = (n - 1) / 2.0;
+  for (int i = 0; i < n; i++)
+  {
+    sx += x[i];
+    stx += (i - c) * x[i];
+    stt += (i - c) * (i - c);
+  }
+  double mean = sx / n, slope = stx / stt, windowPower = 0;
+  for (int i = 0; i < n; i++)
+  {
+    float w = 0.5f - 0.5f * cosf(2 * (float)M_PI * i / n);
+    x[i] = (x[i] - mean - slope * (i - c)) * w;
+    windowPower += w * w;
+  }
+
+  fft.transform(x, n);
+
+  // one-sided density S_k = 2 |X_k|^2 / (hz * sum w^2), and m0 = sum S_k * hz / n
+  int from = std::max(1, (int)ceilf(WAVE_MIN_HZ * n / hz)), peak = 0;
+  float peakPower = 0;
+  double m0 = 0;
+  for (int k = from; k <= n / 2; k++)
+  {
+    float p = RealFFT<WAVE_FFT_SIZE>::power(x, n, k);
+    m0 += k < n / 2 ? 2 * p : p;
+    if (p > peakPower) peakPower = p, peak = k;
+  }
+  m0 /= n * windowPower;
+
+  stats.m0 = m0;
+  stats.hsCm = 4 * sqrt(m0);
+  stats.energy = SEA_WATER_RHO_G * m0 * 1e-4f;
+  stats.peakS = 0;
+  if (peak)
+  {
+    float k = peak;
+    if (peak > from && peak < n / 2)
+    {
+      float a = RealFFT<WAVE_FFT_SIZE>::power(x, n, peak - 1), b = RealFFT<WAVE_FFT_SIZE>::power(x, n, peak + 1);
+      float curve = a - 2 * peakPower + b;
+      if (curve < 0) k += 0.5f * (a - b) / curve;
+    }
+    stats.peakS = n / (k * hz);
+  }
+  return true;
+}
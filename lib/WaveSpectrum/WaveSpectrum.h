@@ -0,0 +1,62 @@
+/**************************************************************************************
+
+  Wave statistics from a burst of evenly spaced range samples
+
+  analyse() takes n samples (a power of two up to WAVE_FFT_SIZE) taken hz
+  apart, in cm, with NAN where a ping gave nothing, and works on them in place:
+
+    1. gaps are filled by linear interpolation between their neighbours
+    2. spikes, more than WAVE_SPIKE_SIGMA robust sigmas (1.4826 * MAD) from the
+       median, are taken out and filled the same way
+    3. the least squares line is removed: the mean level and the tide across
+       the window are not waves
+    4. a Hann window, then the real FFT (RealFFT.h)
+    5. the one-sided spectral density S(f), corrected for the window's power,
+       from WAVE_MIN_HZ (swell of 25 s) to the Nyquist frequency
+
+  From S(f):
+    m0      zeroth moment, the variance of the surface, cm^2
+    Hs      significant wave height 4 * sqrt(m0), cm
+    Tp      peak period, 1 / the frequency of the largest S(f), refined by a
+            parabola through the peak bin and its neighbours, s
+    energy  rho * g * m0 of sea water, J/m^2
+
+  Everything is sized at compile time and nothing is allocated.
+
+  ***************************************************************************************/
+#ifndef _WAVE_SPECTRUM_H
+#define _WAVE_SPECTRUM_H
+
+#include "RealFFT.h"
+
+#define WAVE_FFT_SIZE 512       // most samples in one analysis
+#define WAVE_MIN_HZ 0.04f       // lowest frequency counted as waves
+#define WAVE_SPIKE_SIGMA 4.0f   // robust sigmas from the median that make a spike
+#define WAVE_MIN_VALID 0.75f    // share of the samples that must be there
+
+struct WaveStats
+{
+  float m0;       // cm^2
+  float hsCm;     // significant wave height
+  float peakS;    // peak period, 0 when no band has energy
+  float energy;   // J/m^2
+  int samples;    // n
+  int filled;     // gaps and spikes interpolated
+};
+
+class WaveSpectrum
+{
+public:
+  // in place over x[0..n-1]; false when n is not a power of two in 4..WAVE_FFT_SIZE
+  // or fewer than WAVE_MIN_VALID of the samples are there
+  bool analyse(float *x, int n, float hz, WaveStats &stats);
+
+private:
+  RealFFT<WAVE_FFT_SIZE> fft;
+  float scratch[WAVE_FFT_SIZE]; // for the median and MAD
+
+  static int fillGaps(float *x, int n);
+  float median(const float *x, int n);
+};
+
+#endif
@@ -9,6 +9,7 @@
   (c) 2014 Deligent LLC - All rights reserved
   ***************************************************************************************/
 #include <dConsole.h>
+#include <lwip/sockets.h>
 
 
 dConsole::dConsole()
@@ -17,11 +18,20 @@ dConsole::dConsole()
 	telnetPort = 0;
 	server = NULL;
 	udpPort = 0;
+	udpLength = udpLineEnd = 0;
+	udpSeq = 0;
+	udpSent = udpFailed = 0;
 	readFlag = false;
 	tempBuffer[0] = 0;
 	commandString[0] = 0;
 	parameterString[0] = 0;
 	bufferCount = 0;
+	for (Session &s : sessions) s.open = false, s.lineCount = 0, s.outHead = s.outTail = 0;
+	sessionCount = 0;
+	commandSession = -1;
+	nextSession = 0;
+	outDropped = 0;
+	overflowPolicy = CONSOLE_DROP_OLDEST;
 }
 
 
@@ -67,6 +77,7 @@ void dConsole::disableTelnet()
 {
 	if (server)
 	{
+		for (Session &s : sessions) if (s.open) closeSession(s);
 		server = NULL;
 		telnetPort = 0;
 		this->println("[Console is deactivate on telnet port]");
@@ -74,22 +85,63 @@ void dConsole::disableTelnet()
 	}
 }
 
+// closes the session that typed the command being handled, all of them when it
+// came from the serial port
 void dConsole::closeTelnetConnection()
 {
-	if (client) client.stop();
+	if (commandSession >= 0)
+	{
+		if (sessions[commandSession].open) closeSession(sessions[commandSession]);
+		return;
+	}
+	for (Session &s : sessions) if (s.open) closeSession(s);
+}
+
+void dConsole::openSession(WiFiClient &client)
+{
+	for (Session &s : sessions)
+	{
+		if (s.open) continue;
+		s.client = client;
+		s.open = true;
+		s.lineCount = 0;
+		s.line[0] = 0;
+		s.outHead = s.outTail = 0;
+		sessionCount++;
+		const char *hello = "Connected to [RED] debug console\r\n'?' for more, 'exit' to exit\r\n[RED]> ";
+		queueOutput(s, (const uint8_t *)hello, strlen(hello));
+		drain(s);
+		return;
+	}
+	client.print("[RED] console busy, try again later\r\n");
+	client.stop();
+}
+
+void dConsole::closeSession(Session &s)
+{
+	drain(s); // the goodbye, if the socket takes it
+	s.client.stop();
+	s.open = false;
+	s.outTail = s.outHead;
+	s.lineCount = 0;
+	sessionCount--;
 }
 
 void dConsole::enableUDP(IPAddress localIP, int port)
 {
-	udpPort = port;
+	if (udpPort && udpLength) sendUDP(udpLength);
 	sprintf(broadcastIP, "%d.%d.%d.255", localIP[0], localIP[1], localIP[2]);
-	this->print("UDP: ");
-	this->println(broadcastIP);
+	udpLength = udpLineEnd = 0;
+	udpSent = udpFailed = 0;
+	udpPort = port;
+	this->printf("[Console is activated on UDP %s:%d]\r\n", broadcastIP, udpPort);
 }
 void dConsole::disableUDP()
 {
-	udpPort = 0;
+	if (!udpPort) return;
 	this->println("[Console is deactivate on UDP port]");
+	if (udpLength) sendUDP(udpLength);
+	udpPort = 0;
 }
 
 // Stream -- Parent class implementation
@@ -118,71 +170,36 @@ void dConsole::begin() {
 
 void dConsole::stop() {
 
+  for (Session &s : sessions) if (s.open) closeSession(s);
   server->stop();
 
 }
 
-// checks if we have an active telent connection
+// checks if we have an active telent connection; sessions are accepted and
+// dropped by check(), this does not poll the server
 bool dConsole::isTelnetConnected() {
 
-    if (telnetPort)
-    {
-		//if (server->status() == CLOSED) return false;
-
-		if (!client) client = server->available();
-	
-		if (client) {
-
-		  if (client.connected()) return true;
-		}
-	}
-	return false;
+	return sessionCount > 0;
 }
 
+int dConsole::telnetSessions() { return sessionCount; }
 
- boolean dConsole::disconnected() {
-
-
-    // FIRST: check for Telnet connection
-    if (telnetPort)
-    {
-		//if (server->status() == CLOSED) return true;
-
-		// if we don't have a client, check to see if we have one.
-		// then flush the queue so we don't get weird characters
-		if (!client) 
-		{
-			client = server->available();
-			client.flush();
-		}
-	
-
-		if (client) {
-
-		  if (client.connected()) return false;
-
-		  // client is not connected, stop and get a new one
-		  client.stop();
-		  client = server->available();
-		  client.flush();
 
-		}
-	}
-
-    if (serial) return false; // also connected if serial is enabled
+ boolean dConsole::disconnected() {
 
-	return true;
+	return !sessionCount && !serial;
 }
 
 
+// raw input: the first session with bytes waiting, then the serial port
 int dConsole::read() {
 
   if (disconnected()) return -1;
 
-  if (client.connected()) 
-	return client.read();
-  else
-	return serial->read();
+  for (Session &s : sessions)
+	if (s.open && s.client.available()) return s.client.read();
+  if (serial) return serial->read();
+  return -1;
 
 }
 
@@ -192,7 +209,8 @@ int dConsole::available() {
 
   if (this->disconnected())  return 0;
 
-  if (client) if (client.available()) return client.available();
+  for (Session &s : sessions)
+	if (s.open && s.client.available()) return s.client.available();
   if (serial) if (serial->available()) return serial->available();
 
   return 0;
@@ -211,33 +229,216 @@ int dConsole::peek() {
 
 
 size_t dConsole::write(uint8_t val) {
-size_t result=0;
 
-  if (disconnected()) return 1;
+  return write(&val, 1);
+
+}
+
+
+
+// serial gets the bytes right away (the UART driver buffers them), every telnet
+// session through its ring: a line end or a full chunk sends it, check() sends
+// the rest
+size_t dConsole::write(const uint8_t *buffer, size_t size) {
+
+	if (serial) serial->write(buffer, size);
+
+	if (udpPort) queueUDP(buffer, size);
+
+	if (sessionCount)
+	{
+		bool lineEnd = memchr(buffer, '\n', size) != NULL;
+		for (Session &s : sessions)
+		{
+			if (!s.open) continue;
+			queueOutput(s, buffer, size);
+			if (lineEnd || s.outHead - s.outTail >= CONSOLE_OUT_CHUNK) drain(s);
+		}
+	}
+
+	return size;
+
+}
+
+
+
+void dConsole::queueOutput(Session &s, const uint8_t *buffer, size_t size)
+{
+	size_t room = CONSOLE_OUT_SIZE - (s.outHead - s.outTail);
+	if (size > room)
+	{
+		drain(s);
+		room = CONSOLE_OUT_SIZE - (s.outHead - s.outTail);
+	}
+	if (size > room)
+	{
+		if (overflowPolicy == CONSOLE_DROP_NEWEST)
+		{
+			outDropped += size - room;
+			size = room;
+		}
+		else
+		{
+			// the newest output wins: drop queued bytes, and the head of the write
+			// itself if it is larger than the whole ring
+			if (size > CONSOLE_OUT_SIZE)
+			{
+				outDropped += size - CONSOLE_OUT_SIZE;
+				buffer += size - CONSOLE_OUT_SIZE;
+				size = CONSOLE_OUT_SIZE;
+			}
+			size_t drop = size - (CONSOLE_OUT_SIZE - (s.outHead - s.outTail));
+			outDropped += drop;
+			s.outTail += drop;
+		}
+	}
+
+	// at most two copies, before and after the wrap
+	size_t at = s.outHead & (CONSOLE_OUT_SIZE - 1);
+	size_t first = size < CONSOLE_OUT_SIZE - at ? size : CONSOLE_OUT_SIZE - at;
+	memcpy(s.outBuffer + at, buffer, first);
+	memcpy(s.outBuffer, buffer + first, size - first);
+	s.outHead += size;
+}
+
+
+
+// what the socket takes right now. WiFiClient::write() waits for room, up to ten
+// 1 s selects, so a peer that stopped reading would hold up the caller and every
+// other session; a send that would block returns -1 instead
+static size_t sendNow(WiFiClient &client, const uint8_t *buffer, size_t size)
+{
+	ssize_t sent = lwip_send(client.fd(), buffer, size, MSG_DONTWAIT);
+	return sent > 0 ? sent : 0;
+}
+
+// one send per contiguous run of the ring; whatever the socket does not take
+// stays queued for the next call
+void dConsole::drain(Session &s)
+{
+	while (s.outHead != s.outTail)
+	{
+		if (!s.client.connected())
+		{
+			s.outTail = s.outHead; // nobody left to read it, check() closes the session
+			return;
+		}
+		size_t at = s.outTail & (CONSOLE_OUT_SIZE - 1);
+		size_t run = s.outHead - s.outTail;
+		if (run > CONSOLE_OUT_SIZE - at) run = CONSOLE_OUT_SIZE - at;
+		size_t sent = sendNow(s.client, s.outBuffer + at, run);
+		s.outTail += sent;
+		if (sent < run) return; // socket buffer full
+	}
+}
+
+void dConsole::drain()
+{
+	for (Session &s : sessions)
+		if (s.open) drain(s);
+}
+
+
+
+// fills the datagram; a full one goes out up to its last line end and the
+// partial line starts the next one, a single line longer than a datagram is cut
+void dConsole::queueUDP(const uint8_t *buffer, size_t size)
+{
+	while (size)
+	{
+		if (!udpLength) udpStart = millis();
+		size_t room = sizeof(udpBuffer) - udpLength;
+		size_t n = size < room ? size : room;
+		memcpy(udpBuffer + udpLength, buffer, n);
+		for (size_t i = n; i > 0; i--)
+			if (buffer[i - 1] == '\n')
+			{
+				udpLineEnd = udpLength + i;
+				break;
+			}
+		udpLength += n;
+		buffer += n;
+		size -= n;
+		if (udpLength == sizeof(udpBuffer)) sendUDP(udpLineEnd ? udpLineEnd : udpLength);
+	}
+}
+
+// one datagram of the first length bytes, the rest moves to the front
+void dConsole::sendUDP(size_t length)
+{
+	char header[32];
+	int n = snprintf(header, sizeof(header), "#RED %lu %lu\n", (unsigned long)udpSeq++, millis());
+	bool sent = udp.beginPacket(broadcastIP, udpPort);
+	if (sent)
+	{
+		udp.write((const uint8_t *)header, n);
+		udp.write((const uint8_t *)udpBuffer, length);
+		sent = udp.endPacket();
+	}
+	if (sent) udpSent++;
+	else udpFailed++;
+
+	memmove(udpBuffer, udpBuffer + length, udpLength - length);
+	udpLength -= length;
+	udpLineEnd = udpLineEnd > length ? udpLineEnd - length : 0;
+	if (udpLength) udpStart = millis();
+}
 
-	if (serial) result = serial->write(val);
+int dConsole::udpTargetPort() { return udpPort; }
 
-	if (client.connected()) result = client.write(val);
+unsigned long dConsole::udpDatagrams() { return udpSent; }
 
-  return result;
+unsigned long dConsole::udpFailures() { return udpFailed; }
 
+void dConsole::setOverflowPolicy(ConsoleOverflow policy) { overflowPolicy = policy; }
+
+size_t dConsole::queuedOutput()
+{
+	size_t queued = 0;
+	for (Session &s : sessions) queued += s.outHead - s.outTail;
+	return queued;
 }
 
+unsigned long dConsole::droppedOutput() { return outDropped; }
+
 
 
+// sends what the socket takes, it does not wait for the rest
 void dConsole::flush() {
 
-  if (disconnected()) return;
+  if (serial) serial->flush();
 
-  serial->flush();
+  drain();
 
-  client.flush();
+  if (udpPort && udpLength) sendUDP(udpLength);
 
 }
 
 
 bool dConsole::check()
 {
+	// one pass over the sessions: drop the closed ones, send what is left over
+	for (Session &s : sessions)
+	{
+		if (!s.open) continue;
+		if (!s.client.connected())
+			closeSession(s);
+		else
+			drain(s);
+	}
+
+	// UDP: the lines that waited long enough, everything once the buffer is
+	// old (a prompt has no line end)
+	if (udpPort && udpLength && millis() - udpStart >= CONSOLE_UDP_MS)
+		sendUDP(udpLineEnd ? udpLineEnd : udpLength);
+
+	// at most one new session per pass
+	if (server)
+	{
+		WiFiClient client = server->available();
+		if (client) openSession(client);
+	}
+
 	// check serial port
 	if ((serial) && (readFlag))
 	{
@@ -268,7 +469,8 @@ bool dConsole::check()
 			if ( (c == '\n') || (bufferCount >= CMD_MAX_LENGTH) ) // LF is a command or max length
 			{
 				serial->println();
-				return parseCommand();
+				commandSession = -1;
+				return parseCommand(tempBuffer, bufferCount);
 
 			}
 			else {
@@ -281,110 +483,92 @@ bool dConsole::check()
 		}
 	}
 
-	// now check telnet if a port has been defined
-	if (telnetPort)
+	// then the telnet sessions, starting after the one that had the last command
+	// so a busy session does not keep the others waiting
+	for (int k = 0; k < CONSOLE_SESSIONS; k++)
 	{
-		if (!client.connected()) {
-			if (server)
-			{
-				// server is defined try to connect to a new client
-				client = server->available();
+		int i = (nextSession + k) % CONSOLE_SESSIONS;
+		if (!sessions[i].open || !readSession(sessions[i])) continue;
+		commandSession = i;
+		nextSession = (i + 1) % CONSOLE_SESSIONS;
+		return true;
+	}
+	return false;  // no command
+}
 
-				if (client)
-				{
-					println("Connected to [RED] debug console");
-					println("'?' for more, 'exit' to exit");
-					print("[RED]> ");
+// what one session typed, up to the end of a line; true with a command
+bool dConsole::readSession(Session &s)
+{
+	while (s.client.available()) {
+		char c = s.client.read();
+		yield();	// yield back to the OS
 
-				}
+		if (c == '\x08') // backspace
+		{
+			if (s.lineCount > 0)
+			{
+				s.line[--s.lineCount] = 0;
 			}
+			continue;
 		}
-		else // client is connected
+		if (c == '\x15') // Control U -- erase entire line
 		{
-			//if (client.status() == CLOSED) return false;
-
-			// read data from the connected client
-			while (client.available()) {
-				char c = client.read();
-				yield();	// yield back to the OS
-
-
-				if (c == '\x08') // backspace
-				{
-					if (bufferCount > 0)
-					{
-						tempBuffer[--bufferCount] = 0;
-					}
-					continue;
-				}
-				if (c == '\x15') // Control U -- erase entire line
-				{
-					bufferCount = 0;
-					tempBuffer[bufferCount] = 0;
-					continue;
-				}
+			s.lineCount = 0;
+			s.line[s.lineCount] = 0;
+			continue;
+		}
 
-				if (c == '\r') continue; // ignore CR
-				if ((c == '\n') || (bufferCount >= CMD_MAX_LENGTH) )  // LF is a command
-				{
-					// we have a full line--> exit true
-					return parseCommand();
-				}
-				else 
-				{
-					tempBuffer[bufferCount++] = c;
-					tempBuffer[bufferCount] = 0;
-				}
-			}
+		if (c == '\r') continue; // ignore CR
+		if ((c == '\n') || (s.lineCount >= CMD_MAX_LENGTH) )  // LF is a command
+		{
+			// we have a full line--> exit true
+			return parseCommand(s.line, s.lineCount);
+		}
+		else 
+		{
+			s.line[s.lineCount++] = c;
+			s.line[s.lineCount] = 0;
 		}
 	}
-	return false;  // no command
+	return false;
 }
 
 void dConsole::trace(char* char_array)
 {
 
 
-	if (serial) serial->print(char_array);
-	if (client.connected()) client.print(char_array);
-	if (udpPort) sendUDP(char_array);
-}
-
-void dConsole::sendUDP(char* sentence)
-{
-  udp.beginPacket(broadcastIP, udpPort);
-  uint8_t to;
-  to = *sentence;
-  udp.write(to);
-  udp.endPacket();
+	print(char_array); // serial, telnet and UDP alike
 }
 
 
 // parse line typed in into a command and a parameter
 
-boolean dConsole::parseCommand()
+boolean dConsole::parseCommand(char *line, int &count)
 {
 	char * pch;
 
 	// extract the command
-	pch = strtok (tempBuffer," \t");
+	pch = strtok (line," \t");
 	if (pch != NULL)
 		strcpy(commandString, pch);
 	else
 		strcpy(commandString, "");
 
-	// see if there are any parameters
-	pch = strtok(NULL," \t");
+	// the parameters are the rest of the line, e.g. "rate fixed 10 300"
+	pch = strtok(NULL,"");
 	if (pch != NULL) {
+		while (*pch == ' ' || *pch == '\t') pch++;
 		strcpy(parameterString,pch);
+		for (int i = strlen(parameterString) - 1; i >= 0 && (parameterString[i] == ' ' || parameterString[i] == '\t'); i--)
+			parameterString[i] = 0;
 	}
 	else
 		{
 			parameterString[0] = 0;
 		}
 		
-	tempBuffer[0] = 0;
-	bufferCount = 0;
+	line[0] = 0;
+	count = 0;
 
 	return true;
 }
\ No newline at end of file
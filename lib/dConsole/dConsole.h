@@ -4,9 +4,23 @@ This class will implement a 'virtual console' that simulates the Serial debugger
 
 it uses a telnet protocol on port 21
 
-UDP broadcast doesn't seem to work
+and, once enableUDP() is called, as UDP broadcast datagrams
 
 V2.0 -- implemented backspace and ^u operations
+V2.1 -- telnet output goes through a ring buffer, sent a line (or a chunk) at a
+        time and never waiting on the socket; see write() and drain()
+V2.2 -- up to CONSOLE_SESSIONS telnet sessions at once, each with its own
+        line buffer and output ring; output goes to all of them, a command
+        comes from one. check() makes one pass over them and reads at most
+        a line per session, a session that stops reading only loses its
+        own oldest output
+V2.3 -- UDP broadcast works: output is packed into datagrams of up to
+        CONSOLE_UDP_SIZE bytes, cut at line ends, each starting with a
+        "#RED <seq> <ms>" line so a listener sees what was lost
+        (tools/udplisten.py). Nothing waits on the network: a datagram that
+        cannot go out is counted and gone
+V2.4 -- telnet output goes out with a non-blocking lwip_send(): WiFiClient::write()
+        waits up to 10 s for a peer that stopped reading
 
 * (c) 2014 Deligent LLC - All rights reserved
 *************************************************************************************************/
@@ -22,6 +36,17 @@ V2.0 -- implemented backspace and ^u operations
 #include <WiFiUdp.h>
 
 #define CMD_MAX_LENGTH 120
+#define CONSOLE_SESSIONS 3       // telnet sessions served at once
+#define CONSOLE_OUT_SIZE 2048   // output ring of each session in bytes, power of two
+#define CONSOLE_OUT_CHUNK 1024  // queued bytes that are sent without waiting for a line end
+#define CONSOLE_UDP_SIZE 1400   // UDP datagram payload, header line included, below the Ethernet MTU
+#define CONSOLE_UDP_MS 1000L    // a datagram goes out at the latest this long after its first byte
+
+// what write() does when the telnet ring is full
+enum ConsoleOverflow {
+	CONSOLE_DROP_OLDEST, // make room by dropping the oldest queued output (default)
+	CONSOLE_DROP_NEWEST, // keep the queued output, drop what does not fit
+};
 
 
 class dConsole : public Stream {
@@ -49,6 +74,15 @@ public:
   void stop();
 
   bool isTelnetConnected();
+  int telnetSessions();                           // sessions open as of the last check()
+
+  void drain();                                   // send what the sockets take now, never waits
+  void setOverflowPolicy(ConsoleOverflow policy);
+  size_t queuedOutput();                          // telnet bytes not sent yet, all sessions
+  unsigned long droppedOutput();                  // telnet bytes lost to overflow, all sessions
+  int udpTargetPort();                            // 0 when UDP is off
+  unsigned long udpDatagrams();                   // datagrams sent since enableUDP()
+  unsigned long udpFailures();                    // datagrams the network stack refused
 
 
 
@@ -66,7 +100,9 @@ public:
 
   size_t write(uint8_t val);
 
-  using Print::write; // pull in write(str) and write(buf, size) from Print
+  size_t write(const uint8_t *buffer, size_t size);
+
+  using Print::write; // pull in write(str) from Print
 
   void flush();
 
@@ -85,14 +121,43 @@ private:
 	char broadcastIP[17];
 	int udpPort;
 	WiFiUDP udp;
+	// the datagram being filled: its first line is written when it is sent
+	char udpBuffer[CONSOLE_UDP_SIZE - 28]; // leaves room for the longest "#RED <seq> <ms>" line
+	size_t udpLength, udpLineEnd;  // bytes, bytes up to the last line end
+	unsigned long udpStart;        // millis() of its first byte
+	uint32_t udpSeq;
+	unsigned long udpSent, udpFailed;
 
 	WiFiServer* server;
-	WiFiClient client;
 
-	void sendUDP(char* sentence);
+	// one telnet connection: what it typed so far and what it was not sent yet
+	struct Session {
+		WiFiClient client;
+		bool open;            // from openSession() to closeSession(); the client turns false as soon as the peer hangs up
+		char line[CMD_MAX_LENGTH+1];
+		int lineCount;
+		// output ring, outHead and outTail run free and wrap with the mask
+		uint8_t outBuffer[CONSOLE_OUT_SIZE];
+		size_t outHead, outTail;
+	};
+	Session sessions[CONSOLE_SESSIONS];
+	int sessionCount;
+	int commandSession;   // the session of the last command, -1 for serial
+	int nextSession;      // the session read first by the next check(), round robin
+	unsigned long outDropped;
+	ConsoleOverflow overflowPolicy;
+
+	void openSession(WiFiClient &client);
+	void closeSession(Session &s);
+	void queueOutput(Session &s, const uint8_t *buffer, size_t size);
+	void drain(Session &s);
+	bool readSession(Session &s);
+
+	void queueUDP(const uint8_t *buffer, size_t size);
+	void sendUDP(size_t length);
 	void trace(char* char_array);
 	boolean disconnected();
-	boolean parseCommand();
+	boolean parseCommand(char *line, int &count);
 
 };
 
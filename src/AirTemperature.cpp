@@ -0,0 +1,92 @@
+/**********************************************************************************
+ *
+ * Air temperature for the speed of sound
+ *
+ *     - with a DS18B20 1-Wire probe on TEMP_PROBE_PIN (see pins.h) the sensing
+ *       task reads it every TEMP_READ_INTERVAL, without waiting for the 750ms
+ *       conversion: it is requested on one pass and read on a later one
+ *     - without a probe, or while it does not answer, the configured value
+ *       (console `temp`, NVS key airTemp) is used
+ *
+ * Every change updates soundSpeedFactor, which the network task applies to each
+ * echo with a single multiply (SpeedOfSound.h). Only the sensing task changes
+ * the temperature in use: a new configured value is posted to it and taken on
+ * its next regular tick.
+ *
+ *********************************************************************************/
+#include <RedGlobals.h>
+#include <atomic>
+#ifdef TEMP_PROBE_PIN
+#include <OneWire.h>
+#include <DallasTemperature.h>
+#endif
+
+#define DEFAULT_AIR_TEMP 20.0f        // degC, the 343 m/s of the original conversion
+#define TEMP_READ_INTERVAL 60000L     // ms between probe readings
+#define TEMP_CONVERSION_TIME 750L     // ms for a 12 bit DS18B20 conversion
+
+float configuredAirTemp = DEFAULT_AIR_TEMP;
+float airTemperature = DEFAULT_AIR_TEMP;   // degC in use
+bool airTempFromProbe = false;
+volatile uint32_t soundSpeedFactor = soundFactor(DEFAULT_AIR_TEMP);
+static std::atomic<float> postedAirTemp{NAN}; // from setAirTemperature(), NAN once taken
+
+#ifdef TEMP_PROBE_PIN
+static OneWire oneWire(TEMP_PROBE_PIN);
+static DallasTemperature probe(&oneWire);
+static unsigned long conversionStart;
+static bool converting = false;
+#endif
+
+static void useTemperature(float tempC, bool fromProbe)
+{
+  airTempFromProbe = fromProbe;
+  if (tempC == airTemperature) return;
+  airTemperature = tempC;
+  soundSpeedFactor = soundFactor(tempC); // one aligned 32 bit store, safe to read from the other core
+}
+
+void configureAirTemperature()
+{
+  configuredAirTemp = prefs.getFloat("airTemp", DEFAULT_AIR_TEMP);
+  useTemperature(configuredAirTemp, false);
+#ifdef TEMP_PROBE_PIN
+  probe.begin();
+  probe.setWaitForConversion(false);
+#endif
+}
+
+// network task: the configured value, used whenever the probe has nothing better
+void setAirTemperature(float tempC)
+{
+  configuredAirTemp = tempC;
+  prefs.putFloat("airTemp", tempC);
+  postedAirTemp.store(tempC);
+}
+
+// called by the sensing task between pings
+void handleAirTemperature()
+{
+  float posted = postedAirTemp.exchange(NAN);
+  if (!isnan(posted) && !airTempFromProbe) useTemperature(posted, false);
+#ifdef TEMP_PROBE_PIN
+  static unsigned long lastRead = 0;
+  if (!converting)
+  {
+    if (lastRead && millis() - lastRead < TEMP_READ_INTERVAL) return;
+    probe.requestTemperatures();
+    conversionStart = millis();
+    converting = true;
+    return;
+  }
+  if (millis() - conversionStart < TEMP_CONVERSION_TIME) return;
+  converting = false;
+  lastRead = millis();
+
+  float t = probe.getTempCByIndex(0);
+  if (t != DEVICE_DISCONNECTED_C && t > SOUND_TEMP_MIN && t < SOUND_TEMP_MAX)
+    useTemperature(t, true);
+  else
+    useTemperature(configuredAirTemp, false);
+#endif
+}
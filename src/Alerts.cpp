@@ -0,0 +1,212 @@
+/**********************************************************************************
+ *
+ * Alerts: threshold rules checked on every sample, published the moment they trip
+ *
+ * The level waits for its interval; a flood should not. Each accepted sample
+ * moves the level tracker (LevelTracker.cpp), and right after it every rule
+ * is checked against the tracked level (ft MLLW, the datum of the published
+ * level) or its rate (ft/hr):
+ *     above <ft>      the level is over the threshold
+ *     below <ft>      the level is under it
+ *     rise <ft/hr>    the level rises faster than that
+ *     fall <ft/hr>    the level falls faster than that
+ * A rule is raised once its condition has held for `dwell` seconds of sample
+ * time, and cleared once the value has been back past the threshold by
+ * `hyst` for as long, so a reading that hovers at the threshold does not
+ * flap. Each rule has its own retained topic, <topic>/alert/<n>, so one rule
+ * clearing cannot hide another that is still raised. Raising or clearing
+ * publishes there straight away:
+ *     {"rule":0,"when":"above 5.20","state":"raised","level":5.31,"rate":0.82,"epoch":1747000000}
+ * with the level and rate at the change; a rule that has not changed since
+ * it was set says "cleared" without them, one that is off says "off". Every
+ * rule is published again on each reconnect, which also brings out a change
+ * that happened offline. The tracker gates spikes, so one bad echo raises
+ * nothing. The check costs at most ALERT_RULES compares a sample.
+ *
+ * Console `alert` and MQTT <topic>/alert/set take, kept in NVS:
+ *     <n> above|below|rise|fall <value> [hyst <value>] [dwell <s>]
+ *     <n> off
+ *
+ *********************************************************************************/
+#include <RedGlobals.h>
+
+#define ALERT_RULES 4
+#define ALERT_HYSTERESIS 0.05f  // ft or ft/hr, default
+#define ALERT_MAX_DWELL_S 3600
+
+static const char TAG[] = "alert";
+
+enum AlertKind : uint8_t { ALERT_OFF, ALERT_ABOVE, ALERT_BELOW, ALERT_RISE, ALERT_FALL, ALERT_KINDS };
+static const char *kindNames[ALERT_KINDS] = {"off", "above", "below", "rise", "fall"};
+
+struct AlertRule
+{
+  AlertKind kind;
+  float threshold;   // ft, or ft/hr for rise and fall
+  float hysteresis;
+  uint16_t dwellS;
+  // state
+  bool raised;
+  bool pending;      // the condition to change state has held since sinceUs
+  uint32_t sinceUs;
+  // the last change, for the retained message
+  bool changed;
+  float level, rate;
+  uint32_t epoch;
+};
+
+static AlertRule rules[ALERT_RULES];
+
+static int activeAlerts()
+{
+  int n = 0;
+  for (const AlertRule &r : rules) n += r.raised;
+  return n;
+}
+
+// "above 5.20 hyst 0.05 dwell 60", the rule as the command takes it
+static void formatRule(const AlertRule &r, char *text, size_t size)
+{
+  if (r.kind == ALERT_OFF)
+    snprintf(text, size, "off");
+  else
+    snprintf(text, size, "%s %.2f hyst %.2f dwell %u", kindNames[r.kind], r.threshold, r.hysteresis, r.dwellS);
+}
+
+// a rule without its number; false if it cannot be parsed
+static bool parseRule(const char *text, AlertRule &r)
+{
+  char kind[8], key[2][8];
+  float threshold, value[2];
+  int n = sscanf(text, "%7s %f %7s %f %7s %f", kind, &threshold, key[0], &value[0], key[1], &value[1]);
+  if (n == 1 && !strcmp(kind, "off"))
+  {
+    r = {};
+    return true;
+  }
+  if (n != 2 && n != 4 && n != 6) return false;
+  int k = ALERT_ABOVE;
+  while (k < ALERT_KINDS && strcmp(kind, kindNames[k])) k++;
+  if (k == ALERT_KINDS || !(fabsf(threshold) < 100)) return false;
+
+  AlertRule rule = {(AlertKind)k, threshold, ALERT_HYSTERESIS, 0};
+  for (int i = 0; i < (n - 2) / 2; i++)
+  {
+    if (!strcmp(key[i], "hyst") && value[i] >= 0 && value[i] < 10)
+      rule.hysteresis = value[i];
+    else if (!strcmp(key[i], "dwell") && value[i] >= 0 && value[i] <= ALERT_MAX_DWELL_S)
+      rule.dwellS = value[i];
+    else
+      return false;
+  }
+  r = rule;
+  return true;
+}
+
+void configureAlerts()
+{
+  for (int i = 0; i < ALERT_RULES; i++)
+  {
+    char key[20];
+    snprintf(key, sizeof(key), "alert%d", i);
+    AlertRule &r = rules[i];
+    r = {};
+    if (prefs.isKey(key) && !parseRule(prefs.getString(key).c_str(), r))
+      LOG_W(TAG, "rule %d in NVS is not a rule: %s", i, prefs.getString(key).c_str());
+  }
+}
+
+// rule i's state to <topic>/alert/<i>, retained
+static void publishRule(int i)
+{
+  const AlertRule &r = rules[i];
+  char buffer[160];
+  if (r.kind == ALERT_OFF)
+    snprintf(buffer, sizeof(buffer), "{\"rule\":%d,\"when\":\"off\",\"state\":\"off\"}", i);
+  else if (!r.changed)
+    snprintf(buffer, sizeof(buffer), "{\"rule\":%d,\"when\":\"%s %.2f\",\"state\":\"cleared\"}", i, kindNames[r.kind], r.threshold);
+  else
+    snprintf(buffer, sizeof(buffer), "{\"rule\":%d,\"when\":\"%s %.2f\",\"state\":\"%s\",\"level\":%.2f,\"rate\":%.2f,\"epoch\":%lu}",
+             i, kindNames[r.kind], r.threshold, r.raised ? "raised" : "cleared", r.level, r.rate, (unsigned long)r.epoch);
+  publishAlert(i, buffer);
+}
+
+// every rule, on connect
+void publishAlertStatus()
+{
+  for (int i = 0; i < ALERT_RULES; i++) publishRule(i);
+}
+
+static void setChange(AlertRule &r, float level, float rate)
+{
+  r.changed = true;
+  r.level = level;
+  r.rate = rate;
+  r.epoch = epochNow();
+}
+
+// network task, after every accepted sample: the rules against the tracked level
+void checkAlerts(uint32_t sampleUs)
+{
+  float level, rate;
+  if (!trackedLevel(level, rate)) return;
+  for (int i = 0; i < ALERT_RULES; i++)
+  {
+    AlertRule &r = rules[i];
+    if (r.kind == ALERT_OFF) continue;
+
+    // everything as "over the threshold": below and fall are above and rise mirrored
+    float value = r.kind == ALERT_ABOVE ? level : r.kind == ALERT_BELOW ? -level : r.kind == ALERT_RISE ? rate : -rate;
+    float threshold = r.kind == ALERT_BELOW ? -r.threshold : r.threshold;
+    bool change = r.raised ? value < threshold - r.hysteresis : value > threshold;
+    if (!change)
+    {
+      r.pending = false;
+      continue;
+    }
+    if (!r.pending)
+    {
+      r.pending = true;
+      r.sinceUs = sampleUs;
+    }
+    if (sampleUs - r.sinceUs < r.dwellS * 1000000UL) continue;
+
+    r.raised = !r.raised;
+    r.pending = false;
+    setChange(r, level, rate);
+    if (r.raised)
+      LOG_W(TAG, "rule %d raised: level %.2f ft, rate %.2f ft/hr", i, level, rate);
+    else
+      LOG_I(TAG, "rule %d cleared: level %.2f ft, rate %.2f ft/hr", i, level, rate);
+    if (mqtt_client.connected()) publishRule(i); // otherwise on the reconnect
+  }
+}
+
+// the console / MQTT alert command, false if it could not be parsed
+bool setAlertCommand(const char *args)
+{
+  int n, used;
+  if (sscanf(args, "%d %n", &n, &used) != 1 || n < 0 || n >= ALERT_RULES) return false;
+  AlertRule r;
+  if (!parseRule(args + used, r)) return false;
+
+  rules[n] = r; // a changed rule starts cleared
+  char key[20], text[48];
+  snprintf(key, sizeof(key), "alert%d", n);
+  formatRule(r, text, sizeof(text));
+  prefs.putString(key, text);
+  LOG_I(TAG, "rule %d: %s", n, text);
+  if (mqtt_client.connected()) publishRule(n);
+  return true;
+}
+
+void printAlerts()
+{
+  console.printf("Alerts %d of %d raised\r\n", activeAlerts(), ALERT_RULES);
+  for (int i = 0; i < ALERT_RULES; i++)
+  {
+    char text[48];
+    formatRule(rules[i], text, sizeof(text));
+    console.printf("  %d: %s%s\r\n", i, text, rules[i].raised ? ", raised" : rules[i].pending ? ", pending" : "");
+  }
+}
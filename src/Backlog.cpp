@@ -0,0 +1,100 @@
+/**********************************************************************************
+ *
+ * Store-and-forward backlog of interval records
+ *
+ *     - every publish interval is closed into a LevelRecord
+ *     - every record is also appended to the flash reading log (ReadingLog.cpp),
+ *       whose cursor follows the head of this ring
+ *     - when MQTT is down the record goes into a bounded ring instead of being
+ *       folded into the next interval; when the ring is full the oldest record
+ *       is dropped and counted
+ *     - once the broker is back, drainBacklog() publishes the oldest records in
+ *       batches of BACKLOG_BATCH to <prefix>/<location>/level/backlog, at most
+ *       one batch every BACKLOG_DRAIN_INTERVAL so live publishes keep flowing
+ *
+ * Batch payload, one record per line: epoch,level_ft,samples,rejected
+ *
+ *********************************************************************************/
+#include <RedGlobals.h>
+
+#define BACKLOG_BATCH 10              // records per MQTT message
+#define BACKLOG_DRAIN_INTERVAL 2000L  // ms between two batches
+#define EPOCH_VALID 1600000000L       // anything earlier means SNTP has not synced yet
+
+static const char TAG[] = "backlog";
+
+static LevelRecord backlog[BACKLOG_CAPACITY];
+static int backlogHead = 0;  // oldest record
+static int backlogCount = 0;
+static unsigned long lastDrain = 0;
+
+unsigned long backlogDrops = 0; // records lost because the ring was full
+
+int backlogDepth() { return backlogCount; }
+
+// empty ring, the reading log refills it at boot
+void resetBacklog()
+{
+  backlogHead = backlogCount = 0;
+  lastDrain = 0;
+}
+
+// wall clock seconds, 0 until SNTP has synced
+uint32_t epochNow()
+{
+  time_t now = time(NULL);
+  return now >= EPOCH_VALID ? (uint32_t)now : 0;
+}
+
+// the reading log may forget everything older than the backlog head
+static void advanceLogCursor()
+{
+  setLogCursor(backlogCount ? backlog[backlogHead].id : readingLogPendingId());
+}
+
+// records closed before SNTP synced only know their uptime: back-date them now
+static uint32_t recordEpoch(const LevelRecord &r)
+{
+  if (r.epoch) return r.epoch;
+  uint32_t now = epochNow();
+  return now ? now - (millis() / 1000 - r.uptime) : 0;
+}
+
+void queueLevelRecord(const LevelRecord &record)
+{
+  if (backlogCount == BACKLOG_CAPACITY)
+  {
+    backlogHead = (backlogHead + 1) % BACKLOG_CAPACITY;
+    backlogCount--;
+    backlogDrops++;
+  }
+  backlog[(backlogHead + backlogCount) % BACKLOG_CAPACITY] = record;
+  backlogCount++;
+  advanceLogCursor();
+}
+
+void drainBacklog()
+{
+  if (!backlogCount || otaInProgress || !mqtt_client.connected()) return;
+  if (millis() - lastDrain < BACKLOG_DRAIN_INTERVAL) return;
+  lastDrain = millis();
+
+  char payload[BACKLOG_BATCH * 32];
+  int len = 0, n = 0;
+  for (; n < backlogCount && n < BACKLOG_BATCH; n++)
+  {
+    const LevelRecord &r = backlog[(backlogHead + n) % BACKLOG_CAPACITY];
+    len += snprintf(payload + len, sizeof(payload) - len, "%lu,%.2f,%u,%u\n",
+                    (unsigned long)recordEpoch(r), r.level, r.samples, r.rejected);
+  }
+
+  // only forget the records once the broker took them
+  if (publishBacklog(payload))
+  {
+    backlogHead = (backlogHead + n) % BACKLOG_CAPACITY;
+    backlogCount -= n;
+    advanceLogCursor();
+    LOG_D(TAG, "sent %d records, %d left", n, backlogCount);
+    if (!backlogCount) publishBacklogStatus(backlogCount, backlogDrops);
+  }
+}
@@ -0,0 +1,226 @@
+/**********************************************************************************
+ *
+ * Burst sampling: K pings per tick, reduced to one sample per sensor
+ *
+ * One ping per tick makes one bad echo one bad sample. With a burst, pingBurst()
+ * pings every slot burstSize times, burstSpacingMs apart (past the echo window
+ * the driver waits out anyway), and reduces each sensor's echoes on the spot:
+ *     median   the middle echo (default)
+ *     mean     the average
+ *     trimmed  the average without the lowest and highest quarter
+ * Pings without an echo are left out; a sensor that got none is delivered as
+ * a timeout. Only the reduced sample reaches the callback, so the filters and
+ * the interval never see the single echoes. The slots take turns within the
+ * burst, so with two slots the wait for one is the other's ping.
+ *
+ * The spread of each burst (1.4826 * MAD of the echoes, a robust sigma) and
+ * the time a burst takes are kept; console `burst` prints them and they are
+ * published retained to <topic>/burst with the settings, with every level while
+ * bursts are on. Console `burst` and MQTT <topic>/burst/set change them:
+ *     off                                     one ping per tick
+ *     <K> [<spacing ms>] [median|mean|trimmed]
+ *
+ * The settings and the timing are in RTC memory as well: a low power timer
+ * wake bursts without reading NVS, and its uplink reports the wakes' bursts.
+ *
+ *********************************************************************************/
+#include <RedGlobals.h>
+#include <algorithm>
+
+#define BURST_MAX 9               // pings per burst
+#define BURST_SPACING_MS 60       // default, the HC-SR04 measurement cycle
+#define BURST_MIN_SPACING_MS 30   // the echo window
+#define BURST_MAX_SPACING_MS 250
+
+static const char TAG[] = "burst";
+
+enum BurstReduce : uint8_t { REDUCE_MEDIAN, REDUCE_MEAN, REDUCE_TRIMMED, REDUCE_MODES };
+static const char *reduceNames[REDUCE_MODES] = {"median", "mean", "trimmed"};
+
+// settings, kept across deep sleep; a cold boot starts from these and configureBurst()
+static RTC_DATA_ATTR volatile uint8_t burstSize = 1;
+static RTC_DATA_ATTR volatile uint16_t burstSpacingMs = BURST_SPACING_MS;
+static RTC_DATA_ATTR volatile BurstReduce burstReduce = REDUCE_MEDIAN;
+
+static EchoCallback deliver;
+
+// the burst in progress, sensing task
+static uint16_t widths[ECHO_SENSORS][BURST_MAX];
+static uint8_t echoes[ECHO_SENSORS];
+static unsigned long firstTriggerUs[ECHO_SENSORS];
+static bool triggered[ECHO_SENSORS];
+
+// written by the sensing task, read for the status; in RTC memory for the uplink
+// of a low power gauge, whose bursts run on the timer wakes before it
+static RTC_DATA_ATTR volatile uint32_t lastBurstUs, maxBurstUs, lastSpreadUs;
+static RTC_DATA_ATTR volatile uint32_t burstCount;
+static RTC_DATA_ATTR volatile float meanBurstUs;
+
+// every echo of the burst lands here first
+static void collect(uint8_t sensor, unsigned long triggerUs, unsigned long widthUs)
+{
+  if (!triggered[sensor])
+  {
+    triggered[sensor] = true;
+    firstTriggerUs[sensor] = triggerUs;
+  }
+  if (widthUs && widthUs <= 0xFFFF && echoes[sensor] < BURST_MAX) widths[sensor][echoes[sensor]++] = widthUs;
+}
+
+void startBursts(EchoCallback onSample)
+{
+  deliver = onSample;
+  configureEchoSensor(collect);
+}
+
+static void resetBurstStats()
+{
+  lastBurstUs = maxBurstUs = lastSpreadUs = 0;
+  burstCount = 0;
+  meanBurstUs = 0;
+}
+
+void configureBurst()
+{
+  burstSize = std::max(1, std::min((int)prefs.getUInt("burstSize", 1), BURST_MAX));
+  burstSpacingMs = std::max(BURST_MIN_SPACING_MS, std::min((int)prefs.getUInt("burstMs", BURST_SPACING_MS), BURST_MAX_SPACING_MS));
+  uint8_t reduce = prefs.getUInt("burstReduce", REDUCE_MEDIAN);
+  burstReduce = reduce < REDUCE_MODES ? (BurstReduce)reduce : REDUCE_MEDIAN;
+}
+
+// n echoes (sorted here) to one width, and their spread
+static uint32_t reduce(uint16_t *w, int n, uint32_t &spread)
+{
+  std::sort(w, w + n);
+  uint32_t median = n & 1 ? w[n / 2] : (w[n / 2 - 1] + w[n / 2] + 1) / 2;
+
+  uint16_t deviation[BURST_MAX];
+  for (int i = 0; i < n; i++) deviation[i] = w[i] > median ? w[i] - median : median - w[i];
+  std::sort(deviation, deviation + n);
+  // twice the MAD, the middle two averaged for an even n as the median is
+  uint32_t mad2 = n & 1 ? 2 * deviation[n / 2] : deviation[n / 2 - 1] + deviation[n / 2];
+  spread = (mad2 * 1483 + 1000) / 2000;
+
+  int from = 0, to = n;
+  switch (burstReduce)
+  {
+  case REDUCE_MEDIAN:
+    return median;
+  case REDUCE_TRIMMED:
+    from = n / 4, to = n - n / 4;
+    break;
+  default:
+    break;
+  }
+  uint32_t sum = 0;
+  for (int i = from; i < to; i++) sum += w[i];
+  return (sum + (to - from) / 2) / (to - from);
+}
+
+// sensing task (or a low power wake): a burst of size pings of every slot, then one
+// sample per sensor
+void pingBurst(int size)
+{
+  int slots = echoSlots();
+  uint32_t spacingUs = burstSpacingMs * 1000UL;
+  unsigned long slotTriggerUs[ECHO_SENSORS] = {};
+  for (int i = 0; i < ECHO_SENSORS; i++) echoes[i] = 0, triggered[i] = false;
+
+  unsigned long start = micros();
+  for (int k = 0; k < size; k++)
+  {
+    for (int slot = 0; slot < slots; slot++)
+    {
+      // the slot before has to finish ringing, its echoes complete or time out within ~30ms
+      while ((k && micros() - slotTriggerUs[slot] < spacingUs) || !startEcho(slot)) delay(1);
+      slotTriggerUs[slot] = micros();
+      do
+        delay(1);
+      while (!handleEchoSensor());
+    }
+  }
+  uint32_t took = micros() - start;
+
+  uint32_t widest = 0;
+  for (int i = 0; i < ECHO_SENSORS; i++)
+  {
+    if (!triggered[i]) continue;
+    uint32_t spread = 0, width = echoes[i] ? reduce(widths[i], echoes[i], spread) : 0;
+    if (spread > widest) widest = spread;
+    if (deliver) deliver(i, firstTriggerUs[i], width);
+  }
+
+  lastBurstUs = took;
+  if (took > maxBurstUs) maxBurstUs = took;
+  lastSpreadUs = widest;
+  burstCount = burstCount + 1;
+  meanBurstUs = meanBurstUs + (took - meanBurstUs) / burstCount;
+}
+
+int burstPings() { return burstSize; }
+
+static void saveBurst()
+{
+  prefs.putUInt("burstSize", burstSize);
+  prefs.putUInt("burstMs", burstSpacingMs);
+  prefs.putUInt("burstReduce", burstReduce);
+}
+
+// the console / MQTT burst command, false if it could not be parsed
+bool setBurstCommand(const char *args)
+{
+  char copy[48];
+  snprintf(copy, sizeof(copy), "%s", args);
+  int size = 1, spacing = burstSpacingMs;
+  BurstReduce mode = burstReduce;
+
+  char *word = strtok(copy, " ");
+  if (!word) return false;
+  if (strcmp(word, "off"))
+  {
+    char *end;
+    size = strtol(word, &end, 10);
+    if (*end || size < 1 || size > BURST_MAX) return false;
+    while ((word = strtok(NULL, " ")))
+    {
+      if (isdigit((unsigned char)*word))
+      {
+        spacing = strtol(word, &end, 10);
+        if (*end || spacing < BURST_MIN_SPACING_MS || spacing > BURST_MAX_SPACING_MS) return false;
+        continue;
+      }
+      int m = 0;
+      while (m < REDUCE_MODES && strcasecmp(word, reduceNames[m])) m++;
+      if (m == REDUCE_MODES) return false;
+      mode = (BurstReduce)m;
+    }
+  }
+
+  burstSize = size;
+  burstSpacingMs = spacing;
+  burstReduce = mode;
+  resetBurstStats();
+  saveBurst();
+  publishBurstStatus();
+  LOG_I(TAG, "%d pings %d ms apart, %s", size, spacing, reduceNames[mode]);
+  return true;
+}
+
+// the last burst's spread as a distance
+static float spreadCm() { return echoToCm(lastSpreadUs, soundSpeedFactor); }
+
+void publishBurstStatus()
+{
+  char buffer[160];
+  snprintf(buffer, sizeof(buffer), "{\"size\":%u,\"spacing_ms\":%u,\"reduce\":\"%s\",\"last_ms\":%.1f,\"mean_ms\":%.1f,\"max_ms\":%.1f,\"spread_cm\":%.2f}",
+           burstSize, burstSpacingMs, reduceNames[burstReduce], lastBurstUs / 1000.0f,
+           meanBurstUs / 1000.0f, maxBurstUs / 1000.0f, spreadCm());
+  publishBurst(buffer);
+}
+
+void printBurst()
+{
+  console.printf("Burst %s: %u pings %u ms apart, %s; last %.1f ms (max %.1f ms) over %d slots, spread %.2f cm\r\n",
+                 burstSize > 1 ? "on" : "off", burstSize, burstSpacingMs, reduceNames[burstReduce], lastBurstUs / 1000.0f,
+                 maxBurstUs / 1000.0f, echoSlots(), spreadCm());
+}
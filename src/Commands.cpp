@@ -0,0 +1,389 @@
+/**********************************************************************************
+ *
+ * Console and MQTT commands
+ *
+ * One table serves both: a command with a name is typed on the console, one
+ * with a topic listens on <topic>/<subtopic>, most have both and the handler
+ * is told where the command came from to answer the right way. The lookup and
+ * the argument types are in CommandRouter.h; `?` prints the table.
+ *
+ * A bad argument is answered with the usage on the console and, in debug
+ * mode, logged for MQTT.
+ *
+ *********************************************************************************/
+#include <RedGlobals.h>
+
+static const char TAG[] = "cmd";
+
+using namespace cmd;
+
+static bool help(const Args &, Source);
+static bool status(const Args &, Source);
+static bool measureOn(const Args &, Source);
+static bool measureOff(const Args &, Source);
+static bool level(const Args &, Source);
+static bool debug(const Args &, Source);
+static bool log(const Args &, Source);
+static bool filter(const Args &, Source);
+static bool temp(const Args &, Source);
+static bool rate(const Args &, Source);
+static bool lowpower(const Args &, Source);
+static bool burst(const Args &, Source);
+static bool waves(const Args &, Source);
+static bool kalman(const Args &, Source);
+static bool alert(const Args &, Source);
+static bool sensor(const Args &, Source);
+static bool noaa(const Args &, Source);
+static bool location(const Args &, Source);
+static bool mqtt(const Args &, Source);
+static bool reset(const Args &, Source);
+static bool reboot(const Args &, Source);
+static bool quit(const Args &, Source);
+static bool udp(const Args &, Source);
+static bool metrics(const Args &, Source);
+static bool perf(const Args &, Source);
+
+/*
+ * ********************************************************************************
+
+  ********************  CUSTOMIZABLE SECTION  ***************************
+
+ * ********************************************************************************
+*/
+
+static constexpr Command commands[] = {
+    // name      MQTT subtopic   argument  optional usage                            help
+    {"?",        nullptr,        ARG_NONE,  false, "",                               "this help", help},
+    {"status",   nullptr,        ARG_NONE,  false, "",                               "time, connection, filter, schedule and power", status},
+    {"on",       nullptr,        ARG_NONE,  false, "",                               "resume measuring and publishing", measureOn},
+    {"off",      nullptr,        ARG_NONE,  false, "",                               "pause measuring and publishing", measureOff},
+    {nullptr,    "level/command", ARG_ONOFF, false, "ON|OFF",                        "measuring and publishing", level},
+    {"debug",    "debug/set",    ARG_ONOFF, true,  "[on|off]",                       "debug messages, toggled without argument", debug},
+    {"log",      "log/set",      ARG_WORD,  true,  "[none|error|warn|info|debug]",   "print the log, or set the level sent to MQTT", log},
+    {"metrics",  "metrics/set",  ARG_INT,   true,  "[seconds]",                      "health metrics, or how often they are published (0: never)", metrics},
+    {"perf",     nullptr,        ARG_WORD,  true,  "[reset]",                        "timing spans, p50/p99/max", perf},
+    {"filter",   "filter/set",   ARG_WORD,  true,  "[mean|median|trimmed|hampel]",   "level filter", filter},
+    {"temp",     nullptr,        ARG_FLOAT, true,  "[C]",                            "configured air temperature", temp},
+    {"rate",     "rate/set",     ARG_TEXT,  true,  "[auto|fixed P S|bounds ...]",    "ping and publish rates", rate},
+    {"lowpower", "lowpower/set", ARG_TEXT,  true,  "[on|off|batch N]",               "deep sleep between pings", lowpower},
+    {"burst",    "burst/set",    ARG_TEXT,  true,  "[off|<K> [ms] [median|mean|trimmed]]", "pings per tick and their reduction", burst},
+    {"waves",    "waves/set",    ARG_TEXT,  true,  "[off|on|now|<min> [<window s>] [<Hz>]]", "wave height and period", waves},
+    {"kalman",   "kalman/set",   ARG_TEXT,  true,  "[q <cm2/s3>] [r <cm>]",         "smoothed level and rate tuning", kalman},
+    {"alert",    "alert/set",    ARG_TEXT,  true,  "[<n> above|below|rise|fall <v> [hyst <v>] [dwell <s>]|<n> off]", "level alert rules", alert},
+    {"sensor",   "sensor/set",   ARG_TEXT,  true,  "[<n> on|off|weight W]",          "sensors, their health and weight", sensor},
+    {"noaa",     nullptr,        ARG_WORD,  false, "<station>",                      "NOAA prediction station", noaa},
+    {"location", nullptr,        ARG_TEXT,  false, "<name>",                         "device location, after a reboot", location},
+    {"mqtt",     nullptr,        ARG_WORD,  false, "<server>",                       "MQTT server", mqtt},
+    {"reset",    nullptr,        ARG_NONE,  false, "",                               "factory reset of the configuration", reset},
+    {"reboot",   nullptr,        ARG_NONE,  false, "",                               "restart the gauge", reboot},
+    {"udp",      nullptr,        ARG_WORD,  true,  "[port|off]",                     "console output as UDP broadcast", udp},
+    {"quit",     nullptr,        ARG_NONE,  false, "",                               "close the telnet session", quit},
+    {"exit",     nullptr,        ARG_NONE,  false, "",                               "close the telnet session", quit},
+};
+
+static constexpr Router<sizeof(commands) / sizeof(commands[0])> router(commands);
+static_assert(router.unique(), "two commands share a name or an MQTT subtopic");
+
+static bool help(const Args &, Source)
+{
+  console.printf("[RED]%s %s\r\n", MQTT_TOPIC_PREFIX, VERSION);
+  console.printf("Host: %s @", myHostName);
+  console.println(WiFi.localIP().toString());
+  console.printf("MQTT Server %s, port: %s, %s\r\n", mqttServer, mqttPort, deviceLocation);
+  console.printf("Commands, [MQTT] under %s/:\r\n", mqtt_topic);
+  char line[64];
+  for (size_t i = 0; i < router.size(); i++)
+  {
+    const Command &c = router[i];
+    snprintf(line, sizeof(line), "%s %s", c.name ? c.name : c.topic, c.usage);
+    console.printf("  %-40s %s", line, c.help);
+    if (c.topic) console.printf(c.name ? " [%s]" : " [MQTT only]", c.topic);
+    console.println();
+  }
+  return true;
+}
+
+static bool status(const Args &, Source)
+{
+  printLocalTime();
+  console.printf("Prefs %s MQTT=%s #%s, NOAA %s\r\n", prefs.getString("deviceLocation").c_str(), prefs.getString("mqtt_server").c_str(), prefs.getString("mqtt_port").c_str(), prefs.getString("NoaaStation").c_str());
+  console.printf("MQTT %s %s\r\n", mqttServer, mqttPort);
+  console.printf("Connection %s for %lu s, last reconnect took %lu ms, %lu connects\r\n", connStateName(), timeInConnState() / 1000, reconnectLatency, mqttConnects);
+  console.printf("Filter %s: %d samples, %d rejected\r\n", SampleFilter::modeName(sensorFilterMode()), intervalSamples(), intervalRejected());
+  console.printf("Air %.1f C (%s), sound %.2f m/s\r\n", airTemperature, airTempFromProbe ? "probe" : "configured", soundSpeedFactor / 4294967296.0 * 2e4);
+  console.printf("Samples queued %u, dropped %lu, echo timeouts %lu\r\n", (unsigned)sampleQueue.size(), (unsigned long)sampleQueue.dropped(), echoTimeouts);
+  console.printf("Backlog %d records, %lu dropped\r\n", backlogDepth(), backlogDrops);
+  if (console.udpTargetPort())
+    console.printf("UDP port %d, %lu datagrams, %lu failed\r\n", console.udpTargetPort(), console.udpDatagrams(), console.udpFailures());
+  console.printf("Telnet %d sessions, output %u bytes queued, %lu dropped\r\n", console.telnetSessions(), (unsigned)console.queuedOutput(), console.droppedOutput());
+  printReadingLogStatus();
+  printTidePredictionStatus();
+  if (ECHO_SENSORS > 1) printSensors();
+  printBurst();
+  printWaves();
+  printTracker();
+  printAlerts();
+  printSchedule();
+  printLowPowerStatus();
+  return true;
+}
+
+static bool measureOn(const Args &, Source)
+{
+  resumeTideUpdate();
+  return true;
+}
+
+static bool measureOff(const Args &, Source)
+{
+  pauseTideUpdate();
+  return true;
+}
+
+// we announce ON here ourselves on every connect and the broker echoes it back: only
+// resume when paused, so the echo does not throw away the interval in progress; in
+// low power mode the sleep cycle does the measuring
+static bool level(const Args &args, Source)
+{
+  if (!args.on)
+    pauseTideUpdate();
+  else if (!sensingEnabled && !lowPowerMode)
+    resumeTideUpdate();
+  return true;
+}
+
+static bool debug(const Args &args, Source source)
+{
+  debugMode = args.present ? args.on : !debugMode;
+  prefs.putBool("debugMode", debugMode);
+  savePreferences();
+  if (source == FROM_MQTT)
+    publishDebug(debugMode ? "debug mode enabled" : "debug mode disabled");
+  else
+    console.printf("Debug mode is now %d\r\n", debugMode);
+  return true;
+}
+
+static bool log(const Args &args, Source source)
+{
+  if (args.present) return setLogLevel(args.text);
+  if (source == FROM_CONSOLE) printLog();
+  return true;
+}
+
+// from MQTT without a value: publish a snapshot now
+static bool metrics(const Args &args, Source source)
+{
+  if (args.present)
+  {
+    if (args.i < 0) return false;
+    setMetricsInterval(args.i);
+  }
+  if (source == FROM_CONSOLE)
+    printMetrics();
+  else if (!args.present)
+    publishMetrics();
+  return true;
+}
+
+static bool perf(const Args &args, Source)
+{
+  if (args.present)
+  {
+    if (strcasecmp(args.text, "reset")) return false;
+#if PERF_SPANS
+    PerfSpan::resetAll();
+#endif
+  }
+  printPerf();
+  return true;
+}
+
+static bool filter(const Args &args, Source source)
+{
+  if (args.present)
+  {
+    if (!setFilterMode(args.text)) return false;
+    publishFilterMode();
+  }
+  if (source == FROM_CONSOLE) console.printf("Filter is %s\r\n", SampleFilter::modeName(sensorFilterMode()));
+  return true;
+}
+
+static bool temp(const Args &args, Source)
+{
+  if (args.present) setAirTemperature(args.f);
+  console.printf("Air temperature %.1f C (%s), configured %.1f C\r\n", airTemperature, airTempFromProbe ? "probe" : "configured", configuredAirTemp);
+  return true;
+}
+
+static bool rate(const Args &args, Source source)
+{
+  if (args.present && !setRateCommand(args.text)) return false;
+  if (source == FROM_CONSOLE) printSchedule();
+  return true;
+}
+
+static bool lowpower(const Args &args, Source source)
+{
+  if (args.present && !setLowPowerCommand(args.text)) return false;
+  if (source == FROM_CONSOLE) printLowPowerStatus();
+  return true;
+}
+
+static bool burst(const Args &args, Source source)
+{
+  if (args.present && !setBurstCommand(args.text)) return false;
+  if (source == FROM_CONSOLE) printBurst();
+  return true;
+}
+
+static bool waves(const Args &args, Source source)
+{
+  if (args.present && !setWavesCommand(args.text)) return false;
+  if (source == FROM_CONSOLE) printWaves();
+  return true;
+}
+
+static bool kalman(const Args &args, Source source)
+{
+  if (args.present && !setTrackerCommand(args.text)) return false;
+  if (source == FROM_CONSOLE) printTracker();
+  return true;
+}
+
+static bool alert(const Args &args, Source source)
+{
+  if (args.present && !setAlertCommand(args.text)) return false;
+  if (source == FROM_CONSOLE) printAlerts();
+  return true;
+}
+
+static bool sensor(const Args &args, Source source)
+{
+  if (args.present && !setSensorCommand(args.text)) return false;
+  if (source == FROM_CONSOLE) printSensors();
+  return true;
+}
+
+static bool noaa(const Args &args, Source)
+{
+  snprintf(NoaaStation, 16, "%s", args.text);
+  savePreferences();
+  resetTidePredictions();
+  console.printf("NOAA station changed to %s\r\n", NoaaStation);
+  return true;
+}
+
+static bool location(const Args &args, Source)
+{
+  snprintf(deviceLocation, MQTT_LOCATION_SIZE, "%s", args.text);
+  savePreferences();
+  console.printf("location changed to %s\r\n", deviceLocation);
+  console.println("Change will take effect after next reboot");
+  return true;
+}
+
+static bool mqtt(const Args &args, Source)
+{
+  snprintf(mqttServer, 64, "%s", args.text);
+  savePreferences();
+  console.printf("MQTT server changed to %s\r\n", mqttServer);
+  mqttDisconnect();
+  return true;
+}
+
+static bool reset(const Args &, Source)
+{
+  console.print("Reseting configuration...");
+  resetConfiguration();
+  console.println(" Done.");
+  return true;
+}
+
+static bool reboot(const Args &, Source)
+{
+  console.print("Rebooting...");
+  delay(200);
+  //reset and try again, or maybe put it to deep sleep
+  ESP.restart();
+  delay(5000);
+  return true;
+}
+
+static bool udp(const Args &args, Source)
+{
+  if (args.present && !setUDPConsole(args.text)) return false;
+  if (console.udpTargetPort())
+    console.printf("UDP broadcast on port %d\r\n", console.udpTargetPort());
+  else
+    console.println("UDP off");
+  return true;
+}
+
+static bool quit(const Args &, Source)
+{
+  console.print("quiting...");
+  console.closeTelnetConnection();
+  delay(500);
+  console.println("");
+  return true;
+}
+
+/*
+ * ********************************************************************************
+
+    ********************  END OF CUSTOMIZABLE SECTION  ***************************
+
+ * ********************************************************************************
+*/
+
+static void run(const Command &c, const char *text, Source source)
+{
+  char buffer[CMD_MAX_LENGTH + 1];
+  Args args;
+  if (parseArgs(c, text, args, buffer, sizeof(buffer)) && c.handler(args, source)) return;
+
+  if (source == FROM_CONSOLE)
+    console.printf("usage: %s %s\r\n", c.name, c.usage);
+  else
+    LOG_W(TAG, "bad payload '%s' on %s, expected %s", text, c.topic, c.usage);
+}
+
+// the command for a console name or a full MQTT topic, nullptr if there is none
+const Command *findCommand(const char *key, Source source)
+{
+  if (source == FROM_CONSOLE) return router.byName(key);
+  size_t n = strlen(mqtt_topic);
+  if (strncmp(key, mqtt_topic, n) || key[n] != '/') return nullptr;
+  return router.byTopic(key + n + 1);
+}
+
+// a line typed on the console, false for an unknown command
+bool consoleCommand(const char *name, const char *args)
+{
+  const Command *c = findCommand(name, FROM_CONSOLE);
+  if (!c) return false;
+  run(*c, args, FROM_CONSOLE);
+  return true;
+}
+
+// a message on one of our topics, false if the topic is not a command
+bool mqttCommand(const char *topic, const char *payload)
+{
+  const Command *c = findCommand(topic, FROM_MQTT);
+  if (!c) return false;
+  run(*c, payload, FROM_MQTT);
+  return true;
+}
+
+void subscribeCommands()
+{
+  char topic[MQTT_SUBTOPIC_SIZE];
+  for (size_t i = 0; i < router.size(); i++)
+  {
+    if (!router[i].topic) continue;
+    snprintf(topic, sizeof(topic), "%s/%s", mqtt_topic, router[i].topic);
+    mqtt_client.subscribe(topic);
+  }
+}
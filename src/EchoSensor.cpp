@@ -0,0 +1,146 @@
+/**********************************************************************************
+ *
+ * Non-blocking driver for the HC-SR04 echoes of every sensor in echoPins
+ *
+ *     - startEcho(slot) pulses the trigger pins of the sensors in that slot
+ *       together and arms their echo interrupts (~12us), once the previous
+ *       slot's sound has died away: a neighbour pinged within its echo window
+ *       would take the other's echo for its own
+ *     - each sensor's echo interrupt timestamps its rising and falling edges,
+ *       so the echoes of one slot are timed in parallel
+ *     - handleEchoSensor(), polled by the sensing task, hands each sensor's
+ *       trigger time and pulse width (or 0 on timeout) to the callback given to
+ *       configureEchoSensor(), and is true once the whole slot is delivered
+ *
+ * Nothing ever busy-waits for the echo: the sensing task sleeps a tick between
+ * polls instead of spinning in pulseIn() for up to its one second timeout. A
+ * tick takes one echo window per slot, however many sensors share it.
+ *
+ *********************************************************************************/
+#include <RedGlobals.h>
+
+#define ECHO_TIMEOUT_US 30000L // max range ~450cm => ~26300 us round trip
+
+enum EchoState { ECHO_IDLE, ECHO_ARMED, ECHO_HIGH, ECHO_DONE };
+
+struct Echo
+{
+  volatile EchoState state;
+  volatile unsigned long startUs;   // echo rising edge
+  volatile unsigned long widthUs;   // pulse width once ECHO_DONE
+  uint8_t pin;
+};
+
+static Echo echoes[ECHO_SENSORS];
+static unsigned long triggerUs;     // of the last slot fired
+static int activeSlot = -1;         // slot whose echoes are not all delivered yet
+static EchoCallback echoCallback = NULL;
+
+unsigned long echoTimeouts = 0; // pings that never saw a complete echo
+
+// echo pin edge interrupt of one sensor: timestamp rising edge, compute width on falling edge
+static void IRAM_ATTR echoISR(void *arg)
+{
+  Echo &e = *(Echo *)arg;
+  unsigned long now = micros();
+  if (digitalRead(e.pin) == HIGH)
+  {
+    if (e.state == ECHO_ARMED)
+    {
+      e.startUs = now;
+      e.state = ECHO_HIGH;
+    }
+  }
+  else if (e.state == ECHO_HIGH)
+  {
+    e.widthUs = now - e.startUs;
+    e.state = ECHO_DONE;
+  }
+}
+
+void configureEchoSensor(EchoCallback onComplete)
+{
+  echoCallback = onComplete;
+  activeSlot = -1;
+  triggerUs = micros() - ECHO_TIMEOUT_US; // nothing ringing
+  for (int i = 0; i < ECHO_SENSORS; i++)
+  {
+    echoes[i].state = ECHO_IDLE;
+    echoes[i].pin = echoPins[i].echo;
+    pinMode(echoPins[i].trig, OUTPUT);
+    pinMode(echoPins[i].echo, INPUT);
+    digitalWrite(echoPins[i].trig, LOW); // Ensure trigger pin is low initially
+    attachInterruptArg(digitalPinToInterrupt(echoPins[i].echo), echoISR, &echoes[i], CHANGE);
+  }
+}
+
+// slots in the table, the sensing task pings them in turn
+int echoSlots()
+{
+  int slots = 0;
+  for (int i = 0; i < ECHO_SENSORS; i++)
+    if (echoPins[i].slot >= slots) slots = echoPins[i].slot + 1;
+  return slots;
+}
+
+static void setTriggers(int slot, uint8_t level)
+{
+  for (int i = 0; i < ECHO_SENSORS; i++)
+    if (echoPins[i].slot == slot) digitalWrite(echoPins[i].trig, level);
+}
+
+// fire the sensors of a slot; returns false if the previous slot has not completed
+// or is still ringing
+bool startEcho(int slot)
+{
+  if (activeSlot >= 0 || micros() - triggerUs < ECHO_TIMEOUT_US) return false;
+
+  // Clears the trigger pins
+  setTriggers(slot, LOW);
+  delayMicroseconds(2);
+
+  // arm before the triggers fall: an echo can only rise ~450us later
+  triggerUs = micros();
+  for (int i = 0; i < ECHO_SENSORS; i++)
+    if (echoPins[i].slot == slot) echoes[i].state = ECHO_ARMED;
+  activeSlot = slot;
+
+  // Sets the trigger pins HIGH for 10 micro seconds
+  setTriggers(slot, HIGH);
+  delayMicroseconds(10);
+  setTriggers(slot, LOW);
+  return true;
+}
+
+// deliver the completed or timed out pings of the slot to the callback, true once
+// every one of them is delivered
+bool handleEchoSensor()
+{
+  if (activeSlot < 0) return false;
+
+  bool timedOut = micros() - triggerUs > ECHO_TIMEOUT_US;
+  bool pending = false;
+  for (int i = 0; i < ECHO_SENSORS; i++)
+  {
+    Echo &e = echoes[i];
+    EchoState state = e.state;
+    if (echoPins[i].slot != activeSlot || state == ECHO_IDLE) continue;
+    if (state == ECHO_DONE)
+    {
+      unsigned long width = e.widthUs;
+      e.state = ECHO_IDLE;
+      if (echoCallback) echoCallback(i, triggerUs, width);
+    }
+    else if (timedOut)
+    {
+      e.state = ECHO_IDLE;
+      echoTimeouts++;
+      if (echoCallback) echoCallback(i, triggerUs, 0);
+    }
+    else
+      pending = true;
+  }
+  if (pending) return false;
+  activeSlot = -1;
+  return true;
+}
@@ -0,0 +1,104 @@
+/**********************************************************************************
+ *
+ * Health: the device metrics and their MQTT snapshot
+ *
+ * Every metric the gauge keeps is declared here, in the order of the snapshot
+ * (see Metrics.h). The ones fed on a hot path are updated where it happens;
+ * counts the firmware already keeps are read when the snapshot is taken.
+ *
+ * The snapshot goes to <topic>/metrics, not retained, right after the first
+ * connect of a boot and then every metricsIntervalMs; a low power uplink
+ * therefore sends one each time. It is cut to what fits one MQTT packet with
+ * the topic, so a long location leaves the last metrics off. Console `metrics`
+ * prints it, `metrics <s>` and MQTT <topic>/metrics/set change the interval, 0
+ * to stop publishing.
+ *
+ * The timing spans (see PerfSpan.h) are here too: console `perf` prints their
+ * p50/p99/max, `perf reset` starts them over. PERF_SPANS=0 compiles them out.
+ *
+ *********************************************************************************/
+#include <RedGlobals.h>
+#include <algorithm>
+
+#define METRICS_INTERVAL 300000L // ms between snapshots, default
+
+// network task loop, one pass including its MQTT and HTTP calls, in us
+Histogram networkLoopUs("loop_us", {1000, 10000, 100000, 1000000});
+// from losing the link to MQTT being back, in ms
+Histogram reconnectMs("reconnect_ms", {1000, 10000, 60000, 600000});
+
+Counter samplesMetric("samples");
+Counter wifiDropsMetric("wifi_drops");
+Counter mqttDropsMetric("mqtt_drops");
+static Counter mqttConnectsMetric("mqtt_connects", [] { return (uint32_t)mqttConnects; });
+static Counter echoTimeoutsMetric("echo_timeouts", [] { return (uint32_t)echoTimeouts; });
+static Counter queueDropsMetric("queue_drops", [] { return sampleQueue.dropped(); });
+static Counter backlogDropsMetric("backlog_drops", [] { return (uint32_t)backlogDrops; });
+static Counter logLostMetric("log_overwritten", [] { return logRing.overwritten(); });
+static Counter telnetDropsMetric("telnet_drops", [] { return (uint32_t)console.droppedOutput(); });
+
+static Gauge heapFreeMetric("heap_free", [] { return (int32_t)ESP.getFreeHeap(); });
+static Gauge heapMinMetric("heap_min", [] { return (int32_t)ESP.getMinFreeHeap(); });
+static Gauge heapBlockMetric("heap_block", [] { return (int32_t)ESP.getMaxAllocHeap(); });
+static Gauge mqttDownMetric("mqtt_down_s", [] { return (int32_t)secondsWithoutMQTT; });
+static Gauge wifiDownMetric("wifi_down_s", [] { return (int32_t)secondsWithoutWIFI; });
+static Gauge backlogMetric("backlog", [] { return (int32_t)backlogDepth(); });
+static Gauge queueMetric("queue", [] { return (int32_t)sampleQueue.size(); });
+
+#if PERF_SPANS
+PerfSpan updateSpan("update");
+PerfSpan publishSpan("publish");
+PerfSpan mqttSpan("mqtt");
+PerfSpan consoleSpan("console");
+PerfSpan wavesSpan("waves");
+#endif
+
+uint32_t metricsIntervalMs = METRICS_INTERVAL;
+static unsigned long lastMetricsAt;
+static bool metricsSent; // this boot
+
+void configureMetrics()
+{
+  metricsIntervalMs = prefs.getUInt("metricsMs", METRICS_INTERVAL);
+  metricsSent = false;
+  Metric::resetAll();
+}
+
+void publishMetrics()
+{
+  // what fits the MQTT packet with the topic; the metrics that do not are left off the end
+  char buffer[MQTT_BUFFER_SIZE];
+  Metric::writeSnapshot(buffer, std::min(sizeof(buffer), metricsSnapshotRoom() + 1), millis() / 1000);
+  publishMetricsSnapshot(buffer);
+  lastMetricsAt = millis();
+  metricsSent = true;
+}
+
+// network task, once connected
+void handleMetrics()
+{
+  if (!metricsIntervalMs || !mqtt_client.connected()) return;
+  if (!metricsSent || millis() - lastMetricsAt >= metricsIntervalMs) publishMetrics();
+}
+
+void setMetricsInterval(uint32_t seconds)
+{
+  metricsIntervalMs = seconds * 1000;
+  prefs.putUInt("metricsMs", metricsIntervalMs);
+}
+
+void printMetrics()
+{
+  console.printf("Metrics after %lu s, published every %lu s:\r\n", millis() / 1000, (unsigned long)metricsIntervalMs / 1000);
+  Metric::printAll(console);
+}
+
+void printPerf()
+{
+#if PERF_SPANS
+  console.printf("Timing spans at %lu MHz:\r\n", (unsigned long)getCpuFrequencyMhz());
+  PerfSpan::printAll(console, getCpuFrequencyMhz());
+#else
+  console.println("Timing spans are compiled out (PERF_SPANS=0)");
+#endif
+}
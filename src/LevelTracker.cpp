@@ -0,0 +1,94 @@
+/**********************************************************************************
+ *
+ * Level tracker: a smoothed level and its rise rate, updated on every sample
+ *
+ * The published level is the robust estimate of the interval, which lags the
+ * water by half an interval. Every accepted sample of a sensor that counts in
+ * the fused level also goes into a LevelKalman (level and velocity), with the
+ * time since the previous one, so when an interval closes the tracker has the
+ * level now and how fast it moves. Both go out with the level:
+ *     <topic>/level/smoothed   ft MLLW
+ *     <topic>/level/rate       ft/hr, rising positive
+ *
+ * Console `kalman` and MQTT <topic>/kalman/set tune it at runtime:
+ *     q <cm^2/s^3>   process noise, how fast the rate may change
+ *     r <cm>         noise of one sample
+ * either or both, kept in NVS; the filter restarts with the new values.
+ * A pause in the samples longer than TRACK_MAX_GAP_S restarts it too.
+ *
+ *********************************************************************************/
+#include <RedGlobals.h>
+#include <LevelKalman.h>
+
+#define KALMAN_Q 1e-9          // cm^2/s^3, default process noise
+#define KALMAN_R 0.5           // cm, default sample noise
+#define TRACK_MIN_SAMPLES 3    // before a rate is published
+
+static const char TAG[] = "kalman";
+
+static LevelKalman tracker;
+static unsigned long spikes; // gated out since the start
+
+void configureLevelTracker()
+{
+  tracker.setNoise(prefs.getFloat("kalmanQ", KALMAN_Q), prefs.getFloat("kalmanR", KALMAN_R));
+  tracker.reset();
+  spikes = 0;
+}
+
+// network task: an accepted sample, Q8 cm as measured by the sensor
+void trackLevel(const EchoSample &sample, int32_t distance)
+{
+  if (!sensorTrusted(sample.sensor)) return;
+  double cm = (double)distance / FILTER_SCALE + echoPins[sample.sensor].offsetMm / 10.0;
+  if (!tracker.track(cm, sample.timeUs))
+  {
+    spikes++;
+    LOG_D(TAG, "sensor %u: %.2f cm is %.2f cm off the track", sample.sensor, cm, cm - tracker.level());
+  }
+}
+
+// the level now in ft MLLW and its rate in ft/hr, false until the tracker has samples
+bool trackedLevel(float &levelFt, float &rateFtHr)
+{
+  if (tracker.count() < TRACK_MIN_SAMPLES) return false;
+  levelFt = SEAWALL_MLLW_OFFSET - tracker.level() * CM_TO_FT;
+  rateFtHr = -tracker.velocity() * CM_TO_FT * 3600;
+  return true;
+}
+
+// the console / MQTT kalman command, false if it could not be parsed
+bool setTrackerCommand(const char *args)
+{
+  double q = tracker.processNoise(), r = tracker.sampleNoise();
+  char key[4][4];
+  double value[2];
+  int n = sscanf(args, "%3s %lf %3s %lf", key[0], &value[0], key[1], &value[1]);
+  if (n != 2 && n != 4) return false;
+  for (int i = 0; i < n / 2; i++)
+  {
+    if (!strcmp(key[i], "q") && value[i] > 0 && value[i] < 1)
+      q = value[i];
+    else if (!strcmp(key[i], "r") && value[i] > 0 && value[i] < 100)
+      r = value[i];
+    else
+      return false;
+  }
+
+  tracker.setNoise(q, r);
+  tracker.reset();
+  prefs.putFloat("kalmanQ", q);
+  prefs.putFloat("kalmanR", r);
+  LOG_I(TAG, "q %.3g cm2/s3, r %.2f cm", q, r);
+  return true;
+}
+
+void printTracker()
+{
+  console.printf("Kalman q %.3g cm2/s3, r %.2f cm, %d samples, %lu spikes\r\n", tracker.processNoise(),
+                 tracker.sampleNoise(), tracker.count(), spikes);
+  float level, rate;
+  if (trackedLevel(level, rate))
+    console.printf("  level %.3f ft +- %.3f, rate %.3f ft/hr +- %.3f\r\n", level, tracker.levelSigma() * CM_TO_FT, rate,
+                   tracker.velocitySigma() * CM_TO_FT * 3600);
+}
@@ -0,0 +1,132 @@
+/**********************************************************************************
+ *
+ * Log: the ring behind LOG_E / LOG_W / LOG_I / LOG_D and its two readers
+ *
+ * A log call only copies its arguments into logRing (see LogRing.h); the text
+ * is formatted here, on the network task, for:
+ *     - the console: every record in debug mode, warnings and errors otherwise
+ *     - MQTT: records up to the forwarded level (warn by default) are collected
+ *       into one payload of lines, published to <topic>/debug when the next
+ *       line would not fit or LOG_BATCH_MS after its first line. Offline, this
+ *       reader just waits; what the ring overwrote meanwhile is reported as
+ *       lost in the next batch.
+ *
+ * Levels above LOG_LEVEL (build flag, debug by default) are compiled out; a
+ * file can set LOG_LOCAL_LEVEL lower for itself before including RedGlobals.h.
+ * At run time a record neither reader would show is not written at all, so
+ * per-sample debug records cannot push warnings out of the ring while MQTT
+ * is down: info and debug are kept in debug mode or when forwarded.
+ *
+ * Console `log` prints what the ring holds, `log <level>` and MQTT
+ * <topic>/log/set change the forwarded level.
+ *
+ *********************************************************************************/
+#include <RedGlobals.h>
+
+#define LOG_BATCH_BYTES 400   // payload of one debug topic message, below the MQTT buffer
+#define LOG_BATCH_MS 10000L   // a batch goes out at the latest this long after its first line
+#define LOG_TEXT 160          // the message of one record
+#define LOG_LINE 200          // one record with its time, level and tag
+
+LogRing logRing;
+LogLevel mqttLogLevel = LOG_WARN;
+
+static LogRing::Cursor consoleCursor, mqttCursor;
+static char batch[LOG_BATCH_BYTES + 1];
+static size_t batchLength = 0;
+static unsigned long batchStart;
+
+// "12.345 W mqtt: text", seconds of uptime
+static int formatLine(char *line, size_t size, const LogRing::Entry &entry, const char *text)
+{
+  int n = snprintf(line, size, "%lu.%03lu %c %s: %s", (unsigned long)entry.ms / 1000, (unsigned long)entry.ms % 1000,
+                   LogRing::levelLetter(entry.level), entry.tag, text);
+  return n < (int)size ? n : size - 1;
+}
+
+void configureLog()
+{
+  LogLevel level;
+  if (LogRing::parseLevel(prefs.getString("logLevel", "warn").c_str(), level)) mqttLogLevel = level;
+  batchLength = 0;
+}
+
+static void publishBatch()
+{
+  if (!batchLength) return;
+  batch[batchLength] = 0;
+  publishDebug(batch);
+  batchLength = 0;
+}
+
+static void appendToBatch(const char *line, size_t length)
+{
+  if (batchLength && batchLength + 1 + length > LOG_BATCH_BYTES) publishBatch();
+  if (!batchLength) batchStart = millis();
+  if (batchLength) batch[batchLength++] = '\n';
+  if (length > LOG_BATCH_BYTES - batchLength) length = LOG_BATCH_BYTES - batchLength;
+  memcpy(batch + batchLength, line, length);
+  batchLength += length;
+}
+
+// MQTT reader: everything new up to the forwarded level into the batch
+static void collectBatch()
+{
+  char text[LOG_TEXT], line[LOG_LINE];
+  LogRing::Entry entry;
+  while (logRing.read(mqttCursor, entry, text, sizeof(text)))
+  {
+    if (entry.lost) appendToBatch(line, snprintf(line, sizeof(line), "%lu log records lost", entry.lost));
+    if (entry.level <= mqttLogLevel) appendToBatch(line, formatLine(line, sizeof(line), entry, text));
+  }
+}
+
+// network task: format what is new for the console, forward batches to MQTT
+void handleLog()
+{
+  char text[LOG_TEXT], line[LOG_LINE];
+  LogRing::Entry entry;
+  while (logRing.read(consoleCursor, entry, text, sizeof(text)))
+  {
+    if (entry.lost) console.printf("%lu log records lost\r\n", entry.lost);
+    if (!debugMode && entry.level > LOG_WARN) continue;
+    formatLine(line, sizeof(line), entry, text);
+    console.printf("%s\r\n", line);
+  }
+
+  if (!mqtt_client.connected()) return;
+  collectBatch();
+  if (batchLength && millis() - batchStart >= LOG_BATCH_MS) publishBatch();
+}
+
+// send what is pending now, before going offline
+void flushLog()
+{
+  if (!mqtt_client.connected()) return;
+  collectBatch();
+  publishBatch();
+}
+
+bool setLogLevel(const char *name)
+{
+  LogLevel level;
+  if (!LogRing::parseLevel(name, level)) return false;
+  mqttLogLevel = level;
+  prefs.putString("logLevel", LogRing::levelName(level));
+  return true;
+}
+
+// everything the ring holds, oldest first
+void printLog()
+{
+  char text[LOG_TEXT], line[LOG_LINE];
+  LogRing::Entry entry;
+  LogRing::Cursor cursor = logRing.tail();
+  while (logRing.read(cursor, entry, text, sizeof(text)))
+  {
+    formatLine(line, sizeof(line), entry, text);
+    console.printf("%s\r\n", line);
+  }
+  console.printf("Log: forwarding up to %s to MQTT, %lu records overwritten\r\n", LogRing::levelName(mqttLogLevel),
+                 (unsigned long)logRing.overwritten());
+}
@@ -0,0 +1,257 @@
+/**********************************************************************************
+ *
+ * Deep-sleep duty-cycled mode
+ *
+ * With low power on, the chip sleeps between pings instead of idling with the
+ * radio up:
+ *     - a timer wake only pings: lowPowerWake(), first thing in setup(), stores
+ *       the echo in RTC memory and sleeps for the rest of pingIntervalMs without
+ *       touching NVS, flash or the radio
+ *     - once LOW_POWER_BATCH publish intervals have gone by (or the RTC buffer
+ *       is full) the wake is an uplink instead: setup() carries on, the network
+ *       task joins WiFi and MQTT and handleLowPower() closes the stored samples
+ *       into publish intervals the same way the live path does (reading log,
+ *       backlog, the newest interval as the live level), lets the backlog
+ *       drain and sleeps again
+ *     - an uplink that cannot reach the broker within LOW_POWER_UPLINK_TIMEOUT
+ *       still moves the samples to the flash log, the backlog sends them later
+ *
+ * The time spent awake and asleep is accumulated in RTC memory and published
+ * retained to <topic>/lowpower with the wake-to-sample latency, micros() at the
+ * trigger. The ROM boot before setup() is invisible to the firmware, so both
+ * the duty cycle and the latency leave it out; the native simulation reports
+ * them with the boot included.
+ *
+ * Console `lowpower` and MQTT <topic>/lowpower/set take: on, off, batch <N>.
+ * Publish the command retained, a sleeping gauge only sees it at its next uplink.
+ *
+ *********************************************************************************/
+#include <RedGlobals.h>
+#include <esp_sleep.h>
+
+#define LOW_POWER_BATCH 6                // publish intervals per uplink, default
+#define LOW_POWER_SAMPLES 512            // samples held in RTC memory, 6 bytes each
+#define LOW_POWER_MAX_SPAN 60000L        // s, the sample offsets are 16 bit
+#define LOW_POWER_UPLINK_TIMEOUT 20000L  // ms to reach the broker, below WIFI_RESTART_TIMEOUT
+#define LOW_POWER_LINGER 500L            // ms online before sleeping, retained commands come in
+#define LOW_POWER_MIN_SLEEP 1000L        // ms
+
+static const char TAG[] = "power";
+
+// one ping kept in RTC memory
+struct RtcSample
+{
+  uint16_t offset;   // s after rtcBase
+  uint16_t widthUs;  // echo pulse width, 0 for no echo
+  uint8_t sensor;
+};
+
+// RTC slow memory, kept across deep sleep
+static RTC_DATA_ATTR bool rtcLowPower;
+static RTC_DATA_ATTR uint8_t rtcBatch;
+static RTC_DATA_ATTR uint32_t rtcPingMs, rtcPublishMs;  // the schedule we went to sleep with
+static RTC_DATA_ATTR uint32_t rtcLastUplink;            // time() of the last uplink
+static RTC_DATA_ATTR uint32_t rtcBase;                  // time() of the first sample held
+static RTC_DATA_ATTR uint16_t rtcCount;
+static RTC_DATA_ATTR RtcSample rtcSamples[LOW_POWER_SAMPLES];
+static RTC_DATA_ATTR uint64_t rtcAwakeUs, rtcSleepUs;
+static RTC_DATA_ATTR uint32_t rtcWakes;
+static RTC_DATA_ATTR uint32_t rtcWakeToSampleUs, rtcWakeToSampleMaxUs;
+
+bool lowPowerMode = false;
+bool lowPowerUplink = false;
+
+static unsigned long awakeSince = 0; // micros() when this boot started to count as low power time
+static bool uplinkStarted = false;
+static unsigned long uplinkStart;
+static bool flushed = false;
+static unsigned long flushedAt;
+
+// echo completion on a timer wake: keep the ping in RTC memory
+static void storeSample(uint8_t sensor, unsigned long triggerUs, unsigned long widthUs)
+{
+  uint32_t now = time(NULL);
+  if (!rtcCount) rtcBase = now;
+  if (rtcCount < LOW_POWER_SAMPLES)
+    rtcSamples[rtcCount++] = {(uint16_t)(now - rtcBase), (uint16_t)(widthUs > 0xFFFF ? 0 : widthUs), sensor};
+  rtcWakeToSampleUs = triggerUs;
+  if (triggerUs > rtcWakeToSampleMaxUs) rtcWakeToSampleMaxUs = triggerUs;
+}
+
+static bool uplinkDue()
+{
+  uint32_t now = time(NULL);
+  if (rtcCount >= LOW_POWER_SAMPLES || (rtcCount && now - rtcBase >= LOW_POWER_MAX_SPAN)) return true;
+  return now - rtcLastUplink >= (uint32_t)rtcBatch * (rtcPublishMs / 1000);
+}
+
+// sleep for what is left of the ping interval, does not return
+static void sleepUntilNextPing()
+{
+  unsigned long awakeMs = (micros() - awakeSince) / 1000;
+  uint32_t sleepMs = rtcPingMs > awakeMs + LOW_POWER_MIN_SLEEP ? rtcPingMs - awakeMs : LOW_POWER_MIN_SLEEP;
+  rtcAwakeUs += micros() - awakeSince;
+  rtcSleepUs += sleepMs * 1000ULL;
+  esp_sleep_enable_timer_wakeup(sleepMs * 1000ULL);
+  esp_deep_sleep_start();
+}
+
+// first thing in setup(): a timer wake in low power mode pings and goes back to
+// sleep, unless the uplink is due; true when this boot is an uplink
+bool lowPowerWake()
+{
+  if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER || !rtcLowPower) return false;
+  rtcWakes++;
+  awakeSince = 0;
+  if (rtcCount > LOW_POWER_SAMPLES) rtcCount = 0;
+
+  // one burst, stored reduced like every other sample
+  startBursts(storeSample);
+  pingBurst(burstPings());
+  if (!uplinkDue()) sleepUntilNextPing();
+
+  lowPowerUplink = true;
+  return true;
+}
+
+static void saveLowPower()
+{
+  prefs.putBool("lowPower", lowPowerMode);
+  prefs.putUInt("lpBatch", rtcBatch);
+}
+
+// a fresh duty cycle account, entering low power mode
+static void startLowPower()
+{
+  rtcAwakeUs = rtcSleepUs = 0;
+  rtcWakes = rtcWakeToSampleUs = rtcWakeToSampleMaxUs = 0;
+  rtcLastUplink = time(NULL);
+  awakeSince = micros();
+  uplinkStarted = flushed = false;
+}
+
+void configureLowPower()
+{
+  lowPowerMode = prefs.getBool("lowPower", false);
+  rtcBatch = prefs.getUInt("lpBatch", LOW_POWER_BATCH);
+  rtcLowPower = lowPowerMode;
+  awakeSince = 0;
+  uplinkStarted = flushed = false;
+  if (lowPowerUplink)
+  {
+    pingIntervalMs = rtcPingMs;
+    publishIntervalMs = rtcPublishMs;
+  }
+  else if (lowPowerMode)
+    startLowPower();
+}
+
+// close the samples held in RTC memory into publish intervals, oldest first
+static void flushSamples()
+{
+  uint32_t now = time(NULL);
+  int i = 0;
+  while (i < rtcCount)
+  {
+    uint16_t first = rtcSamples[i].offset, last = first;
+    for (; i < rtcCount && (uint32_t)(rtcSamples[i].offset - first) < publishIntervalMs / 1000; i++)
+    {
+      // back-dated on this boot's clock, the level tracker takes the time between them
+      uint32_t ageUs = (now - (rtcBase + rtcSamples[i].offset)) * 1000000UL;
+      EchoSample sample = {(uint32_t)micros() - ageUs, rtcSamples[i].widthUs, rtcSamples[i].sensor};
+      updateAverage(sample);
+      last = rtcSamples[i].offset;
+    }
+    closeInterval(now - (rtcBase + last), last - first, i == rtcCount);
+  }
+  LOG_D(TAG, "%u samples flushed, %d records in backlog", rtcCount, backlogDepth());
+  rtcCount = 0;
+}
+
+// network task: flush, let the backlog drain, then sleep until the next ping
+void handleLowPower()
+{
+  if (!lowPowerMode) return;
+  if (!uplinkStarted)
+  {
+    uplinkStarted = true;
+    uplinkStart = millis();
+  }
+  bool online = mqtt_client.connected();
+  bool timedOut = millis() - uplinkStart > LOW_POWER_UPLINK_TIMEOUT;
+  if (!online && !timedOut) return;
+
+  if (!flushed)
+  {
+    if (intervalSamples()) publishAverageLevel(); // low power was just switched on
+    flushSamples();
+    flushed = true;
+    flushedAt = millis();
+    return;
+  }
+  if (online && !timedOut && (millis() - flushedAt < LOW_POWER_LINGER || readingLogReplaying() || backlogDepth())) return;
+
+  rtcLastUplink = time(NULL);
+  rtcPingMs = pingIntervalMs;
+  rtcPublishMs = publishIntervalMs;
+  publishLowPowerStatus();
+  LOG_I(TAG, "uplink %s after %lu ms, sleeping", online ? "done" : "timed out", millis() - uplinkStart);
+  flushLog();
+  flushReadingLog();
+  mqttDisconnect();
+  sleepUntilNextPing();
+}
+
+// the console / MQTT lowpower command, false if it could not be parsed
+bool setLowPowerCommand(const char *args)
+{
+  int batch;
+  if (!strcmp(args, "on"))
+  {
+    if (lowPowerMode) return true;
+    lowPowerMode = true;
+    startLowPower();
+    pauseTideUpdate();
+  }
+  else if (!strcmp(args, "off"))
+  {
+    if (!lowPowerMode) return true;
+    lowPowerMode = false;
+    resumeTideUpdate();
+  }
+  else if (sscanf(args, "batch %d", &batch) == 1 && batch >= 1 && batch <= 255)
+    rtcBatch = batch;
+  else
+    return false;
+
+  rtcLowPower = lowPowerMode;
+  saveLowPower();
+  publishLowPowerStatus();
+  return true;
+}
+
+static float dutyCycle()
+{
+  uint64_t awake = rtcAwakeUs + (micros() - awakeSince);
+  return awake ? 100.0f * awake / (awake + rtcSleepUs) : 0;
+}
+
+void publishLowPowerStatus()
+{
+  char buffer[160];
+  if (!lowPowerMode)
+    sprintf(buffer, "{\"mode\":\"off\",\"batch\":%u}", rtcBatch);
+  else
+    sprintf(buffer, "{\"mode\":\"on\",\"batch\":%u,\"duty_pct\":%.2f,\"wakes\":%lu,\"wake_to_sample_us\":%lu,\"wake_to_sample_max_us\":%lu}",
+            rtcBatch, dutyCycle(), (unsigned long)rtcWakes, (unsigned long)rtcWakeToSampleUs, (unsigned long)rtcWakeToSampleMaxUs);
+  publishLowPower(buffer);
+}
+
+void printLowPowerStatus()
+{
+  console.printf("Low power %s, uplink every %u intervals", lowPowerMode ? "on" : "off", rtcBatch);
+  if (lowPowerMode)
+    console.printf(": duty %.2f%%, %lu wakes, wake to sample %lu us (max %lu), %u samples held",
+                   dutyCycle(), (unsigned long)rtcWakes, (unsigned long)rtcWakeToSampleUs, (unsigned long)rtcWakeToSampleMaxUs, rtcCount);
+  console.println();
+}
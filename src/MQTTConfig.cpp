@@ -9,24 +9,49 @@
 #include <RedGlobals.h>
 
 
+#define MQTT_BACKOFF_MIN 1000L      // ms before the first retry
+#define MQTT_BACKOFF_MAX 60000L     // ms, cap of the exponential backoff
+#define MQTT_CONNECT_TIMEOUT 2      // s, bounds the blocking TCP connect
+#define MQTT_PACKET_HEADER 7       // fixed header (up to 5) and the topic length (2)
+
+static const char TAG[] = "mqtt";
+
+static void resetConnState(); // see the connection state machine below
+
 WiFiClient espClient;
 PubSubClient mqtt_client(espClient);
 
 // mqtt client settings
-char clientName[64];
-char mqtt_topic[64];                                         //contains current settings
-
-char mqtt_debug_topic[64];                             //debug messages
-char mqtt_debug_set_topic[64];                     //enable/disable debug messages
-
-char mqtt_level_command[64];  // start and stop tide indicator
-char mqtt_level[64];   // tide level
+char clientName[64 + MQTT_LOCATION_SIZE]; // <host>-<location>
+char mqtt_topic[MQTT_TOPIC_SIZE];                //contains current settings
+
+char mqtt_debug_topic[MQTT_SUBTOPIC_SIZE];      //debug messages
+
+char mqtt_level_command[MQTT_SUBTOPIC_SIZE];    // start and stop tide indicator
+char mqtt_level[MQTT_SUBTOPIC_SIZE];            // tide level
+char mqtt_level_rejected[MQTT_SUBTOPIC_SIZE];   // samples rejected by the filter in the last interval
+char mqtt_level_stddev[MQTT_SUBTOPIC_SIZE];     // spread of the accepted samples in the last interval
+char mqtt_level_predicted[MQTT_SUBTOPIC_SIZE];  // NOAA predicted tide for the interval
+char mqtt_level_residual[MQTT_SUBTOPIC_SIZE];   // observed minus predicted
+char mqtt_level_smoothed[MQTT_SUBTOPIC_SIZE];   // the Kalman level at the end of the interval, see LevelTracker.cpp
+char mqtt_level_rate[MQTT_SUBTOPIC_SIZE];       // its rate of change, ft/hr
+char mqtt_level_backlog[MQTT_SUBTOPIC_SIZE];    // batches of records recorded while MQTT was down
+char mqtt_backlog[MQTT_SUBTOPIC_SIZE];          // backlog depth and dropped records
+char mqtt_connection[MQTT_SUBTOPIC_SIZE];       // connection state and reconnect latency
+char mqtt_filter[MQTT_SUBTOPIC_SIZE];           // current filter mode
+char mqtt_rate[MQTT_SUBTOPIC_SIZE];             // ping and publish rates in use
+char mqtt_lowpower[MQTT_SUBTOPIC_SIZE];         // low power mode and duty cycle
+char mqtt_metrics[MQTT_SUBTOPIC_SIZE];          // health metrics snapshot, see Health.cpp
+char mqtt_sensors[MQTT_SUBTOPIC_SIZE];          // health and weight of each sensor, see SensorArray.cpp
+char mqtt_burst[MQTT_SUBTOPIC_SIZE];            // burst settings and cost, see Burst.cpp
+char mqtt_waves[MQTT_SUBTOPIC_SIZE];            // wave height and period, see Waves.cpp
+char mqtt_alert[MQTT_SUBTOPIC_SIZE];            // alert/<n>, the state of each alert rule, see Alerts.cpp
 
 int secondsWithoutMQTT;
 
 // MQTT Settings
 // debug mode, when true, will send all packets received from the heatpump to topic mqtt_debug_topic
-// this can also be set by sending "on" to mqtt_debug_set_topic
+// this can also be set by sending "on" to <topic>/debug/set
 bool debugMode = false;
 bool retain = true; //change to false to disable mqtt retain
 
@@ -42,85 +67,145 @@ bool retain = true; //change to false to disable mqtt retain
 // configure all topics based on function & location
 void configureTopics() 
 {
-  sprintf(clientName, "%s-%s", myHostName, deviceLocation);
-  sprintf(mqtt_topic, "%s/%s", MQTT_TOPIC_PREFIX, deviceLocation);
-  sprintf(mqtt_debug_topic, "%s/debug", mqtt_topic);
-  sprintf(mqtt_debug_set_topic, "%s/debug/set", mqtt_topic);
-
-  sprintf(mqtt_level_command, "%s/level/command", mqtt_topic);
-  sprintf(mqtt_level, "%s/level", mqtt_topic);
+  snprintf(clientName, sizeof(clientName), "%s-%s", myHostName, deviceLocation);
+  snprintf(mqtt_topic, sizeof(mqtt_topic), "%s/%s", MQTT_TOPIC_PREFIX, deviceLocation);
+  snprintf(mqtt_debug_topic, sizeof(mqtt_debug_topic), "%s/debug", mqtt_topic);
+
+  snprintf(mqtt_level_command, sizeof(mqtt_level_command), "%s/level/command", mqtt_topic);
+  snprintf(mqtt_level, sizeof(mqtt_level), "%s/level", mqtt_topic);
+  snprintf(mqtt_level_rejected, sizeof(mqtt_level_rejected), "%s/level/rejected", mqtt_topic);
+  snprintf(mqtt_level_stddev, sizeof(mqtt_level_stddev), "%s/level/stddev", mqtt_topic);
+  snprintf(mqtt_level_predicted, sizeof(mqtt_level_predicted), "%s/level/predicted", mqtt_topic);
+  snprintf(mqtt_level_residual, sizeof(mqtt_level_residual), "%s/level/residual", mqtt_topic);
+  snprintf(mqtt_level_smoothed, sizeof(mqtt_level_smoothed), "%s/level/smoothed", mqtt_topic);
+  snprintf(mqtt_level_rate, sizeof(mqtt_level_rate), "%s/level/rate", mqtt_topic);
+  snprintf(mqtt_level_backlog, sizeof(mqtt_level_backlog), "%s/level/backlog", mqtt_topic);
+  snprintf(mqtt_backlog, sizeof(mqtt_backlog), "%s/backlog", mqtt_topic);
+  snprintf(mqtt_connection, sizeof(mqtt_connection), "%s/connection", mqtt_topic);
+  snprintf(mqtt_filter, sizeof(mqtt_filter), "%s/filter", mqtt_topic);
+  snprintf(mqtt_rate, sizeof(mqtt_rate), "%s/rate", mqtt_topic);
+  snprintf(mqtt_lowpower, sizeof(mqtt_lowpower), "%s/lowpower", mqtt_topic);
+  snprintf(mqtt_metrics, sizeof(mqtt_metrics), "%s/metrics", mqtt_topic);
+  snprintf(mqtt_sensors, sizeof(mqtt_sensors), "%s/sensors", mqtt_topic);
+  snprintf(mqtt_burst, sizeof(mqtt_burst), "%s/burst", mqtt_topic);
+  snprintf(mqtt_waves, sizeof(mqtt_waves), "%s/waves", mqtt_topic);
+  snprintf(mqtt_alert, sizeof(mqtt_alert), "%s/alert", mqtt_topic);
 }
 
 // this is called when a connection is established with the server
 // it subscribe to all define and needed topics
 void subscribeToTopics()
 {
-  
+  // the command topics, see Commands.cpp
+  subscribeCommands();
 
-
-  // tide on/off topic, start with ON
-  mqtt_client.subscribe(mqtt_level_command);
+  // tide on/off, start with ON
   mqtt_client.publish(mqtt_level_command, "ON");
 
-  // debug topic (?)
-  mqtt_client.subscribe(mqtt_debug_set_topic);
+  // current settings, retained
+  publishFilterMode();
+  publishRateStatus();
+  publishBurstStatus();
+  publishAlertStatus(); // every rule, with a change while offline
+  // low power commands should be retained to reach a sleeping gauge
+  publishLowPowerStatus();
 }
 
-// This routine is called when an MQTT message is received 
-// it handles any needed functionality and return TRUE
-// returns FALSE if the topic is outside the scope of this function
-bool processMQTTcommand(char* topic, char* message)
+// publish the level and the number of samples the filter rejected to the mqtt topics
+void publishLevel(float level, float stddev, int rejected)
 {
-  // if (strcmp(topic, mqtt_led_command) == 0)
-  // {
-  //   setLEDPower(message);
-
-  //   // publish state back to main topic
-  //   mqtt_client.publish(mqtt_topic, message);
-  //   return true;
-  // }
-  
-  // if (strcmp(topic, mqtt_led_mode) == 0)
-  // {
-  //   setLEDMode(atoi(message));
-
-  //   // publish state back to main topic
-  //   mqtt_client.publish(mqtt_topic, message);
-  //   return true;
-  // }
-
-  // turn tide on/off
-  if (strcmp(topic, mqtt_level_command) == 0)
-  {
-    // convert message to uppercase
-    for (int i = 0; message[i]; i++)
-    {
-      message[i] = toupper(message[i]);
-    }
+  char buffer[16];
+  sprintf(buffer, "%.2f", level); // Format as string with 2 decimal places
+  mqtt_client.publish(mqtt_level, buffer, retain);
+  sprintf(buffer, "%.3f", stddev);
+  mqtt_client.publish(mqtt_level_stddev, buffer, retain);
+  sprintf(buffer, "%d", rejected);
+  mqtt_client.publish(mqtt_level_rejected, buffer, retain);
+}
 
-    if (strcmp(message,"OFF") == 0) 
-      pauseTideUpdate();
-    else if (strcmp(message,"ON") == 0)
-      resumeTideUpdate();
-    else // unknown command for mqtt_level_command, do nothing or log an error
-    if (debugMode) {
-      console.printf("Unknown command '%s' on topic %s\n", message, mqtt_level_command);
-    }
-    return true;
-  }
+void publishPrediction(float predicted, float residual)
+{
+  char buffer[16];
+  sprintf(buffer, "%.2f", predicted);
+  mqtt_client.publish(mqtt_level_predicted, buffer, retain);
+  sprintf(buffer, "%.2f", residual);
+  mqtt_client.publish(mqtt_level_residual, buffer, retain);
+}
 
+void publishTrackedLevel(float level, float rate)
+{
+  char buffer[16];
+  sprintf(buffer, "%.2f", level);
+  mqtt_client.publish(mqtt_level_smoothed, buffer, retain);
+  sprintf(buffer, "%.2f", rate);
+  mqtt_client.publish(mqtt_level_rate, buffer, retain);
+}
 
-  return false;
+void publishFilterMode()
+{
+  mqtt_client.publish(mqtt_filter, SampleFilter::modeName(sensorFilterMode()), retain);
 }
 
-// publish the level to the mqtt topic
-void publishLevel(float level)
+void publishDebug(const char *message)
 {
-  char buffer[16];
-  sprintf(buffer, "%.2f", level); // Format as string with 2 decimal places
-  mqtt_client.publish(mqtt_level, buffer, retain);
+  mqtt_client.publish(mqtt_debug_topic, message);
+}
+
+void publishSchedule(const char *json)
+{
+  mqtt_client.publish(mqtt_rate, json, retain);
+}
+
+void publishLowPower(const char *json)
+{
+  mqtt_client.publish(mqtt_lowpower, json, retain);
 }
 
+void publishMetricsSnapshot(const char *json)
+{
+  if (!mqtt_client.publish(mqtt_metrics, json))
+    LOG_W(TAG, "metrics snapshot of %u bytes not published", (unsigned)strlen(json));
+}
+
+size_t metricsSnapshotRoom()
+{
+  return MQTT_BUFFER_SIZE - MQTT_PACKET_HEADER - strlen(mqtt_metrics);
+}
+
+void publishSensors(const char *json)
+{
+  mqtt_client.publish(mqtt_sensors, json, retain);
+}
+
+void publishBurst(const char *json)
+{
+  mqtt_client.publish(mqtt_burst, json, retain);
+}
+
+void publishWaves(const char *json)
+{
+  mqtt_client.publish(mqtt_waves, json, retain);
+}
+
+void publishAlert(int rule, const char *json)
+{
+  char topic[sizeof(mqtt_alert) + 12]; // /<rule>
+  snprintf(topic, sizeof(topic), "%s/%d", mqtt_alert, rule);
+  mqtt_client.publish(topic, json, retain);
+}
+
+// publish a batch of backlog records, returns false if the broker did not take it
+bool publishBacklog(const char *payload)
+{
+  return mqtt_client.publish(mqtt_level_backlog, payload);
+}
+
+void publishBacklogStatus(int depth, unsigned long drops)
+{
+  char buffer[48];
+  sprintf(buffer, "{\"depth\":%d,\"dropped\":%lu}", depth, drops);
+  mqtt_client.publish(mqtt_backlog, buffer, retain);
+}
 
 
 /*
@@ -136,8 +221,8 @@ void publishLevel(float level)
 
    This routine handles all MQTT callbacks and processes the commands sent to hp
    1. it extracts the topic & message
-   2. it routes it to processMQTTcommand to handle app-specific actions
-   3. Handles house keeping command such as turning debug on/off
+   2. it routes it to mqttCommand, the commands are in Commands.cpp
+   3. anything else is reported on the debug topic
 
  * ********************************************************************************
 */
@@ -152,32 +237,11 @@ void mqttCallback(char *topic, byte *payload, unsigned int length)
   }
   message[length] = '\0';
 
-  // try processing main commands
-  if (!processMQTTcommand(topic, message))
+  if (!mqttCommand(topic, message))
   {
-    if (strcmp(topic, mqtt_debug_set_topic) == 0)
-    {
-      // convert message to uppercase
-      for (int i = 0; message[i]; i++)
-      {
-        message[i] = toupper(message[i]);
-      }
-      if (strcmp(message, "ON") == 0)
-      {
-        debugMode = true;
-        mqtt_client.publish(mqtt_debug_topic, "debug mode enabled");
-      }
-      else 
-      {
-        debugMode = false;
-        mqtt_client.publish(mqtt_debug_topic, "debug mode disabled");
-      }
-      savePreferences();
-    }
-    else
-    {
-      mqtt_client.publish(mqtt_debug_topic, strcat((char*)"wrong mqtt topic: ", topic));
-    }
+    char str[128];
+    snprintf(str, sizeof(str), "wrong mqtt topic: %s", topic);
+    mqtt_client.publish(mqtt_debug_topic, str);
   }
 }
 
@@ -202,6 +266,9 @@ void configureMQTT()
   // configure mqtt connection
   mqtt_client.setServer(mqttServer, atoi(mqttPort));
   mqtt_client.setCallback(mqttCallback);
+  mqtt_client.setBufferSize(MQTT_BUFFER_SIZE); // room for a batch of backlog records
+  espClient.setTimeout(MQTT_CONNECT_TIMEOUT);
+  resetConnState();
 
   console.print("MQTT Server :'");
   console.print(mqttServer);
@@ -215,42 +282,131 @@ void configureMQTT()
 
 /*********************************************************************************
 
-   attemps a connection to the MQTT server. if it fails increment secondsWithoutMQTT
-   and return.
+   MQTT connection state machine, called on every pass of the network task.
+   It never waits:
+
+     WIFI_DOWN   --WiFi up-->            BACKOFF (attempt due now)
+     BACKOFF     --attempt due-->        CONNECTING
+     CONNECTING  --connect() ok-->       ONLINE
+                 --connect() failed-->   BACKOFF, next attempt after a jittered
+                                         exponential delay (1s, 2s, 4s... 60s)
+     ONLINE      --connection lost-->    BACKOFF (attempt due now)
+     any         --WiFi lost-->          WIFI_DOWN
+
+   The only blocking left is PubSubClient's TCP connect inside CONNECTING,
+   bounded by MQTT_CONNECT_TIMEOUT and spaced by the backoff.
 
    This code relies on an existing Wifi connection which checked and dealt with
    elsewhere in the code
 
  **********************************************************************************/
 
+static const char *connStateNames[] = {"wifi down", "backoff", "connecting", "online"};
+
+ConnState connState = CONN_WIFI_DOWN;
+static unsigned long connStateSince = 0;
+static unsigned long linkLostAt = 0;      // when the connection was last lost (0: boot)
+static unsigned long nextAttempt = 0;
+static int failedAttempts = 0;
+unsigned long reconnectLatency = 0;       // ms from losing the link to MQTT being back
+unsigned long mqttConnects = 0;
+
+static void setConnState(ConnState state)
+{
+  if (state == connState) return;
+  if (connState == CONN_ONLINE) linkLostAt = millis();
+  connState = state;
+  connStateSince = millis();
+}
+
+// boot state: nothing connected yet, the reconnect latency counts from boot
+static void resetConnState()
+{
+  connState = CONN_WIFI_DOWN;
+  connStateSince = linkLostAt = nextAttempt = 0;
+  failedAttempts = 0;
+}
+
+const char *connStateName() { return connStateNames[connState]; }
+unsigned long timeInConnState() { return millis() - connStateSince; }
+
+// full jitter over the upper half keeps a fleet of gauges from retrying in lockstep
+static unsigned long backoffDelay()
+{
+  unsigned long d = MQTT_BACKOFF_MIN << (failedAttempts < 6 ? failedAttempts : 6);
+  if (d > MQTT_BACKOFF_MAX) d = MQTT_BACKOFF_MAX;
+  return d / 2 + random(d / 2 + 1);
+}
+
+// one connection attempt, announces ourselves on success
+static bool mqttConnect()
+{
+  if (!mqtt_client.connect(clientName)) return false;
+
+  subscribeToTopics();
+  console.printf("Connected to MQTT as %s\r\n", clientName);
+  char str[sizeof(clientName) + MQTT_LOCATION_SIZE + 32];
+  snprintf(str, sizeof(str), "%s %s: @[%s] IP:%i.%i.%i.%i", clientName, VERSION, deviceLocation, WiFi.localIP()[0], WiFi.localIP()[1], WiFi.localIP()[2], WiFi.localIP()[3]);
+  mqtt_client.publish(mqtt_debug_topic, str, true);
+
+  mqttConnects++;
+  reconnectLatency = millis() - linkLostAt;
+  reconnectMs.record(reconnectLatency);
+  snprintf(str, sizeof(str), "{\"state\":\"%s\",\"reconnect_ms\":%lu,\"connects\":%lu}", connStateNames[CONN_ONLINE], reconnectLatency, mqttConnects);
+  mqtt_client.publish(mqtt_connection, str, retain);
+  return true;
+}
+
 bool checkMQTTConnection() {
+  PERF_SCOPE(mqttSpan);
+  unsigned long now = millis();
 
-  // loop through the client
-  mqtt_client.loop();
+  if (WiFi.status() != WL_CONNECTED)
+    setConnState(CONN_WIFI_DOWN);
 
-  if (!mqtt_client.connected()) 
+  switch (connState)
   {
-    console.printf("Status %i - ", mqtt_client.state());
-
-    // Attempt to connect
-    if (mqtt_client.connect(clientName))
+  case CONN_WIFI_DOWN:
+    if (WiFi.status() != WL_CONNECTED) break;
+    // WiFi is back, try right away
+    failedAttempts = 0;
+    nextAttempt = now;
+    setConnState(CONN_MQTT_BACKOFF);
+    // fall through
+
+  case CONN_MQTT_BACKOFF:
+    if ((long)(now - nextAttempt) < 0) break;
+    setConnState(CONN_MQTT_CONNECTING);
+    // fall through
+
+  case CONN_MQTT_CONNECTING:
+    if (mqttConnect())
     {
-      subscribeToTopics();
-      console.printf("Connected to MQTT as %s\r\n", clientName);
-      char str[128];
-      sprintf(str, "%s %s: @[%s] IP:%i.%i.%i.%i", clientName, VERSION, deviceLocation, WiFi.localIP()[0], WiFi.localIP()[1], WiFi.localIP()[2], WiFi.localIP()[3]);
-      mqtt_client.publish(mqtt_debug_topic, str, true);
-      secondsWithoutMQTT = 0;
-      return true;
+      failedAttempts = 0;
+      setConnState(CONN_ONLINE);
     }
     else
     {
-      delay(500);
-      secondsWithoutMQTT++;
-      return false;
+      LOG_D(TAG, "status %i, attempt %d failed", mqtt_client.state(), failedAttempts + 1);
+      failedAttempts++;
+      nextAttempt = millis() + backoffDelay();
+      setConnState(CONN_MQTT_BACKOFF);
     }
+    break;
+
+  case CONN_ONLINE:
+    // loop through the client, it returns false once the connection is gone
+    if (mqtt_client.loop()) break;
+    LOG_W(TAG, "connection lost, status %i", mqtt_client.state());
+    mqttDropsMetric.inc();
+    failedAttempts = 0;
+    nextAttempt = now;
+    setConnState(CONN_MQTT_BACKOFF);
+    break;
   }
-  return true;
+
+  secondsWithoutMQTT = connState == CONN_ONLINE ? 0 : (millis() - linkLostAt) / 1000;
+  return connState == CONN_ONLINE;
 }
 
 /*********************************************************************************
@@ -0,0 +1,337 @@
+/**********************************************************************************
+ *
+ * Flash-backed append-only log of interval records (LittleFS)
+ *
+ *     - every closed interval is appended to the log with a sequential id
+ *     - the log is LOG_SEGMENTS files of LOG_SEGMENT_BYTES, written round robin:
+ *       when the current segment is full the next slot (the oldest) is
+ *       truncated and restarted, so every slot sees the same number of erases
+ *       and nothing is ever rewritten in place
+ *     - the read cursor is the id of the oldest record MQTT has not taken yet;
+ *       it lives in NVS and is saved at most every LOG_CURSOR_SAVE_INTERVAL
+ *     - after a reboot, records from the cursor on are replayed into the
+ *       backlog LOG_REPLAY_BATCH frames per pass of the network task, so replay
+ *       never stalls it
+ *
+ * Delivery is at-least-once: a reboot before the cursor is saved, or while live
+ * records were published past a non-empty backlog, resends some records.
+ *
+ * On-flash format, little endian (decoded by tools/readinglog.py):
+ *   segment header, 16 bytes
+ *     0  char[4] "RLOG"
+ *     4  u8      format version (1)
+ *     5  u8      frame size (24)
+ *     6  u16     CRC-16/CCITT of bytes 0..5 and 8..15
+ *     8  u32     segment sequence number, +1 per rotation
+ *    12  u32     id of the first frame in the segment
+ *   frame, 24 bytes, ids are consecutive within a segment
+ *     0  u8      sync 0xA5
+ *     1  u8      payload length (20)
+ *     2  u32     id
+ *     6  u32     epoch
+ *    10  u32     uptime
+ *    14  f32     level (ft MLLW)
+ *    18  u16     samples
+ *    20  u16     rejected
+ *    22  u16     CRC-16/CCITT of bytes 0..21
+ *
+ *********************************************************************************/
+#include <RedGlobals.h>
+#include <LittleFS.h>
+
+#define LOG_SEGMENTS 8
+#define LOG_SEGMENT_BYTES 16384
+#define LOG_HEADER_SIZE 16
+#define LOG_FRAME_SIZE 24
+#define LOG_FRAMES_PER_SEGMENT ((LOG_SEGMENT_BYTES - LOG_HEADER_SIZE) / LOG_FRAME_SIZE)
+#define LOG_VERSION 1
+#define LOG_SYNC 0xA5
+#define LOG_REPLAY_BATCH 16
+#define LOG_CURSOR_SAVE_INTERVAL 60000L // ms
+
+static const char TAG[] = "readlog";
+
+struct LogSegment
+{
+  bool valid;
+  uint32_t seq;
+  uint32_t firstId;
+};
+
+static bool logMounted = false;
+static LogSegment segments[LOG_SEGMENTS];
+static int writeSlot = -1;         // segment being appended to, -1 before the first one
+static int writeFrames = 0;        // frames already in writeSlot
+static bool rotatePending = false; // writeSlot ends with a torn frame, start a new one
+static uint32_t nextId = 0;        // id of the next appended record
+
+static uint32_t logCursor = 0;     // oldest id not yet taken by the broker
+static bool cursorDirty = false;
+static unsigned long lastCursorSave = 0;
+
+static bool replaying = false;
+static uint32_t replayId = 0;      // next id to hand to the backlog
+
+unsigned long logCorruptFrames = 0;
+
+// CRC-16/CCITT-FALSE
+static uint16_t crc16(const uint8_t *data, size_t len, uint16_t crc = 0xFFFF)
+{
+  while (len--)
+  {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (int i = 0; i < 8; i++) crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+static void segmentPath(int slot, char *path)
+{
+  sprintf(path, "/log/%d.bin", slot);
+}
+
+static bool readHeader(int slot, LogSegment &seg)
+{
+  char path[24];
+  uint8_t h[LOG_HEADER_SIZE];
+  segmentPath(slot, path);
+  seg.valid = false;
+  if (!LittleFS.exists(path)) return false;
+  File f = LittleFS.open(path, "r");
+  if (!f || f.read(h, sizeof(h)) != sizeof(h)) return false;
+  uint16_t crc;
+  memcpy(&crc, h + 6, 2);
+  if (memcmp(h, "RLOG", 4) || h[4] != LOG_VERSION || h[5] != LOG_FRAME_SIZE) return false;
+  if (crc != crc16(h + 8, 8, crc16(h, 6))) return false;
+  memcpy(&seg.seq, h + 8, 4);
+  memcpy(&seg.firstId, h + 12, 4);
+  seg.valid = true;
+  return true;
+}
+
+static void encodeFrame(const LevelRecord &r, uint8_t *f)
+{
+  f[0] = LOG_SYNC;
+  f[1] = LOG_FRAME_SIZE - 4;
+  memcpy(f + 2, &r.id, 4);
+  memcpy(f + 6, &r.epoch, 4);
+  memcpy(f + 10, &r.uptime, 4);
+  memcpy(f + 14, &r.level, 4);
+  memcpy(f + 18, &r.samples, 2);
+  memcpy(f + 20, &r.rejected, 2);
+  uint16_t crc = crc16(f, 22);
+  memcpy(f + 22, &crc, 2);
+}
+
+static bool decodeFrame(const uint8_t *f, LevelRecord &r)
+{
+  uint16_t crc;
+  memcpy(&crc, f + 22, 2);
+  if (f[0] != LOG_SYNC || f[1] != LOG_FRAME_SIZE - 4 || crc != crc16(f, 22)) return false;
+  memcpy(&r.id, f + 2, 4);
+  memcpy(&r.epoch, f + 6, 4);
+  memcpy(&r.uptime, f + 10, 4);
+  memcpy(&r.level, f + 14, 4);
+  memcpy(&r.samples, f + 18, 2);
+  memcpy(&r.rejected, f + 20, 2);
+  return true;
+}
+
+// truncate the oldest slot and start a new segment with the next id
+static void rotateSegment()
+{
+  int slot = (writeSlot + 1) % LOG_SEGMENTS;
+  uint32_t seq = writeSlot < 0 ? 1 : segments[writeSlot].seq + 1;
+  char path[24];
+  uint8_t h[LOG_HEADER_SIZE];
+
+  memcpy(h, "RLOG", 4);
+  h[4] = LOG_VERSION;
+  h[5] = LOG_FRAME_SIZE;
+  memcpy(h + 8, &seq, 4);
+  memcpy(h + 12, &nextId, 4);
+  uint16_t crc = crc16(h + 8, 8, crc16(h, 6));
+  memcpy(h + 6, &crc, 2);
+
+  segmentPath(slot, path);
+  File f = LittleFS.open(path, "w");
+  if (!f || f.write(h, sizeof(h)) != sizeof(h))
+  {
+    LOG_E(TAG, "cannot start a new segment");
+    return;
+  }
+  f.close();
+
+  segments[slot] = {true, seq, nextId};
+  writeSlot = slot;
+  writeFrames = 0;
+  rotatePending = false;
+
+  // records still unsent in the overwritten slot are gone from flash
+  uint32_t oldest = nextId;
+  for (int i = 0; i < LOG_SEGMENTS; i++)
+    if (segments[i].valid && segments[i].firstId < oldest) oldest = segments[i].firstId;
+  if (logCursor < oldest) setLogCursor(oldest);
+  if (replaying && replayId < oldest) replayId = oldest;
+}
+
+void configureReadingLog()
+{
+  // everything below is rebuilt from flash
+  for (int i = 0; i < LOG_SEGMENTS; i++) segments[i].valid = false;
+  writeSlot = -1;
+  writeFrames = 0;
+  rotatePending = false;
+  nextId = 0;
+  cursorDirty = false;
+  replaying = false;
+  resetBacklog();
+
+  logMounted = LittleFS.begin(true); // format on first use
+  if (!logMounted)
+  {
+    LOG_E(TAG, "LittleFS mount failed, log disabled");
+    return;
+  }
+  LittleFS.mkdir("/log");
+
+  // the newest valid segment is the one we append to
+  for (int i = 0; i < LOG_SEGMENTS; i++)
+    if (readHeader(i, segments[i]) && (writeSlot < 0 || segments[i].seq > segments[writeSlot].seq)) writeSlot = i;
+
+  if (writeSlot >= 0)
+  {
+    // count the frames that made it to flash, a torn one ends the segment
+    char path[24];
+    uint8_t frame[LOG_FRAME_SIZE];
+    LevelRecord r;
+    segmentPath(writeSlot, path);
+    File f = LittleFS.open(path, "r");
+    f.seek(LOG_HEADER_SIZE);
+    while (writeFrames < LOG_FRAMES_PER_SEGMENT && f.read(frame, LOG_FRAME_SIZE) == LOG_FRAME_SIZE)
+    {
+      if (!decodeFrame(frame, r) || r.id != segments[writeSlot].firstId + writeFrames)
+      {
+        rotatePending = true;
+        break;
+      }
+      writeFrames++;
+    }
+    if (!rotatePending && f.available() > 0) rotatePending = true; // partial frame at the end
+    nextId = segments[writeSlot].firstId + writeFrames;
+  }
+
+  logCursor = prefs.getUInt("logCursor", nextId);
+  if (logCursor > nextId) logCursor = nextId;
+
+  // only the newest BACKLOG_CAPACITY records can be held for the broker
+  replayId = logCursor;
+  if (nextId - replayId > BACKLOG_CAPACITY)
+  {
+    backlogDrops += nextId - replayId - BACKLOG_CAPACITY;
+    replayId = nextId - BACKLOG_CAPACITY;
+  }
+  replaying = replayId < nextId;
+
+  console.printf("Reading log: next id %lu, %lu records to replay\r\n", (unsigned long)nextId, (unsigned long)(nextId - replayId));
+}
+
+// append a closed interval, assigning its id
+void appendReading(LevelRecord &record)
+{
+  record.id = nextId;
+  if (!logMounted)
+  {
+    nextId++;
+    return;
+  }
+
+  if (writeSlot < 0 || rotatePending || writeFrames >= LOG_FRAMES_PER_SEGMENT) rotateSegment();
+
+  char path[24];
+  uint8_t frame[LOG_FRAME_SIZE];
+  encodeFrame(record, frame);
+  segmentPath(writeSlot, path);
+  File f = LittleFS.open(path, "a");
+  if (f && f.write(frame, LOG_FRAME_SIZE) == LOG_FRAME_SIZE)
+    writeFrames++;
+  else
+    rotatePending = true; // never append after a partial frame
+  nextId++;
+}
+
+// save the cursor now, before a deep sleep or a reboot
+void flushReadingLog()
+{
+  if (!cursorDirty) return;
+  prefs.putUInt("logCursor", logCursor);
+  cursorDirty = false;
+  lastCursorSave = millis();
+}
+
+void setLogCursor(uint32_t id)
+{
+  if (id == logCursor) return;
+  logCursor = id;
+  cursorDirty = true;
+}
+
+bool readingLogReplaying() { return replaying; }
+
+// first id not yet handed to the backlog
+uint32_t readingLogPendingId() { return replaying ? replayId : nextId; }
+
+// replay a bounded batch of records into the backlog and persist the cursor
+void handleReadingLog()
+{
+  if (millis() - lastCursorSave >= LOG_CURSOR_SAVE_INTERVAL) flushReadingLog();
+
+  if (!replaying) return;
+
+  // segment holding replayId: the valid one with the largest first id <= replayId
+  int slot = -1;
+  for (int i = 0; i < LOG_SEGMENTS; i++)
+    if (segments[i].valid && segments[i].firstId <= replayId && (slot < 0 || segments[i].firstId > segments[slot].firstId)) slot = i;
+
+  if (slot >= 0)
+  {
+    char path[24];
+    uint8_t frame[LOG_FRAME_SIZE];
+    LevelRecord r;
+    segmentPath(slot, path);
+    File f = LittleFS.open(path, "r");
+    f.seek(LOG_HEADER_SIZE + (replayId - segments[slot].firstId) * LOG_FRAME_SIZE);
+    for (int n = 0; n < LOG_REPLAY_BATCH && replayId < nextId; n++)
+    {
+      if (f.read(frame, LOG_FRAME_SIZE) != LOG_FRAME_SIZE)
+      {
+        // end of a segment cut short: continue with the next one
+        uint32_t next = nextId;
+        for (int i = 0; i < LOG_SEGMENTS; i++)
+          if (segments[i].valid && segments[i].firstId > replayId && segments[i].firstId < next) next = segments[i].firstId;
+        logCorruptFrames += next - replayId;
+        replayId = next;
+        break;
+      }
+      if (decodeFrame(frame, r) && r.id == replayId)
+        queueLevelRecord(r);
+      else
+        logCorruptFrames++;
+      replayId++;
+    }
+  }
+  else
+    replayId = nextId; // nothing left on flash
+
+  if (replayId >= nextId)
+  {
+    replaying = false;
+    LOG_D(TAG, "replay done, %d records in backlog", backlogDepth());
+  }
+}
+
+void printReadingLogStatus()
+{
+  console.printf("Log %s: next id %lu, cursor %lu, %s, %lu corrupt frames\r\n", logMounted ? "mounted" : "disabled",
+                 (unsigned long)nextId, (unsigned long)logCursor, replaying ? "replaying" : "idle", logCorruptFrames);
+}
@@ -0,0 +1,195 @@
+/**********************************************************************************
+ *
+ * Adaptive ping rate and publish cadence
+ *
+ * At the close of every interval the schedule is recomputed from:
+ *     - how fast the level moves: the larger of the observed rate (smoothed
+ *       over the last intervals) and the rate of the NOAA prediction, so a
+ *       turning tide is anticipated instead of noticed one interval late
+ *     - how noisy the samples are: the spread of the interval's samples
+ *
+ * The publish interval is the time the level takes to move RATE_TARGET_CHANGE,
+ * and the ping interval leaves enough samples in it to bring the standard error
+ * of the interval's level down to NOISE_TARGET (never fewer than
+ * MIN_SAMPLES_PER_PUBLISH), but no more than FILTER_CAPACITY samples: the
+ * median and trimmed modes would only see the last of them. Both are clamped
+ * to the configured bounds; in fixed mode the configured rates are used as
+ * they are, with a warning when they overrun the capacity.
+ *
+ * Console `rate` and MQTT <topic>/rate/set take the same arguments:
+ *     auto                                    adaptive within the bounds
+ *     fixed <ping s> <publish s>              constant rates
+ *     bounds <ping min> <ping max> <publish min> <publish max>   seconds
+ * The rates in use are published retained to <topic>/rate.
+ *
+ *********************************************************************************/
+#include <RedGlobals.h>
+
+#define RATE_TARGET_CHANGE 0.05f    // ft the level may move between two publishes
+#define NOISE_TARGET 0.3f           // cm, standard error wanted on an interval's level
+#define MIN_SAMPLES_PER_PUBLISH 5   // keeps the Hampel window fed
+#define RATE_SMOOTHING 0.5f         // weight of the newest interval in the observed rate
+#define PING_STEP 1000L             // ms, ping interval granularity
+#define PUBLISH_STEP 30000L         // ms, publish interval granularity
+
+static const char TAG[] = "sched";
+
+static bool adaptive = true;
+static uint32_t pingMinMs = 2000, pingMaxMs = 30000;
+static uint32_t publishMinMs = 60000, publishMaxMs = 900000;
+static uint32_t fixedPingMs = TIDE_UPDATE_INTERVAL, fixedPublishMs = MQTT_UPDATE_INTERVAL;
+
+volatile uint32_t pingIntervalMs = TIDE_UPDATE_INTERVAL; // read by the sensing task
+uint32_t publishIntervalMs = MQTT_UPDATE_INTERVAL;
+float levelRate = 0; // ft/hr, the rate the schedule was computed with
+
+static float observedRate = 0; // ft/hr, smoothed
+static float lastLevel;
+static uint32_t lastLevelAt;   // uptime s of lastLevel's record
+static bool haveLevel = false;
+
+static uint32_t clampStep(float ms, uint32_t lo, uint32_t hi, uint32_t step)
+{
+  if (ms < lo) ms = lo;
+  if (ms > hi) ms = hi;
+  uint32_t v = ((uint32_t)ms + step / 2) / step * step;
+  return v < lo ? lo : (v > hi ? hi : v);
+}
+
+void publishRateStatus()
+{
+  char buffer[96];
+  sprintf(buffer, "{\"mode\":\"%s\",\"ping_ms\":%lu,\"publish_ms\":%lu,\"rate_ft_hr\":%.2f}", adaptive ? "auto" : "fixed",
+          (unsigned long)pingIntervalMs, (unsigned long)publishIntervalMs, levelRate);
+  publishSchedule(buffer);
+}
+
+static void applySchedule(uint32_t pingMs, uint32_t publishMs)
+{
+  bool changed = pingMs != pingIntervalMs || publishMs != publishIntervalMs;
+  pingIntervalMs = pingMs;
+  if (publishMs != publishIntervalMs)
+  {
+    publishIntervalMs = publishMs;
+    restartPublishTicker();
+  }
+  if (changed)
+  {
+    LOG_D(TAG, "ping %lu s, publish %lu s (%.2f ft/hr)", (unsigned long)pingMs / 1000, (unsigned long)publishMs / 1000, levelRate);
+    publishRateStatus();
+  }
+}
+
+static void saveSchedule()
+{
+  prefs.putBool("rateAuto", adaptive);
+  prefs.putUInt("pingMin", pingMinMs);
+  prefs.putUInt("pingMax", pingMaxMs);
+  prefs.putUInt("publishMin", publishMinMs);
+  prefs.putUInt("publishMax", publishMaxMs);
+  prefs.putUInt("pingMs", fixedPingMs);
+  prefs.putUInt("publishMs", fixedPublishMs);
+}
+
+void configureScheduler()
+{
+  adaptive = prefs.getBool("rateAuto", true);
+  pingMinMs = prefs.getUInt("pingMin", pingMinMs);
+  pingMaxMs = prefs.getUInt("pingMax", pingMaxMs);
+  publishMinMs = prefs.getUInt("publishMin", publishMinMs);
+  publishMaxMs = prefs.getUInt("publishMax", publishMaxMs);
+  fixedPingMs = prefs.getUInt("pingMs", fixedPingMs);
+  fixedPublishMs = prefs.getUInt("publishMs", fixedPublishMs);
+  observedRate = 0;
+  haveLevel = false;
+  if (!adaptive)
+  {
+    pingIntervalMs = fixedPingMs;
+    publishIntervalMs = fixedPublishMs;
+  }
+}
+
+// an interval closed into this record with this sample spread (cm); the rate is taken
+// from the record times, so a low power batch closed all at once computes it right
+void updateSchedule(const LevelRecord &record, float spreadCm)
+{
+  uint32_t elapsed = record.uptime - lastLevelAt;
+  if (haveLevel && elapsed)
+  {
+    float rate = (record.level - lastLevel) * 3600.0f / elapsed;
+    observedRate += RATE_SMOOTHING * (rate - observedRate);
+  }
+  lastLevel = record.level;
+  lastLevelAt = record.uptime;
+  haveLevel = true;
+  if (!adaptive) return;
+
+  // where the predicted tide is heading over the next few minutes
+  float rate = fabsf(observedRate), a, b;
+  uint32_t epoch = record.epoch;
+  if (epoch && predictedTide(epoch, a) && predictedTide(epoch + 600, b) && fabsf(b - a) * 6 > rate)
+    rate = fabsf(b - a) * 6;
+  levelRate = rate;
+
+  float publishMs = rate > 0 ? RATE_TARGET_CHANGE / rate * 3600000.0f : publishMaxMs;
+  uint32_t publish = clampStep(publishMs, publishMinMs, publishMaxMs, PUBLISH_STEP);
+
+  float samples = (spreadCm / NOISE_TARGET) * (spreadCm / NOISE_TARGET);
+  if (samples < MIN_SAMPLES_PER_PUBLISH) samples = MIN_SAMPLES_PER_PUBLISH;
+  uint32_t ping = clampStep(publish / samples, pingMinMs, pingMaxMs, PING_STEP);
+
+  // no more samples than the median and trimmed modes keep: they would see only the last ones
+  if (publish / ping > FILTER_CAPACITY)
+  {
+    ping = (publish / FILTER_CAPACITY + PING_STEP - 1) / PING_STEP * PING_STEP;
+    if (ping > pingMaxMs)
+    {
+      ping = pingMaxMs;
+      publish = clampStep(ping * FILTER_CAPACITY - PUBLISH_STEP / 2, publishMinMs, publishMaxMs, PUBLISH_STEP);
+    }
+  }
+
+  applySchedule(ping, publish);
+}
+
+// the console / MQTT rate command, false if it could not be parsed
+bool setRateCommand(const char *args)
+{
+  float a, b, c, d;
+  if (!strncmp(args, "auto", 4))
+  {
+    adaptive = true;
+  }
+  else if (sscanf(args, "fixed %f %f", &a, &b) == 2 && a >= 1 && b >= a)
+  {
+    adaptive = false;
+    fixedPingMs = a * 1000;
+    fixedPublishMs = b * 1000;
+    if (fixedPublishMs / fixedPingMs > FILTER_CAPACITY)
+      LOG_W(TAG, "%lu samples an interval, median and trimmed see the last %d", (unsigned long)(fixedPublishMs / fixedPingMs), FILTER_CAPACITY);
+    applySchedule(fixedPingMs, fixedPublishMs);
+  }
+  else if (sscanf(args, "bounds %f %f %f %f", &a, &b, &c, &d) == 4 && a >= 1 && b >= a && c >= b && d >= c)
+  {
+    pingMinMs = a * 1000;
+    pingMaxMs = b * 1000;
+    publishMinMs = c * 1000;
+    publishMaxMs = d * 1000;
+    if (adaptive)
+      applySchedule(clampStep(pingIntervalMs, pingMinMs, pingMaxMs, PING_STEP), clampStep(publishIntervalMs, publishMinMs, publishMaxMs, PUBLISH_STEP));
+  }
+  else
+    return false;
+
+  saveSchedule();
+  publishRateStatus();
+  return true;
+}
+
+void printSchedule()
+{
+  console.printf("Rate %s: ping %lu s, publish %lu s, level moving %.2f ft/hr\r\n", adaptive ? "auto" : "fixed",
+                 (unsigned long)pingIntervalMs / 1000, (unsigned long)publishIntervalMs / 1000, levelRate);
+  console.printf("Bounds: ping %lu..%lu s, publish %lu..%lu s\r\n", (unsigned long)pingMinMs / 1000, (unsigned long)pingMaxMs / 1000,
+                 (unsigned long)publishMinMs / 1000, (unsigned long)publishMaxMs / 1000);
+}
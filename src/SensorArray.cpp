@@ -0,0 +1,295 @@
+/**********************************************************************************
+ *
+ * Sensor array: one level from the readings of every sensor in echoPins
+ *
+ * Each sensor has its own SampleFilter, so a fouled transducer cannot pull the
+ * estimates of the others. When an interval closes, fuseSensors():
+ *     - takes the sensors with at least FUSE_MIN_SAMPLES accepted samples (all
+ *       those with any when none has that many)
+ *     - finds the consensus: among the healthy ones, the estimate closest to
+ *       all the others (the medoid); on a tie, as with two sensors that
+ *       disagree, the healthier one, then the one closer to the last level
+ *     - calls a sensor further than FUSE_TOLERANCE_CM from it an outlier for
+ *       the interval; its samples count as rejected
+ *     - averages the others, weighted by their configured weight times the
+ *       inverse variance of their mean (samples / spread^2)
+ *
+ * Health is a running score per sensor: the share of its pings that gave an
+ * echo for an interval it agreed with the consensus, 0 for one it did not. A
+ * sensor below HEALTH_MIN stays out of the level until it recovers, unless no
+ * healthy sensor has a reading.
+ *
+ * Console `sensor` and MQTT <topic>/sensor/set take: <n> on|off, <n> weight <w>.
+ * With more than one sensor the state, health and share of each is published
+ * retained to <topic>/sensors with every level.
+ *
+ *********************************************************************************/
+#include <RedGlobals.h>
+
+#define FUSE_MIN_SAMPLES 3       // accepted samples a sensor needs to count in an interval
+#define FUSE_TOLERANCE_CM 3.0    // further than this from the consensus is an outlier
+#define SPREAD_FLOOR_CM 0.2      // smallest spread used for the weights
+#define HEALTH_SMOOTHING 0.25f   // weight of the newest interval in the health score
+#define HEALTH_MIN 0.5f          // below this a sensor is left out
+#define SENSORS_BUFFER 400       // status payload, 4 sensors at most
+
+static_assert(ECHO_SENSORS <= 4, "SENSORS_BUFFER holds the status of 4 sensors");
+
+static const char TAG[] = "sensors";
+
+enum SensorState : uint8_t { SENSOR_OK, SENSOR_OUTLIER, SENSOR_SILENT, SENSOR_OFF };
+static const char *stateNames[] = {"ok", "outlier", "silent", "off"};
+
+struct Sensor
+{
+  bool enabled;
+  float weight;        // configured
+  float health;        // 0..1
+  uint16_t pings;      // this interval
+  uint16_t echoes;     // pings with a distance in range, this interval
+  SensorState state;   // in the last fused interval
+  float share;         // of the weight in the last fused level
+  float cm;            // its estimate in the last fused interval
+};
+
+SampleFilter sensorFilters[ECHO_SENSORS];
+static Sensor sensors[ECHO_SENSORS];
+static double lastDistance = -1; // fused Q8 cm, -1 before the first
+
+static void saveSensors()
+{
+  uint32_t off = 0;
+  for (int i = 0; i < ECHO_SENSORS; i++)
+  {
+    if (!sensors[i].enabled) off |= 1 << i;
+    char key[20];
+    snprintf(key, sizeof(key), "sensorW%d", i);
+    prefs.putFloat(key, sensors[i].weight);
+  }
+  prefs.putUInt("sensorOff", off);
+}
+
+void configureSensors()
+{
+  uint32_t off = prefs.getUInt("sensorOff", 0);
+  for (int i = 0; i < ECHO_SENSORS; i++)
+  {
+    char key[20];
+    snprintf(key, sizeof(key), "sensorW%d", i);
+    Sensor &s = sensors[i];
+    s.enabled = !(off & (1 << i));
+    s.weight = prefs.getFloat(key, 1.0f);
+    if (!(s.weight >= 0)) s.weight = 1.0f;
+    s.health = 1.0f;
+    s.state = s.enabled ? SENSOR_SILENT : SENSOR_OFF;
+    s.share = 0;
+    s.cm = 0;
+  }
+  lastDistance = -1;
+  resetSensors();
+}
+
+void resetSensors()
+{
+  for (int i = 0; i < ECHO_SENSORS; i++)
+  {
+    sensorFilters[i].reset();
+    sensors[i].pings = sensors[i].echoes = 0;
+  }
+}
+
+void setSensorFilterMode(FilterMode mode)
+{
+  for (int i = 0; i < ECHO_SENSORS; i++) sensorFilters[i].setMode(mode);
+}
+
+FilterMode sensorFilterMode() { return sensorFilters[0].getMode(); }
+
+// one ping of a sensor, false when the distance was not taken
+bool addSensorSample(uint8_t sensor, int32_t distance)
+{
+  if (sensor >= ECHO_SENSORS) return false;
+  Sensor &s = sensors[sensor];
+  s.pings++;
+  if (!distance || !s.enabled) return false;
+  s.echoes++;
+  return sensorFilters[sensor].add(distance + echoPins[sensor].offsetMm * FILTER_SCALE / 10);
+}
+
+int intervalSamples()
+{
+  int n = 0;
+  for (int i = 0; i < ECHO_SENSORS; i++) n += sensorFilters[i].count();
+  return n;
+}
+
+int intervalRejected()
+{
+  int n = 0;
+  for (int i = 0; i < ECHO_SENSORS; i++) n += sensorFilters[i].rejected();
+  return n;
+}
+
+// of two sensors with the same claim to the consensus, is a the better one
+static bool preferred(int a, int b, const double *estimate)
+{
+  if (sensors[a].health != sensors[b].health) return sensors[a].health > sensors[b].health;
+  return lastDistance >= 0 && fabs(estimate[a] - lastDistance) < fabs(estimate[b] - lastDistance);
+}
+
+bool fuseSensors(FusedLevel &level)
+{
+  double estimate[ECHO_SENSORS] = {}, spread[ECHO_SENSORS] = {};
+  bool candidate[ECHO_SENSORS];
+
+  int most = 0;
+  for (int i = 0; i < ECHO_SENSORS; i++)
+    if (sensors[i].enabled && sensorFilters[i].count() > most) most = sensorFilters[i].count();
+  if (!most) return false;
+  int need = most >= FUSE_MIN_SAMPLES ? FUSE_MIN_SAMPLES : 1;
+
+  bool anyHealthy = false;
+  for (int i = 0; i < ECHO_SENSORS; i++)
+  {
+    Sensor &s = sensors[i];
+    candidate[i] = s.enabled && sensorFilters[i].count() >= need;
+    s.state = s.enabled ? SENSOR_SILENT : SENSOR_OFF;
+    s.share = 0;
+    if (!candidate[i]) continue;
+    estimate[i] = sensorFilters[i].estimate();
+    spread[i] = sensorFilters[i].stddev();
+    s.cm = estimate[i] / FILTER_SCALE;
+    if (s.health >= HEALTH_MIN) anyHealthy = true;
+  }
+  auto counts = [&](int i) { return candidate[i] && (!anyHealthy || sensors[i].health >= HEALTH_MIN); };
+
+  // the consensus: the medoid of the sensors that count
+  int ref = -1;
+  double best = 0;
+  for (int i = 0; i < ECHO_SENSORS; i++)
+  {
+    if (!counts(i)) continue;
+    double d = 0;
+    for (int j = 0; j < ECHO_SENSORS; j++)
+      if (counts(j)) d += fabs(estimate[i] - estimate[j]);
+    if (ref < 0 || d < best || (d == best && preferred(i, ref, estimate))) ref = i, best = d;
+  }
+
+  double floor = SPREAD_FLOOR_CM * FILTER_SCALE;
+  double weightSum = 0, sum = 0, variance = 0;
+  level.samples = 0;
+  level.rejected = intervalRejected();
+  for (int i = 0; i < ECHO_SENSORS; i++)
+  {
+    if (!candidate[i]) continue;
+    Sensor &s = sensors[i];
+    s.state = fabs(estimate[i] - estimate[ref]) <= FUSE_TOLERANCE_CM * FILTER_SCALE ? SENSOR_OK : SENSOR_OUTLIER;
+    if (s.state != SENSOR_OK || !counts(i) || s.weight <= 0) continue;
+    double w = s.weight * sensorFilters[i].count() / std::max(spread[i] * spread[i], floor * floor);
+    s.share = w; // normalised below
+    weightSum += w;
+    sum += w * estimate[i];
+    variance += w * spread[i] * spread[i];
+  }
+
+  if (weightSum > 0)
+  {
+    level.distance = sum / weightSum;
+    level.spread = sqrt(variance / weightSum);
+  }
+  else
+  {
+    // every agreeing sensor is weighted out: the consensus alone
+    sensors[ref].share = 1;
+    weightSum = 1;
+    level.distance = estimate[ref];
+    level.spread = spread[ref];
+  }
+  lastDistance = level.distance;
+
+  for (int i = 0; i < ECHO_SENSORS; i++)
+  {
+    Sensor &s = sensors[i];
+    if (s.share > 0)
+    {
+      s.share /= weightSum;
+      level.samples += sensorFilters[i].count();
+    }
+    else
+      level.rejected += sensorFilters[i].count(); // taken by the filter, left out of the level
+    if (!s.enabled) continue;
+    float score = s.state == SENSOR_OK && s.pings ? (float)s.echoes / s.pings : 0;
+    s.health += HEALTH_SMOOTHING * (score - s.health);
+    if (s.state == SENSOR_OUTLIER)
+      LOG_W(TAG, "sensor %d reads %.2f cm, %.2f cm off the consensus, health %.2f", i, s.cm, (estimate[i] - estimate[ref]) / FILTER_SCALE, s.health);
+  }
+  return true;
+}
+
+// the console / MQTT sensor command, false if it could not be parsed
+bool setSensorCommand(const char *args)
+{
+  int n;
+  float weight;
+  char word[8];
+  if (sscanf(args, "%d weight %f", &n, &weight) == 2 && n >= 0 && n < ECHO_SENSORS && weight >= 0 && weight <= 100)
+    sensors[n].weight = weight;
+  else if (sscanf(args, "%d %7s", &n, word) == 2 && n >= 0 && n < ECHO_SENSORS && (!strcmp(word, "on") || !strcmp(word, "off")))
+  {
+    Sensor &s = sensors[n];
+    s.enabled = !strcmp(word, "on");
+    s.health = 1.0f; // back from maintenance, or out of it
+    s.state = s.enabled ? SENSOR_SILENT : SENSOR_OFF;
+    if (!s.enabled) s.share = 0;
+  }
+  else
+    return false;
+
+  saveSensors();
+  publishSensorStatus();
+  return true;
+}
+
+void publishSensorStatus()
+{
+  char buffer[SENSORS_BUFFER];
+  int len = snprintf(buffer, sizeof(buffer), "{\"sensors\":[");
+  for (int i = 0; i < ECHO_SENSORS; i++)
+  {
+    const Sensor &s = sensors[i];
+    len += snprintf(buffer + len, sizeof(buffer) - len, "%s{\"id\":%d,\"state\":\"%s\",\"health\":%.2f,\"weight\":%.2f,\"share\":%.2f,\"cm\":%.2f}",
+                    i ? "," : "", i, stateNames[s.state], s.health, s.weight, s.share, s.cm);
+  }
+  snprintf(buffer + len, sizeof(buffer) - len, "]}");
+  publishSensors(buffer);
+}
+
+// the enabled sensor with the best health, the first on a tie
+int healthiestSensor()
+{
+  int best = 0;
+  for (int i = 1; i < ECHO_SENSORS; i++)
+    if (sensors[i].enabled && (!sensors[best].enabled || sensors[i].health > sensors[best].health)) best = i;
+  return best;
+}
+
+bool sensorTrusted(uint8_t sensor)
+{
+  if (sensor >= ECHO_SENSORS || !sensors[sensor].enabled) return false;
+  if (sensors[sensor].health >= HEALTH_MIN) return true;
+  for (int i = 0; i < ECHO_SENSORS; i++)
+    if (sensors[i].enabled && sensors[i].health >= HEALTH_MIN) return false;
+  return true; // none is healthy, as in fuseSensors()
+}
+
+void printSensors()
+{
+  console.printf("Sensors %d in %d slots, outlier beyond %.1f cm\r\n", ECHO_SENSORS, echoSlots(), FUSE_TOLERANCE_CM);
+  for (int i = 0; i < ECHO_SENSORS; i++)
+  {
+    const Sensor &s = sensors[i];
+    console.printf("  %d: pins %u/%u slot %u offset %d mm, %s, weight %.2f, health %.2f, share %.0f%%, %.2f cm, %u/%u echoes\r\n", i,
+                   echoPins[i].trig, echoPins[i].echo, echoPins[i].slot, echoPins[i].offsetMm, stateNames[s.state], s.weight,
+                   s.health, s.share * 100, s.cm, s.echoes, s.pings);
+  }
+}
@@ -0,0 +1,256 @@
+/**********************************************************************************
+ *
+ * NOAA tide predictions for the configured station
+ *
+ *     - the hilo (high/low) predictions are fetched from NOAA_BASE_URL and parsed
+ *       as they stream in (NoaaHilo), the body is never buffered
+ *     - the fetch runs in its own low priority task: the network task hands it
+ *       the URL and takes the parsed extremes back on a later pass, so the
+ *       connection and TLS handshake never hold up sampling or publishing
+ *     - the extremes from a day back to PREDICTION_DAYS ahead are cached in NVS,
+ *       so a reboot does not need the network to predict
+ *     - once less than PREDICTION_REFRESH_DAYS are left ahead, only the missing
+ *       days are requested, starting right after the last cached extreme
+ *     - between two extremes the tide follows the usual cosine interpolation
+ *
+ * Predictions are in ft MLLW, the datum of the published level, and times are
+ * requested in GMT so they compare directly with epochNow().
+ *
+ *********************************************************************************/
+#include <RedGlobals.h>
+#include <HTTPClient.h>
+#include <WiFiClientSecure.h>
+#include <NoaaHilo.h>
+#include <atomic>
+
+#define PREDICTION_CAPACITY NOAA_HILO_CAPACITY // extremes cached, ~4 a day
+#define PREDICTION_DAYS 7              // how far ahead a refresh reaches
+#define PREDICTION_REFRESH_DAYS 5      // refresh once less than this is left ahead
+#define PREDICTION_KEEP_BEHIND 86400L  // s of past extremes kept
+#define PREDICTION_RETRY 900000L       // ms between attempts after a failed fetch
+#define PREDICTION_READ_TIMEOUT 10000L // ms without data before giving up on a response
+#define FETCH_STACK 8192               // the TLS handshake, like the network task
+#define FETCH_PRIORITY 0               // below the network task, it only gets the idle time
+
+static const char TAG[] = "noaa";
+
+static TidePrediction predictions[PREDICTION_CAPACITY];
+static int predictionCount = 0;
+static unsigned long lastAttempt = 0;
+static bool attempted = false;
+static int lastStatus = 0; // HTTP status of the last fetch, <0 transport error
+
+unsigned long predictionFetches = 0;
+
+// the request and its result belong to the network task while fetchState is
+// FETCH_IDLE, to the fetch task from FETCH_REQUESTED until it stores FETCH_DONE
+enum FetchState : uint8_t
+{
+  FETCH_IDLE,
+  FETCH_REQUESTED,
+  FETCH_DONE
+};
+static std::atomic<uint8_t> fetchState{FETCH_IDLE};
+static TaskHandle_t fetchTaskHandle;
+static char fetchUrl[320];
+static char fetchStation[16];               // a result for another station is dropped
+static struct
+{
+  int status;     // HTTP status, <0 transport error
+  bool complete;  // the JSON was read to its end
+  bool malformed; // the JSON parser gave up
+  NoaaListener listener;
+} fetched;
+
+// keep the cache in time order, extremes already known are ignored
+static bool addPrediction(const TidePrediction &p)
+{
+  if (predictionCount && p.epoch <= predictions[predictionCount - 1].epoch) return false;
+  if (predictionCount == PREDICTION_CAPACITY)
+  {
+    memmove(predictions, predictions + 1, sizeof(TidePrediction) * --predictionCount);
+  }
+  predictions[predictionCount++] = p;
+  return true;
+}
+
+// forget extremes more than PREDICTION_KEEP_BEHIND old
+static void prunePredictions(uint32_t now)
+{
+  int n = 0;
+  while (n < predictionCount && predictions[n].epoch + PREDICTION_KEEP_BEHIND < now) n++;
+  if (!n) return;
+  predictionCount -= n;
+  memmove(predictions, predictions + n, sizeof(TidePrediction) * predictionCount);
+}
+
+static void savePredictions()
+{
+  prefs.putString("tideStation", NoaaStation);
+  prefs.putBytes("tidePred", predictions, sizeof(TidePrediction) * predictionCount);
+}
+
+// fetch task: GET fetchUrl and parse the body into fetched, nothing else is
+// touched and nothing logged, the network task reports the result
+static void fetchPredictions()
+{
+  fetched.listener = NoaaListener();
+  fetched.complete = fetched.malformed = false;
+
+  WiFiClientSecure client;
+  client.setInsecure(); // public data, nothing to protect but availability
+  HTTPClient http;
+  http.useHTTP10(true); // no chunked encoding, the stream is the plain body
+  http.begin(client, fetchUrl);
+  fetched.status = http.GET(); // connect, TLS handshake and the request: seconds on a poor link
+  if (fetched.status != HTTP_CODE_OK)
+  {
+    http.end();
+    return;
+  }
+
+  JsonStream json(fetched.listener);
+  WiFiClient *stream = http.getStreamPtr();
+  int left = http.getSize(); // -1 when the server did not say
+  unsigned long lastData = millis();
+  while (left && !json.done() && !json.failed())
+  {
+    if (!stream->available())
+    {
+      if (!http.connected() || millis() - lastData > PREDICTION_READ_TIMEOUT) break;
+      delay(1);
+      continue;
+    }
+    json.feed(stream->read());
+    if (left > 0) left--;
+    lastData = millis();
+  }
+  http.end();
+  fetched.complete = json.done();
+  fetched.malformed = json.failed();
+}
+
+// low priority, core NETWORK_CORE: one fetch per notification from handleTidePredictions()
+static void fetchTask(void *)
+{
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (fetchState.load(std::memory_order_acquire) != FETCH_REQUESTED) continue;
+    fetchPredictions();
+    fetchState.store(FETCH_DONE, std::memory_order_release);
+  }
+}
+
+// network task: merge a finished fetch into the cache and report it
+static void takeFetched()
+{
+  if (strcmp(fetchStation, NoaaStation)) return; // the station changed meanwhile
+  lastStatus = fetched.status;
+  if (lastStatus != HTTP_CODE_OK)
+  {
+    LOG_W(TAG, "request failed, %d %s", lastStatus, lastStatus < 0 ? HTTPClient::errorToString(lastStatus).c_str() : "");
+    return;
+  }
+
+  const NoaaListener &listener = fetched.listener;
+  int added = 0;
+  for (int i = 0; i < listener.count; i++) added += addPrediction(listener.found[i]);
+  if (listener.error) LOG_W(TAG, "%s", listener.message);
+  if (!fetched.complete || listener.error)
+  {
+    LOG_W(TAG, "%s response, %d predictions kept", fetched.malformed ? "malformed" : listener.error ? "error" : "incomplete", added);
+    if (added) savePredictions();
+    return;
+  }
+  savePredictions();
+  LOG_D(TAG, "%d new predictions, %d cached", added, predictionCount);
+}
+
+// hand the fetch task a request for everything after the last cached extreme up
+// to PREDICTION_DAYS ahead
+static void requestPredictions(uint32_t now)
+{
+  uint32_t from = predictionCount ? predictions[predictionCount - 1].epoch + 60 : now - PREDICTION_KEEP_BEHIND;
+  uint32_t to = now + PREDICTION_DAYS * 86400L;
+  time_t t = from;
+  struct tm begin;
+  gmtime_r(&t, &begin);
+
+  snprintf(fetchUrl, sizeof(fetchUrl), "%s&station=%s&begin_date=%04d%02d%02d%%20%02d:%02d&range=%lu", NOAA_BASE_URL, NoaaStation,
+           begin.tm_year + 1900, begin.tm_mon + 1, begin.tm_mday, begin.tm_hour, begin.tm_min, (unsigned long)((to - from) / 3600 + 1));
+  snprintf(fetchStation, sizeof(fetchStation), "%s", NoaaStation);
+  predictionFetches++;
+  fetchState.store(FETCH_REQUESTED, std::memory_order_release);
+  xTaskNotifyGive(fetchTaskHandle);
+}
+
+// read the cache, discarding it if it belongs to another station
+void configureTidePredictions()
+{
+  predictionCount = 0;
+  attempted = false;
+  fetchState.store(FETCH_IDLE);
+  if (!fetchTaskHandle) xTaskCreatePinnedToCore(fetchTask, "noaa", FETCH_STACK, NULL, FETCH_PRIORITY, &fetchTaskHandle, NETWORK_CORE);
+  if (strcmp(prefs.getString("tideStation", "").c_str(), NoaaStation)) return;
+  size_t len = prefs.getBytes("tidePred", predictions, sizeof(predictions));
+  predictionCount = len / sizeof(TidePrediction);
+}
+
+// the station changed: start over
+void resetTidePredictions()
+{
+  predictionCount = 0;
+  attempted = false;
+  savePredictions();
+}
+
+// refresh when the cache runs short, called from the network task
+void handleTidePredictions()
+{
+  uint8_t state = fetchState.load(std::memory_order_acquire);
+  if (state == FETCH_DONE)
+  {
+    takeFetched();
+    fetchState.store(FETCH_IDLE, std::memory_order_relaxed);
+  }
+  else if (state == FETCH_REQUESTED) return; // still under way
+
+  uint32_t now = epochNow();
+  if (!now || WiFi.status() != WL_CONNECTED) return;
+
+  prunePredictions(now);
+  if (predictionCount && predictions[predictionCount - 1].epoch >= now + PREDICTION_REFRESH_DAYS * 86400L) return;
+  if (attempted && millis() - lastAttempt < PREDICTION_RETRY) return;
+
+  attempted = true;
+  lastAttempt = millis();
+  requestPredictions(now);
+}
+
+// predicted level at a given time, false if the cache does not cover it
+bool predictedTide(uint32_t epoch, float &level)
+{
+  for (int i = 0; i + 1 < predictionCount; i++)
+  {
+    const TidePrediction &a = predictions[i], &b = predictions[i + 1];
+    if (epoch < a.epoch || epoch > b.epoch) continue;
+    float phase = M_PI * (epoch - a.epoch) / (float)(b.epoch - a.epoch);
+    level = (a.level + b.level) / 2 + (a.level - b.level) / 2 * cosf(phase);
+    return true;
+  }
+  return false;
+}
+
+void printTidePredictionStatus()
+{
+  console.printf("NOAA %s: %d extremes cached", NoaaStation, predictionCount);
+  if (predictionCount)
+  {
+    time_t until = predictions[predictionCount - 1].epoch;
+    struct tm tm;
+    gmtime_r(&until, &tm);
+    console.print(&tm, " until %Y-%m-%d %H:%M UTC");
+  }
+  console.printf(", %lu fetches, last status %d\r\n", predictionFetches, lastStatus);
+}
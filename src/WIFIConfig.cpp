@@ -2,15 +2,21 @@
 #include <WiFiManager.h> //https://github.com/tzapu/WiFiManager
 #include <ArduinoOTA.h>
 
+#define WIFI_RESTART_TIMEOUT 30 // seconds without WiFi before restarting
+
+static const char TAG[] = "wifi";
+
 bool otaInProgress; // flags if OTA is in progress
 int secondsWithoutWIFI = 0; // counter the seconds without wifi
+static bool wifiDown = false;
+static unsigned long wifiDownSince;
 
 
 // configuration parameters
 // Hostname, AP name & MQTT clientID
 // length should be max size + 1
 char myHostName[64] = "SeaLevel";
-char deviceLocation[64] = "Ocean Ridge";
+char deviceLocation[MQTT_LOCATION_SIZE] = "Ocean Ridge";
 char mqttServer[64] = "Carbon.local";
 char mqttPort[16] = "1883";
 char mqttUser[64] = "";
@@ -20,7 +26,7 @@ char NoaaStation[16] = NOAA_DEFAULT_STATION;
 // The extra parameters to be configured (can be either global or just in the setup)
 // After connecting, parameter.getValue() will get you the configured value
 // id/name placeholder/prompt default length
-WiFiManagerParameter custom_deviceLocation("location", "Device Location", deviceLocation, 64);
+WiFiManagerParameter custom_deviceLocation("location", "Device Location", deviceLocation, MQTT_LOCATION_SIZE);
 WiFiManagerParameter custom_mqtt_server("server", "mqtt server", mqttServer, 40);
 WiFiManagerParameter custom_mqtt_port("port", "mqtt port", mqttPort, 5);
 WiFiManagerParameter custom_noaa_station("NoaaStation", "Noaa Station", NoaaStation, 16);
@@ -45,7 +51,18 @@ void configureWIFI()
 
     // get configuration from NVM
     readPreferences();
+    wifiDown = false;
 
+    // low power uplink: join with the stored credentials and move on, no portal.
+    // handleLowPower() gives up on the uplink well before checkConnection() would restart
+    if (lowPowerUplink)
+    {
+        WiFi.mode(WIFI_STA);
+        WiFi.begin();
+        configureOTA(myHostName);
+        configTime(0, 0, "pool.ntp.org", "time.nist.gov");
+        return;
+    }
 
 
     // WiFiManager
@@ -100,27 +117,34 @@ void configureWIFI()
    
 
     // if you get here you have connected to the WiFi
-    if (debugMode) console.println("connected...yeey! Enabling telnet:)");
+    LOG_D(TAG, "connected...yeey! Enabling telnet:)");
     console.enableTelnet(23);
+    startUDPConsole();
 
 
     // and OTA
     configureOTA(myHostName);
 
+    // UTC wall clock for timestamping interval records
+    configTime(0, 0, "pool.ntp.org", "time.nist.gov");
+
     // save the custom parameters to FS
     if (shouldSaveConfig) {
         //writeConfigToDisk();
         savePreferences();
     }
 
-    if (debugMode) console.printf("local ip: "); console.println(WiFi.localIP());
+    console.print("local ip: ");
+    console.println(WiFi.localIP());
 
 }
 /*
  * ********************************************************************************
  * This routine will check the Wifi status, and reset the ESP is unable to connect
+ * for WIFI_RESTART_TIMEOUT seconds. It never waits: the ESP32 reconnects on its own
+ * and the reading log keeps any unpublished readings across the restart.
  *
- * If all is well it initiates mDNS service & OTA process
+ * If all is well it handles the OTA process
  *
  * ********************************************************************************
  */
@@ -132,9 +156,15 @@ void checkConnection()
 
     if (WiFi.status() != WL_CONNECTED) // reconnect wifi
     {
-        console.println("Not connected to WIFI.. give it ~10 seconds.");
-        delay(1000);
-        if (secondsWithoutWIFI++ > 30)
+        if (!wifiDown)
+        {
+          wifiDown = true;
+          wifiDownSince = millis();
+          wifiDropsMetric.inc();
+          console.printf("Not connected to WIFI.. give it ~%d seconds.\r\n", WIFI_RESTART_TIMEOUT);
+        }
+        secondsWithoutWIFI = (millis() - wifiDownSince) / 1000;
+        if (secondsWithoutWIFI > WIFI_RESTART_TIMEOUT)
         {
           ESP.restart();
           delay(5000);
@@ -142,6 +172,7 @@ void checkConnection()
     }
     else
     {
+      wifiDown = false;
       secondsWithoutWIFI = 0;
     }
 
@@ -155,7 +186,7 @@ void checkConnection()
  * ********************************************************************************
 */
 void readPreferences() {
-  if (prefs.isKey("deviceLocation"))     strcpy(deviceLocation, prefs.getString("deviceLocation").c_str());
+  if (prefs.isKey("deviceLocation"))     snprintf(deviceLocation, sizeof(deviceLocation), "%s", prefs.getString("deviceLocation").c_str());
   if (prefs.isKey("mqtt_server"))    strcpy(mqttServer, prefs.getString("mqtt_server").c_str());
   if (prefs.isKey("mqtt_port"))    strcpy(mqttPort, prefs.getString("mqtt_port").c_str());
   if (prefs.isKey("NoaaStation"))    strcpy(NoaaStation, prefs.getString("NoaaStation").c_str());
@@ -174,8 +205,7 @@ void savePreferences()
   prefs.putString("mqtt_server", String(mqttServer));
   prefs.putString("mqtt_port", String(mqttPort));
   prefs.putString("NoaaStation", String(NoaaStation));
-  if (debugMode) 
-    console.println("Preferences saved!");
+  LOG_D(TAG, "Preferences saved!");
 }
 
 /*
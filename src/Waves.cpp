@@ -0,0 +1,226 @@
+/**************************************************************************************
+ *
+ * Wave capture: a few minutes of fast pings, turned into a wave spectrum
+ *
+ * Every waveEveryMin minutes the sensing task switches to a wave capture: it
+ * pings every 1/waveHz s, one ping per slot with bursts paused, for the
+ * window's samples, then returns to its schedule. The regular pings go on
+ * inside the capture, on the capture tick closest to where they fell due;
+ * the ticks between them are marked wave only and stay out of the level.
+ *
+ * The network task collects the ticks of one sensor, the healthiest when the
+ * capture started, by their trigger time, so a lost ping leaves a gap rather
+ * than shifting the series. When the capture is over, WaveSpectrum.h fills
+ * the gaps, takes out spikes, removes the tide and works out the significant
+ * wave height, the peak period and the energy from the spectrum. That costs
+ * a fixed-size FFT, and it is timed as the `waves` span.
+ *
+ * The result goes to <topic>/waves:
+ *     {"hs_ft":0.82,"tp_s":4.9,"m0_cm2":39.1,"energy_j_m2":39.3,"samples":256,"hz":2,"filled":3}
+ *
+ * Console `waves` and MQTT <topic>/waves/set take:
+ *     off                               no captures (the default)
+ *     on                                every WAVE_EVERY_MIN min, or as before
+ *     now                               one capture at the next ping
+ *     <every min> [<window s>] [<Hz>]   the window is rounded down to a power
+ *                                       of two of samples, 64 to WAVE_FFT_SIZE
+ * No capture runs in low power mode: the chip sleeps between pings.
+ *
+ *********************************************************************************/
+#include <RedGlobals.h>
+#include <WaveSpectrum.h>
+
+#define WAVE_EVERY_MIN 30       // default capture interval, when on
+#define WAVE_WINDOW_S 128       // default window
+#define WAVE_HZ 2               // default rate
+#define WAVE_MAX_HZ 5           // 200 ms leaves room for 4 slots of 30 ms echo windows
+#define WAVE_MIN_SAMPLES 64
+#define WAVE_SETTLE_MS 200      // after the last tick, for its samples to come through
+
+static const char TAG[] = "waves";
+
+enum WaveState : uint8_t { WAVES_IDLE, WAVES_CAPTURING };
+
+// settings
+static uint16_t waveEveryMin;   // 0: off
+static uint16_t waveWindowS = WAVE_WINDOW_S;
+static uint8_t waveHz = WAVE_HZ;
+
+// shared with the sensing task
+static volatile WaveState state = WAVES_IDLE;
+static volatile uint16_t ticksLeft;  // the sensing task counts them down
+static volatile uint16_t tickMs;
+
+// the capture, network task
+static WaveSpectrum spectrum;
+static float series[WAVE_FFT_SIZE];  // cm from the sensor, NAN until a sample comes
+static int samples;                  // in this capture
+static uint8_t sensor;               // whose pings are taken
+static uint8_t captureHz;
+static bool started;                 // startUs is set
+static uint32_t startUs;             // trigger time of the first tick
+static unsigned long nextCaptureMs, settleMs;
+static bool captureRequested;        // `waves now`
+
+static WaveStats lastWaves;
+static uint8_t lastHz;
+static bool haveWaves;
+static unsigned long lastWavesMs;
+
+// the power of two of samples in the window at the rate
+static int windowSamples()
+{
+  int n = WAVE_MIN_SAMPLES;
+  while (n * 2 <= WAVE_FFT_SIZE && n * 2 <= waveWindowS * waveHz) n *= 2;
+  return n;
+}
+
+void configureWaves()
+{
+  waveEveryMin = prefs.getUInt("waveEvery", 0);
+  waveWindowS = prefs.getUInt("waveWindow", WAVE_WINDOW_S);
+  waveHz = prefs.getUInt("waveHz", WAVE_HZ);
+  if (waveHz < 1 || waveHz > WAVE_MAX_HZ) waveHz = WAVE_HZ;
+  state = WAVES_IDLE;
+  ticksLeft = 0;
+  captureRequested = false;
+  haveWaves = false;
+  nextCaptureMs = millis() + waveEveryMin * 60000UL;
+}
+
+// sensing task: the capture's tick in ms while one is running, 0 otherwise
+uint32_t waveTickMs()
+{
+  return state == WAVES_CAPTURING && ticksLeft ? tickMs : 0;
+}
+
+// sensing task: a capture tick has been pinged
+void waveTicked()
+{
+  if (ticksLeft) ticksLeft = ticksLeft - 1;
+}
+
+// network task: a sample of a capture tick, distance in Q8 cm or 0 for none
+void addWaveSample(const EchoSample &sample, int32_t distance)
+{
+  if (state != WAVES_CAPTURING || sample.sensor != sensor) return;
+  if (!started)
+  {
+    started = true;
+    startUs = sample.timeUs;
+  }
+  uint32_t i = (sample.timeUs - startUs + tickMs * 500UL) / (tickMs * 1000UL);
+  if (i < (uint32_t)samples && distance) series[i] = (float)distance / FILTER_SCALE;
+}
+
+static void startCapture()
+{
+  samples = windowSamples();
+  for (int i = 0; i < samples; i++) series[i] = NAN;
+  sensor = healthiestSensor();
+  started = false;
+  settleMs = 0;
+  captureHz = waveHz;
+  tickMs = 1000 / captureHz;
+  ticksLeft = samples;
+  state = WAVES_CAPTURING;
+  LOG_I(TAG, "capturing %d samples at %u Hz from sensor %u", samples, captureHz, sensor);
+}
+
+static void finishCapture()
+{
+  state = WAVES_IDLE;
+  WaveStats stats;
+  bool ok;
+  {
+    PERF_SCOPE(wavesSpan);
+    ok = spectrum.analyse(series, samples, captureHz, stats);
+  }
+  if (!ok)
+  {
+    LOG_W(TAG, "capture of %d samples has too many gaps", samples);
+    return;
+  }
+  lastWaves = stats;
+  lastHz = captureHz;
+  haveWaves = true;
+  lastWavesMs = millis();
+  LOG_I(TAG, "Hs %.2f ft, Tp %.1f s, %d filled", stats.hsCm * CM_TO_FT, stats.peakS, stats.filled);
+  publishWaveStats();
+}
+
+// network task: start a capture when one is due, analyse it when it is over
+void handleWaves()
+{
+  if (state == WAVES_CAPTURING)
+  {
+    if (ticksLeft) return;
+    if (!settleMs) settleMs = millis();
+    if (millis() - settleMs >= WAVE_SETTLE_MS) finishCapture();
+    return;
+  }
+  bool due = waveEveryMin && (long)(millis() - nextCaptureMs) >= 0;
+  if (!(due || captureRequested) || !sensingEnabled || lowPowerMode) return;
+  if (due) nextCaptureMs = millis() + waveEveryMin * 60000UL;
+  captureRequested = false;
+  startCapture();
+}
+
+static void saveWaves()
+{
+  prefs.putUInt("waveEvery", waveEveryMin);
+  prefs.putUInt("waveWindow", waveWindowS);
+  prefs.putUInt("waveHz", waveHz);
+}
+
+// the console / MQTT waves command, false if it could not be parsed
+bool setWavesCommand(const char *args)
+{
+  int every, window = waveWindowS, hz = waveHz;
+  char word[8];
+  if (sscanf(args, "%7s", word) == 1 && !strcmp(word, "now"))
+  {
+    captureRequested = true;
+    return true;
+  }
+  if (sscanf(args, "%7s", word) == 1 && !strcmp(word, "off"))
+    every = 0;
+  else if (!strcmp(word, "on"))
+    every = waveEveryMin ? waveEveryMin : WAVE_EVERY_MIN;
+  else if (sscanf(args, "%d %d %d", &every, &window, &hz) < 1 || every < 1 || every > 24 * 60 ||
+           window < 1 || window > 3600 || hz < 1 || hz > WAVE_MAX_HZ || window * hz < WAVE_MIN_SAMPLES)
+    return false;
+
+  waveEveryMin = every;
+  waveWindowS = window;
+  waveHz = hz;
+  nextCaptureMs = millis() + waveEveryMin * 60000UL;
+  saveWaves();
+  if (every)
+    LOG_I(TAG, "every %d min, %d samples at %d Hz", every, windowSamples(), hz);
+  else
+    LOG_I(TAG, "off");
+  return true;
+}
+
+void publishWaveStats()
+{
+  if (!haveWaves) return;
+  char buffer[160];
+  snprintf(buffer, sizeof(buffer), "{\"hs_ft\":%.2f,\"tp_s\":%.1f,\"m0_cm2\":%.1f,\"energy_j_m2\":%.1f,\"samples\":%d,\"hz\":%u,\"filled\":%d}",
+           lastWaves.hsCm * CM_TO_FT, lastWaves.peakS, lastWaves.m0, lastWaves.energy, lastWaves.samples, lastHz, lastWaves.filled);
+  publishWaves(buffer);
+}
+
+void printWaves()
+{
+  if (waveEveryMin)
+    console.printf("Waves every %u min, %d samples at %u Hz (%d s)%s\r\n", waveEveryMin, windowSamples(), waveHz,
+                   windowSamples() / waveHz, state == WAVES_CAPTURING ? ", capturing" : "");
+  else
+    console.printf("Waves off%s\r\n", state == WAVES_CAPTURING ? ", capturing" : "");
+  if (haveWaves)
+    console.printf("  Hs %.2f ft, Tp %.1f s, m0 %.1f cm2, energy %.1f J/m2, %d of %d filled, %lu s ago\r\n",
+                   lastWaves.hsCm * CM_TO_FT, lastWaves.peakS, lastWaves.m0, lastWaves.energy, lastWaves.filled,
+                   lastWaves.samples, (millis() - lastWavesMs) / 1000);
+}
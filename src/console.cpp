@@ -20,119 +20,48 @@ void printLocalTime()
   console.printf(" DST=%s\r\n", timeinfo.tm_isdst?"TRUE":"FALSE");
 }
 
-/*
- * ********************************************************************************
-
-  ********************  CUSTOMIZABLE SECTION  ***************************
-
- * ********************************************************************************
-*/
-#define CUSTOM_COMMANDS "Custom Commands: status, on, off, test, noaa"
-
-void executeCustomCommands(char* commandString,char* parameterString)
+void setupConsole()
 {
-  if (strcmp(commandString, "on") == 0)     resumeTideUpdate();
-  if (strcmp(commandString, "off") == 0)    pauseTideUpdate();
-  if (strcmp(commandString, "status") == 0)
-  {
-
-    printLocalTime();
-    console.printf("Prefs %s MQTT=%s #%s, NOAA %s\r\n", prefs.getString("deviceLocation"), prefs.getString("mqtt_server"), prefs.getString("mqtt_port"), prefs.getString("NoaaStation"));
-    console.printf("MQTT %s %s\r\n", mqttServer, mqttPort);
-  }
-
-
-  if (strcmp(commandString, "test") == 0)
-  {
-  }
-
-
-  if (strcmp(commandString, "noaa") == 0) {
-    strcpy(NoaaStation, parameterString);
-    savePreferences();
-    console.printf("NOAA station changed to %s\r\n", NoaaStation);
-  }
+  console.enableSerial(&Serial, true);
+  //console.enableTelnet(23);
 }
 
-/*
- * ********************************************************************************
-
-    ********************  END OF CUSTOMIZABLE SECTION  ***************************
 
- * ********************************************************************************
-*/
-
-void setupConsole()
+// console output as UDP broadcast, e.g. to tools/udplisten.py
+void startUDPConsole()
 {
-  console.enableSerial(&Serial, true);
-  //console.enableTelnet(23);
+  int port = prefs.getInt("udpPort", 0);
+  if (port) console.enableUDP(WiFi.localIP(), port);
 }
 
+bool setUDPConsole(const char *port)
+{
+  if (!strcasecmp(port, "off"))
+  {
+    console.disableUDP();
+    prefs.putInt("udpPort", 0);
+    return true;
+  }
+  char *end;
+  long n = strtol(port, &end, 10);
+  if (*end || n < 1 || n > 65535) return false;
+  prefs.putInt("udpPort", n);
+  console.enableUDP(WiFi.localIP(), n);
+  return true;
+}
 
 void handleConsole()
 {
-  // console
-  if (console.check())
+  // console, commands are in Commands.cpp
+  bool ready;
   {
-    executeCustomCommands(console.commandString, console.parameterString);
-
-    if (strcmp(console.commandString, "?") == 0)
-    {
-      console.print("[RED]");
-      console.print(MQTT_TOPIC_PREFIX);
-      console.print(" ");
-      console.println(VERSION);
-      console.printf("Host: %s @", myHostName);
-      console.println(WiFi.localIP().toString());
-      console.printf("MQTT Server %s, port: %s, %s\r\n", mqttServer, mqttPort, deviceLocation);
-      console.println("Commands: ?, debug, reset (Factory), reboot, quit");
-      console.println(CUSTOM_COMMANDS);
-    }
-    if (strcmp(console.commandString, "debug") == 0)
-    {
-      debugMode = !debugMode;
-      console.print("Debug mode is now ");
-      console.println(debugMode);
-      prefs.putBool("debugMode", debugMode);
-      savePreferences();
-    }
-    if (strcmp(console.commandString, "location") == 0)
-    {
-      strcpy(deviceLocation, console.parameterString);
-      savePreferences();
-
-      console.printf("location changed to %s\r\n", deviceLocation);
-      console.println("Change will take effect after next reboot");
-    }
-    if (strcmp(console.commandString, "mqtt") == 0)
-    {
-      strcpy(mqttServer, console.parameterString);
-      savePreferences();
-      console.print("MQTT server changed to ");
-      console.println(mqttServer);
-      mqttDisconnect();
-    }
-    if (strcmp(console.commandString, "reset") == 0)
-    {
-      console.print("Reseting configuration...");
-      resetConfiguration();
-      console.println(" Done.");
-    }
-    if (strcmp(console.commandString, "reboot") == 0)
-    {
-      console.print("Rebooting...");
-      delay(200);
-      //reset and try again, or maybe put it to deep sleep
-      ESP.restart();
-      delay(5000);
-    }
-    if ((strcmp(console.commandString, "exit") == 0) || (strcmp(console.commandString, "quit") == 0))
-    {
-      console.print("quiting...");
-      console.closeTelnetConnection();
-      delay(500);
-      console.println("");
-    }
+    PERF_SCOPE(consoleSpan);
+    ready = console.check();
+  }
+  if (ready)
+  {
+    if (console.commandString[0] && !consoleCommand(console.commandString, console.parameterString))
+      console.printf("Unknown command %s, ? for help\r\n", console.commandString);
 
     console.print("[RED]> ");
   }
@@ -1,138 +1,282 @@
 #include <RedGlobals.h>
 Preferences prefs; // preferences library
 
-// Ultrasonic sensor data
-float current_level = 0.0; // running average of distance measurement in cm
-int sample_count = 0;    // number of samples in current_level
-Ticker tideUpdateTicker;
-Ticker mqttPublishTicker;
+/*
+ * Two pinned tasks share the work:
+ *   - sensing (core 1): fires a ping every pingIntervalMs and pushes the
+ *     timestamped echo into sampleQueue; it never touches the network
+ *   - network (core 0): drains sampleQueue into the level filter, publishes,
+ *     runs the console, OTA and the connection state machine
+ * The filter is only ever used by the network task, so nothing is shared but
+ * the lock-free queue, and a slow WiFi call cannot delay a ping. The network
+ * task sleeps until it is notified, by a sample pushed or the publish ticker,
+ * or until the next poll: the console, MQTT input and the timers of its
+ * handlers are looked at every NETWORK_IDLE_MS, every NETWORK_BUSY_MS while
+ * it connects, a telnet session is open or a low power uplink is under way.
+ */
+#define SENSING_STACK 4096
+#define NETWORK_STACK 8192
+#define SENSING_PRIORITY 3
+#define NETWORK_PRIORITY 1
+#define NETWORK_IDLE_MS 1000 // network task sleep without a notification, connected and no telnet session
+#define NETWORK_BUSY_MS 100  // the same while connecting, with a telnet session open or in low power
+
+static const char TAG[] = "level";
 
-// Function to measure distance using HC-SR04 and update running average
-void measureDistanceAndUpdateAverage() {
-  long duration;
-  float distance_cm;
+// Ultrasonic sensor data, the filters are in SensorArray
+SpscQueue<EchoSample, SAMPLE_QUEUE_SIZE> sampleQueue;
+Ticker mqttPublishTicker;
+volatile bool publishDue = false;      // set by mqttPublishTicker, handled by the network task
+volatile bool sensingEnabled = false;  // pings are paused during OTA or from the console
+static unsigned long intervalStart;    // millis() when the current publish interval began
+static TaskHandle_t sensingTaskHandle;
+static TaskHandle_t networkTaskHandle;
 
-  // Clears the TRIGP_PIN
-  digitalWrite(TRIG_PIN, LOW);
-  delayMicroseconds(2);
+static bool waveTick, waveOnlyTick; // the sensing task's current tick, see Waves.cpp
 
-  // Sets the TRIGP_PIN on HIGH state for 10 micro seconds
-  digitalWrite(TRIG_PIN, HIGH);
-  delayMicroseconds(10);
-  digitalWrite(TRIG_PIN, LOW);
+// Echo completion, sensing task: hand the ping to the network task
+void queueSample(uint8_t sensor, unsigned long triggerUs, unsigned long durationUs) {
+  EchoSample sample = {(uint32_t)triggerUs, (uint32_t)durationUs, sensor, waveTick, waveOnlyTick};
+  sampleQueue.push(sample); // a full queue drops the ping, counted by the queue
+  if (networkTaskHandle) xTaskNotifyGive(networkTaskHandle);
+}
 
-  // Reads the ECHO_PIN, returns the sound wave travel time in microseconds
-  // Timeout is 1 second by default. Max range ~400cm => ~23300 us.
-  duration = pulseIn(ECHO_PIN, HIGH);
+// Network task: convert the pulse width to a distance and feed the level filter
+void updateAverage(const EchoSample &sample) {
+  PERF_SCOPE(updateSpan);
+  samplesMetric.inc();
 
-  // Calculate the distance in cm
-  // Speed of sound wave = 343 m/s = 0.0343 cm/us
-  // Distance = (duration * speed_of_sound) / 2 (for round trip)
-  distance_cm = duration * 0.0343 / 2.0;
+  // Calculate the distance in Q8 cm (1/256 cm)
+  // Distance = (duration * speed_of_sound) / 2 (for round trip), with the speed
+  // of sound at the current air temperature (AirTemperature.cpp). The filter keeps
+  // it in integers; it becomes feet MLLW only when the interval closes.
+  int32_t distance = echoToQ8(sample.widthUs, soundSpeedFactor);
 
   // Basic filtering for plausible values (HC-SR04 typical range 2cm to 400cm)
-  if (distance_cm > 1.0 && distance_cm < 450.0) { // Adjusted lower bound slightly
-    if (sample_count == 0) {
-      current_level = distance_cm;
-    } else {
-      // Update running average
-      current_level = (current_level * sample_count + distance_cm) / (sample_count + 1.0);
-    }
-    sample_count++;
-    if (debugMode) {
-      console.printf("Measured distance: %.2f cm, Current avg: %.2f cm, Samples: %d\n\r", distance_cm, current_level, sample_count);
+  bool plausible = distance > 1 * FILTER_SCALE && distance < 450 * FILTER_SCALE; // Adjusted lower bound slightly
+  if (sample.wave) addWaveSample(sample, plausible ? distance : 0);
+  if (sample.waveOnly) return;
+  if (plausible) {
+    bool accepted = addSensorSample(sample.sensor, distance);
+    if (accepted) {
+      trackLevel(sample, distance);
+      checkAlerts(sample.timeUs); // straight away, not at the interval
     }
+    LOG_D(TAG, "Sensor %u measured distance: %.2f cm%s, Samples: %d, Rejected: %d", sample.sensor, distance / (float)FILTER_SCALE, accepted ? "" : " (outlier)", intervalSamples(), intervalRejected());
   } else {
-    if (debugMode) {
-      console.printf("Distance out of range or error: %.2f cm (duration: %ld us)\n\r", distance_cm, duration);
-    }
+    addSensorSample(sample.sensor, 0);
+    LOG_D(TAG, "Sensor %u distance out of range or error: %.2f cm (duration: %lu us)", sample.sensor, distance / (float)FILTER_SCALE, (unsigned long)sample.widthUs);
   }
 }
 
-// Function to publish the average level to MQTT and reset average
+// close the current interval, called when publishDue
 void publishAverageLevel() {
-  if (otaInProgress || !mqtt_client.connected()) {
-    if (debugMode) {
-        console.println("OTA in progress or MQTT not connected, skipping MQTT publish of level.");
-    }
-    // Do not reset average if publish is skipped, try again next interval
+  PERF_SCOPE(publishSpan);
+  closeInterval(0, (millis() - intervalStart) / 1000, true);
+}
+
+// Function to close the interval that ended ageS seconds ago, after lengthS seconds, into
+// a record, publish it (or keep it for later) and reset. Only a live interval is published
+// as the level, older ones (low power batches) go through the backlog.
+void closeInterval(uint32_t ageS, uint32_t lengthS, bool live) {
+  FusedLevel fused;
+  if (!fuseSensors(fused)) {
+    LOG_D(TAG, "No valid samples collected in this interval, not publishing to MQTT.");
+    // Reset even if no samples, to ensure a clean start for the next interval
+    resetSensors();
+    intervalStart = millis();
     return;
   }
 
-  if (sample_count > 0) {
-    // our seawall, where the measurement is taking place, is, basically, at 0 NAVD88
-    // convert to feet and change offset to MLLW
-    float current_level_mllw = SEAWALL_MLLW_OFFSET - (current_level * 0.0328084);   // NAVD88 to MLLW conversion
-    publishLevel(current_level_mllw);                                             // Publish the average level
-    if (debugMode) {
-      console.printf("Publishing average %f ft to MQTT\n\r", current_level_mllw);
-    }
+  // our seawall, where the measurement is taking place, is, basically, at 0 NAVD88
+  // convert to feet and change offset to MLLW: the one place the datum is applied
+  double distanceCm = fused.distance / FILTER_SCALE;
+  double spreadCm = fused.spread / FILTER_SCALE;
+  LevelRecord record;
+  uint32_t now = epochNow();
+  record.epoch = now ? now - ageS : 0;
+  record.uptime = millis() / 1000 - ageS; // wraps for samples from before this boot, the backlog's back-dating still works
+  record.level = SEAWALL_MLLW_OFFSET - distanceCm * CM_TO_FT;   // NAVD88 to MLLW conversion
+  record.samples = fused.samples;
+  record.rejected = fused.rejected;
+  uint32_t midpoint = record.epoch - lengthS / 2;
+  updateSchedule(record, spreadCm); // may change the rates for the next interval
 
-    // Reset for the next interval ("process restarts")
-    current_level = 0.0;
-    sample_count = 0;
-  } else {
-    if (debugMode) {
-      console.println("No valid samples collected in this interval, not publishing to MQTT.");
-    }
-    // Reset even if no samples, to ensure a clean start for the next interval
-    current_level = 0.0;
-    sample_count = 0;
+  // Reset for the next interval ("process restarts")
+  resetSensors();
+  intervalStart = millis();
+
+  // persist first: the record survives a reboot until the broker has it
+  appendReading(record);
+
+  // records logged before a reboot go first, replay will reach this one too
+  if (readingLogReplaying()) return;
+
+  if (!live || otaInProgress || !mqtt_client.connected()) {
+    // keep the interval as its own record, it is sent once the broker is back
+    queueLevelRecord(record);
+    LOG_D(TAG, "%s, %d records in backlog.", live ? "OTA in progress or MQTT not connected" : "Earlier interval", backlogDepth());
+    return;
   }
+
+  publishLevel(record.level, spreadCm * CM_TO_FT, record.rejected);              // Publish the robust level
+  if (ECHO_SENSORS > 1) publishSensorStatus();
+  if (burstPings() > 1) publishBurstStatus();
+  float smoothed, rate;
+  if (trackedLevel(smoothed, rate)) publishTrackedLevel(smoothed, rate); // the level now, without the interval's lag
+  float predicted;
+  if (record.epoch && predictedTide(midpoint, predicted))
+    publishPrediction(predicted, record.level - predicted);
+  if (!backlogDepth()) setLogCursor(record.id + 1);
+  publishBacklogStatus(backlogDepth(), backlogDrops);
+  LOG_D(TAG, "Publishing %s %f ft to MQTT (%d samples, %d rejected)", SampleFilter::modeName(sensorFilterMode()), record.level, record.samples, record.rejected);
+}
+
+// select the robust estimator by name, persist it and return true if the name is valid
+bool setFilterMode(const char *name)
+{
+  FilterMode mode;
+  if (!SampleFilter::parseMode(name, mode)) return false;
+  setSensorFilterMode(mode);
+  prefs.putInt("filterMode", mode);
+  return true;
 }
 
 void resumeTideUpdate()
 {
   console.println("Resuming tide measurement and MQTT publishing.");
-  // Reset average and count when resuming to start fresh for the new period of activity
-  current_level = 0.0;
-  sample_count = 0;
-  tideUpdateTicker.attach_ms(TIDE_UPDATE_INTERVAL, measureDistanceAndUpdateAverage);
-  mqttPublishTicker.attach_ms(MQTT_UPDATE_INTERVAL, publishAverageLevel);
+  // Reset the filters when resuming to start fresh for the new period of activity
+  resetSensors();
+  intervalStart = millis();
+  sensingEnabled = true;
+  restartPublishTicker();
+}
+
+// (re)start the publish interval at the current cadence
+void restartPublishTicker()
+{
+  if (!sensingEnabled) return;
+  // publishing talks to the MQTT client, so it runs in the network task rather than the timer task
+  mqttPublishTicker.attach_ms(publishIntervalMs, []() {
+    publishDue = true;
+    if (networkTaskHandle) xTaskNotifyGive(networkTaskHandle);
+  });
 }
 
 void pauseTideUpdate()
 {
   console.println("Pausing tide measurement and MQTT publishing.");
-  tideUpdateTicker.detach();
+  sensingEnabled = false;
   mqttPublishTicker.detach();
 }
 
+// core 1: one ping of every sensor per pingIntervalMs, on a steady cadence; a wave
+// capture ticks faster, with the regular pings on its ticks
+static void sensingTask(void *)
+{
+  TickType_t lastWake = xTaskGetTickCount(), lastPing = lastWake;
+  for (;;)
+  {
+    uint32_t waveMs = waveTickMs();
+    vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(waveMs ? waveMs : pingIntervalMs));
+    if (!sensingEnabled) continue;
+    bool regular = !waveMs || lastWake - lastPing >= pdMS_TO_TICKS(pingIntervalMs) - pdMS_TO_TICKS(waveMs) / 2;
+    if (regular) lastPing = lastWake;
+    waveTick = waveMs;
+    waveOnlyTick = !regular;
+    pingBurst(waveMs ? 1 : burstPings()); // every slot, burstSize times
+    if (waveMs) waveTicked();
+    if (regular) handleAirTemperature(); // probe, if fitted
+  }
+}
+
+// the network task's next poll when nothing notifies it
+static TickType_t networkIdleTicks()
+{
+  bool busy = !mqtt_client.connected() || console.isTelnetConnected() || lowPowerMode; // an uplink hurries to sleep
+  return pdMS_TO_TICKS(busy ? NETWORK_BUSY_MS : NETWORK_IDLE_MS);
+}
+
+// core 0: everything that talks to the outside world
+static void networkTask(void *)
+{
+  for (;;)
+  {
+    unsigned long passStart = micros();
+    // This should be the first call of the task
+    checkConnection(); // check WIFI connection & Handle OTA
+    handleConsole();   // handle any commands from console
+    handleLog();       // format new log records for the console, batch them to MQTT
+    handleReadingLog(); // replay records logged before a reboot, save the cursor
+    handleTidePredictions(); // keep the NOAA predictions a few days ahead
+
+    EchoSample sample;
+    while (sampleQueue.pop(sample)) updateAverage(sample);
+    handleWaves(); // after the samples: a finished capture has all of its own
+
+    // Work to be done, but only if we aren't updating the software
+    if (!otaInProgress)
+    {
+      checkMQTTConnection(); // check MQTT
+      if (publishDue)
+      {
+        publishDue = false;
+        publishAverageLevel();
+      }
+      drainBacklog(); // catch up on intervals recorded while MQTT was down
+      handleMetrics();  // health snapshot on its own interval
+      handleLowPower(); // low power uplink: flush the RTC samples, then back to sleep
+    }
+    networkLoopUs.record(micros() - passStart);
+    ulTaskNotifyTake(pdTRUE, networkIdleTicks()); // a sample or the publish ticker wakes it sooner
+  }
+}
+
 void setup()
 {
-  // Setup sensor pins
-  pinMode(TRIG_PIN, OUTPUT);
-  pinMode(ECHO_PIN, INPUT);
-  digitalWrite(TRIG_PIN, LOW); // Ensure trigger pin is low initially
+  // a timer wake in low power mode only pings, and sleeps again unless the uplink is due
+  lowPowerWake();
+
+  // Setup sensor pins and echo interrupt, allocated on this core (SENSING_CORE)
+  startBursts(queueSample);
 
   // initialize preferences library
   prefs.begin(myHostName, false); // false:: read/write mode
   debugMode = prefs.getBool("debugMode");
+  configureLog();
+  configureMetrics();
+  setSensorFilterMode((FilterMode)prefs.getInt("filterMode", FILTER_HAMPEL));
+  // nothing carries over from before a deep sleep but RTC memory (the simulation keeps RAM)
+  configureSensors();
+  configureBurst();
+  configureWaves();
+  configureLevelTracker();
+  configureAlerts();
+  for (EchoSample stale; sampleQueue.pop(stale);) {}
+  configureAirTemperature();
+  configureScheduler();
+  configureLowPower(); // after the scheduler: an uplink resumes the rates it slept with
   // prefs.clear();    // clear all parameters
 
   // setup Console
   setupConsole();
 
+  // open the flash log, records not yet published are replayed by the network task
+  configureReadingLog();
+
 
   configureWIFI(); // configure wifi
+  configureTidePredictions(); // cached NOAA predictions for the configured station
   configureMQTT(); // configure MQTT (this also calls configureTopics() which sets up mqtt_level)
 
-  // Start the measurement and publishing tasks.
-  resumeTideUpdate();
+  // Start the measurement and publishing tasks, in low power mode the sensing task stays idle
+  if (!lowPowerMode) resumeTideUpdate();
+  xTaskCreatePinnedToCore(sensingTask, "sensing", SENSING_STACK, NULL, SENSING_PRIORITY, &sensingTaskHandle, SENSING_CORE);
+  xTaskCreatePinnedToCore(networkTask, "network", NETWORK_STACK, NULL, NETWORK_PRIORITY, &networkTaskHandle, NETWORK_CORE);
 }
 
 void loop()
 {
-  // This should be the first line in loop();
-  checkConnection(); // check WIFI connection & Handle OTA
-  handleConsole();   // handle any commands from console
-
-  // Work to be done, but only if we aren't updating the software
-  if (!otaInProgress)
-  {
-
-    checkMQTTConnection(); // check MQTT
-    // Tickers handle their own timing for sensor reads and MQTT publishes.
-    delay(100);
-  }
-}
\ No newline at end of file
+  // everything runs in the pinned tasks started by setup()
+  vTaskDelete(NULL);
+}
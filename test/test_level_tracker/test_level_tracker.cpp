@@ -0,0 +1,244 @@
+/**************************************************************************************
+
+  LevelKalman replayed over recorded echoes:  pio test -e native -f test_level_tracker
+
+  echoes.inc holds echoes as the firmware receives them, "ms,sensor,width_us,"
+  a line (the simulation writes them with --record; a recording from a gauge
+  in the same format drops in). Each is turned into cm the way updateAverage()
+  does and fed to LevelKalman::track() with its micros(), which wraps every 72
+  minutes over the recording.
+
+  There is no true level in a recording, so the reference is what hindsight
+  gives: a straight line fitted to the samples REF_WINDOW_S either side of
+  each moment, spikes left out. The same samples also go through the current
+  averaging, a SampleFilter as the firmware sets it up, closed and published
+  every MQTT_UPDATE_INTERVAL; at any moment its level is the last published
+  interval and its rate the step from the one before. Both only see the past
+  and are scored at the same moments. Against the reference the tracker must
+  be
+    - close: RMS error well under the noise of one sample, and below the boxcar's
+    - current: the error does not follow the slope, the lag is under MAX_LAG_S
+      and below the boxcar's
+    - right about the rate, better than the boxcar's step
+  in time order, with pairs of samples handed over the wrong way round (a
+  burst does that), and across a pause longer than TRACK_MAX_GAP_S.
+
+  ***************************************************************************************/
+#include <unity.h>
+#include <LevelKalman.h>
+#include <SampleFilter.h>
+#include <SpeedOfSound.h>
+#include <math.h>
+#include <vector>
+
+static const uint32_t recording[] = {
+#include "echoes.inc"
+};
+
+#define REF_WINDOW_S 600.0    // each side of a reference point
+#define SPIKE_CM 3.0          // off the reference line, a spike
+#define WARMUP_S 1800.0       // after a (re)start, before the tracker is judged
+#define MAX_RMS_CM 0.25       // the samples are 0.5 cm apart from the water
+#define MAX_LAG_S 60.0
+#define BOXCAR_S 300          // MQTT_UPDATE_INTERVAL, the publish interval the schedule starts from
+#define MAX_RATE_RMS_CM_HR 2.0
+
+struct Sample
+{
+  double t;       // s since the start of the recording
+  uint32_t us;    // micros() when it was taken
+  int32_t q8;     // Q8 cm, as the filter takes it
+  double cm;
+};
+
+static std::vector<Sample> samples;
+
+void setUp() {}
+void tearDown() {}
+
+// the recording, in cm, without the echoes updateAverage() turns down
+static void load()
+{
+  uint32_t factor = soundFactor(20);
+  for (size_t i = 0; i + 2 < sizeof(recording) / sizeof(recording[0]); i += 3)
+  {
+    int32_t q8 = echoToQ8(recording[i + 2], factor);
+    if (q8 <= 1 * 256 || q8 >= 450 * 256) continue;
+    uint64_t ms = recording[i];
+    samples.push_back({ms / 1000.0, (uint32_t)(ms * 1000), q8, q8 / 256.0});
+  }
+}
+
+// hindsight: the line through the samples around t, fitted again without the far ones,
+// then without the spikes
+static void reference(double t, double &level, double &slope)
+{
+  level = 0, slope = 0;
+  for (double cut : {(double)INFINITY, 4 * SPIKE_CM, SPIKE_CM})
+  {
+    double n = 0, st = 0, sx = 0, stt = 0, stx = 0;
+    for (const Sample &s : samples)
+    {
+      double dt = s.t - t;
+      if (fabs(dt) > REF_WINDOW_S) continue;
+      if (fabs(s.cm - (level + slope * dt)) > cut) continue;
+      n++, st += dt, sx += s.cm, stt += dt * dt, stx += dt * s.cm;
+    }
+    slope = (n * stx - st * sx) / (n * stt - st * st);
+    level = (sx - slope * st) / n;
+  }
+}
+
+// a level and rate against the reference, from WARMUP_S after the last start
+struct Score
+{
+  double n = 0, e2 = 0, ev = 0, v2 = 0, r2 = 0;
+  int restarts = 0;
+
+  void add(double cm, double cmPerS, double t)
+  {
+    double level, slope;
+    reference(t, level, slope);
+    double e = cm - level, r = (cmPerS - slope) * 3600;
+    n++, e2 += e * e, ev += e * slope, v2 += slope * slope, r2 += r * r;
+  }
+  double rms() const { return sqrt(e2 / n); }
+  double lag() const { return -ev / v2; }  // the error as -lag * slope, least squares
+  double rateRms() const { return sqrt(r2 / n); }
+
+  void report(const char *name) const
+  {
+    char m[96];
+    snprintf(m, sizeof(m), "%-7s %5.0f judged, rms %.3f cm, lag %6.1f s, rate rms %.2f cm/hr", name, n, rms(), lag(), rateRms());
+    TEST_MESSAGE(m);
+  }
+};
+
+// the tracker on its own bounds, and against the boxcar on the same samples
+static void check(const Score &tracker, const Score &boxcar)
+{
+  tracker.report("tracker");
+  boxcar.report("boxcar");
+  TEST_ASSERT_GREATER_THAN(samples.size() / 2, tracker.n);
+  TEST_ASSERT_EQUAL(tracker.n, boxcar.n);
+  TEST_ASSERT_DOUBLE_WITHIN(MAX_RMS_CM, 0, tracker.rms());
+  TEST_ASSERT_DOUBLE_WITHIN(MAX_LAG_S, 0, tracker.lag());
+  TEST_ASSERT_DOUBLE_WITHIN(MAX_RATE_RMS_CM_HR, 0, tracker.rateRms());
+  TEST_ASSERT_TRUE(tracker.rms() < boxcar.rms());
+  TEST_ASSERT_TRUE(fabs(tracker.lag()) < fabs(boxcar.lag()));
+  TEST_ASSERT_TRUE(tracker.rateRms() < boxcar.rateRms());
+}
+
+// the published intervals: a SampleFilter closed every BOXCAR_S
+struct Boxcar
+{
+  SampleFilter filter;
+  double closeAt = 0, lastAt = 0, level = NAN, rate = 0;
+
+  void add(const Sample &s)
+  {
+    if (!closeAt) closeAt = s.t + BOXCAR_S;
+    if (s.t >= closeAt)
+    {
+      if (filter.count())
+      {
+        double cm = filter.estimate() / FILTER_SCALE;
+        if (!isnan(level)) rate = (cm - level) / (closeAt - lastAt);
+        level = cm, lastAt = closeAt;
+      }
+      filter.reset();
+      while (s.t >= closeAt) closeAt += BOXCAR_S;
+    }
+    filter.add(s.q8);
+  }
+};
+
+// feeds samples[order[i]] in turn to the tracker and to the boxcar, scoring both at the
+// newest time the tracker has seen
+static void replay(const std::vector<size_t> &order, Score &tracker, Score &boxcar)
+{
+  LevelKalman k;
+  k.setNoise(1e-9, 0.5); // the firmware's defaults, LevelTracker.cpp
+  Boxcar averaged;
+  double now = 0, started = 0;
+  for (size_t i : order)
+  {
+    const Sample &s = samples[i];
+    int before = k.count();
+    k.track(s.cm, s.us);
+    averaged.add(s);
+    if (k.count() < before || (before == 0 && k.count() == 1))
+    {
+      if (before) tracker.restarts++;
+      started = s.t;
+    }
+    if (s.t > now) now = s.t;
+    if (now - started >= WARMUP_S && now >= samples.front().t + REF_WINDOW_S && now <= samples.back().t - REF_WINDOW_S)
+    {
+      tracker.add(k.level(), k.velocity(), now);
+      boxcar.add(averaged.level, averaged.rate, now);
+    }
+  }
+}
+
+static std::vector<size_t> inOrder()
+{
+  std::vector<size_t> order(samples.size());
+  for (size_t i = 0; i < order.size(); i++) order[i] = i;
+  return order;
+}
+
+// the recording as it came
+static void test_replay_in_order()
+{
+  TEST_ASSERT_GREATER_THAN(1000, samples.size());
+  Score tracker, boxcar;
+  replay(inOrder(), tracker, boxcar);
+  check(tracker, boxcar);
+  TEST_ASSERT_EQUAL(0, tracker.restarts);
+}
+
+// every third pair handed over newest first: the older sample must not restart the
+// tracker or move its clock back
+static void test_out_of_order()
+{
+  std::vector<size_t> order = inOrder();
+  for (size_t i = 0; i + 1 < order.size(); i += 6) std::swap(order[i], order[i + 1]);
+  Score tracker, boxcar;
+  replay(order, tracker, boxcar);
+  check(tracker, boxcar);
+  TEST_ASSERT_EQUAL(0, tracker.restarts);
+}
+
+// the samples of a pause taken out; longer than TRACK_MAX_GAP_S restarts the tracker
+static std::vector<size_t> withPause(double fromS, double lengthS)
+{
+  std::vector<size_t> order;
+  for (size_t i = 0; i < samples.size(); i++)
+    if (samples[i].t < fromS || samples[i].t >= fromS + lengthS) order.push_back(i);
+  return order;
+}
+
+static void test_pause()
+{
+  double middle = (samples.front().t + samples.back().t) / 2;
+  Score shortPause, shortBoxcar;
+  replay(withPause(middle, TRACK_MAX_GAP_S - 120), shortPause, shortBoxcar);
+  TEST_ASSERT_EQUAL(0, shortPause.restarts);
+  check(shortPause, shortBoxcar);
+
+  Score longPause, longBoxcar;
+  replay(withPause(middle, TRACK_MAX_GAP_S + 120), longPause, longBoxcar);
+  TEST_ASSERT_EQUAL(1, longPause.restarts);
+  check(longPause, longBoxcar);
+}
+
+int main()
+{
+  load();
+  UNITY_BEGIN();
+  RUN_TEST(test_replay_in_order);
+  RUN_TEST(test_out_of_order);
+  RUN_TEST(test_pause);
+  return UNITY_END();
+}
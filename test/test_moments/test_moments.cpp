@@ -0,0 +1,136 @@
+/**************************************************************************************
+
+  Moments against a long double reference:  pio test -e native -f test_moments
+
+  The reference keeps the plain sums of the samples and of their squares in
+  128 bit integers, so it is exact too, and forms the mean and the variance
+  from them in long double. Moments must agree to the rounding of its one
+  final division, over millions of Q8 samples, at the edges of its range and
+  after a reset().
+
+  ***************************************************************************************/
+#include <unity.h>
+#include <Moments.h>
+#include <math.h>
+#include <random>
+
+#define SAMPLES 10000000UL
+#define MAX_DEVIATION ((1L << 17) - 1) // what Moments.h promises to hold, 450 cm in Q8
+
+struct Reference
+{
+  unsigned long n = 0;
+  __int128 sum = 0, sumSq = 0;
+
+  void add(int32_t x)
+  {
+    n++;
+    sum += x;
+    sumSq += (__int128)x * x;
+  }
+  long double mean() const { return (long double)sum / n; }
+  long double variance() const { return (long double)(sumSq * n - sum * sum) / n / (n - 1); }
+};
+
+static std::mt19937 rng(20);
+
+// the relative agreement the final divisions in double allow
+static void assertAgree(const Moments &m, const Reference &r)
+{
+  TEST_ASSERT_EQUAL(r.n, m.count());
+  long double mean = r.mean(), variance = r.variance();
+  TEST_ASSERT_DOUBLE_WITHIN(1e-12 * fabsl(mean) + 1e-12, (double)mean, m.mean());
+  TEST_ASSERT_DOUBLE_WITHIN(1e-12 * variance + 1e-12, (double)variance, m.variance());
+}
+
+void setUp() {}
+void tearDown() {}
+
+// a tide at 3 m with 2 cm of noise, ten million samples
+static void test_millions_of_samples()
+{
+  std::normal_distribution<double> noise(0, 2 * 256);
+  Moments m;
+  Reference r;
+  for (unsigned long i = 0; i < SAMPLES; i++)
+  {
+    int32_t x = 300 * 256 + 20 * 256 * sin(i * 1e-6) + lround(noise(rng));
+    m.add(x);
+    r.add(x);
+  }
+  assertAgree(m, r);
+}
+
+// large values with a small spread: the float sum of squares cancels here, the deviations do not
+static void test_far_from_zero()
+{
+  std::uniform_int_distribution<int32_t> spread(-3, 3);
+  const int32_t base[] = {INT32_MAX - MAX_DEVIATION, INT32_MIN + MAX_DEVIATION};
+  for (int32_t b : base)
+  {
+    Moments m;
+    Reference r;
+    for (unsigned long i = 0; i < SAMPLES / 4; i++)
+    {
+      int32_t x = b + spread(rng);
+      m.add(x);
+      r.add(x);
+    }
+    assertAgree(m, r);
+    TEST_ASSERT_DOUBLE_WITHIN(0.01, 4.0, m.variance()); // uniform on -3..3
+  }
+}
+
+// deviations at the limit Moments.h states, both ways from the first sample
+static void test_largest_deviations()
+{
+  Moments m;
+  Reference r;
+  int32_t first = 0;
+  m.add(first);
+  r.add(first);
+  for (unsigned long i = 0; i < SAMPLES / 2; i++)
+  {
+    int32_t x = i & 1 ? MAX_DEVIATION : -MAX_DEVIATION;
+    m.add(x);
+    r.add(x);
+  }
+  assertAgree(m, r);
+}
+
+// a reset forgets the sums and the reference sample of the interval before
+static void test_reset()
+{
+  Moments m;
+  TEST_ASSERT_EQUAL(0, m.count());
+  TEST_ASSERT_DOUBLE_WITHIN(0, 0, m.mean());
+  m.add(1000);
+  TEST_ASSERT_DOUBLE_WITHIN(0, 1000, m.mean());
+  TEST_ASSERT_DOUBLE_WITHIN(0, 0, m.variance());
+
+  std::uniform_int_distribution<int32_t> first(0, 450 * 256), second(-2000, -1000);
+  for (unsigned long i = 0; i < SAMPLES / 4; i++) m.add(first(rng));
+  m.reset();
+  TEST_ASSERT_EQUAL(0, m.count());
+  TEST_ASSERT_DOUBLE_WITHIN(0, 0, m.mean());
+  TEST_ASSERT_DOUBLE_WITHIN(0, 0, m.variance());
+
+  Reference r;
+  for (unsigned long i = 0; i < SAMPLES / 4; i++)
+  {
+    int32_t x = second(rng);
+    m.add(x);
+    r.add(x);
+  }
+  assertAgree(m, r);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_millions_of_samples);
+  RUN_TEST(test_far_from_zero);
+  RUN_TEST(test_largest_deviations);
+  RUN_TEST(test_reset);
+  return UNITY_END();
+}
@@ -0,0 +1,177 @@
+/**************************************************************************************
+
+  NoaaListener over canned CO-OPS responses:  pio test -e native -f test_noaa_hilo
+
+  A hilo response laid out the way the API sends it is parsed whole, then cut
+  after every one of its characters, as a dropped connection would leave it:
+  the parser must not finish and exactly the extremes whose object closed
+  must be kept. An error body, bodies that are not JSON, a response longer
+  than the cache and extremes out of order complete it.
+
+  ***************************************************************************************/
+#include <unity.h>
+#include <NoaaHilo.h>
+#include <string.h>
+#include <string>
+
+#define JUNE_1_2025 1748736000UL // 2025-06-01 00:00 UTC
+
+static const char HILO[] = "{ \"predictions\" : [\n"
+                           "{\"t\":\"2025-06-01 03:12\", \"v\":\"3.921\", \"type\":\"H\"},"
+                           "{\"t\":\"2025-06-01 09:30\", \"v\":\"-0.104\", \"type\":\"L\"},"
+                           "{\"t\":\"2025-06-01 15:41\", \"v\":\"3.517\", \"type\":\"H\"},"
+                           "{\"t\":\"2025-06-01 21:48\", \"v\":\"0.262\", \"type\":\"L\"}"
+                           "\n]}\n";
+
+static const TidePrediction EXPECTED[] = {
+    {JUNE_1_2025 + 3 * 3600 + 12 * 60, 3.921f, 'H'},
+    {JUNE_1_2025 + 9 * 3600 + 30 * 60, -0.104f, 'L'},
+    {JUNE_1_2025 + 15 * 3600 + 41 * 60, 3.517f, 'H'},
+    {JUNE_1_2025 + 21 * 3600 + 48 * 60, 0.262f, 'L'},
+};
+
+void setUp() {}
+void tearDown() {}
+
+// feed the first len characters, like the fetch loop: stop once the document ends or fails
+static void parse(JsonStream &json, const char *body, size_t len)
+{
+  for (size_t i = 0; i < len && !json.done() && !json.failed(); i++) json.feed(body[i]);
+}
+
+static void assertExtreme(const TidePrediction &expected, const TidePrediction &p)
+{
+  TEST_ASSERT_EQUAL_UINT32(expected.epoch, p.epoch);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-6, expected.level, p.level);
+  TEST_ASSERT_EQUAL(expected.type, p.type);
+}
+
+static void test_parse_time()
+{
+  TEST_ASSERT_EQUAL_UINT32(JUNE_1_2025, parseNoaaTime("2025-06-01 00:00"));
+  TEST_ASSERT_EQUAL_UINT32(951782400UL + 23 * 3600 + 59 * 60, parseNoaaTime("2000-02-29 23:59"));
+  TEST_ASSERT_EQUAL_UINT32(4107542400UL, parseNoaaTime("2100-03-01 00:00")); // 2100 is not a leap year
+  TEST_ASSERT_EQUAL_UINT32(0, parseNoaaTime("2025-06-01"));
+  TEST_ASSERT_EQUAL_UINT32(0, parseNoaaTime(""));
+}
+
+static void test_complete_response()
+{
+  NoaaListener listener;
+  JsonStream json(listener);
+  parse(json, HILO, strlen(HILO));
+  TEST_ASSERT_TRUE(json.done());
+  TEST_ASSERT_FALSE(listener.error);
+  TEST_ASSERT_EQUAL(4, listener.count);
+  for (int i = 0; i < 4; i++) assertExtreme(EXPECTED[i], listener.found[i]);
+}
+
+// cut after every character: never done, and an extreme counts once its '}' arrived
+static void test_truncated_response()
+{
+  size_t end = strrchr(HILO, ']') - HILO; // everything up to here can be lost
+  for (size_t len = 0; len <= end; len++)
+  {
+    NoaaListener listener;
+    JsonStream json(listener);
+    parse(json, HILO, len);
+    TEST_ASSERT_FALSE(json.done());
+    TEST_ASSERT_FALSE(json.failed());
+    TEST_ASSERT_FALSE(listener.error);
+
+    int closed = 0;
+    for (size_t i = strchr(HILO, '[') - HILO; i < len; i++) closed += HILO[i] == '}';
+    TEST_ASSERT_EQUAL(closed, listener.count);
+    for (int i = 0; i < listener.count; i++) assertExtreme(EXPECTED[i], listener.found[i]);
+  }
+}
+
+static void test_error_body()
+{
+  const char body[] = "{\"error\": {\"message\": \"Wrong begin_date or range\"}}";
+  NoaaListener listener;
+  JsonStream json(listener);
+  parse(json, body, strlen(body));
+  TEST_ASSERT_TRUE(json.done());
+  TEST_ASSERT_TRUE(listener.error);
+  TEST_ASSERT_EQUAL_STRING("Wrong begin_date or range", listener.message);
+  TEST_ASSERT_EQUAL(0, listener.count);
+}
+
+// a proxy's error page, and a response broken after its first extreme
+static void test_malformed_body()
+{
+  const char page[] = "<html><body>502 Bad Gateway</body></html>";
+  NoaaListener listener;
+  JsonStream json(listener);
+  parse(json, page, strlen(page));
+  TEST_ASSERT_TRUE(json.failed());
+  TEST_ASSERT_EQUAL(0, listener.count);
+
+  std::string broken = HILO;
+  broken.erase(broken.find(", \"type\":\"L\""), 1); // the comma before the second type
+  NoaaListener kept;
+  JsonStream json2(kept);
+  parse(json2, broken.c_str(), broken.size());
+  TEST_ASSERT_TRUE(json2.failed());
+  TEST_ASSERT_EQUAL(1, kept.count);
+  assertExtreme(EXPECTED[0], kept.found[0]);
+}
+
+// more extremes than the cache holds: the newest stay
+static void test_capacity()
+{
+  const int n = NOAA_HILO_CAPACITY + 10;
+  std::string body = "{\"predictions\":[";
+  for (int i = 0; i < n; i++)
+  {
+    char item[96];
+    snprintf(item, sizeof(item), "%s{\"t\":\"2025-06-%02d %02d:00\", \"v\":\"%d.5\", \"type\":\"%c\"}", i ? "," : "", 1 + i / 4,
+             i % 4 * 6, i, i & 1 ? 'L' : 'H');
+    body += item;
+  }
+  body += "]}";
+  NoaaListener listener;
+  JsonStream json(listener);
+  parse(json, body.c_str(), body.size());
+  TEST_ASSERT_TRUE(json.done());
+  TEST_ASSERT_EQUAL(NOAA_HILO_CAPACITY, listener.count);
+  for (int i = 0; i < NOAA_HILO_CAPACITY; i++)
+  {
+    int k = n - NOAA_HILO_CAPACITY + i;
+    TEST_ASSERT_EQUAL_UINT32(JUNE_1_2025 + k * 6 * 3600UL, listener.found[i].epoch);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-6, k + 0.5, listener.found[i].level);
+  }
+}
+
+// a repeated or earlier extreme, and one without a level or a time, are left out
+static void test_out_of_order()
+{
+  const char body[] = "{\"predictions\":["
+                      "{\"t\":\"2025-06-01 09:30\", \"v\":\"-0.104\", \"type\":\"L\"},"
+                      "{\"t\":\"2025-06-01 09:30\", \"v\":\"9.999\", \"type\":\"H\"},"
+                      "{\"t\":\"2025-06-01 03:12\", \"v\":\"3.921\", \"type\":\"H\"},"
+                      "{\"t\":\"2025-06-01 12:00\", \"type\":\"H\"},"
+                      "{\"v\":\"1.000\", \"type\":\"H\"},"
+                      "{\"t\":\"2025-06-01 15:41\", \"v\":\"3.517\", \"type\":\"H\"}]}";
+  NoaaListener listener;
+  JsonStream json(listener);
+  parse(json, body, strlen(body));
+  TEST_ASSERT_TRUE(json.done());
+  TEST_ASSERT_EQUAL(2, listener.count);
+  assertExtreme(EXPECTED[1], listener.found[0]);
+  assertExtreme(EXPECTED[2], listener.found[1]);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_parse_time);
+  RUN_TEST(test_complete_response);
+  RUN_TEST(test_truncated_response);
+  RUN_TEST(test_error_body);
+  RUN_TEST(test_malformed_body);
+  RUN_TEST(test_capacity);
+  RUN_TEST(test_out_of_order);
+  return UNITY_END();
+}
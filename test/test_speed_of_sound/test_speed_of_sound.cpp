@@ -0,0 +1,94 @@
+/**************************************************************************************
+
+  SpeedOfSound against the exact formula:  pio test -e native -f test_speed_of_sound
+
+  soundFactor() is swept every 0.01 degC across the table and past both of
+  its ends, where it must hold the end values, and echoToQ8()/echoToCm() at
+  every echo width up to the driver's timeout, each against
+  331.3 * sqrt(1 + T / 273.15) evaluated in double.
+
+  ***************************************************************************************/
+#include <unity.h>
+#include <SpeedOfSound.h>
+#include <math.h>
+
+#define ECHO_TIMEOUT_US 30000 // EchoSensor.cpp, the longest width delivered
+#define TABLE_TOLERANCE 1e-5  // relative, the interpolation
+#define SWEEP_MIN (SOUND_TEMP_MIN - 10)
+#define SWEEP_MAX (SOUND_TEMP_MAX + 10)
+
+void setUp() {}
+void tearDown() {}
+
+// half the speed of sound in cm/us, the table clamped to its range
+static double exactHalfSpeed(double tempC)
+{
+  if (tempC < SOUND_TEMP_MIN) tempC = SOUND_TEMP_MIN;
+  if (tempC > SOUND_TEMP_MAX) tempC = SOUND_TEMP_MAX;
+  return 331.3 * sqrt(1 + tempC / 273.15) * 1e-4 / 2;
+}
+
+static double factorError(float tempC)
+{
+  return fabs(soundFactor(tempC) / 4294967296.0 / exactHalfSpeed(tempC) - 1);
+}
+
+// the table and its interpolation, every 0.01 degC
+static void test_factor_matches_formula()
+{
+  double worst = 0;
+  for (int t = SWEEP_MIN * 100; t <= SWEEP_MAX * 100; t++) worst = fmax(worst, factorError(t / 100.0f));
+  char m[64];
+  snprintf(m, sizeof(m), "largest error %.2f ppm", worst * 1e6);
+  TEST_MESSAGE(m);
+  TEST_ASSERT_DOUBLE_WITHIN(TABLE_TOLERANCE, 0, worst);
+}
+
+// outside the table, and for a reading that is not a number, the end values
+static void test_factor_clamps()
+{
+  TEST_ASSERT_EQUAL_UINT32(soundFactor(SOUND_TEMP_MIN), soundFactor(SOUND_TEMP_MIN - 0.01f));
+  TEST_ASSERT_EQUAL_UINT32(soundFactor(SOUND_TEMP_MIN), soundFactor(-273.15f));
+  TEST_ASSERT_EQUAL_UINT32(soundFactor(SOUND_TEMP_MIN), soundFactor(NAN));
+  TEST_ASSERT_EQUAL_UINT32(soundFactor(SOUND_TEMP_MAX), soundFactor(SOUND_TEMP_MAX + 0.01f));
+  TEST_ASSERT_EQUAL_UINT32(soundFactor(SOUND_TEMP_MAX), soundFactor(1000));
+  TEST_ASSERT_TRUE(soundFactor(SOUND_TEMP_MIN) < soundFactor(0));
+  TEST_ASSERT_TRUE(soundFactor(0) < soundFactor(SOUND_TEMP_MAX));
+}
+
+// every width at the ends of the table, between two entries and at 20 degC: the table
+// error over the distance, plus half a Q8 step for the rounding
+static void test_echo_to_distance()
+{
+  const float temps[] = {SOUND_TEMP_MIN, -17.3f, 0, 20, 33.9f, SOUND_TEMP_MAX};
+  for (float tempC : temps)
+  {
+    uint32_t factor = soundFactor(tempC);
+    double worstQ8 = 0, worstCm = 0;
+    for (uint32_t width = 0; width <= ECHO_TIMEOUT_US; width++)
+    {
+      double exact = width * exactHalfSpeed(tempC);
+      double allowed = TABLE_TOLERANCE * exact;
+      worstQ8 = fmax(worstQ8, fabs(echoToQ8(width, factor) / 256.0 - exact) - allowed);
+      worstCm = fmax(worstCm, fabs(echoToCm(width, factor) - exact) - allowed);
+    }
+    TEST_ASSERT_DOUBLE_WITHIN(0.5 / 256, 0, worstQ8);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-4, 0, worstCm); // float keeps 1e-7 of 450 cm
+  }
+}
+
+// the historical 0.0343 cm/us round trip at 20 degC
+static void test_twenty_degrees()
+{
+  TEST_ASSERT_DOUBLE_WITHIN(0.0001, 0.0343 / 2, soundFactor(20) / 4294967296.0);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_factor_matches_formula);
+  RUN_TEST(test_factor_clamps);
+  RUN_TEST(test_echo_to_distance);
+  RUN_TEST(test_twenty_degrees);
+  return UNITY_END();
+}
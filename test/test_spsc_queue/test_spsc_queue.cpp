@@ -0,0 +1,141 @@
+/**************************************************************************************
+
+  SpscQueue under two real threads:  pio test -e native -f test_spsc_queue
+
+  The simulation runs its tasks as coroutines, one at a time, so it never
+  has the producer and the consumer touching the ring at once. Here they
+  are std::threads, free to run on two cores, and every item carries its
+  sequence number and a check word: an item seen before the producer's
+  release store would show up as out of order or torn. On a single core the
+  threads rarely interleave that finely; a build with -fsanitize=thread
+  reports the race either way.
+
+  ***************************************************************************************/
+#include <unity.h>
+#include <SpscQueue.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define ITEMS 4000000UL
+
+struct Item
+{
+  uint32_t seq;
+  uint32_t check; // ~seq
+  uint64_t payload;
+};
+
+static Item makeItem(uint32_t seq) { return {seq, ~seq, seq * 0x9E3779B97F4A7C15ULL}; }
+static bool intact(const Item &item) { return item.check == ~item.seq && item.payload == item.seq * 0x9E3779B97F4A7C15ULL; }
+
+void setUp() {}
+void tearDown() {}
+
+// the producer retries a full ring: everything arrives, in order, nothing is dropped but the retries
+static void test_every_item_in_order()
+{
+  static SpscQueue<Item, 64> queue;
+  unsigned long retries = 0;
+  std::thread producer([&] {
+    for (uint32_t i = 0; i < ITEMS; i++)
+      while (!queue.push(makeItem(i)))
+      {
+        retries++;
+        std::this_thread::yield();
+      }
+  });
+
+  uint32_t expected = 0;
+  unsigned long torn = 0, misordered = 0;
+  Item item;
+  while (expected < ITEMS)
+  {
+    if (!queue.pop(item))
+    {
+      std::this_thread::yield();
+      continue;
+    }
+    if (!intact(item)) torn++;
+    if (item.seq != expected) misordered++;
+    expected = item.seq + 1;
+  }
+  producer.join();
+
+  TEST_ASSERT_EQUAL(0, torn);
+  TEST_ASSERT_EQUAL(0, misordered);
+  TEST_ASSERT_FALSE(queue.pop(item));
+  TEST_ASSERT_EQUAL(0, queue.size());
+  TEST_ASSERT_EQUAL((uint32_t)retries, queue.dropped());
+}
+
+// the producer keeps its cadence like the sensing task: what does not fit is lost and
+// counted, what arrives is in order and whole
+static void test_drops_are_counted()
+{
+  static SpscQueue<Item, 16> queue;
+  std::atomic<bool> done{false};
+  std::vector<uint8_t> pushed(ITEMS);
+  std::thread producer([&] {
+    for (uint32_t i = 0; i < ITEMS; i++) pushed[i] = queue.push(makeItem(i));
+    done.store(true, std::memory_order_release);
+  });
+
+  unsigned long received = 0, torn = 0, misordered = 0;
+  uint32_t last = 0;
+  Item item;
+  for (;;)
+  {
+    bool finished = done.load(std::memory_order_acquire);
+    if (!queue.pop(item))
+    {
+      if (finished) break;
+      std::this_thread::yield();
+      continue;
+    }
+    if (!intact(item)) torn++;
+    if (received && item.seq <= last) misordered++;
+    last = item.seq;
+    received++;
+    if ((received & 0xFF) == 0) std::this_thread::yield(); // a slow consumer, so the ring fills
+  }
+  producer.join();
+
+  unsigned long accepted = 0;
+  for (uint8_t p : pushed) accepted += p;
+  TEST_ASSERT_EQUAL(0, torn);
+  TEST_ASSERT_EQUAL(0, misordered);
+  TEST_ASSERT_EQUAL(accepted, received);
+  TEST_ASSERT_EQUAL(ITEMS - accepted, queue.dropped());
+}
+
+// the indices run past the capacity; a full ring refuses and counts, it never overwrites
+static void test_full_ring()
+{
+  static SpscQueue<Item, 4> queue;
+  Item item;
+  for (uint32_t i = 0; i < 10; i++)
+  {
+    TEST_ASSERT_TRUE(queue.push(makeItem(i)));
+    TEST_ASSERT_TRUE(queue.pop(item));
+    TEST_ASSERT_EQUAL(i, item.seq);
+  }
+  for (int i = 0; i < 4; i++) TEST_ASSERT_TRUE(queue.push(makeItem(i)));
+  TEST_ASSERT_FALSE(queue.push(makeItem(4)));
+  TEST_ASSERT_EQUAL(4, queue.size());
+  TEST_ASSERT_EQUAL(1, queue.dropped());
+  for (uint32_t i = 0; i < 4; i++)
+  {
+    TEST_ASSERT_TRUE(queue.pop(item));
+    TEST_ASSERT_EQUAL(i, item.seq);
+  }
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_every_item_in_order);
+  RUN_TEST(test_drops_are_counted);
+  RUN_TEST(test_full_ring);
+  return UNITY_END();
+}
@@ -0,0 +1,98 @@
+/**************************************************************************************
+
+  RealFFT against a direct DFT:  pio test -e native -f test_wave_spectrum
+
+  The split real transform is checked bin by bin against the DFT sum in
+  double at every size it takes, and WaveSpectrum against a sine whose
+  height and period are known.
+
+  ***************************************************************************************/
+#include <unity.h>
+#include <WaveSpectrum.h>
+#include <complex>
+#include <random>
+
+#define FFT_TOLERANCE 1e-5 // largest bin error, relative to the largest bin; float sums over 512 points
+
+void setUp() {}
+void tearDown() {}
+
+static RealFFT<WAVE_FFT_SIZE> fft;
+
+// largest |FFT - DFT| over the bins of input, relative to the largest |DFT|
+static double dftError(const float *input, int n)
+{
+  float x[WAVE_FFT_SIZE];
+  std::copy(input, input + n, x);
+  TEST_ASSERT_TRUE(fft.transform(x, n));
+  double err = 0, peak = 0;
+  for (int k = 0; k <= n / 2; k++)
+  {
+    std::complex<double> dft = 0;
+    for (int t = 0; t < n; t++) dft += (double)input[t] * std::polar(1.0, -2 * M_PI * k * t / n);
+    std::complex<double> got = k == 0 ? x[0] : k == n / 2 ? x[1] : std::complex<double>(x[2 * k], x[2 * k + 1]);
+    err = std::max(err, std::abs(dft - got));
+    peak = std::max(peak, std::abs(dft));
+  }
+  return err / peak;
+}
+
+// a swell, an offset and noise, at every size
+static void test_fft_matches_dft()
+{
+  std::mt19937 rng(23);
+  std::normal_distribution<float> noise(0, 3);
+  float input[WAVE_FFT_SIZE];
+  for (int n = 4; n <= WAVE_FFT_SIZE; n *= 2)
+  {
+    for (int i = 0; i < n; i++) input[i] = 300 + 12 * sinf(2 * (float)M_PI * i / 10) + noise(rng);
+    TEST_ASSERT_DOUBLE_WITHIN(FFT_TOLERANCE, 0, dftError(input, n));
+  }
+}
+
+// one bin at a time: each lands in its own slot of the packing, the Nyquist bin in x[1]
+static void test_fft_single_bins()
+{
+  float input[WAVE_FFT_SIZE];
+  const int n = 64;
+  for (int k = 0; k <= n / 2; k++)
+  {
+    for (int i = 0; i < n; i++) input[i] = cosf(2 * (float)M_PI * k * i / n);
+    TEST_ASSERT_DOUBLE_WITHIN(FFT_TOLERANCE, 0, dftError(input, n));
+  }
+}
+
+static void test_fft_sizes()
+{
+  float x[WAVE_FFT_SIZE] = {};
+  TEST_ASSERT_FALSE(fft.transform(x, 2));
+  TEST_ASSERT_FALSE(fft.transform(x, 48));
+  TEST_ASSERT_FALSE(fft.transform(x, 2 * WAVE_FFT_SIZE));
+}
+
+// a sine of amplitude a has m0 = a^2 / 2 and Hs = 4 sqrt(m0)
+static void test_spectrum_of_a_sine()
+{
+  static WaveSpectrum spectrum;
+  float x[WAVE_FFT_SIZE];
+  const int n = 256;
+  const float hz = 2, a = 10, periodS = 4; // bin 32
+  for (int i = 0; i < n; i++) x[i] = 250 + 0.01f * i + a * sinf(2 * (float)M_PI * i / hz / periodS);
+  x[40] = NAN; // a lost ping is filled
+  WaveStats stats;
+  TEST_ASSERT_TRUE(spectrum.analyse(x, n, hz, stats));
+  TEST_ASSERT_FLOAT_WITHIN(0.02f * a * a / 2, a * a / 2, stats.m0);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f * 4 * a / sqrtf(2), 4 * a / sqrtf(2), stats.hsCm);
+  TEST_ASSERT_FLOAT_WITHIN(0.05f, periodS, stats.peakS);
+  TEST_ASSERT_EQUAL(1, stats.filled);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_fft_matches_dft);
+  RUN_TEST(test_fft_single_bins);
+  RUN_TEST(test_fft_sizes);
+  RUN_TEST(test_spectrum_of_a_sine);
+  return UNITY_END();
+}
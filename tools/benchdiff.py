@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+"""
+Compare two runs of the native benchmarks (`program --bench`, see
+lib/NativeHAL/Bench.h) and show what changed.
+
+Each line of a run is "name value unit [value unit...]". Values are matched
+by name and unit; a change beyond the threshold is flagged with '!', time
+only counts when it got slower, allocations whenever they changed. The exit
+status is 1 when anything was flagged, so a script can gate on it.
+
+    tools/benchdiff.py before.txt after.txt
+    tools/benchdiff.py before.txt after.txt --threshold 20   # percent, default 10
+"""
+import argparse
+import sys
+
+
+def parse(path):
+    figures = {}
+    with open(path) as f:
+        for line in f:
+            tokens = line.split()
+            if len(tokens) < 3:
+                continue
+            name = tokens[0]
+            for value, unit in zip(tokens[1::2], tokens[2::2]):
+                try:
+                    figures[(name, unit)] = float(value)
+                except ValueError:
+                    break
+    return figures
+
+
+def flagged(unit, old, new, threshold):
+    if unit == "allocs/op":
+        return old != new
+    if unit == "ns/op":
+        return new > old * (1 + threshold / 100)
+    return abs(new - old) > abs(old) * threshold / 100
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("before")
+    ap.add_argument("after")
+    ap.add_argument("--threshold", type=float, default=10, help="percent change that is flagged")
+    args = ap.parse_args()
+
+    before, after = parse(args.before), parse(args.after)
+    bad = False
+    for key in sorted(set(before) | set(after), key=lambda k: (k[0], k[1])):
+        name, unit = key
+        old, new = before.get(key), after.get(key)
+        if old is None or new is None:
+            print(f"  {name:<40} {unit:<16} {'gone' if new is None else 'new'}")
+            continue
+        change = (new - old) / old * 100 if old else (0.0 if new == old else float("inf"))
+        mark = "!" if flagged(unit, old, new, args.threshold) else " "
+        bad |= mark == "!"
+        print(f"{mark} {name:<40} {unit:<16} {old:12.2f} -> {new:12.2f} {change:+7.1f}%")
+    sys.exit(1 if bad else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""
+Decode the flash reading log written by src/ReadingLog.cpp.
+
+Point it at a copy of the LittleFS /log directory (pulled from a gauge, or the
+--flash directory of a native simulation) and it prints every record as CSV,
+oldest first, flagging corrupt frames and records past the read cursor.
+
+    tools/readinglog.py /tmp/simflash/log
+    tools/readinglog.py /tmp/simflash/log --cursor 42     # mark records >= 42 as unsent
+"""
+import argparse
+import os
+import struct
+import sys
+from datetime import datetime, timezone
+
+HEADER = struct.Struct("<4sBBHII")  # magic, version, frame size, crc, seq, first id
+FRAME = struct.Struct("<BBIIIfHHH")  # sync, length, id, epoch, uptime, level, samples, rejected, crc
+VERSION = 1
+SYNC = 0xA5
+
+
+def crc16(data, crc=0xFFFF):
+    """CRC-16/CCITT-FALSE, as in ReadingLog.cpp"""
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def read_segment(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) < HEADER.size:
+        return None
+    magic, version, frame_size, crc, seq, first_id = HEADER.unpack_from(data)
+    if magic != b"RLOG" or version != VERSION or frame_size != FRAME.size:
+        return None
+    if crc != crc16(data[8:16], crc16(data[0:6])):
+        return None
+    return seq, first_id, data[HEADER.size:]
+
+
+def frames(body, first_id):
+    for off in range(0, len(body) - FRAME.size + 1, FRAME.size):
+        raw = body[off:off + FRAME.size]
+        sync, length, rid, epoch, uptime, level, samples, rejected, crc = FRAME.unpack(raw)
+        ok = sync == SYNC and length == FRAME.size - 4 and crc == crc16(raw[:22]) and rid == first_id + off // FRAME.size
+        yield ok, rid, epoch, uptime, level, samples, rejected
+    if len(body) % FRAME.size:
+        yield False, None, 0, 0, 0.0, 0, 0
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("logdir", help="directory holding the <slot>.bin segment files")
+    ap.add_argument("--cursor", type=int, help="read cursor (NVS key logCursor); later records are flagged unsent")
+    args = ap.parse_args()
+
+    segments = []
+    for name in sorted(os.listdir(args.logdir)):
+        if name.endswith(".bin"):
+            seg = read_segment(os.path.join(args.logdir, name))
+            if seg is None:
+                print(f"# {name}: no valid header", file=sys.stderr)
+            else:
+                segments.append((name,) + seg)
+    segments.sort(key=lambda s: s[1])
+
+    corrupt = 0
+    print("id,epoch,utc,uptime,level_ft,samples,rejected,status")
+    for name, seq, first_id, body in segments:
+        print(f"# segment {name} seq {seq} first id {first_id}")
+        for ok, rid, epoch, uptime, level, samples, rejected in frames(body, first_id):
+            if not ok:
+                corrupt += 1
+                print(f"# corrupt frame after id {rid if rid is not None else '?'} in {name}")
+                break  # the firmware starts a new segment after a torn frame
+            utc = datetime.fromtimestamp(epoch, timezone.utc).strftime("%Y-%m-%d %H:%M:%S") if epoch else ""
+            status = "unsent" if args.cursor is not None and rid >= args.cursor else ""
+            print(f"{rid},{epoch},{utc},{uptime},{level:.2f},{samples},{rejected},{status}")
+
+    return 1 if corrupt else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
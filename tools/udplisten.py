@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+"""
+Print the console output a gauge broadcasts over UDP (console `udp <port>`).
+
+Every datagram starts with a "#RED <seq> <ms>" line followed by whole console
+lines. Sequence numbers count up per gauge from boot, so a gap is reported as
+lost datagrams and a smaller number as a restart. A native simulation sends
+the same datagrams to this listener with --udp-forward PORT.
+
+    tools/udplisten.py 4210
+    tools/udplisten.py 4210 --quiet          # only the loss summary per sender
+"""
+import argparse
+import socket
+import sys
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("port", type=int)
+    ap.add_argument("--quiet", action="store_true", help="do not print the console lines")
+    args = ap.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", args.port))
+
+    senders = {}  # address -> [next seq, received, lost]
+    try:
+        while True:
+            data, (host, _) = sock.recvfrom(2048)
+            header, _, body = data.partition(b"\n")
+            fields = header.split()
+            if len(fields) != 3 or fields[0] != b"#RED":
+                print(f"{host}: not a console datagram ({len(data)} bytes)", file=sys.stderr)
+                continue
+            seq = int(fields[1])
+            state = senders.setdefault(host, [seq, 0, 0])
+            if seq > state[0]:
+                state[2] += seq - state[0]
+                print(f"{host}: {seq - state[0]} datagrams lost", file=sys.stderr)
+            elif seq < state[0]:
+                print(f"{host}: restarted", file=sys.stderr)
+            state[0] = seq + 1
+            state[1] += 1
+            if not args.quiet:
+                sys.stdout.write(body.decode("utf-8", "replace"))
+                sys.stdout.flush()
+    except KeyboardInterrupt:
+        pass
+    for host, (_, received, lost) in senders.items():
+        print(f"{host}: {received} datagrams, {lost} lost", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()